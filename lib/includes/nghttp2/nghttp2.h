@@ -690,6 +690,11 @@ typedef enum {
    * `nghttp2_submit_response()`.
    */
   NGHTTP2_DATA_FLAG_NO_END_STREAM = 0x02,
+  /**
+   * Indicates that application will send complete DATA frame in
+   * :type:`nghttp2_send_data_callback`.
+   */
+  NGHTTP2_DATA_FLAG_NO_COPY = 0x04,
 } nghttp2_data_flag;
 
 /**
@@ -717,6 +722,15 @@ typedef enum {
  * `nghttp2_submit_trailer()` to send trailers.
  * `nghttp2_submit_trailer()` can be called inside this callback.
  *
+ * Sometimes it is desirable to avoid copying data into |buf| and let
+ * application to send data directly.  To achieve this, set
+ * :enum:`NGHTTP2_DATA_FLAG_NO_COPY` to |*data_flags| (and possibly
+ * other flags, just like when we do copy), and return the number of
+ * bytes to send without copying data into |buf|.  The library, seeing
+ * :enum:`NGHTTP2_DATA_FLAG_NO_COPY`, will invoke
+ * :type:`nghttp2_send_data_callback`.  The application must send
+ * complete DATA frame in that callback.
+ *
  * If the application wants to postpone DATA frames (e.g.,
  * asynchronous I/O, or reading data blocks for long time), it is
  * achieved by returning :enum:`NGHTTP2_ERR_DEFERRED` without reading
@@ -1167,6 +1181,57 @@ typedef ssize_t (*nghttp2_send_callback)(nghttp2_session *session,
                                          const uint8_t *data, size_t length,
                                          int flags, void *user_data);
 
+/**
+ * @functypedef
+ *
+ * Callback function invoked when :enum:`NGHTTP2_DATA_FLAG_NO_COPY` is
+ * used in :type:`nghttp2_data_source_read_callback` to send complete
+ * DATA frame.
+ *
+ * The |frame| is a DATA frame to send.  The |framehd| is the
+ * serialized frame header (9 bytes). The |length| is the length of
+ * application data to send (this does not include padding).  The
+ * |source| is the same pointer passed to
+ * :type:`nghttp2_data_source_read_callback`.
+ *
+ * The application first must send frame header |framehd| of length 9
+ * bytes.  If ``frame->data.padlen > 0``, send 1 byte of value
+ * ``frame->data.padlen - 1``.  Then send exactly |length| bytes of
+ * application data.  Finally, if ``frame->data.padlen > 1``, send
+ * ``frame->data.padlen - 1`` bytes of zero as padding.
+ *
+ * The application has to send complete DATA frame in this callback.
+ * If all data were written successfully, return 0.
+ *
+ * If it cannot send any data at all, just return
+ * :enum:`NGHTTP2_ERR_WOULDBLOCK`; the library will call this callback
+ * with the same parameters later (It is recommended to send complete
+ * DATA frame at once in this function to deal with error; if partial
+ * frame data has already sent, it is impossible to send another data
+ * in that state, and all we can do is tear down connection).  When
+ * data is fully processed, but application wants to make
+ * `nghttp2_session_mem_send()` or `nghttp2_session_send()` return
+ * immediately without processing next frames, return
+ * :enum:`NGHTTP2_ERR_PAUSE`.  If application decided to reset this
+ * stream, return :enum:`NGHTTP2_ERR_TEMPORAL_CALLBACK_FAILURE`, then
+ * the library will send RST_STREAM with INTERNAL_ERROR as error code.
+ * The application can also return
+ * :enum:`NGHTTP2_ERR_CALLBACK_FAILURE`, which will result in
+ * connection closure.  Returning any other value is treated as
+ * :enum:`NGHTTP2_ERR_CALLBACK_FAILURE`.
+ *
+ * This callback is required if application uses
+ * :enum:`NGHTTP2_DATA_FLAG_NO_COPY`.
+ *
+ * To set this callback to :type:`nghttp2_session_callbacks`, use
+ * `nghttp2_session_callbacks_set_send_data_callback()`.
+ */
+typedef int (*nghttp2_send_data_callback)(nghttp2_session *session,
+                                          nghttp2_frame *frame,
+                                          const uint8_t *framehd, size_t length,
+                                          nghttp2_data_source *source,
+                                          void *user_data);
+
 /**
  * @functypedef
  *
@@ -1757,6 +1822,17 @@ void nghttp2_session_callbacks_set_on_begin_frame_callback(
     nghttp2_session_callbacks *cbs,
     nghttp2_on_begin_frame_callback on_begin_frame_callback);
 
+/**
+ * @function
+ *
+ * Sets callback function invoked when
+ * :enum:`NGHTTP2_DATA_FLAG_NO_COPY` is used in
+ * :type:`nghttp2_data_source_read_callback` to avoid data copy.
+ */
+void nghttp2_session_callbacks_set_send_data_callback(
+    nghttp2_session_callbacks *cbs,
+    nghttp2_send_data_callback send_data_callback);
+
 /**
  * @functypedef
  *
@@ -1946,6 +2022,55 @@ void nghttp2_option_set_recv_client_preface(nghttp2_option *option, int val);
  */
 void nghttp2_option_set_no_http_messaging(nghttp2_option *option, int val);
 
+/**
+ * @function
+ *
+ * This option enables the free lists of the objects which the
+ * library allocates per stream and per frame, such as stream and
+ * outbound frame objects.  When such an object is released, up to
+ * |val| objects of each kind are kept in the session, and reused for
+ * subsequent allocations without calling the memory allocator.  The
+ * objects kept in the free lists are deallocated when the session is
+ * deleted.  If |val| is 0, the free lists are disabled.  By default,
+ * this option is set to 0.
+ */
+void nghttp2_option_set_free_list_size(nghttp2_option *option, size_t val);
+
+/**
+ * @function
+ *
+ * This option enables the counters of frame level statistics, which
+ * are retrieved by `nghttp2_session_get_stats()`.  If nonzero is
+ * given to |val|, the session updates the counters as it sends and
+ * receives frames.  By default, this option is set to zero.
+ */
+void nghttp2_option_set_stats(nghttp2_option *option, int val);
+
+/**
+ * @function
+ *
+ * This option enables the automatic tuning of the local flow control
+ * window of streams and the connection, and sets the memory budget
+ * for it to |val| bytes.
+ *
+ * When the remote endpoint consumes the whole window of a stream, or
+ * the connection, in less than twice the round trip time, the window
+ * is doubled by adding the growth to the next WINDOW_UPDATE.  The
+ * round trip time is measured by PING frames which the library sends
+ * while DATA is flowing.  Its ACK is passed to
+ * :type:`nghttp2_on_frame_recv_callback` like any other PING.  The
+ * connection window never grows beyond |val| bytes, and the sum of
+ * the growth given to streams never exceeds |val| bytes.  The growth
+ * is taken back from the streams which have not received DATA for a
+ * while, so that the budget can be given to the busy streams.
+ *
+ * This works with both automatic WINDOW_UPDATE and
+ * `nghttp2_session_consume()`.  If |val| is 0, the auto-tuning is
+ * disabled.  By default, this option is set to 0.
+ */
+void nghttp2_option_set_window_auto_tuning(nghttp2_option *option,
+                                           size_t val);
+
 /**
  * @function
  *
@@ -2188,6 +2313,51 @@ int nghttp2_session_send(nghttp2_session *session);
 ssize_t nghttp2_session_mem_send(nghttp2_session *session,
                                  const uint8_t **data_ptr);
 
+/**
+ * @function
+ *
+ * Serializes as many pending frames as possible into the buffer
+ * pointed by |buf| of length |buflen|.
+ *
+ * This function behaves like `nghttp2_session_mem_send()` except that
+ * it copies the serialized data of multiple frames into the buffer
+ * supplied by the application, so that the application can send them
+ * in one write operation.  The callbacks are called in the same way
+ * as they are in `nghttp2_session_send()`.
+ *
+ * If a frame does not fit in the remaining space of |buf|, its first
+ * part is written to fill |buf|, and the rest is written in the next
+ * call of this function, `nghttp2_session_mem_send()` or
+ * `nghttp2_session_send()`.
+ *
+ * If the next frame is DATA which is sent by
+ * :type:`nghttp2_send_data_callback`, this function returns the data
+ * serialized so far without invoking the callback.  If no data has
+ * been serialized, it invokes the callback, and returns 0 right after
+ * the callback wrote the frame, since the callback may write it into
+ * the memory region pointed by |buf|.  In this case, the length of
+ * the DATA frame, including frame header and padding, is assigned to
+ * |*pnocopylen|.  Otherwise, 0 is assigned to |*pnocopylen|.  If the
+ * callback appends frames to the same buffer that |buf| points into,
+ * application should call this function again with the remaining
+ * space after the frame, so that multiple DATA frames are sent in
+ * one write operation.
+ *
+ * If no data is available to send, or the callback returned
+ * :enum:`NGHTTP2_ERR_WOULDBLOCK`, this function returns 0, and
+ * assigns 0 to |*pnocopylen|.
+ *
+ * This function returns the number of bytes written to |buf| if it
+ * succeeds, or one of the following negative error codes:
+ *
+ * :enum:`NGHTTP2_ERR_NOMEM`
+ *     Out of memory.
+ * :enum:`NGHTTP2_ERR_CALLBACK_FAILURE`
+ *     The callback function failed.
+ */
+ssize_t nghttp2_session_mem_send_batch(nghttp2_session *session, uint8_t *buf,
+                                       size_t buflen, size_t *pnocopylen);
+
 /**
  * @function
  *
@@ -2462,6 +2632,104 @@ int32_t nghttp2_session_get_stream_remote_window_size(nghttp2_session *session,
  */
 int32_t nghttp2_session_get_remote_window_size(nghttp2_session *session);
 
+/**
+ * @macro
+ *
+ * The number of frame types which are counted separately in
+ * :type:`nghttp2_session_stats`.
+ */
+#define NGHTTP2_STATS_NUM_FRAME_TYPES (NGHTTP2_CONTINUATION + 1)
+
+/**
+ * @struct
+ *
+ * The frame level statistics of a session, which
+ * `nghttp2_session_get_stats()` fills.  All counters start with 0
+ * when the session is created.
+ */
+typedef struct {
+  /**
+   * The number of frames sent, indexed by :type:`nghttp2_frame_type`.
+   * CONTINUATION frames are counted separately from HEADERS and
+   * PUSH_PROMISE.
+   */
+  uint64_t frames_sent[NGHTTP2_STATS_NUM_FRAME_TYPES];
+  /**
+   * The number of frames received, indexed by
+   * :type:`nghttp2_frame_type`.
+   */
+  uint64_t frames_received[NGHTTP2_STATS_NUM_FRAME_TYPES];
+  /**
+   * The number of frames received, whose type is unknown to this
+   * library.
+   */
+  uint64_t unknown_frames_received;
+  /**
+   * The number of bytes of padding sent, including Pad Length field.
+   */
+  uint64_t padding_sent;
+  /**
+   * The number of bytes of padding received, including Pad Length
+   * field.
+   */
+  uint64_t padding_received;
+  /**
+   * The sum of the length of names and values of header fields given
+   * to HPACK encoder.
+   */
+  uint64_t hd_deflate_inlen;
+  /**
+   * The number of bytes of header blocks produced by HPACK encoder.
+   */
+  uint64_t hd_deflate_outlen;
+  /**
+   * The number of bytes of header blocks given to HPACK decoder.
+   */
+  uint64_t hd_inflate_inlen;
+  /**
+   * The sum of the length of names and values of header fields which
+   * HPACK decoder emitted.
+   */
+  uint64_t hd_inflate_outlen;
+  /**
+   * The number of times DATA of a stream was deferred because its
+   * stream level remote window was exhausted.
+   */
+  uint64_t stream_flow_control_stalls;
+  /**
+   * The total time in milliseconds during which DATA of streams was
+   * deferred because of stream level flow control.  The stall which
+   * has not ended yet is not included.
+   */
+  uint64_t stream_blocked_msec;
+  /**
+   * The number of times the connection level remote window was
+   * exhausted.
+   */
+  uint64_t connection_flow_control_stalls;
+  /**
+   * The total time in milliseconds during which the connection level
+   * remote window was exhausted.  The stall which has not ended yet
+   * is not included.
+   */
+  uint64_t connection_blocked_msec;
+} nghttp2_session_stats;
+
+/**
+ * @function
+ *
+ * Stores the frame level statistics of the |session| in |*stats|.
+ * The statistics must be enabled by `nghttp2_option_set_stats()`.
+ *
+ * This function returns 0 if it succeeds, or one of the following
+ * negative error codes:
+ *
+ * :enum:`NGHTTP2_ERR_INVALID_STATE`
+ *     The statistics are not enabled for the |session|.
+ */
+int nghttp2_session_get_stats(nghttp2_session *session,
+                              nghttp2_session_stats *stats);
+
 /**
  * @function
  *
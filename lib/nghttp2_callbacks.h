@@ -106,6 +106,11 @@ struct nghttp2_session_callbacks {
    * Sets callback function invoked when a frame header is received.
    */
   nghttp2_on_begin_frame_callback on_begin_frame_callback;
+  /**
+   * Callback function invoked when NGHTTP2_DATA_FLAG_NO_COPY is used
+   * in nghttp2_data_source_read_callback to send complete DATA frame.
+   */
+  nghttp2_send_data_callback send_data_callback;
 };
 
 #endif /* NGHTTP2_CALLBACKS_H */
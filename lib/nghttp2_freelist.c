@@ -0,0 +1,83 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2015 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "nghttp2_freelist.h"
+
+#include <assert.h>
+
+void nghttp2_freelist_init(nghttp2_freelist *fl, size_t objsize, size_t max,
+                           nghttp2_mem *mem) {
+  assert(objsize >= sizeof(nghttp2_freelist_entry));
+
+  fl->mem = mem;
+  fl->head = NULL;
+  fl->objsize = objsize;
+  fl->len = 0;
+  fl->max = max;
+}
+
+void nghttp2_freelist_free(nghttp2_freelist *fl) {
+  nghttp2_freelist_entry *ent, *next;
+
+  for (ent = fl->head; ent;) {
+    next = ent->next;
+    nghttp2_mem_free(fl->mem, ent);
+    ent = next;
+  }
+
+  fl->head = NULL;
+  fl->len = 0;
+}
+
+void *nghttp2_freelist_get(nghttp2_freelist *fl) {
+  nghttp2_freelist_entry *ent;
+
+  if (fl->head == NULL) {
+    return nghttp2_mem_malloc(fl->mem, fl->objsize);
+  }
+
+  ent = fl->head;
+  fl->head = ent->next;
+  --fl->len;
+
+  return ent;
+}
+
+void nghttp2_freelist_put(nghttp2_freelist *fl, void *ptr) {
+  nghttp2_freelist_entry *ent;
+
+  if (ptr == NULL) {
+    return;
+  }
+
+  if (fl->len == fl->max) {
+    nghttp2_mem_free(fl->mem, ptr);
+    return;
+  }
+
+  ent = ptr;
+  ent->next = fl->head;
+  fl->head = ent;
+  ++fl->len;
+}
@@ -0,0 +1,91 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2015 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef NGHTTP2_FREELIST_H
+#define NGHTTP2_FREELIST_H
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include <nghttp2/nghttp2.h>
+
+#include "nghttp2_mem.h"
+
+/*
+ * Free list of fixed size objects.  The objects are allocated one at
+ * a time by nghttp2_mem, and when they are released, up to |max|
+ * of them are kept in the list, so that next allocation can reuse
+ * them without calling allocator.  Since every object is allocated
+ * by nghttp2_mem individually, an object obtained from free list can
+ * be also released by nghttp2_mem_free() directly.
+ *
+ * If |max| is 0, free list just forwards the requests to
+ * nghttp2_mem.
+ */
+
+typedef struct nghttp2_freelist_entry {
+  struct nghttp2_freelist_entry *next;
+} nghttp2_freelist_entry;
+
+typedef struct {
+  nghttp2_mem *mem;
+  /* The head of the list of released objects */
+  nghttp2_freelist_entry *head;
+  /* The size of each object */
+  size_t objsize;
+  /* The number of objects in the list */
+  size_t len;
+  /* The maximum number of objects kept in the list */
+  size_t max;
+} nghttp2_freelist;
+
+/*
+ * Initializes |fl| for the objects of size |objsize|.  |objsize|
+ * must be at least sizeof(nghttp2_freelist_entry).
+ */
+void nghttp2_freelist_init(nghttp2_freelist *fl, size_t objsize, size_t max,
+                           nghttp2_mem *mem);
+
+/*
+ * Deallocates all objects kept in |fl|.
+ */
+void nghttp2_freelist_free(nghttp2_freelist *fl);
+
+/*
+ * Returns an object of size fl->objsize.  The object is taken from
+ * the list if it is not empty, or newly allocated otherwise.  This
+ * function returns NULL if it fails to allocate memory.
+ */
+void *nghttp2_freelist_get(nghttp2_freelist *fl);
+
+/*
+ * Releases |ptr|, which must be obtained by nghttp2_freelist_get()
+ * or allocated by fl->mem with the size fl->objsize.  If the list is
+ * full, |ptr| is deallocated by nghttp2_mem_free().  |ptr| may be
+ * NULL.
+ */
+void nghttp2_freelist_put(nghttp2_freelist *fl, void *ptr);
+
+#endif /* NGHTTP2_FREELIST_H */
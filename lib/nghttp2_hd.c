@@ -38,7 +38,7 @@
   {                                                                            \
     {                                                                          \
       { (uint8_t *)(N), (uint8_t *)(V), sizeof((N)) - 1, sizeof((V)) - 1, 0 }  \
-      , (NH), (VH), 1, NGHTTP2_HD_FLAG_NONE                                    \
+      , (NH), (VH)                                                             \
     }                                                                          \
     , I                                                                        \
   }
@@ -139,71 +139,26 @@ static uint32_t hash(const uint8_t *s, size_t n) {
   return h;
 }
 
-int nghttp2_hd_entry_init(nghttp2_hd_entry *ent, uint8_t flags, uint8_t *name,
-                          size_t namelen, uint8_t *value, size_t valuelen,
-                          uint32_t name_hash, uint32_t value_hash,
-                          nghttp2_mem *mem) {
-  int rv = 0;
-
-  /* Since nghttp2_hd_entry is used for indexing, ent->nv.flags always
-     NGHTTP2_NV_FLAG_NONE */
-  ent->nv.flags = NGHTTP2_NV_FLAG_NONE;
+/* Denotes the absence of an entry in the offset links of
+   nghttp2_hd_ringent and nghttp2_hd_map */
+#define HD_RINGENT_NONE UINT32_MAX
 
-  if ((flags & NGHTTP2_HD_FLAG_NAME_ALLOC) &&
-      (flags & NGHTTP2_HD_FLAG_NAME_GIFT) == 0) {
-    if (namelen == 0) {
-      /* We should not allow empty header field name */
-      ent->nv.name = NULL;
-    } else {
-      ent->nv.name = nghttp2_memdup(name, namelen, mem);
-      if (ent->nv.name == NULL) {
-        rv = NGHTTP2_ERR_NOMEM;
-        goto fail;
-      }
-    }
-  } else {
-    ent->nv.name = name;
-  }
-  if ((flags & NGHTTP2_HD_FLAG_VALUE_ALLOC) &&
-      (flags & NGHTTP2_HD_FLAG_VALUE_GIFT) == 0) {
-    if (valuelen == 0) {
-      ent->nv.value = NULL;
-    } else {
-      ent->nv.value = nghttp2_memdup(value, valuelen, mem);
-      if (ent->nv.value == NULL) {
-        rv = NGHTTP2_ERR_NOMEM;
-        goto fail2;
-      }
-    }
-  } else {
-    ent->nv.value = value;
-  }
-  ent->nv.namelen = namelen;
-  ent->nv.valuelen = valuelen;
-  ent->ref = 1;
-  ent->flags = flags;
-
-  ent->name_hash = name_hash;
-  ent->value_hash = value_hash;
-
-  return 0;
+/*
+ * Returns the number of bytes an entry occupies in the byte ring.
+ * The entries are aligned to 4 bytes boundary.  Since
+ * sizeof(nghttp2_hd_ringent) + 3 <= NGHTTP2_HD_ENTRY_OVERHEAD, this is
+ * not larger than the size of entry defined in the spec.
+ */
+static size_t ringent_size(size_t namelen, size_t valuelen) {
+  return (sizeof(nghttp2_hd_ringent) + namelen + valuelen + 3) & ~(size_t)3;
+}
 
-fail2:
-  if (flags & NGHTTP2_HD_FLAG_NAME_ALLOC) {
-    nghttp2_mem_free(mem, ent->nv.name);
-  }
-fail:
-  return rv;
+static uint8_t *ringent_name(nghttp2_hd_ringent *ent) {
+  return (uint8_t *)ent + sizeof(nghttp2_hd_ringent);
 }
 
-void nghttp2_hd_entry_free(nghttp2_hd_entry *ent, nghttp2_mem *mem) {
-  assert(ent->ref == 0);
-  if (ent->flags & NGHTTP2_HD_FLAG_NAME_ALLOC) {
-    nghttp2_mem_free(mem, ent->nv.name);
-  }
-  if (ent->flags & NGHTTP2_HD_FLAG_VALUE_ALLOC) {
-    nghttp2_mem_free(mem, ent->nv.value);
-  }
+static uint8_t *ringent_value(nghttp2_hd_ringent *ent) {
+  return ringent_name(ent) + ent->namelen;
 }
 
 static int hd_ringbuf_init(nghttp2_hd_ringbuf *ringbuf, size_t bufsize,
@@ -211,39 +166,52 @@ static int hd_ringbuf_init(nghttp2_hd_ringbuf *ringbuf, size_t bufsize,
   size_t size;
   for (size = 1; size < bufsize; size <<= 1)
     ;
-  ringbuf->buffer = nghttp2_mem_malloc(mem, sizeof(nghttp2_hd_entry *) * size);
+  ringbuf->buffer = nghttp2_mem_malloc(mem, sizeof(uint32_t) * size);
   if (ringbuf->buffer == NULL) {
     return NGHTTP2_ERR_NOMEM;
   }
   ringbuf->mask = size - 1;
   ringbuf->first = 0;
   ringbuf->len = 0;
+  /* The byte ring is allocated when the first entry is added */
+  ringbuf->data = NULL;
+  ringbuf->datalen = 0;
+  ringbuf->head = 0;
   return 0;
 }
 
-static nghttp2_hd_entry *hd_ringbuf_get(nghttp2_hd_ringbuf *ringbuf,
-                                        size_t idx) {
+static nghttp2_hd_ringent *hd_ringbuf_at(nghttp2_hd_ringbuf *ringbuf,
+                                         uint32_t offset) {
+  return (nghttp2_hd_ringent *)(void *)(ringbuf->data + offset);
+}
+
+static uint32_t hd_ringbuf_offset(nghttp2_hd_ringbuf *ringbuf, size_t idx) {
   assert(idx < ringbuf->len);
   return ringbuf->buffer[(ringbuf->first + idx) & ringbuf->mask];
 }
 
+static nghttp2_hd_ringent *hd_ringbuf_get(nghttp2_hd_ringbuf *ringbuf,
+                                          size_t idx) {
+  return hd_ringbuf_at(ringbuf, hd_ringbuf_offset(ringbuf, idx));
+}
+
 static int hd_ringbuf_reserve(nghttp2_hd_ringbuf *ringbuf, size_t bufsize,
                               nghttp2_mem *mem) {
   size_t i;
   size_t size;
-  nghttp2_hd_entry **buffer;
+  uint32_t *buffer;
 
   if (ringbuf->mask + 1 >= bufsize) {
     return 0;
   }
   for (size = 1; size < bufsize; size <<= 1)
     ;
-  buffer = nghttp2_mem_malloc(mem, sizeof(nghttp2_hd_entry *) * size);
+  buffer = nghttp2_mem_malloc(mem, sizeof(uint32_t) * size);
   if (buffer == NULL) {
     return NGHTTP2_ERR_NOMEM;
   }
   for (i = 0; i < ringbuf->len; ++i) {
-    buffer[i] = hd_ringbuf_get(ringbuf, i);
+    buffer[i] = hd_ringbuf_offset(ringbuf, i);
   }
   nghttp2_mem_free(mem, ringbuf->buffer);
   ringbuf->buffer = buffer;
@@ -252,39 +220,294 @@ static int hd_ringbuf_reserve(nghttp2_hd_ringbuf *ringbuf, size_t bufsize,
   return 0;
 }
 
-static void hd_ringbuf_free(nghttp2_hd_ringbuf *ringbuf, nghttp2_mem *mem) {
+/*
+ * Makes sure that the byte ring of |ringbuf| can hold entries whose
+ * total size is |n|.  If the byte ring is reallocated, entries are
+ * packed from the beginning of the new ring, and if |*pname| points
+ * to the content of an entry, it is updated to point to the same
+ * content in the new ring.
+ *
+ * This function returns 1 if the byte ring is reallocated, 0 if it is
+ * large enough already, or one of the following negative error
+ * codes:
+ *
+ * NGHTTP2_ERR_NOMEM
+ *     Out of memory.
+ */
+static int hd_ringbuf_reserve_data(nghttp2_hd_ringbuf *ringbuf, size_t n,
+                                   const uint8_t **pname, nghttp2_mem *mem) {
   size_t i;
-  if (ringbuf == NULL) {
-    return;
+  size_t size;
+  size_t offset = 0;
+  uint8_t *data;
+
+  if (ringbuf->datalen >= n * 2) {
+    return 0;
   }
-  for (i = 0; i < ringbuf->len; ++i) {
-    nghttp2_hd_entry *ent = hd_ringbuf_get(ringbuf, i);
-    --ent->ref;
-    nghttp2_hd_entry_free(ent, mem);
-    nghttp2_mem_free(mem, ent);
+  for (size = 256; size < n * 2; size <<= 1)
+    ;
+  data = nghttp2_mem_malloc(mem, size);
+  if (data == NULL) {
+    return NGHTTP2_ERR_NOMEM;
   }
-  nghttp2_mem_free(mem, ringbuf->buffer);
+  /* Relocate from the oldest entry */
+  for (i = ringbuf->len; i > 0; --i) {
+    size_t slot = (ringbuf->first + i - 1) & ringbuf->mask;
+    uint8_t *src = ringbuf->data + ringbuf->buffer[slot];
+    nghttp2_hd_ringent *ent = (nghttp2_hd_ringent *)(void *)src;
+    size_t entsize = ringent_size(ent->namelen, ent->valuelen);
+
+    memcpy(data + offset, src, entsize);
+    if (*pname >= src && *pname < src + entsize) {
+      *pname = data + offset + (*pname - src);
+    }
+    ringbuf->buffer[slot] = (uint32_t)offset;
+    offset += entsize;
+  }
+  nghttp2_mem_free(mem, ringbuf->data);
+  ringbuf->data = data;
+  ringbuf->datalen = size;
+  ringbuf->head = offset;
+  return 1;
 }
 
-static int hd_ringbuf_push_front(nghttp2_hd_ringbuf *ringbuf,
-                                 nghttp2_hd_entry *ent, nghttp2_mem *mem) {
-  int rv;
+/*
+ * Returns the offset in the byte ring where an entry of |size| bytes
+ * should be stored.  hd_ringbuf_reserve_data() must be called
+ * beforehand.
+ */
+static size_t hd_ringbuf_place(nghttp2_hd_ringbuf *ringbuf, size_t size) {
+  size_t tail;
 
-  rv = hd_ringbuf_reserve(ringbuf, ringbuf->len + 1, mem);
+  if (ringbuf->len == 0) {
+    return 0;
+  }
 
-  if (rv != 0) {
-    return rv;
+  tail = hd_ringbuf_offset(ringbuf, ringbuf->len - 1);
+
+  if (ringbuf->head >= tail) {
+    if (ringbuf->datalen - ringbuf->head >= size) {
+      return ringbuf->head;
+    }
+    /* Wrap around, and skip the rest of the ring */
+    assert(tail >= size);
+    return 0;
   }
 
-  ringbuf->buffer[--ringbuf->first & ringbuf->mask] = ent;
-  ++ringbuf->len;
+  assert(tail - ringbuf->head >= size);
+  return ringbuf->head;
+}
 
-  return 0;
+static void hd_ringbuf_free(nghttp2_hd_ringbuf *ringbuf, nghttp2_mem *mem) {
+  if (ringbuf == NULL) {
+    return;
+  }
+  nghttp2_mem_free(mem, ringbuf->data);
+  nghttp2_mem_free(mem, ringbuf->buffer);
+}
+
+/*
+ * Pushes the entry at |offset| whose size is |size| as the newest
+ * entry.  hd_ringbuf_reserve() must be called beforehand.
+ */
+static void hd_ringbuf_push_front(nghttp2_hd_ringbuf *ringbuf,
+                                  uint32_t offset, size_t size) {
+  assert(ringbuf->len <= ringbuf->mask);
+  ringbuf->buffer[--ringbuf->first & ringbuf->mask] = offset;
+  ++ringbuf->len;
+  ringbuf->head = offset + size;
 }
 
 static void hd_ringbuf_pop_back(nghttp2_hd_ringbuf *ringbuf) {
   assert(ringbuf->len > 0);
-  --ringbuf->len;
+  if (--ringbuf->len == 0) {
+    ringbuf->head = 0;
+  }
+}
+
+/* The initial number of buckets in nghttp2_hd_map.  This covers the
+   dynamic table of default size without resizing. */
+#define HD_MAP_INITIAL_TABLE_LENGTH                                            \
+  (NGHTTP2_HD_DEFAULT_MAX_BUFFER_SIZE / NGHTTP2_HD_ENTRY_OVERHEAD)
+
+static uint32_t hd_map_mix(uint32_t h) {
+  /* The hash values are computed by multiplying 31, and their lower
+     bits are poorly distributed.  Scramble them before masking. */
+  h ^= h >> 16;
+  h *= 0x85ebca6bu;
+  h ^= h >> 13;
+  return h;
+}
+
+static size_t hd_map_nv_bucket(nghttp2_hd_map *map, uint32_t name_hash,
+                               uint32_t value_hash) {
+  return hd_map_mix(name_hash * 31 + value_hash) & (map->tablelen - 1);
+}
+
+static size_t hd_map_name_bucket(nghttp2_hd_map *map, uint32_t name_hash) {
+  return hd_map_mix(name_hash) & (map->tablelen - 1);
+}
+
+static int name_eq(const nghttp2_nv *a, const nghttp2_nv *b) {
+  return a->namelen == b->namelen && memeq(a->name, b->name, a->namelen);
+}
+
+static int value_eq(const nghttp2_nv *a, const nghttp2_nv *b) {
+  return a->valuelen == b->valuelen && memeq(a->value, b->value, a->valuelen);
+}
+
+static int ringent_name_eq(nghttp2_hd_ringent *ent, const uint8_t *name,
+                           size_t namelen) {
+  return ent->namelen == namelen && memeq(ringent_name(ent), name, namelen);
+}
+
+static int ringent_value_eq(nghttp2_hd_ringent *ent, const uint8_t *value,
+                            size_t valuelen) {
+  return ent->valuelen == valuelen &&
+         memeq(ringent_value(ent), value, valuelen);
+}
+
+static uint32_t *hd_map_alloc_table(size_t tablelen, nghttp2_mem *mem) {
+  uint32_t *table;
+
+  table = nghttp2_mem_malloc(mem, sizeof(uint32_t) * tablelen * 2);
+  if (table == NULL) {
+    return NULL;
+  }
+  /* Fill with HD_RINGENT_NONE */
+  memset(table, 0xff, sizeof(uint32_t) * tablelen * 2);
+  return table;
+}
+
+static int hd_map_init(nghttp2_hd_map *map, nghttp2_mem *mem) {
+  map->tablelen = HD_MAP_INITIAL_TABLE_LENGTH;
+  map->nvtable = hd_map_alloc_table(map->tablelen, mem);
+  if (map->nvtable == NULL) {
+    return NGHTTP2_ERR_NOMEM;
+  }
+  map->nametable = map->nvtable + map->tablelen;
+  map->next_seq = 0;
+  return 0;
+}
+
+static void hd_map_free(nghttp2_hd_map *map, nghttp2_mem *mem) {
+  nghttp2_mem_free(mem, map->nvtable);
+}
+
+/*
+ * Links the entry at |offset| in |ringbuf| into |map|.  The entry must
+ * be newer than any entry already in |map|.  Its seq is not changed.
+ */
+static void hd_map_link(nghttp2_hd_map *map, nghttp2_hd_ringbuf *ringbuf,
+                        uint32_t offset) {
+  nghttp2_hd_ringent *ent = hd_ringbuf_at(ringbuf, offset);
+  uint32_t *dst;
+  size_t idx;
+
+  idx = hd_map_nv_bucket(map, ent->name_hash, ent->value_hash);
+  ent->next = map->nvtable[idx];
+  map->nvtable[idx] = offset;
+
+  idx = hd_map_name_bucket(map, ent->name_hash);
+  for (dst = &map->nametable[idx]; *dst != HD_RINGENT_NONE;) {
+    nghttp2_hd_ringent *p = hd_ringbuf_at(ringbuf, *dst);
+    if (p->name_hash == ent->name_hash &&
+        ringent_name_eq(p, ringent_name(ent), ent->namelen)) {
+      /* Replace older entry with |ent| */
+      ent->name_next = p->name_next;
+      p->name_next = HD_RINGENT_NONE;
+      *dst = offset;
+      return;
+    }
+    dst = &p->name_next;
+  }
+  ent->name_next = HD_RINGENT_NONE;
+  *dst = offset;
+}
+
+/*
+ * Inserts the entry at |offset| into |map| as the newest entry.
+ */
+static void hd_map_insert(nghttp2_hd_map *map, nghttp2_hd_ringbuf *ringbuf,
+                          uint32_t offset) {
+  hd_ringbuf_at(ringbuf, offset)->seq = map->next_seq++;
+  hd_map_link(map, ringbuf, offset);
+}
+
+/*
+ * Removes the entry at |offset| from |map|.  It must be the oldest
+ * entry in |map|.
+ */
+static void hd_map_remove(nghttp2_hd_map *map, nghttp2_hd_ringbuf *ringbuf,
+                          uint32_t offset) {
+  nghttp2_hd_ringent *ent = hd_ringbuf_at(ringbuf, offset);
+  uint32_t *dst;
+
+  dst = &map->nvtable[hd_map_nv_bucket(map, ent->name_hash, ent->value_hash)];
+  while (*dst != HD_RINGENT_NONE) {
+    if (*dst == offset) {
+      *dst = ent->next;
+      break;
+    }
+    dst = &hd_ringbuf_at(ringbuf, *dst)->next;
+  }
+
+  dst = &map->nametable[hd_map_name_bucket(map, ent->name_hash)];
+  while (*dst != HD_RINGENT_NONE) {
+    if (*dst == offset) {
+      *dst = ent->name_next;
+      break;
+    }
+    dst = &hd_ringbuf_at(ringbuf, *dst)->name_next;
+  }
+}
+
+/*
+ * Links all entries in |ringbuf| into |map| again.
+ */
+static void hd_map_rebuild(nghttp2_hd_map *map, nghttp2_hd_ringbuf *ringbuf) {
+  size_t i;
+
+  memset(map->nvtable, 0xff, sizeof(uint32_t) * map->tablelen * 2);
+
+  /* Link from the oldest so that the newer entries come first */
+  for (i = ringbuf->len; i > 0; --i) {
+    hd_map_link(map, ringbuf, hd_ringbuf_offset(ringbuf, i - 1));
+  }
+}
+
+/*
+ * Makes sure that |map| has at least |n| buckets, rebuilding it from
+ * the entries in |ringbuf| if necessary.
+ *
+ * This function returns 0 if it succeeds, or one of the following
+ * negative error codes:
+ *
+ * NGHTTP2_ERR_NOMEM
+ *     Out of memory.
+ */
+static int hd_map_reserve(nghttp2_hd_map *map, nghttp2_hd_ringbuf *ringbuf,
+                          size_t n, nghttp2_mem *mem) {
+  size_t tablelen;
+  uint32_t *nvtable;
+
+  if (map->tablelen >= n) {
+    return 0;
+  }
+  for (tablelen = map->tablelen; tablelen < n; tablelen <<= 1)
+    ;
+  nvtable = hd_map_alloc_table(tablelen, mem);
+  if (nvtable == NULL) {
+    return NGHTTP2_ERR_NOMEM;
+  }
+  nghttp2_mem_free(mem, map->nvtable);
+  map->nvtable = nvtable;
+  map->nametable = nvtable + tablelen;
+  map->tablelen = tablelen;
+
+  hd_map_rebuild(map, ringbuf);
+
+  return 0;
 }
 
 static int hd_context_init(nghttp2_hd_context *context, nghttp2_mem *mem) {
@@ -321,6 +544,12 @@ int nghttp2_hd_deflate_init2(nghttp2_hd_deflater *deflater,
     return rv;
   }
 
+  rv = hd_map_init(&deflater->map, mem);
+  if (rv != 0) {
+    hd_context_free(&deflater->ctx);
+    return rv;
+  }
+
   if (deflate_hd_table_bufsize_max < NGHTTP2_HD_DEFAULT_MAX_BUFFER_SIZE) {
     deflater->notify_table_size_change = 1;
     deflater->ctx.hd_table_bufsize_max = deflate_hd_table_bufsize_max;
@@ -344,8 +573,8 @@ int nghttp2_hd_inflate_init(nghttp2_hd_inflater *inflater, nghttp2_mem *mem) {
 
   inflater->settings_hd_table_bufsize_max = NGHTTP2_HD_DEFAULT_MAX_BUFFER_SIZE;
 
-  inflater->ent_keep = NULL;
   inflater->nv_keep = NULL;
+  inflater->rawname = NULL;
 
   inflater->opcode = NGHTTP2_HD_OPCODE_NONE;
   inflater->state = NGHTTP2_HD_STATE_OPCODE;
@@ -377,19 +606,13 @@ static void hd_inflate_keep_free(nghttp2_hd_inflater *inflater) {
   nghttp2_mem *mem;
 
   mem = inflater->ctx.mem;
-  if (inflater->ent_keep) {
-    if (inflater->ent_keep->ref == 0) {
-      nghttp2_hd_entry_free(inflater->ent_keep, mem);
-      nghttp2_mem_free(mem, inflater->ent_keep);
-    }
-    inflater->ent_keep = NULL;
-  }
 
   nghttp2_mem_free(mem, inflater->nv_keep);
   inflater->nv_keep = NULL;
 }
 
 void nghttp2_hd_deflate_free(nghttp2_hd_deflater *deflater) {
+  hd_map_free(&deflater->map, deflater->ctx.mem);
   hd_context_free(&deflater->ctx);
 }
 
@@ -403,15 +626,13 @@ static size_t entry_room(size_t namelen, size_t valuelen) {
   return NGHTTP2_HD_ENTRY_OVERHEAD + namelen + valuelen;
 }
 
-static int emit_indexed_header(nghttp2_nv *nv_out, nghttp2_hd_entry *ent) {
+static int emit_indexed_header(nghttp2_nv *nv_out, const nghttp2_nv *nv) {
   DEBUGF(fprintf(stderr, "inflatehd: header emission: "));
-  DEBUGF(fwrite(ent->nv.name, ent->nv.namelen, 1, stderr));
+  DEBUGF(fwrite(nv->name, nv->namelen, 1, stderr));
   DEBUGF(fprintf(stderr, ": "));
-  DEBUGF(fwrite(ent->nv.value, ent->nv.valuelen, 1, stderr));
+  DEBUGF(fwrite(nv->value, nv->valuelen, 1, stderr));
   DEBUGF(fprintf(stderr, "\n"));
-  /* ent->ref may be 0. This happens if the encoder emits literal
-     block larger than header table capacity with indexing. */
-  *nv_out = ent->nv;
+  *nv_out = *nv;
   return 0;
 }
 
@@ -729,92 +950,163 @@ static int emit_newname_block(nghttp2_bufs *bufs, const nghttp2_nv *nv,
   return 0;
 }
 
-static nghttp2_hd_entry *add_hd_table_incremental(nghttp2_hd_context *context,
-                                                  const nghttp2_nv *nv,
-                                                  uint32_t name_hash,
-                                                  uint32_t value_hash,
-                                                  uint8_t entry_flags) {
-  int rv;
-  nghttp2_hd_entry *new_ent;
-  size_t room;
-  nghttp2_mem *mem;
+/*
+ * Evicts the oldest entry from the dynamic table of |context|.  If
+ * |map| is not NULL, the entry is removed from it as well.
+ */
+static void hd_context_evict(nghttp2_hd_context *context,
+                             nghttp2_hd_map *map) {
+  size_t idx = context->hd_table.len - 1;
+  uint32_t offset = hd_ringbuf_offset(&context->hd_table, idx);
+  nghttp2_hd_ringent *ent = hd_ringbuf_at(&context->hd_table, offset);
 
-  mem = context->mem;
-  room = entry_room(nv->namelen, nv->valuelen);
+  context->hd_table_bufsize -= entry_room(ent->namelen, ent->valuelen);
 
-  while (context->hd_table_bufsize + room > context->hd_table_bufsize_max &&
-         context->hd_table.len > 0) {
+  DEBUGF(fprintf(stderr, "hpack: remove item from header table: "));
+  DEBUGF(fwrite(ringent_name(ent), ent->namelen, 1, stderr));
+  DEBUGF(fprintf(stderr, ": "));
+  DEBUGF(fwrite(ringent_value(ent), ent->valuelen, 1, stderr));
+  DEBUGF(fprintf(stderr, "\n"));
 
-    size_t idx = context->hd_table.len - 1;
-    nghttp2_hd_entry *ent = hd_ringbuf_get(&context->hd_table, idx);
+  if (map) {
+    hd_map_remove(map, &context->hd_table, offset);
+  }
+  hd_ringbuf_pop_back(&context->hd_table);
+}
 
-    context->hd_table_bufsize -= entry_room(ent->nv.namelen, ent->nv.valuelen);
+/*
+ * Copies the content of |bufs| to |dest|.
+ */
+static void hd_copy_bufs(uint8_t *dest, nghttp2_bufs *bufs) {
+  nghttp2_buf_chain *ci;
 
-    DEBUGF(fprintf(stderr, "hpack: remove item from header table: "));
-    DEBUGF(fwrite(ent->nv.name, ent->nv.namelen, 1, stderr));
-    DEBUGF(fprintf(stderr, ": "));
-    DEBUGF(fwrite(ent->nv.value, ent->nv.valuelen, 1, stderr));
-    DEBUGF(fprintf(stderr, "\n"));
-    hd_ringbuf_pop_back(&context->hd_table);
-    if (--ent->ref == 0) {
-      nghttp2_hd_entry_free(ent, mem);
-      nghttp2_mem_free(mem, ent);
+  for (ci = bufs->head; ci; ci = ci->next) {
+    dest = nghttp2_cpymem(dest, ci->buf.pos, nghttp2_buf_len(&ci->buf));
+    if (ci == bufs->cur) {
+      break;
     }
   }
+}
 
-  new_ent = nghttp2_mem_malloc(mem, sizeof(nghttp2_hd_entry));
-  if (new_ent == NULL) {
-    return NULL;
-  }
+/*
+ * Adds the header field, whose name is |namelen| bytes long and value
+ * is |valuelen| bytes long, to the dynamic table of |context|,
+ * evicting entries as necessary.  The name and value are copied from
+ * |name| and |value| respectively.  If either of them is NULL, it is
+ * copied from |bufs| instead; if both of them are NULL, |bufs| must
+ * contain the name followed by the value.  |name| may point to the
+ * entry in the dynamic table.  If |map| is not NULL, it is kept in
+ * sync with the dynamic table.
+ *
+ * If the header field does not fit in the dynamic table, the table is
+ * emptied and |*ent_ptr| is set to NULL.  Otherwise, |*ent_ptr| is
+ * set to the new entry.  The new entry stays valid until the next
+ * modification of the dynamic table.
+ *
+ * This function returns 0 if it succeeds, or one of the following
+ * negative error codes:
+ *
+ * NGHTTP2_ERR_NOMEM
+ *     Out of memory.
+ */
+static int add_hd_table_incremental(nghttp2_hd_context *context,
+                                    const uint8_t *name, size_t namelen,
+                                    const uint8_t *value, size_t valuelen,
+                                    nghttp2_bufs *bufs, uint32_t name_hash,
+                                    uint32_t value_hash, nghttp2_hd_map *map,
+                                    nghttp2_hd_ringent **ent_ptr) {
+  int rv;
+  nghttp2_hd_ringbuf *ringbuf;
+  nghttp2_hd_ringent *ent;
+  size_t room, size, offset;
+  uint8_t *dest;
+  nghttp2_mem *mem;
 
-  rv = nghttp2_hd_entry_init(new_ent, entry_flags, nv->name, nv->namelen,
-                             nv->value, nv->valuelen, name_hash, value_hash,
-                             mem);
-  if (rv != 0) {
-    nghttp2_mem_free(mem, new_ent);
-    return NULL;
-  }
+  mem = context->mem;
+  ringbuf = &context->hd_table;
+  room = entry_room(namelen, valuelen);
 
   if (room > context->hd_table_bufsize_max) {
     /* The entry taking more than NGHTTP2_HD_MAX_BUFFER_SIZE is
        immediately evicted. */
-    --new_ent->ref;
-  } else {
-    rv = hd_ringbuf_push_front(&context->hd_table, new_ent, mem);
+    while (ringbuf->len > 0) {
+      hd_context_evict(context, map);
+    }
+    *ent_ptr = NULL;
+    return 0;
+  }
+
+  /* Make room before evicting entries, because |name| may refer to
+     the entry which is going to be evicted. */
+  rv = hd_ringbuf_reserve(ringbuf, ringbuf->len + 1, mem);
+  if (rv != 0) {
+    return rv;
+  }
+
+  rv = hd_ringbuf_reserve_data(
+      ringbuf,
+      nghttp2_min(context->hd_table_bufsize + room,
+                  context->hd_table_bufsize_max),
+      &name, mem);
+  if (rv < 0) {
+    return rv;
+  }
 
+  if (map) {
+    if (rv == 1) {
+      /* Offsets are changed */
+      hd_map_rebuild(map, ringbuf);
+    }
+    rv = hd_map_reserve(map, ringbuf, ringbuf->len + 1, mem);
     if (rv != 0) {
-      --new_ent->ref;
+      return rv;
+    }
+  }
 
-      if ((entry_flags & NGHTTP2_HD_FLAG_NAME_ALLOC) &&
-          (entry_flags & NGHTTP2_HD_FLAG_NAME_GIFT)) {
-        /* nv->name are managed by caller. */
-        new_ent->nv.name = NULL;
-        new_ent->nv.namelen = 0;
-      }
-      if ((entry_flags & NGHTTP2_HD_FLAG_VALUE_ALLOC) &&
-          (entry_flags & NGHTTP2_HD_FLAG_VALUE_GIFT)) {
-        /* nv->value are managed by caller. */
-        new_ent->nv.value = NULL;
-        new_ent->nv.valuelen = 0;
-      }
+  while (context->hd_table_bufsize + room > context->hd_table_bufsize_max &&
+         ringbuf->len > 0) {
+    hd_context_evict(context, map);
+  }
 
-      nghttp2_hd_entry_free(new_ent, mem);
-      nghttp2_mem_free(mem, new_ent);
+  size = ringent_size(namelen, valuelen);
+  offset = hd_ringbuf_place(ringbuf, size);
+  dest = ringbuf->data + offset + sizeof(nghttp2_hd_ringent);
 
-      return NULL;
+  /* |name| may overlap with the new entry if it belonged to the
+     evicted entry.  Copy it first, before anything else is
+     overwritten. */
+  if (name) {
+    memmove(dest, name, namelen);
+    if (value) {
+      memcpy(dest + namelen, value, valuelen);
+    } else {
+      hd_copy_bufs(dest + namelen, bufs);
     }
+  } else {
+    assert(value == NULL);
+    hd_copy_bufs(dest, bufs);
+  }
 
-    context->hd_table_bufsize += room;
+  ent = hd_ringbuf_at(ringbuf, (uint32_t)offset);
+  ent->namelen = (uint32_t)namelen;
+  ent->valuelen = (uint32_t)valuelen;
+  ent->name_hash = name_hash;
+  ent->value_hash = value_hash;
+  ent->next = HD_RINGENT_NONE;
+  ent->name_next = HD_RINGENT_NONE;
+  ent->seq = 0;
+
+  hd_ringbuf_push_front(ringbuf, (uint32_t)offset, size);
+
+  if (map) {
+    hd_map_insert(map, ringbuf, (uint32_t)offset);
   }
-  return new_ent;
-}
 
-static int name_eq(const nghttp2_nv *a, const nghttp2_nv *b) {
-  return a->namelen == b->namelen && memeq(a->name, b->name, a->namelen);
-}
+  context->hd_table_bufsize += room;
 
-static int value_eq(const nghttp2_nv *a, const nghttp2_nv *b) {
-  return a->valuelen == b->valuelen && memeq(a->value, b->value, a->valuelen);
+  *ent_ptr = ent;
+
+  return 0;
 }
 
 typedef struct {
@@ -823,38 +1115,60 @@ typedef struct {
   uint8_t name_value_match;
 } search_result;
 
-static search_result search_hd_table(nghttp2_hd_context *context,
+/*
+ * Returns the index of |ent|, which is in the dynamic table, in the
+ * header index address space.
+ */
+static size_t hd_map_table_index(nghttp2_hd_map *map,
+                                 nghttp2_hd_ringent *ent) {
+  return (uint32_t)(map->next_seq - 1 - ent->seq) +
+         NGHTTP2_STATIC_TABLE_LENGTH;
+}
+
+static search_result search_hd_table(nghttp2_hd_deflater *deflater,
                                      const nghttp2_nv *nv, uint32_t name_hash,
                                      uint32_t value_hash) {
   ssize_t left = -1, right = (ssize_t)STATIC_TABLE_LENGTH;
   search_result res = {-1, 0};
   size_t i;
   int use_index = (nv->flags & NGHTTP2_NV_FLAG_NO_INDEX) == 0;
+  nghttp2_hd_map *map = &deflater->map;
+  nghttp2_hd_ringbuf *ringbuf = &deflater->ctx.hd_table;
+  nghttp2_hd_entry *ent;
 
   /* Search dynamic table first, so that we can find recently used
-     entry first */
-  if (use_index) {
-    for (i = 0; i < context->hd_table.len; ++i) {
-      nghttp2_hd_entry *ent = hd_ringbuf_get(&context->hd_table, i);
-      if (ent->name_hash != name_hash || !name_eq(&ent->nv, nv)) {
-        continue;
-      }
-
-      if (res.index == -1) {
-        res.index = (ssize_t)(i + NGHTTP2_STATIC_TABLE_LENGTH);
-      }
-
-      if (ent->value_hash == value_hash && value_eq(&ent->nv, nv)) {
-        res.index = (ssize_t)(i + NGHTTP2_STATIC_TABLE_LENGTH);
+     entry first.  Each bucket lists newer entries first. */
+  if (use_index && ringbuf->len > 0) {
+    uint32_t offset;
+
+    offset = map->nvtable[hd_map_nv_bucket(map, name_hash, value_hash)];
+    while (offset != HD_RINGENT_NONE) {
+      nghttp2_hd_ringent *rent = hd_ringbuf_at(ringbuf, offset);
+      if (rent->name_hash == name_hash && rent->value_hash == value_hash &&
+          ringent_name_eq(rent, nv->name, nv->namelen) &&
+          ringent_value_eq(rent, nv->value, nv->valuelen)) {
+        res.index = (ssize_t)hd_map_table_index(map, rent);
         res.name_value_match = 1;
         return res;
       }
+      offset = rent->next;
+    }
+
+    offset = map->nametable[hd_map_name_bucket(map, name_hash)];
+    while (offset != HD_RINGENT_NONE) {
+      nghttp2_hd_ringent *rent = hd_ringbuf_at(ringbuf, offset);
+      if (rent->name_hash == name_hash &&
+          ringent_name_eq(rent, nv->name, nv->namelen)) {
+        res.index = (ssize_t)hd_map_table_index(map, rent);
+        break;
+      }
+      offset = rent->name_next;
     }
   }
 
   while (right - left > 1) {
     ssize_t mid = (left + right) / 2;
-    nghttp2_hd_entry *ent = &static_table[mid].ent;
+    ent = &static_table[mid].ent;
     if (ent->name_hash < name_hash) {
       left = mid;
     } else {
@@ -863,7 +1177,7 @@ static search_result search_hd_table(nghttp2_hd_context *context,
   }
 
   for (i = right; i < STATIC_TABLE_LENGTH; ++i) {
-    nghttp2_hd_entry *ent = &static_table[i].ent;
+    ent = &static_table[i].ent;
     if (ent->name_hash != name_hash) {
       break;
     }
@@ -884,21 +1198,11 @@ static search_result search_hd_table(nghttp2_hd_context *context,
   return res;
 }
 
-static void hd_context_shrink_table_size(nghttp2_hd_context *context) {
-  nghttp2_mem *mem;
-
-  mem = context->mem;
-
+static void hd_context_shrink_table_size(nghttp2_hd_context *context,
+                                         nghttp2_hd_map *map) {
   while (context->hd_table_bufsize > context->hd_table_bufsize_max &&
          context->hd_table.len > 0) {
-    size_t idx = context->hd_table.len - 1;
-    nghttp2_hd_entry *ent = hd_ringbuf_get(&context->hd_table, idx);
-    context->hd_table_bufsize -= entry_room(ent->nv.namelen, ent->nv.valuelen);
-    hd_ringbuf_pop_back(&context->hd_table);
-    if (--ent->ref == 0) {
-      nghttp2_hd_entry_free(ent, mem);
-      nghttp2_mem_free(mem, ent);
-    }
+    hd_context_evict(context, map);
   }
 }
 
@@ -914,7 +1218,7 @@ int nghttp2_hd_deflate_change_table_size(nghttp2_hd_deflater *deflater,
 
   deflater->notify_table_size_change = 1;
 
-  hd_context_shrink_table_size(&deflater->ctx);
+  hd_context_shrink_table_size(&deflater->ctx, &deflater->map);
   return 0;
 }
 
@@ -922,7 +1226,7 @@ int nghttp2_hd_inflate_change_table_size(nghttp2_hd_inflater *inflater,
                                          size_t settings_hd_table_bufsize_max) {
   inflater->settings_hd_table_bufsize_max = settings_hd_table_bufsize_max;
   inflater->ctx.hd_table_bufsize_max = settings_hd_table_bufsize_max;
-  hd_context_shrink_table_size(&inflater->ctx);
+  hd_context_shrink_table_size(&inflater->ctx, NULL);
   return 0;
 }
 
@@ -933,14 +1237,22 @@ static size_t get_max_index(nghttp2_hd_context *context) {
   return context->hd_table.len + NGHTTP2_STATIC_TABLE_LENGTH - 1;
 }
 
-nghttp2_hd_entry *nghttp2_hd_table_get(nghttp2_hd_context *context,
-                                       size_t idx) {
+nghttp2_nv nghttp2_hd_table_get(nghttp2_hd_context *context, size_t idx) {
   assert(INDEX_RANGE_VALID(context, idx));
   if (idx >= NGHTTP2_STATIC_TABLE_LENGTH) {
-    return hd_ringbuf_get(&context->hd_table,
-                          idx - NGHTTP2_STATIC_TABLE_LENGTH);
+    nghttp2_nv nv;
+    nghttp2_hd_ringent *ent =
+        hd_ringbuf_get(&context->hd_table, idx - NGHTTP2_STATIC_TABLE_LENGTH);
+
+    nv.name = ringent_name(ent);
+    nv.namelen = ent->namelen;
+    nv.value = ringent_value(ent);
+    nv.valuelen = ent->valuelen;
+    nv.flags = NGHTTP2_NV_FLAG_NONE;
+
+    return nv;
   } else {
-    return &static_table[static_table_index[idx]].ent;
+    return static_table[static_table_index[idx]].ent.nv;
   }
 }
 
@@ -973,7 +1285,6 @@ static int deflate_nv(nghttp2_hd_deflater *deflater, nghttp2_bufs *bufs,
   int incidx = 0;
   uint32_t name_hash = hash(nv->name, nv->namelen);
   uint32_t value_hash = hash(nv->value, nv->valuelen);
-  nghttp2_mem *mem;
 
   DEBUGF(fprintf(stderr, "deflatehd: deflating "));
   DEBUGF(fwrite(nv->name, nv->namelen, 1, stderr));
@@ -981,9 +1292,7 @@ static int deflate_nv(nghttp2_hd_deflater *deflater, nghttp2_bufs *bufs,
   DEBUGF(fwrite(nv->value, nv->valuelen, 1, stderr));
   DEBUGF(fprintf(stderr, "\n"));
 
-  mem = deflater->ctx.mem;
-
-  res = search_hd_table(&deflater->ctx, nv, name_hash, value_hash);
+  res = search_hd_table(deflater, nv, name_hash, value_hash);
 
   idx = res.index;
 
@@ -1004,26 +1313,14 @@ static int deflate_nv(nghttp2_hd_deflater *deflater, nghttp2_bufs *bufs,
   }
 
   if (hd_deflate_should_indexing(deflater, nv)) {
-    nghttp2_hd_entry *new_ent;
-    if (idx != -1 && idx < (ssize_t)NGHTTP2_STATIC_TABLE_LENGTH) {
-      nghttp2_nv nv_indname;
-      nv_indname = *nv;
-      nv_indname.name = nghttp2_hd_table_get(&deflater->ctx, idx)->nv.name;
-      new_ent =
-          add_hd_table_incremental(&deflater->ctx, &nv_indname, name_hash,
-                                   value_hash, NGHTTP2_HD_FLAG_VALUE_ALLOC);
-    } else {
-      new_ent = add_hd_table_incremental(
-          &deflater->ctx, nv, name_hash, value_hash,
-          NGHTTP2_HD_FLAG_NAME_ALLOC | NGHTTP2_HD_FLAG_VALUE_ALLOC);
-    }
-    if (!new_ent) {
+    nghttp2_hd_ringent *new_ent;
+
+    rv = add_hd_table_incremental(&deflater->ctx, nv->name, nv->namelen,
+                                  nv->value, nv->valuelen, NULL, name_hash,
+                                  value_hash, &deflater->map, &new_ent);
+    if (rv != 0) {
       return NGHTTP2_ERR_HEADER_COMP;
     }
-    if (new_ent->ref == 0) {
-      nghttp2_hd_entry_free(new_ent, mem);
-      nghttp2_mem_free(mem, new_ent);
-    }
     incidx = 1;
   }
   if (idx == -1) {
@@ -1301,6 +1598,33 @@ static ssize_t hd_inflate_read(nghttp2_hd_inflater *inflater,
   return (ssize_t)len;
 }
 
+/*
+ * Copies the raw new name referenced by |inflater->rawname| into
+ * nvbufs.  This must be done before the input is returned to the
+ * caller, or before the value is buffered in nvbufs after the name.
+ *
+ * This function returns 0 if it succeeds, or one of the following
+ * negative error codes:
+ *
+ * NGHTTP2_ERR_NOMEM
+ *   Out of memory
+ * NGHTTP2_ERR_BUFFER_ERROR
+ *     Out of buffer space.
+ */
+static int hd_inflate_flush_rawname(nghttp2_hd_inflater *inflater) {
+  int rv;
+
+  if (!inflater->rawname) {
+    return 0;
+  }
+
+  rv = nghttp2_bufs_add(&inflater->nvbufs, inflater->rawname,
+                        inflater->newnamelen);
+  inflater->rawname = NULL;
+
+  return rv;
+}
+
 /*
  * Finalize indexed header representation reception. If header is
  * emitted, |*nv_out| is filled with that value and 0 is returned. If
@@ -1314,9 +1638,9 @@ static ssize_t hd_inflate_read(nghttp2_hd_inflater *inflater,
  */
 static int hd_inflate_commit_indexed(nghttp2_hd_inflater *inflater,
                                      nghttp2_nv *nv_out) {
-  nghttp2_hd_entry *ent = nghttp2_hd_table_get(&inflater->ctx, inflater->index);
+  nghttp2_nv nv = nghttp2_hd_table_get(&inflater->ctx, inflater->index);
 
-  emit_indexed_header(nv_out, ent);
+  emit_indexed_header(nv_out, &nv);
 
   return 0;
 }
@@ -1328,8 +1652,7 @@ static int hd_inflate_remove_bufs(nghttp2_hd_inflater *inflater, nghttp2_nv *nv,
   uint8_t *buf;
   nghttp2_buf *pbuf;
 
-  if (inflater->index_required ||
-      inflater->nvbufs.head != inflater->nvbufs.cur) {
+  if (inflater->nvbufs.head != inflater->nvbufs.cur) {
 
     rv = nghttp2_bufs_remove(&inflater->nvbufs, &buf);
 
@@ -1339,6 +1662,8 @@ static int hd_inflate_remove_bufs(nghttp2_hd_inflater *inflater, nghttp2_nv *nv,
 
     buflen = rv;
 
+    inflater->nv_keep = buf;
+
     if (value_only) {
       nv->name = NULL;
       nv->namelen = 0;
@@ -1379,71 +1704,116 @@ static int hd_inflate_remove_bufs(nghttp2_hd_inflater *inflater, nghttp2_nv *nv,
 /*
  * Finalize literal header representation - new name- reception. If
  * header is emitted, |*nv_out| is filled with that value and 0 is
- * returned.
+ * returned.  If |value| is not NULL, it points to the raw value of
+ * length |valuelen| in the current input.  Otherwise, the value is
+ * buffered in nvbufs.  The name is either |inflater->rawname| or
+ * buffered in nvbufs before the value.
  *
  * This function returns 0 if it succeeds, or one of the following
  * negative error codes:
  *
  * NGHTTP2_ERR_NOMEM
  *   Out of memory
+ * NGHTTP2_ERR_BUFFER_ERROR
+ *     Out of buffer space.
  */
 static int hd_inflate_commit_newname(nghttp2_hd_inflater *inflater,
-                                     nghttp2_nv *nv_out) {
+                                     nghttp2_nv *nv_out, uint8_t *value,
+                                     size_t valuelen) {
   int rv;
   nghttp2_nv nv;
-  nghttp2_mem *mem;
+  uint8_t *name;
 
-  mem = inflater->ctx.mem;
+  name = inflater->rawname;
+  inflater->rawname = NULL;
 
-  rv = hd_inflate_remove_bufs(inflater, &nv, 0 /* name and value */);
-  if (rv != 0) {
-    return NGHTTP2_ERR_NOMEM;
+  if (value && !name) {
+    if (inflater->nvbufs.head == inflater->nvbufs.cur) {
+      name = inflater->nvbufs.head->buf.pos;
+    } else {
+      /* The name spans several chunks.  Buffer the value after it,
+         so that they are removed together. */
+      rv = nghttp2_bufs_add(&inflater->nvbufs, value, valuelen);
+      if (rv != 0) {
+        return rv;
+      }
+      value = NULL;
+    }
   }
 
-  if (inflater->no_index) {
-    nv.flags = NGHTTP2_NV_FLAG_NO_INDEX;
-  } else {
-    nv.flags = NGHTTP2_NV_FLAG_NONE;
+  if (!value) {
+    valuelen = nghttp2_bufs_len(&inflater->nvbufs);
+    if (!name) {
+      valuelen -= inflater->newnamelen;
+    }
   }
 
   if (inflater->index_required) {
-    nghttp2_hd_entry *new_ent;
-    uint8_t ent_flags;
+    nghttp2_hd_ringent *new_ent;
 
-    /* nv->value points to the middle of the buffer pointed by
-       nv->name.  So we just need to keep track of nv->name for memory
-       management. */
-    ent_flags = NGHTTP2_HD_FLAG_NAME_ALLOC | NGHTTP2_HD_FLAG_NAME_GIFT;
-
-    new_ent =
-        add_hd_table_incremental(&inflater->ctx, &nv, hash(nv.name, nv.namelen),
-                                 hash(nv.value, nv.valuelen), ent_flags);
+    /* Name and value which are not given as pointers are copied from
+       nvbufs to the dynamic table directly. */
+    rv = add_hd_table_incremental(&inflater->ctx, name, inflater->newnamelen,
+                                  value, valuelen, &inflater->nvbufs, 0, 0,
+                                  NULL, &new_ent);
+    if (rv != 0) {
+      return NGHTTP2_ERR_NOMEM;
+    }
 
     if (new_ent) {
-      emit_indexed_header(nv_out, new_ent);
-      inflater->ent_keep = new_ent;
+      nv.name = ringent_name(new_ent);
+      nv.namelen = new_ent->namelen;
+      nv.value = ringent_value(new_ent);
+      nv.valuelen = new_ent->valuelen;
+      nv.flags = NGHTTP2_NV_FLAG_NONE;
+
+      emit_indexed_header(nv_out, &nv);
+
+      nghttp2_bufs_reset(&inflater->nvbufs);
 
       return 0;
     }
 
-    nghttp2_mem_free(mem, nv.name);
+    /* The entry was too large to be stored in the dynamic table.
+       Emit it as if it was not indexed. */
+  }
 
-    return NGHTTP2_ERR_NOMEM;
+  if (value) {
+    nv.value = value;
+    nv.valuelen = valuelen;
+
+    /* Resetting does not change the content of first buffer, which
+       may contain the name */
+    nghttp2_bufs_reset(&inflater->nvbufs);
+  } else {
+    rv = hd_inflate_remove_bufs(inflater, &nv, name != NULL);
+    if (rv != 0) {
+      return NGHTTP2_ERR_NOMEM;
+    }
   }
 
-  emit_literal_header(nv_out, &nv);
+  if (name) {
+    nv.name = name;
+    nv.namelen = inflater->newnamelen;
+  }
 
-  if (nv.name != inflater->nvbufs.head->buf.pos) {
-    inflater->nv_keep = nv.name;
+  if (inflater->no_index) {
+    nv.flags = NGHTTP2_NV_FLAG_NO_INDEX;
+  } else {
+    nv.flags = NGHTTP2_NV_FLAG_NONE;
   }
 
+  emit_literal_header(nv_out, &nv);
+
   return 0;
 }
 
 /*
  * Finalize literal header representation - indexed name-
  * reception. If header is emitted, |*nv_out| is filled with that
- * value and 0 is returned.
+ * value and 0 is returned.  If |value| is not NULL, it points to the
+ * raw value of length |valuelen| in the current input.  Otherwise,
+ * the value is buffered in nvbufs.
  *
  * This function returns 0 if it succeeds, or one of the following
  * negative error codes:
@@ -1452,72 +1822,71 @@ static int hd_inflate_commit_newname(nghttp2_hd_inflater *inflater,
  *   Out of memory
  */
 static int hd_inflate_commit_indname(nghttp2_hd_inflater *inflater,
-                                     nghttp2_nv *nv_out) {
+                                     nghttp2_nv *nv_out, uint8_t *value,
+                                     size_t valuelen) {
   int rv;
   nghttp2_nv nv;
-  nghttp2_hd_entry *ent_name;
-  nghttp2_mem *mem;
-
-  mem = inflater->ctx.mem;
+  nghttp2_nv nv_name;
 
-  rv = hd_inflate_remove_bufs(inflater, &nv, 1 /* value only */);
-  if (rv != 0) {
-    return NGHTTP2_ERR_NOMEM;
-  }
+  /* If the name refers to the entry in the dynamic table,
+     add_hd_table_incremental() takes care of it even if the entry is
+     evicted or relocated. */
+  nv_name = nghttp2_hd_table_get(&inflater->ctx, inflater->index);
 
-  if (inflater->no_index) {
-    nv.flags = NGHTTP2_NV_FLAG_NO_INDEX;
-  } else {
-    nv.flags = NGHTTP2_NV_FLAG_NONE;
+  if (!value) {
+    valuelen = nghttp2_bufs_len(&inflater->nvbufs);
   }
 
-  ent_name = nghttp2_hd_table_get(&inflater->ctx, inflater->index);
-
-  nv.name = ent_name->nv.name;
-  nv.namelen = ent_name->nv.namelen;
-
   if (inflater->index_required) {
-    nghttp2_hd_entry *new_ent;
-    uint8_t ent_flags;
-    int static_name;
-
-    ent_flags = NGHTTP2_HD_FLAG_VALUE_ALLOC | NGHTTP2_HD_FLAG_VALUE_GIFT;
-    static_name = inflater->index < NGHTTP2_STATIC_TABLE_LENGTH;
-
-    if (!static_name) {
-      ent_flags |= NGHTTP2_HD_FLAG_NAME_ALLOC;
-      /* For entry in static table, we must not touch ref, because it
-         is shared by threads */
-      ++ent_name->ref;
-    }
-
-    new_ent = add_hd_table_incremental(&inflater->ctx, &nv, ent_name->name_hash,
-                                       hash(nv.value, nv.valuelen), ent_flags);
+    nghttp2_hd_ringent *new_ent;
 
-    if (!static_name && --ent_name->ref == 0) {
-      nghttp2_hd_entry_free(ent_name, mem);
-      nghttp2_mem_free(mem, ent_name);
+    rv = add_hd_table_incremental(&inflater->ctx, nv_name.name,
+                                  nv_name.namelen, value, valuelen,
+                                  &inflater->nvbufs, 0, 0, NULL, &new_ent);
+    if (rv != 0) {
+      return NGHTTP2_ERR_NOMEM;
     }
 
     if (new_ent) {
-      emit_indexed_header(nv_out, new_ent);
+      nv.name = ringent_name(new_ent);
+      nv.namelen = new_ent->namelen;
+      nv.value = ringent_value(new_ent);
+      nv.valuelen = new_ent->valuelen;
+      nv.flags = NGHTTP2_NV_FLAG_NONE;
+
+      emit_indexed_header(nv_out, &nv);
 
-      inflater->ent_keep = new_ent;
+      nghttp2_bufs_reset(&inflater->nvbufs);
 
       return 0;
     }
 
-    nghttp2_mem_free(mem, nv.value);
-
-    return NGHTTP2_ERR_NOMEM;
+    /* The entry was too large to be stored in the dynamic table, and
+       the dynamic table is now empty.  The evicted entries are still
+       intact in the byte ring, so the name is still readable. */
   }
 
-  emit_literal_header(nv_out, &nv);
+  if (value) {
+    nv.value = value;
+    nv.valuelen = valuelen;
+  } else {
+    rv = hd_inflate_remove_bufs(inflater, &nv, 1 /* value only */);
+    if (rv != 0) {
+      return NGHTTP2_ERR_NOMEM;
+    }
+  }
 
-  if (nv.value != inflater->nvbufs.head->buf.pos) {
-    inflater->nv_keep = nv.value;
+  if (inflater->no_index) {
+    nv.flags = NGHTTP2_NV_FLAG_NO_INDEX;
+  } else {
+    nv.flags = NGHTTP2_NV_FLAG_NONE;
   }
 
+  nv.name = nv_name.name;
+  nv.namelen = nv_name.namelen;
+
+  emit_literal_header(nv_out, &nv);
+
   return 0;
 }
 
@@ -1583,7 +1952,7 @@ ssize_t nghttp2_hd_inflate_hd(nghttp2_hd_inflater *inflater, nghttp2_nv *nv_out,
       }
       DEBUGF(fprintf(stderr, "inflatehd: table_size=%zu\n", inflater->left));
       inflater->ctx.hd_table_bufsize_max = inflater->left;
-      hd_context_shrink_table_size(&inflater->ctx);
+      hd_context_shrink_table_size(&inflater->ctx, NULL);
       inflater->state = NGHTTP2_HD_STATE_OPCODE;
       break;
     case NGHTTP2_HD_STATE_READ_INDEX: {
@@ -1665,6 +2034,15 @@ ssize_t nghttp2_hd_inflate_hd(nghttp2_hd_inflater *inflater, nghttp2_nv *nv_out,
         nghttp2_hd_huff_decode_context_init(&inflater->huff_decode_ctx);
 
         inflater->state = NGHTTP2_HD_STATE_NEWNAME_READ_NAMEHUFF;
+      } else if (inflater->left <= (size_t)(last - in)) {
+        /* The whole raw name is in the input.  Refer to it directly
+           instead of copying it into nvbufs. */
+        inflater->rawname = in;
+        inflater->newnamelen = inflater->left;
+
+        in += inflater->left;
+
+        inflater->state = NGHTTP2_HD_STATE_CHECK_VALUELEN;
       } else {
         inflater->state = NGHTTP2_HD_STATE_NEWNAME_READ_NAME;
       }
@@ -1734,11 +2112,23 @@ ssize_t nghttp2_hd_inflate_hd(nghttp2_hd_inflater *inflater, nghttp2_nv *nv_out,
       }
 
       DEBUGF(fprintf(stderr, "inflatehd: valuelen=%zu\n", inflater->left));
-      if (inflater->left == 0) {
+      if (inflater->left == 0 ||
+          (!inflater->huffman_encoded &&
+           inflater->left <= (size_t)(last - in) &&
+           (inflater->opcode == NGHTTP2_HD_OPCODE_INDNAME ||
+            inflater->newnamelen + inflater->left <= NGHTTP2_HD_MAX_NV))) {
+        /* The whole raw value is in the input.  Emit the header
+           field referring to it directly. */
+        uint8_t *value = in;
+        size_t valuelen = inflater->left;
+
+        in += valuelen;
+        inflater->left = 0;
+
         if (inflater->opcode == NGHTTP2_HD_OPCODE_NEWNAME) {
-          rv = hd_inflate_commit_newname(inflater, nv_out);
+          rv = hd_inflate_commit_newname(inflater, nv_out, value, valuelen);
         } else {
-          rv = hd_inflate_commit_indname(inflater, nv_out);
+          rv = hd_inflate_commit_indname(inflater, nv_out, value, valuelen);
         }
         if (rv != 0) {
           goto fail;
@@ -1748,6 +2138,15 @@ ssize_t nghttp2_hd_inflate_hd(nghttp2_hd_inflater *inflater, nghttp2_nv *nv_out,
         return (ssize_t)(in - first);
       }
 
+      if (inflater->left > (size_t)(last - in)) {
+        /* The value spans input chunks, and is buffered in nvbufs
+           after the name */
+        rv = hd_inflate_flush_rawname(inflater);
+        if (rv != 0) {
+          goto fail;
+        }
+      }
+
       if (inflater->huffman_encoded) {
         nghttp2_hd_huff_decode_context_init(&inflater->huff_decode_ctx);
 
@@ -1774,9 +2173,9 @@ ssize_t nghttp2_hd_inflate_hd(nghttp2_hd_inflater *inflater, nghttp2_nv *nv_out,
       }
 
       if (inflater->opcode == NGHTTP2_HD_OPCODE_NEWNAME) {
-        rv = hd_inflate_commit_newname(inflater, nv_out);
+        rv = hd_inflate_commit_newname(inflater, nv_out, NULL, 0);
       } else {
-        rv = hd_inflate_commit_indname(inflater, nv_out);
+        rv = hd_inflate_commit_indname(inflater, nv_out, NULL, 0);
       }
 
       if (rv != 0) {
@@ -1806,9 +2205,9 @@ ssize_t nghttp2_hd_inflate_hd(nghttp2_hd_inflater *inflater, nghttp2_nv *nv_out,
       }
 
       if (inflater->opcode == NGHTTP2_HD_OPCODE_NEWNAME) {
-        rv = hd_inflate_commit_newname(inflater, nv_out);
+        rv = hd_inflate_commit_newname(inflater, nv_out, NULL, 0);
       } else {
-        rv = hd_inflate_commit_indname(inflater, nv_out);
+        rv = hd_inflate_commit_indname(inflater, nv_out, NULL, 0);
       }
 
       if (rv != 0) {
@@ -1826,6 +2225,12 @@ ssize_t nghttp2_hd_inflate_hd(nghttp2_hd_inflater *inflater, nghttp2_nv *nv_out,
 
   DEBUGF(fprintf(stderr, "inflatehd: all input bytes were processed\n"));
 
+  /* The input is no longer valid after we return */
+  rv = hd_inflate_flush_rawname(inflater);
+  if (rv != 0) {
+    goto fail;
+  }
+
   if (in_final) {
     DEBUGF(fprintf(stderr, "inflatehd: in_final set\n"));
 
@@ -1841,6 +2246,11 @@ ssize_t nghttp2_hd_inflate_hd(nghttp2_hd_inflater *inflater, nghttp2_nv *nv_out,
   return (ssize_t)(in - first);
 
 almost_ok:
+  rv = hd_inflate_flush_rawname(inflater);
+  if (rv != 0) {
+    goto fail;
+  }
+
   if (in_final && inflater->state != NGHTTP2_HD_STATE_OPCODE) {
     DEBUGF(fprintf(stderr, "inflatehd: input ended prematurely\n"));
 
@@ -1853,6 +2263,7 @@ almost_ok:
 fail:
   DEBUGF(fprintf(stderr, "inflatehd: error return %zd\n", rv));
 
+  inflater->rawname = NULL;
   inflater->ctx.bad = 1;
   return rv;
 }
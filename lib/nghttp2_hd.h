@@ -51,27 +51,11 @@
 /* Exported for unit test */
 extern const size_t NGHTTP2_STATIC_TABLE_LENGTH;
 
-typedef enum {
-  NGHTTP2_HD_FLAG_NONE = 0,
-  /* Indicates name was dynamically allocated and must be freed */
-  NGHTTP2_HD_FLAG_NAME_ALLOC = 1,
-  /* Indicates value was dynamically allocated and must be freed */
-  NGHTTP2_HD_FLAG_VALUE_ALLOC = 1 << 1,
-  /* Indicates that the name was gifted to the entry and no copying
-     necessary. */
-  NGHTTP2_HD_FLAG_NAME_GIFT = 1 << 2,
-  /* Indicates that the value was gifted to the entry and no copying
-     necessary. */
-  NGHTTP2_HD_FLAG_VALUE_GIFT = 1 << 3
-} nghttp2_hd_flags;
-
+/* Entry of the static table */
 typedef struct {
   nghttp2_nv nv;
   uint32_t name_hash;
   uint32_t value_hash;
-  /* Reference count */
-  uint8_t ref;
-  uint8_t flags;
 } nghttp2_hd_entry;
 
 typedef struct {
@@ -79,13 +63,65 @@ typedef struct {
   size_t index;
 } nghttp2_hd_static_entry;
 
+/*
+ * Entry of the dynamic table.  It is stored in the byte ring of
+ * nghttp2_hd_ringbuf, immediately followed by its name and value.
+ * Its size including padding never exceeds the per entry overhead
+ * NGHTTP2_HD_ENTRY_OVERHEAD.
+ */
 typedef struct {
-  nghttp2_hd_entry **buffer;
+  uint32_t namelen;
+  uint32_t valuelen;
+  uint32_t name_hash;
+  uint32_t value_hash;
+  /* The following members are only used by the deflater to index the
+     dynamic table.  |next| is the offset of the next entry in the
+     same name/value bucket, and |name_next| is the one in the same
+     name bucket. */
+  uint32_t next;
+  uint32_t name_next;
+  /* The sequence number of this entry in the dynamic table.  The
+     entry inserted later has larger value (modulo 2**32). */
+  uint32_t seq;
+} nghttp2_hd_ringent;
+
+typedef struct {
+  /* The byte ring which stores entries.  An entry is never split at
+     the end of the ring; if it does not fit, it is stored from the
+     beginning instead.  The ring is at least twice as large as the
+     sum of entry sizes it has to hold, which guarantees that there is
+     always a contiguous room for a new entry. */
+  uint8_t *data;
+  /* The capacity of |data| */
+  size_t datalen;
+  /* The offset in |data| where the next entry is stored */
+  size_t head;
+  /* The offsets of entries in |data|, newest first.  This is a ring
+     buffer of length |mask| + 1. */
+  uint32_t *buffer;
   size_t mask;
   size_t first;
   size_t len;
 } nghttp2_hd_ringbuf;
 
+/*
+ * Hash index of the dynamic table used by the deflater.  Each entry in
+ * the dynamic table is linked into |nvtable| by the hash of its name
+ * and value.  |nametable| only holds the most recently inserted entry
+ * for each distinct name.  Since entries are evicted in the order of
+ * insertion, all older entries sharing the name are evicted before it,
+ * and it can simply be removed from |nametable| when it is evicted.
+ * Entries are referred by their offsets in nghttp2_hd_ringbuf.data.
+ */
+typedef struct {
+  uint32_t *nvtable;
+  uint32_t *nametable;
+  /* The number of buckets in each table.  Always power of 2. */
+  size_t tablelen;
+  /* The sequence number assigned to the next inserted entry */
+  uint32_t next_seq;
+} nghttp2_hd_map;
+
 typedef enum {
   NGHTTP2_HD_OPCODE_NONE,
   NGHTTP2_HD_OPCODE_INDEXED,
@@ -126,6 +162,8 @@ typedef struct {
 
 struct nghttp2_hd_deflater {
   nghttp2_hd_context ctx;
+  /* Hash index of ctx.hd_table */
+  nghttp2_hd_map map;
   /* The upper limit of the header table size the deflater accepts. */
   size_t deflate_hd_table_bufsize_max;
   /* Minimum header table size notified in the next context update */
@@ -141,13 +179,13 @@ struct nghttp2_hd_inflater {
   nghttp2_bufs nvbufs;
   /* Stores current state of huffman decoding */
   nghttp2_hd_huff_decode_context huff_decode_ctx;
-  /* Pointer to the nghttp2_hd_entry which is used current header
-     emission. This is required because in some cases the
-     ent_keep->ref == 0 and we have to keep track of it. */
-  nghttp2_hd_entry *ent_keep;
   /* Pointer to the name/value pair buffer which is used in the
      current header emission. */
   uint8_t *nv_keep;
+  /* Pointer to the raw new name in the current input, which is
+     emitted without being copied into nvbufs.  NULL if the name is
+     buffered in nvbufs. */
+  uint8_t *rawname;
   /* The number of bytes to read */
   size_t left;
   /* The index in indexed repr or indexed name */
@@ -171,28 +209,6 @@ struct nghttp2_hd_inflater {
   uint8_t no_index;
 };
 
-/*
- * Initializes the |ent| members. If NGHTTP2_HD_FLAG_NAME_ALLOC bit
- * set in the |flags|, the content pointed by the |name| with length
- * |namelen| is copied. Likewise, if NGHTTP2_HD_FLAG_VALUE_ALLOC bit
- * set in the |flags|, the content pointed by the |value| with length
- * |valuelen| is copied.  The |name_hash| and |value_hash| are hash
- * value for |name| and |value| respectively.  The hash function is
- * defined in nghttp2_hd.c.
- *
- * This function returns 0 if it succeeds, or one of the following
- * negative error codes:
- *
- * NGHTTP2_ERR_NOMEM
- *     Out of memory.
- */
-int nghttp2_hd_entry_init(nghttp2_hd_entry *ent, uint8_t flags, uint8_t *name,
-                          size_t namelen, uint8_t *value, size_t valuelen,
-                          uint32_t name_hash, uint32_t value_hash,
-                          nghttp2_mem *mem);
-
-void nghttp2_hd_entry_free(nghttp2_hd_entry *ent, nghttp2_mem *mem);
-
 /*
  * Initializes |deflater| for deflating name/values pairs.
  *
@@ -283,8 +299,7 @@ int nghttp2_hd_emit_newname_block(nghttp2_bufs *bufs, nghttp2_nv *nv,
 int nghttp2_hd_emit_table_size(nghttp2_bufs *bufs, size_t table_size);
 
 /* For unittesting purpose */
-nghttp2_hd_entry *nghttp2_hd_table_get(nghttp2_hd_context *context,
-                                       size_t index);
+nghttp2_nv nghttp2_hd_table_get(nghttp2_hd_context *context, size_t index);
 
 /* For unittesting purpose */
 ssize_t nghttp2_hd_decode_length(uint32_t *res, size_t *shift_ptr, int *final,
@@ -29,88 +29,10 @@
 #include <stdio.h>
 
 #include "nghttp2_hd.h"
+#include "nghttp2_helper.h"
 
 extern const nghttp2_huff_sym huff_sym_table[];
-extern const nghttp2_huff_decode huff_decode_table[][16];
-
-/*
- * Encodes huffman code |sym| into |*dest_ptr|, whose least |rembits|
- * bits are not filled yet.  The |rembits| must be in range [1, 8],
- * inclusive.  At the end of the process, the |*dest_ptr| is updated
- * and points where next output should be placed. The number of
- * unfilled bits in the pointed location is returned.
- */
-static ssize_t huff_encode_sym(nghttp2_bufs *bufs, size_t *avail_ptr,
-                               size_t rembits, const nghttp2_huff_sym *sym) {
-  int rv;
-  size_t nbits = sym->nbits;
-  uint32_t code = sym->code;
-
-  /* We assume that sym->nbits <= 32 */
-  if (rembits > nbits) {
-    nghttp2_bufs_fast_orb_hold(bufs, code << (rembits - nbits));
-    return (ssize_t)(rembits - nbits);
-  }
-
-  if (rembits == nbits) {
-    nghttp2_bufs_fast_orb(bufs, code);
-    --*avail_ptr;
-    return 8;
-  }
-
-  nghttp2_bufs_fast_orb(bufs, code >> (nbits - rembits));
-  --*avail_ptr;
-
-  nbits -= rembits;
-  if (nbits & 0x7) {
-    /* align code to MSB byte boundary */
-    code <<= 8 - (nbits & 0x7);
-  }
-
-  /* we lose at most 3 bytes, but it is not critical in practice */
-  if (*avail_ptr < (nbits + 7) / 8) {
-    rv = nghttp2_bufs_advance(bufs);
-    if (rv != 0) {
-      return rv;
-    }
-    *avail_ptr = nghttp2_bufs_cur_avail(bufs);
-    /* we assume that we at least 3 buffer space available */
-    assert(*avail_ptr >= 3);
-  }
-
-  /* fast path, since most code is less than 8 */
-  if (nbits < 8) {
-    nghttp2_bufs_fast_addb_hold(bufs, code);
-    *avail_ptr = nghttp2_bufs_cur_avail(bufs);
-    return (ssize_t)(8 - nbits);
-  }
-
-  /* handle longer code path */
-  if (nbits > 24) {
-    nghttp2_bufs_fast_addb(bufs, code >> 24);
-    nbits -= 8;
-  }
-
-  if (nbits > 16) {
-    nghttp2_bufs_fast_addb(bufs, code >> 16);
-    nbits -= 8;
-  }
-
-  if (nbits > 8) {
-    nghttp2_bufs_fast_addb(bufs, code >> 8);
-    nbits -= 8;
-  }
-
-  if (nbits == 8) {
-    nghttp2_bufs_fast_addb(bufs, code);
-    *avail_ptr = nghttp2_bufs_cur_avail(bufs);
-    return 8;
-  }
-
-  nghttp2_bufs_fast_addb_hold(bufs, code);
-  *avail_ptr = nghttp2_bufs_cur_avail(bufs);
-  return (ssize_t)(8 - nbits);
-}
+extern const nghttp2_huff_decode huff_decode_table[][256];
 
 size_t nghttp2_hd_huff_encode_count(const uint8_t *src, size_t len) {
   size_t i;
@@ -123,44 +45,78 @@ size_t nghttp2_hd_huff_encode_count(const uint8_t *src, size_t len) {
   return (nbits + 7) / 8;
 }
 
+/*
+ * Writes |n| bytes in |buf| to |bufs|.  |*avail_ptr| is the number of
+ * bytes available in the current buffer of |bufs|, and it is updated
+ * on return.
+ */
+static int huff_encode_write(nghttp2_bufs *bufs, size_t *avail_ptr,
+                             const uint8_t *buf, size_t n) {
+  int rv;
+
+  if (*avail_ptr >= n) {
+    bufs->cur->buf.last = nghttp2_cpymem(bufs->cur->buf.last, buf, n);
+    *avail_ptr -= n;
+    return 0;
+  }
+
+  rv = nghttp2_bufs_add(bufs, buf, n);
+  if (rv != 0) {
+    return rv;
+  }
+  *avail_ptr = nghttp2_bufs_cur_avail(bufs);
+  return 0;
+}
+
 int nghttp2_hd_huff_encode(nghttp2_bufs *bufs, const uint8_t *src,
                            size_t srclen) {
   int rv;
-  ssize_t rembits = 8;
-  size_t i;
+  /* Codes are accumulated in |x| from LSB, and the lower |nbits| bits
+     are not written yet.  Since the longest code is 30 bits long, 64
+     bits are enough to hold pending bits below 32 and the next
+     code. */
+  uint64_t x = 0;
+  size_t nbits = 0;
   size_t avail;
+  uint8_t buf[4];
+  const uint8_t *end = src + srclen;
 
   avail = nghttp2_bufs_cur_avail(bufs);
 
-  for (i = 0; i < srclen; ++i) {
-    const nghttp2_huff_sym *sym = &huff_sym_table[src[i]];
-    if (rembits == 8) {
-      if (avail) {
-        nghttp2_bufs_fast_addb_hold(bufs, 0);
-      } else {
-        rv = nghttp2_bufs_addb_hold(bufs, 0);
-        if (rv != 0) {
-          return rv;
-        }
-        avail = nghttp2_bufs_cur_avail(bufs);
-      }
+  for (; src != end; ++src) {
+    const nghttp2_huff_sym *sym = &huff_sym_table[*src];
+
+    x = (x << sym->nbits) | sym->code;
+    nbits += sym->nbits;
+
+    if (nbits < 32) {
+      continue;
     }
-    rembits = huff_encode_sym(bufs, &avail, rembits, sym);
-    if (rembits < 0) {
-      return (int)rembits;
+
+    nbits -= 32;
+    nghttp2_put_uint32be(buf, (uint32_t)(x >> nbits));
+
+    rv = huff_encode_write(bufs, &avail, buf, sizeof(buf));
+    if (rv != 0) {
+      return rv;
     }
   }
-  /* 256 is special terminal symbol, pad with its prefix */
-  if (rembits < 8) {
-    /* if rembits < 8, we should have at least 1 buffer space
-       available */
-    const nghttp2_huff_sym *sym = &huff_sym_table[256];
-    assert(avail);
-    /* Caution we no longer adjust avail here */
-    nghttp2_bufs_fast_orb(bufs, sym->code >> (sym->nbits - rembits));
+
+  /* 256 is special terminal symbol, pad with its prefix, which is all
+     1 bits */
+  if (nbits & 0x7) {
+    size_t padlen = 8 - (nbits & 0x7);
+    x = (x << padlen) | ((1u << padlen) - 1);
+    nbits += padlen;
   }
 
-  return 0;
+  if (nbits == 0) {
+    return 0;
+  }
+
+  nghttp2_put_uint32be(buf, (uint32_t)(x << (32 - nbits)));
+
+  return huff_encode_write(bufs, &avail, buf, nbits / 8);
 }
 
 void nghttp2_hd_huff_decode_context_init(nghttp2_hd_huff_decode_context *ctx) {
@@ -171,40 +127,50 @@ void nghttp2_hd_huff_decode_context_init(nghttp2_hd_huff_decode_context *ctx) {
 ssize_t nghttp2_hd_huff_decode(nghttp2_hd_huff_decode_context *ctx,
                                nghttp2_bufs *bufs, const uint8_t *src,
                                size_t srclen, int final) {
-  size_t i, j;
+  size_t i;
   int rv;
   size_t avail;
+  uint8_t state = ctx->state;
+  uint8_t flags = ctx->accept ? NGHTTP2_HUFF_ACCEPTED : 0;
 
   avail = nghttp2_bufs_cur_avail(bufs);
 
   /* We use the decoding algorithm described in
-     http://graphics.ics.uci.edu/pub/Prefix.pdf */
+     http://graphics.ics.uci.edu/pub/Prefix.pdf, but consume 8 bits at
+     once instead of 4 bits. */
   for (i = 0; i < srclen; ++i) {
-    uint8_t in = src[i] >> 4;
-    for (j = 0; j < 2; ++j) {
-      const nghttp2_huff_decode *t;
+    const nghttp2_huff_decode *t;
 
-      t = &huff_decode_table[ctx->state][in];
-      if (t->flags & NGHTTP2_HUFF_FAIL) {
-        return NGHTTP2_ERR_HEADER_COMP;
-      }
-      if (t->flags & NGHTTP2_HUFF_SYM) {
-        if (avail) {
-          nghttp2_bufs_fast_addb(bufs, t->sym);
-          --avail;
-        } else {
-          rv = nghttp2_bufs_addb(bufs, t->sym);
-          if (rv != 0) {
-            return rv;
-          }
-          avail = nghttp2_bufs_cur_avail(bufs);
+    t = &huff_decode_table[state][src[i]];
+    flags = t->flags;
+
+    if (flags & NGHTTP2_HUFF_FAIL) {
+      return NGHTTP2_ERR_HEADER_COMP;
+    }
+    if (flags & NGHTTP2_HUFF_SYM) {
+      size_t nsym = (flags & NGHTTP2_HUFF_SYM2) ? 2 : 1;
+      if (avail >= 2) {
+        /* Always copy 2 bytes to avoid branch, and only advance by
+           the number of symbols. */
+        uint8_t *p = bufs->cur->buf.last;
+        p[0] = t->sym[0];
+        p[1] = t->sym[1];
+        bufs->cur->buf.last += nsym;
+        avail -= nsym;
+      } else {
+        rv = nghttp2_bufs_add(bufs, t->sym, nsym);
+        if (rv != 0) {
+          return rv;
         }
+        avail = nghttp2_bufs_cur_avail(bufs);
       }
-      ctx->state = t->state;
-      ctx->accept = (t->flags & NGHTTP2_HUFF_ACCEPTED) != 0;
-      in = src[i] & 0xf;
     }
+    state = t->state;
   }
+
+  ctx->state = state;
+  ctx->accept = (flags & NGHTTP2_HUFF_ACCEPTED) != 0;
+
   if (final && !ctx->accept) {
     return NGHTTP2_ERR_HEADER_COMP;
   }
@@ -38,7 +38,9 @@ typedef enum {
   /* This state emits symbol */
   NGHTTP2_HUFF_SYM = (1 << 1),
   /* If state machine reaches this state, decoding fails. */
-  NGHTTP2_HUFF_FAIL = (1 << 2)
+  NGHTTP2_HUFF_FAIL = (1 << 2),
+  /* This state emits 2 symbols.  NGHTTP2_HUFF_SYM is also set. */
+  NGHTTP2_HUFF_SYM2 = (1 << 3)
 } nghttp2_huff_decode_flag;
 
 typedef struct {
@@ -49,11 +51,15 @@ typedef struct {
   uint8_t state;
   /* bitwise OR of zero or more of the nghttp2_huff_decode_flag */
   uint8_t flags;
-  /* symbol if NGHTTP2_HUFF_SYM flag set */
-  uint8_t sym;
+  /* symbols if NGHTTP2_HUFF_SYM flag set.  The second one is only
+     valid if NGHTTP2_HUFF_SYM2 flag is also set. */
+  uint8_t sym[2];
 } nghttp2_huff_decode;
 
-typedef nghttp2_huff_decode huff_decode_table_type[16];
+/* The decoding table is indexed by the current state and the next
+   input byte.  Since the shortest code is 5 bits long, one transition
+   emits at most 2 symbols. */
+typedef nghttp2_huff_decode huff_decode_table_type[256];
 
 typedef struct {
   /* Current huffman decoding state. We stripped leaf nodes, so the
@@ -27,8 +27,166 @@
 #include <assert.h>
 #include <string.h>
 
+#ifdef HAVE_X86_SIMD
+#include <immintrin.h>
+#endif /* HAVE_X86_SIMD */
+
 #include "nghttp2_net.h"
 
+int nghttp2_simd_max_level = NGHTTP2_SIMD_AVX2;
+
+#ifdef HAVE_X86_SIMD
+/*
+ * Returns the highest nghttp2_simd_level which the running CPU
+ * supports, capped by nghttp2_simd_max_level.
+ */
+static int simd_level(void) {
+  if (nghttp2_simd_max_level >= NGHTTP2_SIMD_AVX2 &&
+      __builtin_cpu_supports("avx2")) {
+    return NGHTTP2_SIMD_AVX2;
+  }
+  if (nghttp2_simd_max_level >= NGHTTP2_SIMD_SSE2 &&
+      __builtin_cpu_supports("sse2")) {
+    return NGHTTP2_SIMD_SSE2;
+  }
+  return NGHTTP2_SIMD_NONE;
+}
+
+/*
+ * The following functions process 16 bytes (SSE2) or 32 bytes (AVX2)
+ * at a time.  Byte ranges are tested with unsigned comparison: x is
+ * in [lo, hi] if and only if min(x - lo, hi - lo) == x - lo.  They
+ * return the number of leading bytes processed; the caller handles
+ * the remaining bytes with the scalar code.
+ */
+
+#define SSE2_IN_RANGE(X, LO, HI)                                               \
+  _mm_cmpeq_epi8(_mm_min_epu8(_mm_sub_epi8(X, _mm_set1_epi8(LO)),           \
+                              _mm_set1_epi8((char)((HI) - (LO)))),             \
+                 _mm_sub_epi8(X, _mm_set1_epi8(LO)))
+
+#define AVX2_IN_RANGE(X, LO, HI)                                               \
+  _mm256_cmpeq_epi8(                                                           \
+      _mm256_min_epu8(_mm256_sub_epi8(X, _mm256_set1_epi8(LO)),                \
+                      _mm256_set1_epi8((char)((HI) - (LO)))),                  \
+      _mm256_sub_epi8(X, _mm256_set1_epi8(LO)))
+
+/* Valid header field name characters are '!', '#'-'\'', '*', '+',
+   '-', '.', '0'-'9', '^'-'z', '|' and '~'. */
+__attribute__((target("sse2"))) static size_t
+check_header_name_sse2(const uint8_t *name, size_t len) {
+  size_t i;
+  __m128i x, ok;
+
+  for (i = 0; i + 16 <= len; i += 16) {
+    x = _mm_loadu_si128((const __m128i *)(const void *)(name + i));
+    ok = _mm_or_si128(SSE2_IN_RANGE(x, '^', 'z'), SSE2_IN_RANGE(x, '0', '9'));
+    ok = _mm_or_si128(ok, SSE2_IN_RANGE(x, '#', '\''));
+    ok = _mm_or_si128(ok, SSE2_IN_RANGE(x, '*', '+'));
+    ok = _mm_or_si128(ok, SSE2_IN_RANGE(x, '-', '.'));
+    ok = _mm_or_si128(ok, _mm_cmpeq_epi8(x, _mm_set1_epi8('!')));
+    ok = _mm_or_si128(ok, _mm_cmpeq_epi8(x, _mm_set1_epi8('|')));
+    ok = _mm_or_si128(ok, _mm_cmpeq_epi8(x, _mm_set1_epi8('~')));
+    if (_mm_movemask_epi8(ok) != 0xffff) {
+      break;
+    }
+  }
+
+  return i;
+}
+
+__attribute__((target("avx2"))) static size_t
+check_header_name_avx2(const uint8_t *name, size_t len) {
+  size_t i;
+  __m256i x, ok;
+
+  for (i = 0; i + 32 <= len; i += 32) {
+    x = _mm256_loadu_si256((const __m256i *)(const void *)(name + i));
+    ok = _mm256_or_si256(AVX2_IN_RANGE(x, '^', 'z'),
+                         AVX2_IN_RANGE(x, '0', '9'));
+    ok = _mm256_or_si256(ok, AVX2_IN_RANGE(x, '#', '\''));
+    ok = _mm256_or_si256(ok, AVX2_IN_RANGE(x, '*', '+'));
+    ok = _mm256_or_si256(ok, AVX2_IN_RANGE(x, '-', '.'));
+    ok = _mm256_or_si256(ok, _mm256_cmpeq_epi8(x, _mm256_set1_epi8('!')));
+    ok = _mm256_or_si256(ok, _mm256_cmpeq_epi8(x, _mm256_set1_epi8('|')));
+    ok = _mm256_or_si256(ok, _mm256_cmpeq_epi8(x, _mm256_set1_epi8('~')));
+    if ((uint32_t)_mm256_movemask_epi8(ok) != 0xffffffffu) {
+      break;
+    }
+  }
+
+  return i;
+}
+
+/* Invalid header field value characters are 0x00-0x08, 0x0a-0x1f
+   and 0x7f. */
+__attribute__((target("sse2"))) static size_t
+check_header_value_sse2(const uint8_t *value, size_t len) {
+  size_t i;
+  __m128i x, bad;
+
+  for (i = 0; i + 16 <= len; i += 16) {
+    x = _mm_loadu_si128((const __m128i *)(const void *)(value + i));
+    bad = _mm_andnot_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8('\t')),
+                           SSE2_IN_RANGE(x, 0x00, 0x1f));
+    bad = _mm_or_si128(bad, _mm_cmpeq_epi8(x, _mm_set1_epi8(0x7f)));
+    if (_mm_movemask_epi8(bad)) {
+      break;
+    }
+  }
+
+  return i;
+}
+
+__attribute__((target("avx2"))) static size_t
+check_header_value_avx2(const uint8_t *value, size_t len) {
+  size_t i;
+  __m256i x, bad;
+
+  for (i = 0; i + 32 <= len; i += 32) {
+    x = _mm256_loadu_si256((const __m256i *)(const void *)(value + i));
+    bad = _mm256_andnot_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8('\t')),
+                              AVX2_IN_RANGE(x, 0x00, 0x1f));
+    bad = _mm256_or_si256(bad, _mm256_cmpeq_epi8(x, _mm256_set1_epi8(0x7f)));
+    if (_mm256_movemask_epi8(bad)) {
+      break;
+    }
+  }
+
+  return i;
+}
+
+__attribute__((target("sse2"))) static size_t downcase_sse2(uint8_t *s,
+                                                             size_t len) {
+  size_t i;
+  __m128i x, upper;
+
+  for (i = 0; i + 16 <= len; i += 16) {
+    x = _mm_loadu_si128((const __m128i *)(void *)(s + i));
+    upper = SSE2_IN_RANGE(x, 'A', 'Z');
+    x = _mm_add_epi8(x, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+    _mm_storeu_si128((__m128i *)(void *)(s + i), x);
+  }
+
+  return i;
+}
+
+__attribute__((target("avx2"))) static size_t downcase_avx2(uint8_t *s,
+                                                             size_t len) {
+  size_t i;
+  __m256i x, upper;
+
+  for (i = 0; i + 32 <= len; i += 32) {
+    x = _mm256_loadu_si256((const __m256i *)(void *)(s + i));
+    upper = AVX2_IN_RANGE(x, 'A', 'Z');
+    x = _mm256_add_epi8(x, _mm256_and_si256(upper, _mm256_set1_epi8(0x20)));
+    _mm256_storeu_si256((__m256i *)(void *)(s + i), x);
+  }
+
+  return i;
+}
+#endif /* HAVE_X86_SIMD */
+
 void nghttp2_put_uint16be(uint8_t *buf, uint16_t n) {
   uint16_t x = htons(n);
   memcpy(buf, &x, sizeof(uint16_t));
@@ -135,8 +293,20 @@ static const int DOWNCASE_TBL[] = {
 };
 
 void nghttp2_downcase(uint8_t *s, size_t len) {
-  size_t i;
-  for (i = 0; i < len; ++i) {
+  size_t i = 0;
+#ifdef HAVE_X86_SIMD
+  if (len >= 16) {
+    switch (simd_level()) {
+    case NGHTTP2_SIMD_AVX2:
+      i = downcase_avx2(s, len);
+      break;
+    case NGHTTP2_SIMD_SSE2:
+      i = downcase_sse2(s, len);
+      break;
+    }
+  }
+#endif /* HAVE_X86_SIMD */
+  for (; i < len; ++i) {
     s[i] = DOWNCASE_TBL[s[i]];
   }
 }
@@ -376,6 +546,21 @@ int nghttp2_check_header_name(const uint8_t *name, size_t len) {
     ++name;
     --len;
   }
+#ifdef HAVE_X86_SIMD
+  if (len >= 16) {
+    size_t n = 0;
+    switch (simd_level()) {
+    case NGHTTP2_SIMD_AVX2:
+      n = check_header_name_avx2(name, len);
+      break;
+    case NGHTTP2_SIMD_SSE2:
+      n = check_header_name_sse2(name, len);
+      break;
+    }
+    name += n;
+    len -= n;
+  }
+#endif /* HAVE_X86_SIMD */
   for (last = name + len; name != last; ++name) {
     if (!VALID_HD_NAME_CHARS[*name]) {
       return 0;
@@ -442,6 +627,21 @@ static int VALID_HD_VALUE_CHARS[] = {
 
 int nghttp2_check_header_value(const uint8_t *value, size_t len) {
   const uint8_t *last;
+#ifdef HAVE_X86_SIMD
+  if (len >= 16) {
+    size_t n = 0;
+    switch (simd_level()) {
+    case NGHTTP2_SIMD_AVX2:
+      n = check_header_value_avx2(value, len);
+      break;
+    case NGHTTP2_SIMD_SSE2:
+      n = check_header_value_sse2(value, len);
+      break;
+    }
+    value += n;
+    len -= n;
+  }
+#endif /* HAVE_X86_SIMD */
   for (last = value + len; value != last; ++value) {
     if (!VALID_HD_VALUE_CHARS[*value]) {
       return 0;
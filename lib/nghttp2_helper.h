@@ -29,12 +29,18 @@
 #include <config.h>
 #endif /* HAVE_CONFIG_H */
 
+#include <stddef.h>
+
 #include <nghttp2/nghttp2.h>
 #include "nghttp2_mem.h"
 
 #define nghttp2_min(A, B) ((A) < (B) ? (A) : (B))
 #define nghttp2_max(A, B) ((A) > (B) ? (A) : (B))
 
+/* Returns the pointer to the struct of type |T| which contains the
+   member |M| pointed by |P| */
+#define nghttp2_struct_of(P, T, M) ((T *)(void *)((char *)(P)-offsetof(T, M)))
+
 /*
  * Copies 2 byte unsigned integer |n| in host byte order to |buf| in
  * network byte order.
@@ -71,6 +77,29 @@ uint32_t nghttp2_get_uint32(const uint8_t *data);
  */
 void *nghttp2_memdup(const void *src, size_t n, nghttp2_mem *mem);
 
+/*
+ * Instruction sets which nghttp2_check_header_name(),
+ * nghttp2_check_header_value() and nghttp2_downcase() may use.  They
+ * are selected at run time, depending on what the CPU supports.
+ */
+typedef enum {
+  NGHTTP2_SIMD_NONE,
+  NGHTTP2_SIMD_SSE2,
+  NGHTTP2_SIMD_AVX2
+} nghttp2_simd_level;
+
+/*
+ * The highest nghttp2_simd_level which the library uses.  This is
+ * NGHTTP2_SIMD_AVX2 by default.  Tests and benchmarks lower it to
+ * exercise the other code paths.  The library uses SIMD only if it is
+ * built with HAVE_X86_SIMD.
+ */
+extern int nghttp2_simd_max_level;
+
+/*
+ * Converts upper case ASCII letters in |s| of length |len| to lower
+ * case in place.
+ */
 void nghttp2_downcase(uint8_t *s, size_t len);
 
 /*
@@ -26,13 +26,13 @@
 
 #include <string.h>
 
-#define INITIAL_TABLE_LENGTH 256
+#define INITIAL_TABLE_LENGTH 128
 
 int nghttp2_map_init(nghttp2_map *map, nghttp2_mem *mem) {
   map->mem = mem;
   map->tablelen = INITIAL_TABLE_LENGTH;
   map->table =
-      nghttp2_mem_calloc(mem, map->tablelen, sizeof(nghttp2_map_entry *));
+      nghttp2_mem_calloc(mem, map->tablelen, sizeof(nghttp2_map_bucket));
   if (map->table == NULL) {
     return NGHTTP2_ERR_NOMEM;
   }
@@ -49,15 +49,19 @@ void nghttp2_map_free(nghttp2_map *map) {
 void nghttp2_map_each_free(nghttp2_map *map,
                            int (*func)(nghttp2_map_entry *entry, void *ptr),
                            void *ptr) {
-  size_t i;
+  uint32_t i;
+  nghttp2_map_bucket *bkt;
+
   for (i = 0; i < map->tablelen; ++i) {
-    nghttp2_map_entry *entry;
-    for (entry = map->table[i]; entry;) {
-      nghttp2_map_entry *next = entry->next;
-      func(entry, ptr);
-      entry = next;
+    bkt = &map->table[i];
+
+    if (bkt->data == NULL) {
+      continue;
     }
-    map->table[i] = NULL;
+
+    func(bkt->data, ptr);
+    bkt->psl = 0;
+    bkt->data = NULL;
   }
 }
 
@@ -65,14 +69,19 @@ int nghttp2_map_each(nghttp2_map *map,
                      int (*func)(nghttp2_map_entry *entry, void *ptr),
                      void *ptr) {
   int rv;
-  size_t i;
+  uint32_t i;
+  nghttp2_map_bucket *bkt;
+
   for (i = 0; i < map->tablelen; ++i) {
-    nghttp2_map_entry *entry;
-    for (entry = map->table[i]; entry; entry = entry->next) {
-      rv = func(entry, ptr);
-      if (rv != 0) {
-        return rv;
-      }
+    bkt = &map->table[i];
+
+    if (bkt->data == NULL) {
+      continue;
+    }
+
+    rv = func(bkt->data, ptr);
+    if (rv != 0) {
+      return rv;
     }
   }
   return 0;
@@ -80,57 +89,80 @@ int nghttp2_map_each(nghttp2_map *map,
 
 void nghttp2_map_entry_init(nghttp2_map_entry *entry, key_type key) {
   entry->key = key;
-  entry->next = NULL;
 }
 
-/* Same hash function in android HashMap source code. */
+/* Same hash function in android HashMap source code.  Stream IDs are
+   mostly sequential, and this function maps them to distinct buckets,
+   which keeps probe sequence short. */
 /* The |mod| must be power of 2 */
-static int32_t hash(int32_t h, size_t mod) {
+static uint32_t hash(key_type key, uint32_t mod) {
+  uint32_t h = key;
   h ^= (h >> 20) ^ (h >> 12);
   h ^= (h >> 7) ^ (h >> 4);
   return h & (mod - 1);
 }
 
-static int insert(nghttp2_map_entry **table, size_t tablelen,
+static void bucket_swap(nghttp2_map_bucket *a, nghttp2_map_bucket *b) {
+  nghttp2_map_bucket c = *a;
+
+  *a = *b;
+  *b = c;
+}
+
+static int insert(nghttp2_map_bucket *table, uint32_t tablelen, key_type key,
                   nghttp2_map_entry *entry) {
-  int32_t h = hash(entry->key, tablelen);
-  if (table[h] == NULL) {
-    table[h] = entry;
-  } else {
-    nghttp2_map_entry *p;
-    /* We won't allow duplicated key, so check it out. */
-    for (p = table[h]; p; p = p->next) {
-      if (p->key == entry->key) {
-        return NGHTTP2_ERR_INVALID_ARGUMENT;
-      }
+  uint32_t idx = hash(key, tablelen);
+  nghttp2_map_bucket b = {1, key, entry}, *bkt;
+
+  for (;;) {
+    bkt = &table[idx];
+
+    if (bkt->psl == 0) {
+      *bkt = b;
+      return 0;
+    }
+
+    /* Until |b| is swapped, it holds the new entry.  If the same key
+       exists, it is found before we reach the bucket which is closer
+       to its home than |b|.  After swap, |b| holds the existing entry
+       which has unique key. */
+    if (b.key == bkt->key) {
+      return NGHTTP2_ERR_INVALID_ARGUMENT;
     }
-    entry->next = table[h];
-    table[h] = entry;
+
+    if (bkt->psl < b.psl) {
+      bucket_swap(bkt, &b);
+    }
+
+    ++b.psl;
+    idx = (idx + 1) & (tablelen - 1);
   }
-  return 0;
 }
 
 /* new_tablelen must be power of 2 */
-static int resize(nghttp2_map *map, size_t new_tablelen) {
-  size_t i;
-  nghttp2_map_entry **new_table;
+static int resize(nghttp2_map *map, uint32_t new_tablelen) {
+  uint32_t i;
+  nghttp2_map_bucket *new_table;
+  nghttp2_map_bucket *bkt;
 
   new_table =
-      nghttp2_mem_calloc(map->mem, new_tablelen, sizeof(nghttp2_map_entry *));
+      nghttp2_mem_calloc(map->mem, new_tablelen, sizeof(nghttp2_map_bucket));
   if (new_table == NULL) {
     return NGHTTP2_ERR_NOMEM;
   }
 
   for (i = 0; i < map->tablelen; ++i) {
-    nghttp2_map_entry *entry;
-    for (entry = map->table[i]; entry;) {
-      nghttp2_map_entry *next = entry->next;
-      entry->next = NULL;
-      /* This function must succeed */
-      insert(new_table, new_tablelen, entry);
-      entry = next;
+    bkt = &map->table[i];
+
+    if (bkt->data == NULL) {
+      continue;
     }
+
+    /* This function must succeed.  Use the key in the bucket, so
+       that we do not touch the entry itself. */
+    insert(new_table, new_tablelen, bkt->key, bkt->data);
   }
+
   nghttp2_mem_free(map->mem, map->table);
   map->tablelen = new_tablelen;
   map->table = new_table;
@@ -141,13 +173,13 @@ static int resize(nghttp2_map *map, size_t new_tablelen) {
 int nghttp2_map_insert(nghttp2_map *map, nghttp2_map_entry *new_entry) {
   int rv;
   /* Load factor is 0.75 */
-  if ((map->size + 1) * 4 > map->tablelen * 3) {
+  if ((map->size + 1) * 4 > (size_t)map->tablelen * 3) {
     rv = resize(map, map->tablelen * 2);
     if (rv != 0) {
       return rv;
     }
   }
-  rv = insert(map->table, map->tablelen, new_entry);
+  rv = insert(map->table, map->tablelen, new_entry->key, new_entry);
   if (rv != 0) {
     return rv;
   }
@@ -155,36 +187,99 @@ int nghttp2_map_insert(nghttp2_map *map, nghttp2_map_entry *new_entry) {
   return 0;
 }
 
+/* Returns the bucket which has |key|, or NULL if there is no such
+   bucket. */
+static nghttp2_map_bucket *find_bucket(nghttp2_map *map, key_type key) {
+  uint32_t idx = hash(key, map->tablelen);
+  uint32_t psl = 1;
+  nghttp2_map_bucket *bkt;
+
+  for (;;) {
+    bkt = &map->table[idx];
+
+    /* Robin Hood invariant: if |key| were stored, it would be found
+       before the bucket closer to its home than our probe.  An empty
+       bucket has psl 0, so it also stops here. */
+    if (bkt->psl < psl) {
+      return NULL;
+    }
+
+    if (bkt->key == key) {
+      return bkt;
+    }
+
+    ++psl;
+    idx = (idx + 1) & (map->tablelen - 1);
+  }
+}
+
 nghttp2_map_entry *nghttp2_map_find(nghttp2_map *map, key_type key) {
-  int32_t h;
-  nghttp2_map_entry *entry;
-  h = hash(key, map->tablelen);
-  for (entry = map->table[h]; entry; entry = entry->next) {
-    if (entry->key == key) {
-      return entry;
+  uint32_t idx = hash(key, map->tablelen);
+  uint32_t psl = 1;
+  nghttp2_map_bucket *bkt;
+
+  /* This is the same as find_bucket(), but spelled out here because
+     this is the hot path of stream lookup, and compilers tend not to
+     inline find_bucket(). */
+  for (;;) {
+    bkt = &map->table[idx];
+
+    if (bkt->psl < psl) {
+      return NULL;
+    }
+
+    if (bkt->key == key) {
+      return bkt->data;
     }
+
+    ++psl;
+    idx = (idx + 1) & (map->tablelen - 1);
   }
-  return NULL;
 }
 
 int nghttp2_map_remove(nghttp2_map *map, key_type key) {
-  int32_t h;
-  nghttp2_map_entry *entry, *prev;
-  h = hash(key, map->tablelen);
-  prev = NULL;
-  for (entry = map->table[h]; entry; entry = entry->next) {
-    if (entry->key == key) {
-      if (prev == NULL) {
-        map->table[h] = entry->next;
-      } else {
-        prev->next = entry->next;
-      }
-      --map->size;
-      return 0;
+  uint32_t idx, next;
+  nghttp2_map_bucket *bkt;
+
+  bkt = find_bucket(map, key);
+  if (bkt == NULL) {
+    return NGHTTP2_ERR_INVALID_ARGUMENT;
+  }
+
+  idx = (uint32_t)(bkt - map->table);
+
+  /* Backward shift deletion: move the following entries one bucket
+     back until we hit empty bucket or the entry in its home
+     bucket. */
+  for (;;) {
+    next = (idx + 1) & (map->tablelen - 1);
+    bkt = &map->table[next];
+
+    if (bkt->psl <= 1) {
+      map->table[idx].psl = 0;
+      map->table[idx].data = NULL;
+      break;
     }
-    prev = entry;
+
+    map->table[idx] = *bkt;
+    --map->table[idx].psl;
+
+    idx = next;
+  }
+
+  --map->size;
+
+  /* Shrink the table if its occupancy is less than 1/8.  After
+     shrinking, the load factor is still less than 0.25, so that
+     alternating insert and remove does not cause resize repeatedly.
+     Failure to shrink is not an error; we just keep the current
+     table. */
+  if (map->tablelen > INITIAL_TABLE_LENGTH &&
+      map->size * 8 < map->tablelen) {
+    resize(map, map->tablelen / 2);
   }
-  return NGHTTP2_ERR_INVALID_ARGUMENT;
+
+  return 0;
 }
 
 size_t nghttp2_map_size(nghttp2_map *map) { return map->size; }
@@ -33,12 +33,14 @@
 #include "nghttp2_int.h"
 #include "nghttp2_mem.h"
 
-/* Implementation of unordered map */
+/* Implementation of unordered map.  This is an open addressing hash
+   table using Robin Hood hashing with backward shift deletion.  The
+   key is stored inline in the bucket, so that lookup does not have
+   to dereference each entry in the probe sequence. */
 
 typedef uint32_t key_type;
 
 typedef struct nghttp2_map_entry {
-  struct nghttp2_map_entry *next;
   key_type key;
 #if SIZEOF_INT_P == 4
   /* we requires 8 bytes aligment */
@@ -47,10 +49,21 @@ typedef struct nghttp2_map_entry {
 } nghttp2_map_entry;
 
 typedef struct {
-  nghttp2_map_entry **table;
+  /* 1 + the distance from the bucket where |key| is hashed to.
+     This is 1 if the entry is placed in its home bucket, and 0 if
+     this bucket is empty. */
+  uint32_t psl;
+  key_type key;
+  /* The stored entry, or NULL if this bucket is empty. */
+  nghttp2_map_entry *data;
+} nghttp2_map_bucket;
+
+typedef struct {
+  nghttp2_map_bucket *table;
   nghttp2_mem *mem;
-  size_t tablelen;
   size_t size;
+  /* The number of buckets in |table|.  This is always power of 2. */
+  uint32_t tablelen;
 } nghttp2_map;
 
 /*
@@ -108,7 +121,8 @@ nghttp2_map_entry *nghttp2_map_find(nghttp2_map *map, key_type key);
 
 /*
  * Removes the entry associated by the key |key| from the |map|.  The
- * removed entry is not freed by this function.
+ * removed entry is not freed by this function.  If the occupancy of
+ * the table becomes low, the table is shrunk.
  *
  * This function returns 0 if it succeeds, or one of the following
  * negative error codes:
@@ -134,6 +148,8 @@ size_t nghttp2_map_size(nghttp2_map *map);
  * invocations of the |func| return 0, or nonzero value which the last
  * invocation of |func| returns.
  *
+ * The |func| must not insert or remove entries.
+ *
  * Don't use this function to free each entry. Use
  * nghttp2_map_each_free() instead.
  */
@@ -56,3 +56,19 @@ void nghttp2_option_set_no_http_messaging(nghttp2_option *option, int val) {
   option->opt_set_mask |= NGHTTP2_OPT_NO_HTTP_MESSAGING;
   option->no_http_messaging = val;
 }
+
+void nghttp2_option_set_free_list_size(nghttp2_option *option, size_t val) {
+  option->opt_set_mask |= NGHTTP2_OPT_FREE_LIST_SIZE;
+  option->free_list_size = val;
+}
+
+void nghttp2_option_set_stats(nghttp2_option *option, int val) {
+  option->opt_set_mask |= NGHTTP2_OPT_STATS;
+  option->stats = val;
+}
+
+void nghttp2_option_set_window_auto_tuning(nghttp2_option *option,
+                                           size_t val) {
+  option->opt_set_mask |= NGHTTP2_OPT_WINDOW_AUTO_TUNING;
+  option->window_auto_tuning = val;
+}
@@ -59,6 +59,9 @@ typedef enum {
   NGHTTP2_OPT_PEER_MAX_CONCURRENT_STREAMS = 1 << 1,
   NGHTTP2_OPT_RECV_CLIENT_PREFACE = 1 << 2,
   NGHTTP2_OPT_NO_HTTP_MESSAGING = 1 << 3,
+  NGHTTP2_OPT_FREE_LIST_SIZE = 1 << 4,
+  NGHTTP2_OPT_STATS = 1 << 5,
+  NGHTTP2_OPT_WINDOW_AUTO_TUNING = 1 << 6,
 } nghttp2_option_flag;
 
 /**
@@ -74,6 +77,14 @@ struct nghttp2_option {
    * NGHTTP2_OPT_PEER_MAX_CONCURRENT_STREAMS
    */
   uint32_t peer_max_concurrent_streams;
+  /**
+   * NGHTTP2_OPT_FREE_LIST_SIZE
+   */
+  size_t free_list_size;
+  /**
+   * NGHTTP2_OPT_WINDOW_AUTO_TUNING
+   */
+  size_t window_auto_tuning;
   /**
    * NGHTTP2_OPT_NO_AUTO_WINDOW_UPDATE
    */
@@ -86,6 +97,10 @@ struct nghttp2_option {
    * NGHTTP2_OPT_NO_HTTP_MESSAGING
    */
   uint8_t no_http_messaging;
+  /**
+   * NGHTTP2_OPT_STATS
+   */
+  uint8_t stats;
 };
 
 #endif /* NGHTTP2_OPTION_H */
@@ -32,6 +32,7 @@
 #include <nghttp2/nghttp2.h>
 #include "nghttp2_frame.h"
 #include "nghttp2_mem.h"
+#include "nghttp2_pq.h"
 
 /* A bit higher weight for non-DATA frames */
 #define NGHTTP2_OB_EX_WEIGHT 300
@@ -74,6 +75,10 @@ typedef struct {
    * |eof| is 0. It becomes 1 after all data were read.
    */
   uint8_t eof;
+  /**
+   * The flag to indicate that NGHTTP2_DATA_FLAG_NO_COPY is used.
+   */
+  uint8_t no_copy;
 } nghttp2_data_aux_data;
 
 typedef enum {
@@ -102,11 +107,11 @@ typedef union {
 
 typedef struct {
   nghttp2_frame frame;
+  /* Entry in the outbound queues of nghttp2_session.  DATA is never
+     queued there; it is scheduled by the dependency tree instead. */
+  nghttp2_pq_entry pq_entry;
   nghttp2_aux_data aux_data;
   int64_t seq;
-  /* Reset count of weight. See comment for last_cycle in
-     nghttp2_session.h */
-  uint64_t cycle;
   /* The priority used in priority comparion.  Larger is served
      ealier. */
   int32_t weight;
@@ -35,9 +35,17 @@
 
 /* Implementation of priority queue */
 
+/* An entry of priority queue.  This is embedded in the item stored
+   in the queue, and the item is retrieved from it using
+   nghttp2_struct_of(). */
+typedef struct {
+  /* The position of this entry in the queue */
+  size_t index;
+} nghttp2_pq_entry;
+
 typedef struct {
   /* The pointer to the pointer to the item stored */
-  void **q;
+  nghttp2_pq_entry **q;
   /* Memory allocator */
   nghttp2_mem *mem;
   /* The number of items sotred */
@@ -45,20 +53,16 @@ typedef struct {
   /* The maximum number of items this pq can store. This is
      automatically extended when length is reached to this value. */
   size_t capacity;
-  /* The compare function between items */
+  /* The compare function between items.  It is called with pointers
+     to nghttp2_pq_entry. */
   nghttp2_compar compar;
 } nghttp2_pq;
 
 /*
- * Initializes priority queue |pq| with compare function |cmp|.
- *
- * This function returns 0 if it succeeds, or one of the following
- * negative error codes:
- *
- * NGHTTP2_ERR_NOMEM
- *     Out of memory.
+ * Initializes priority queue |pq| with compare function |cmp|.  No
+ * memory is allocated until the first item is pushed.
  */
-int nghttp2_pq_init(nghttp2_pq *pq, nghttp2_compar cmp, nghttp2_mem *mem);
+void nghttp2_pq_init(nghttp2_pq *pq, nghttp2_compar cmp, nghttp2_mem *mem);
 
 /*
  * Deallocates any resources allocated for |pq|.  The stored items are
@@ -75,13 +79,13 @@ void nghttp2_pq_free(nghttp2_pq *pq);
  * NGHTTP2_ERR_NOMEM
  *     Out of memory.
  */
-int nghttp2_pq_push(nghttp2_pq *pq, void *item);
+int nghttp2_pq_push(nghttp2_pq *pq, nghttp2_pq_entry *item);
 
 /*
  * Returns item at the top of the queue |pq|. If the queue is empty,
  * this function returns NULL.
  */
-void *nghttp2_pq_top(nghttp2_pq *pq);
+nghttp2_pq_entry *nghttp2_pq_top(nghttp2_pq *pq);
 
 /*
  * Pops item at the top of the queue |pq|. The popped item is not
@@ -89,6 +93,12 @@ void *nghttp2_pq_top(nghttp2_pq *pq);
  */
 void nghttp2_pq_pop(nghttp2_pq *pq);
 
+/*
+ * Removes |item| from the queue |pq|.  |item| must be stored in
+ * |pq|.  The removed item is not freed by this function.
+ */
+void nghttp2_pq_remove(nghttp2_pq *pq, nghttp2_pq_entry *item);
+
 /*
  * Returns nonzero if the queue |pq| is empty.
  */
@@ -99,7 +109,7 @@ int nghttp2_pq_empty(nghttp2_pq *pq);
  */
 size_t nghttp2_pq_size(nghttp2_pq *pq);
 
-typedef int (*nghttp2_pq_item_cb)(void *item, void *arg);
+typedef int (*nghttp2_pq_item_cb)(nghttp2_pq_entry *item, void *arg);
 
 /*
  * Updates each item in |pq| using function |fun| and re-construct
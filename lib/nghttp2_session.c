@@ -34,6 +34,7 @@
 #include "nghttp2_priority_spec.h"
 #include "nghttp2_option.h"
 #include "nghttp2_http.h"
+#include "nghttp2_time.h"
 
 /*
  * Returns non-zero if the number of outgoing opened streams is larger
@@ -81,6 +82,84 @@ static int session_enforce_http_messaging(nghttp2_session *session) {
   return (session->opt_flags & NGHTTP2_OPTMASK_NO_HTTP_MESSAGING) == 0;
 }
 
+static int session_stats_enabled(nghttp2_session *session) {
+  return (session->opt_flags & NGHTTP2_OPTMASK_STATS) != 0;
+}
+
+/*
+ * Counts the frame of type |type| received.
+ */
+static void session_stats_frame_received(nghttp2_session *session,
+                                         uint8_t type) {
+  if (!session_stats_enabled(session)) {
+    return;
+  }
+
+  if (type < NGHTTP2_STATS_NUM_FRAME_TYPES) {
+    ++session->stats.frames_received[type];
+  } else {
+    ++session->stats.unknown_frames_received;
+  }
+}
+
+/*
+ * Counts the header fields |nva| of length |nvlen| which are encoded
+ * into the header block of length |blocklen|.
+ */
+static void session_stats_deflated(nghttp2_session *session,
+                                   const nghttp2_nv *nva, size_t nvlen,
+                                   size_t blocklen) {
+  size_t i;
+
+  if (!session_stats_enabled(session)) {
+    return;
+  }
+
+  for (i = 0; i < nvlen; ++i) {
+    session->stats.hd_deflate_inlen += nva[i].namelen + nva[i].valuelen;
+  }
+  session->stats.hd_deflate_outlen += blocklen;
+}
+
+/*
+ * Records that DATA of |stream| is deferred by stream level flow
+ * control.
+ */
+static void session_stats_stream_deferred(nghttp2_session *session,
+                                          nghttp2_stream *stream) {
+  if (!session_stats_enabled(session)) {
+    return;
+  }
+
+  ++session->stats.stream_flow_control_stalls;
+  stream->deferred_msec = nghttp2_time_now_msec();
+}
+
+/*
+ * Records that DATA of |stream| is no longer deferred by stream level
+ * flow control.  This must be called before the deferred flag is
+ * cleared.
+ */
+static void session_stats_stream_resumed(nghttp2_session *session,
+                                         nghttp2_stream *stream) {
+  if (!session_stats_enabled(session) ||
+      !nghttp2_stream_check_deferred_by_flow_control(stream)) {
+    return;
+  }
+
+  session->stats.stream_blocked_msec +=
+      nghttp2_time_now_msec() - stream->deferred_msec;
+}
+
+/*
+ * Returns the window growth of |stream| to the budget.
+ */
+static void session_window_tuning_release(nghttp2_session *session,
+                                          nghttp2_stream *stream) {
+  session->window_tuning.used -= (size_t)stream->window_growth;
+  stream->window_growth = 0;
+}
+
 /*
  * Returns nonzero if |frame| is trailer headers.
  */
@@ -224,19 +303,15 @@ nghttp2_stream *nghttp2_session_get_stream_raw(nghttp2_session *session,
 static int outbound_item_compar(const void *lhsx, const void *rhsx) {
   const nghttp2_outbound_item *lhs, *rhs;
 
-  lhs = (const nghttp2_outbound_item *)lhsx;
-  rhs = (const nghttp2_outbound_item *)rhsx;
-
-  if (lhs->cycle == rhs->cycle) {
-    if (lhs->weight == rhs->weight) {
-      return (lhs->seq < rhs->seq) ? -1 : ((lhs->seq > rhs->seq) ? 1 : 0);
-    }
+  lhs = nghttp2_struct_of(lhsx, nghttp2_outbound_item, pq_entry);
+  rhs = nghttp2_struct_of(rhsx, nghttp2_outbound_item, pq_entry);
 
-    /* Larger weight has higher precedence */
-    return rhs->weight - lhs->weight;
+  if (lhs->weight == rhs->weight) {
+    return (lhs->seq < rhs->seq) ? -1 : ((lhs->seq > rhs->seq) ? 1 : 0);
   }
 
-  return (lhs->cycle < rhs->cycle) ? -1 : 1;
+  /* Larger weight has higher precedence */
+  return rhs->weight - lhs->weight;
 }
 
 static void session_inbound_frame_reset(nghttp2_session *session) {
@@ -301,12 +376,13 @@ static void init_settings(nghttp2_settings_storage *settings) {
   settings->max_header_list_size = UINT32_MAX;
 }
 
-static void active_outbound_item_reset(nghttp2_active_outbound_item *aob,
-                                       nghttp2_mem *mem) {
+static void active_outbound_item_reset(nghttp2_session *session) {
+  nghttp2_active_outbound_item *aob = &session->aob;
+
   DEBUGF(fprintf(stderr, "send: reset nghttp2_active_outbound_item\n"));
   DEBUGF(fprintf(stderr, "send: aob->item = %p\n", aob->item));
-  nghttp2_outbound_item_free(aob->item, mem);
-  nghttp2_mem_free(mem, aob->item);
+  nghttp2_outbound_item_free(aob->item, &session->mem);
+  nghttp2_session_release_outbound_item(session, aob->item);
   aob->item = NULL;
   nghttp2_bufs_reset(&aob->framebufs);
   aob->state = NGHTTP2_OB_POP_ITEM;
@@ -335,21 +411,16 @@ static int session_new(nghttp2_session **session_ptr,
   (*session_ptr)->mem = *mem;
   mem = &(*session_ptr)->mem;
 
+  nghttp2_freelist_init(&(*session_ptr)->item_freelist,
+                        sizeof(nghttp2_outbound_item), 0, mem);
+  nghttp2_freelist_init(&(*session_ptr)->stream_freelist,
+                        sizeof(nghttp2_stream), 0, mem);
+
   /* next_stream_id is initialized in either
      nghttp2_session_client_new2 or nghttp2_session_server_new2 */
 
-  rv = nghttp2_pq_init(&(*session_ptr)->ob_pq, outbound_item_compar, mem);
-  if (rv != 0) {
-    goto fail_ob_pq;
-  }
-  rv = nghttp2_pq_init(&(*session_ptr)->ob_ss_pq, outbound_item_compar, mem);
-  if (rv != 0) {
-    goto fail_ob_ss_pq;
-  }
-  rv = nghttp2_pq_init(&(*session_ptr)->ob_da_pq, outbound_item_compar, mem);
-  if (rv != 0) {
-    goto fail_ob_da_pq;
-  }
+  nghttp2_pq_init(&(*session_ptr)->ob_pq, outbound_item_compar, mem);
+  nghttp2_pq_init(&(*session_ptr)->ob_ss_pq, outbound_item_compar, mem);
 
   rv = nghttp2_hd_deflate_init(&(*session_ptr)->hd_deflater, mem);
   if (rv != 0) {
@@ -364,10 +435,9 @@ static int session_new(nghttp2_session **session_ptr,
     goto fail_map;
   }
 
-  nghttp2_stream_roots_init(&(*session_ptr)->roots);
+  nghttp2_stream_roots_init(&(*session_ptr)->roots, mem);
 
   (*session_ptr)->next_seq = 0;
-  (*session_ptr)->last_cycle = 1;
 
   (*session_ptr)->remote_window_size = NGHTTP2_INITIAL_CONNECTION_WINDOW_SIZE;
   (*session_ptr)->recv_window_size = 0;
@@ -397,7 +467,7 @@ static int session_new(nghttp2_session **session_ptr,
     goto fail_aob_framebuf;
   }
 
-  active_outbound_item_reset(&(*session_ptr)->aob, mem);
+  active_outbound_item_reset(*session_ptr);
 
   init_settings(&(*session_ptr)->remote_settings);
   init_settings(&(*session_ptr)->local_settings);
@@ -426,6 +496,21 @@ static int session_new(nghttp2_session **session_ptr,
 
       (*session_ptr)->opt_flags |= NGHTTP2_OPTMASK_NO_HTTP_MESSAGING;
     }
+
+    if (option->opt_set_mask & NGHTTP2_OPT_FREE_LIST_SIZE) {
+
+      (*session_ptr)->item_freelist.max = option->free_list_size;
+      (*session_ptr)->stream_freelist.max = option->free_list_size;
+    }
+
+    if ((option->opt_set_mask & NGHTTP2_OPT_STATS) && option->stats) {
+      (*session_ptr)->opt_flags |= NGHTTP2_OPTMASK_STATS;
+    }
+
+    if (option->opt_set_mask & NGHTTP2_OPT_WINDOW_AUTO_TUNING) {
+      (*session_ptr)->window_tuning.budget = nghttp2_min(
+          option->window_auto_tuning, (size_t)NGHTTP2_MAX_WINDOW_SIZE);
+    }
   }
 
   (*session_ptr)->callbacks = *callbacks;
@@ -455,12 +540,8 @@ fail_map:
 fail_hd_inflater:
   nghttp2_hd_deflate_free(&(*session_ptr)->hd_deflater);
 fail_hd_deflater:
-  nghttp2_pq_free(&(*session_ptr)->ob_da_pq);
-fail_ob_da_pq:
   nghttp2_pq_free(&(*session_ptr)->ob_ss_pq);
-fail_ob_ss_pq:
   nghttp2_pq_free(&(*session_ptr)->ob_pq);
-fail_ob_pq:
   nghttp2_mem_free(mem, *session_ptr);
 fail_session:
   return rv;
@@ -547,21 +628,22 @@ static int free_streams(nghttp2_map_entry *entry, void *ptr) {
 
   if (item && !item->queued && item != session->aob.item) {
     nghttp2_outbound_item_free(item, mem);
-    nghttp2_mem_free(mem, item);
+    nghttp2_session_release_outbound_item(session, item);
   }
 
   nghttp2_stream_free(stream);
-  nghttp2_mem_free(mem, stream);
+  nghttp2_freelist_put(&session->stream_freelist, stream);
 
   return 0;
 }
 
 static void ob_pq_free(nghttp2_pq *pq, nghttp2_mem *mem) {
   while (!nghttp2_pq_empty(pq)) {
-    nghttp2_outbound_item *item = (nghttp2_outbound_item *)nghttp2_pq_top(pq);
+    nghttp2_outbound_item *item =
+        nghttp2_struct_of(nghttp2_pq_top(pq), nghttp2_outbound_item, pq_entry);
+    nghttp2_pq_pop(pq);
     nghttp2_outbound_item_free(item, mem);
     nghttp2_mem_free(mem, item);
-    nghttp2_pq_pop(pq);
   }
   nghttp2_pq_free(pq);
 }
@@ -586,12 +668,13 @@ void nghttp2_session_del(nghttp2_session *session) {
 
   ob_pq_free(&session->ob_pq, mem);
   ob_pq_free(&session->ob_ss_pq, mem);
-  ob_pq_free(&session->ob_da_pq, mem);
-  active_outbound_item_reset(&session->aob, mem);
+  active_outbound_item_reset(session);
   session_inbound_frame_reset(session);
   nghttp2_hd_deflate_free(&session->hd_deflater);
   nghttp2_hd_inflate_free(&session->hd_inflater);
   nghttp2_bufs_free(&session->aob.framebufs);
+  nghttp2_freelist_free(&session->stream_freelist);
+  nghttp2_freelist_free(&session->item_freelist);
   nghttp2_mem_free(mem, session);
 }
 
@@ -644,9 +727,9 @@ nghttp2_session_reprioritize_stream(nghttp2_session *session,
     if (pri_spec->exclusive &&
         session->roots.num_streams <= NGHTTP2_MAX_DEP_TREE_LENGTH) {
 
-      rv = nghttp2_stream_dep_all_your_stream_are_belong_to_us(stream, session);
+      rv = nghttp2_stream_dep_all_your_stream_are_belong_to_us(stream);
     } else {
-      rv = nghttp2_stream_dep_make_root(stream, session);
+      rv = nghttp2_stream_dep_make_root(stream);
     }
 
     return rv;
@@ -661,7 +744,10 @@ nghttp2_session_reprioritize_stream(nghttp2_session *session,
                    stream->stream_id));
 
     nghttp2_stream_dep_remove_subtree(dep_stream);
-    nghttp2_stream_dep_make_root(dep_stream, session);
+    rv = nghttp2_stream_dep_make_root(dep_stream);
+    if (rv != 0) {
+      return rv;
+    }
   }
 
   nghttp2_stream_dep_remove_subtree(stream);
@@ -675,12 +761,12 @@ nghttp2_session_reprioritize_stream(nghttp2_session *session,
       NGHTTP2_MAX_DEP_TREE_LENGTH) {
     stream->weight = NGHTTP2_DEFAULT_WEIGHT;
 
-    rv = nghttp2_stream_dep_make_root(stream, session);
+    rv = nghttp2_stream_dep_make_root(stream);
   } else {
     if (pri_spec->exclusive) {
-      rv = nghttp2_stream_dep_insert_subtree(dep_stream, stream, session);
+      rv = nghttp2_stream_dep_insert_subtree(dep_stream, stream);
     } else {
-      rv = nghttp2_stream_dep_add_subtree(dep_stream, stream, session);
+      rv = nghttp2_stream_dep_add_subtree(dep_stream, stream);
     }
   }
 
@@ -694,14 +780,22 @@ nghttp2_session_reprioritize_stream(nghttp2_session *session,
 void nghttp2_session_outbound_item_init(nghttp2_session *session,
                                         nghttp2_outbound_item *item) {
   item->seq = session->next_seq++;
-  /* We use cycle for DATA only */
-  item->cycle = 0;
   item->weight = NGHTTP2_OB_EX_WEIGHT;
   item->queued = 0;
 
   memset(&item->aux_data, 0, sizeof(nghttp2_aux_data));
 }
 
+nghttp2_outbound_item *
+nghttp2_session_alloc_outbound_item(nghttp2_session *session) {
+  return nghttp2_freelist_get(&session->item_freelist);
+}
+
+void nghttp2_session_release_outbound_item(nghttp2_session *session,
+                                           nghttp2_outbound_item *item) {
+  nghttp2_freelist_put(&session->item_freelist, item);
+}
+
 int nghttp2_session_add_item(nghttp2_session *session,
                              nghttp2_outbound_item *item) {
   /* TODO Return error if stream is not found for the frame requiring
@@ -743,7 +837,7 @@ int nghttp2_session_add_item(nghttp2_session *session,
          both of them are queued into ob_ss_pq, which is not
          desirable. */
       if (frame->headers.cat == NGHTTP2_HCAT_REQUEST) {
-        rv = nghttp2_pq_push(&session->ob_ss_pq, item);
+        rv = nghttp2_pq_push(&session->ob_ss_pq, &item->pq_entry);
 
         if (rv != 0) {
           return rv;
@@ -752,16 +846,31 @@ int nghttp2_session_add_item(nghttp2_session *session,
         item->queued = 1;
       } else if (stream && (stream->state == NGHTTP2_STREAM_RESERVED ||
                             item->aux_data.headers.attach_stream)) {
-        item->weight = stream->effective_weight;
-        item->cycle = session->last_cycle;
+        /* HEADERS attached to stream is not scheduled by dependency
+           tree; only DATA is. */
+        item->weight = stream->weight;
 
-        rv = nghttp2_stream_attach_item(stream, item, session);
+        rv = nghttp2_stream_attach_item(stream, item);
 
         if (rv != 0) {
           return rv;
         }
+
+        if (stream->state == NGHTTP2_STREAM_RESERVED) {
+          rv = nghttp2_pq_push(&session->ob_ss_pq, &item->pq_entry);
+        } else {
+          rv = nghttp2_pq_push(&session->ob_pq, &item->pq_entry);
+        }
+
+        if (rv != 0) {
+          nghttp2_stream_detach_item(stream);
+
+          return rv;
+        }
+
+        item->queued = 1;
       } else {
-        rv = nghttp2_pq_push(&session->ob_pq, item);
+        rv = nghttp2_pq_push(&session->ob_pq, &item->pq_entry);
 
         if (rv != 0) {
           return rv;
@@ -770,7 +879,7 @@ int nghttp2_session_add_item(nghttp2_session *session,
         item->queued = 1;
       }
     } else {
-      rv = nghttp2_pq_push(&session->ob_pq, item);
+      rv = nghttp2_pq_push(&session->ob_pq, &item->pq_entry);
 
       if (rv != 0) {
         return rv;
@@ -790,10 +899,9 @@ int nghttp2_session_add_item(nghttp2_session *session,
     return NGHTTP2_ERR_DATA_EXIST;
   }
 
-  item->weight = stream->effective_weight;
-  item->cycle = session->last_cycle;
+  item->weight = stream->weight;
 
-  rv = nghttp2_stream_attach_item(stream, item, session);
+  rv = nghttp2_stream_attach_item(stream, item);
 
   if (rv != 0) {
     return rv;
@@ -807,12 +915,12 @@ typedef struct {
   uint32_t error_code;
 } nghttp2_rst_target;
 
-static int cancel_pending_request(void *pq_item, void *arg) {
+static int cancel_pending_request(nghttp2_pq_entry *ent, void *arg) {
   nghttp2_outbound_item *item;
   nghttp2_rst_target *t;
   nghttp2_headers_aux_data *aux_data;
 
-  item = pq_item;
+  item = nghttp2_struct_of(ent, nghttp2_outbound_item, pq_entry);
   t = arg;
   aux_data = &item->aux_data.headers;
 
@@ -832,10 +940,8 @@ int nghttp2_session_add_rst_stream(nghttp2_session *session, int32_t stream_id,
   nghttp2_outbound_item *item;
   nghttp2_frame *frame;
   nghttp2_stream *stream;
-  nghttp2_mem *mem;
   nghttp2_rst_target t = {stream_id, error_code};
 
-  mem = &session->mem;
   stream = nghttp2_session_get_stream(session, stream_id);
   if (stream && stream->state == NGHTTP2_STREAM_CLOSING) {
     return 0;
@@ -848,7 +954,8 @@ int nghttp2_session_add_rst_stream(nghttp2_session *session, int32_t stream_id,
     nghttp2_outbound_item *top;
     nghttp2_frame *headers_frame;
 
-    top = nghttp2_pq_top(&session->ob_ss_pq);
+    top = nghttp2_struct_of(nghttp2_pq_top(&session->ob_ss_pq),
+                            nghttp2_outbound_item, pq_entry);
     headers_frame = &top->frame;
 
     assert(headers_frame->hd.type == NGHTTP2_HEADERS);
@@ -861,7 +968,7 @@ int nghttp2_session_add_rst_stream(nghttp2_session *session, int32_t stream_id,
     }
   }
 
-  item = nghttp2_mem_malloc(mem, sizeof(nghttp2_outbound_item));
+  item = nghttp2_session_alloc_outbound_item(session);
   if (item == NULL) {
     return NGHTTP2_ERR_NOMEM;
   }
@@ -874,7 +981,7 @@ int nghttp2_session_add_rst_stream(nghttp2_session *session, int32_t stream_id,
   rv = nghttp2_session_add_item(session, item);
   if (rv != 0) {
     nghttp2_frame_rst_stream_free(&frame->rst_stream);
-    nghttp2_mem_free(mem, item);
+    nghttp2_session_release_outbound_item(session, item);
     return rv;
   }
   return 0;
@@ -901,15 +1008,23 @@ nghttp2_stream *nghttp2_session_open_stream(nghttp2_session *session,
     assert(stream->state == NGHTTP2_STREAM_IDLE);
     assert(nghttp2_stream_in_dep_tree(stream));
     nghttp2_session_detach_idle_stream(session, stream);
-    nghttp2_stream_dep_remove(stream);
+    rv = nghttp2_stream_dep_remove(stream);
+    if (rv != 0) {
+      return NULL;
+    }
+    /* stream is initialized again below */
+    nghttp2_stream_free(stream);
   } else {
     if (session->server && initial_state != NGHTTP2_STREAM_IDLE &&
         !nghttp2_session_is_my_stream_id(session, stream_id)) {
 
-      nghttp2_session_adjust_closed_stream(session, 1);
+      rv = nghttp2_session_adjust_closed_stream(session, 1);
+      if (rv != 0) {
+        return NULL;
+      }
     }
 
-    stream = nghttp2_mem_malloc(mem, sizeof(nghttp2_stream));
+    stream = nghttp2_freelist_get(&session->stream_freelist);
     if (stream == NULL) {
       return NULL;
     }
@@ -932,7 +1047,7 @@ nghttp2_stream *nghttp2_session_open_stream(nghttp2_session *session,
 
       if (dep_stream == NULL) {
         if (stream_alloc) {
-          nghttp2_mem_free(mem, stream);
+          nghttp2_freelist_put(&session->stream_freelist, stream);
         }
 
         return NULL;
@@ -952,12 +1067,12 @@ nghttp2_stream *nghttp2_session_open_stream(nghttp2_session *session,
   nghttp2_stream_init(
       stream, stream_id, flags, initial_state, pri_spec->weight,
       &session->roots, session->remote_settings.initial_window_size,
-      session->local_settings.initial_window_size, stream_user_data);
+      session->local_settings.initial_window_size, stream_user_data, mem);
 
   if (stream_alloc) {
     rv = nghttp2_map_insert(&session->streams, &stream->map_entry);
     if (rv != 0) {
-      nghttp2_mem_free(mem, stream);
+      nghttp2_freelist_put(&session->stream_freelist, stream);
       return NULL;
     }
   }
@@ -978,7 +1093,10 @@ nghttp2_stream *nghttp2_session_open_stream(nghttp2_session *session,
     /* Idle stream does not count toward the concurrent streams limit.
        This is used as anchor node in dependency tree. */
     assert(session->server);
-    nghttp2_session_keep_idle_stream(session, stream);
+    rv = nghttp2_session_keep_idle_stream(session, stream);
+    if (rv != 0) {
+      return NULL;
+    }
     break;
   default:
     if (nghttp2_session_is_my_stream_id(session, stream_id)) {
@@ -999,11 +1117,10 @@ nghttp2_stream *nghttp2_session_open_stream(nghttp2_session *session,
 
     if (pri_spec->exclusive &&
         session->roots.num_streams <= NGHTTP2_MAX_DEP_TREE_LENGTH) {
-      rv = nghttp2_stream_dep_all_your_stream_are_belong_to_us(stream, session);
-
-      /* Since no dpri is changed in dependency tree, the above
-         function call never fail. */
-      assert(rv == 0);
+      rv = nghttp2_stream_dep_all_your_stream_are_belong_to_us(stream);
+      if (rv != 0) {
+        return NULL;
+      }
     } else {
       nghttp2_stream_roots_add(&session->roots, stream);
     }
@@ -1021,7 +1138,10 @@ nghttp2_stream *nghttp2_session_open_stream(nghttp2_session *session,
 
   if (root_stream->num_substreams < NGHTTP2_MAX_DEP_TREE_LENGTH) {
     if (pri_spec->exclusive) {
-      nghttp2_stream_dep_insert(dep_stream, stream);
+      rv = nghttp2_stream_dep_insert(dep_stream, stream);
+      if (rv != 0) {
+        return NULL;
+      }
     } else {
       nghttp2_stream_dep_add(dep_stream, stream);
     }
@@ -1036,7 +1156,6 @@ nghttp2_stream *nghttp2_session_open_stream(nghttp2_session *session,
 
 int nghttp2_session_close_stream(nghttp2_session *session, int32_t stream_id,
                                  uint32_t error_code) {
-  int rv;
   nghttp2_stream *stream;
   nghttp2_mem *mem;
 
@@ -1050,16 +1169,16 @@ int nghttp2_session_close_stream(nghttp2_session *session, int32_t stream_id,
   DEBUGF(fprintf(stderr, "stream: stream(%p)=%d close\n", stream,
                  stream->stream_id));
 
+  session_window_tuning_release(session, stream);
+
   if (stream->item) {
     nghttp2_outbound_item *item;
 
     item = stream->item;
 
-    rv = nghttp2_stream_detach_item(stream, session);
+    session_stats_stream_resumed(session, stream);
 
-    if (rv != 0) {
-      return rv;
-    }
+    nghttp2_stream_detach_item(stream);
 
     /* If item is queued, it will be deleted when it is popped
        (nghttp2_session_prep_frame() will fail).  If session->aob.item
@@ -1067,7 +1186,7 @@ int nghttp2_session_close_stream(nghttp2_session *session, int32_t stream_id,
        free the item. */
     if (!item->queued && item != session->aob.item) {
       nghttp2_outbound_item_free(item, mem);
-      nghttp2_mem_free(mem, item);
+      nghttp2_session_release_outbound_item(session, item);
     }
   }
 
@@ -1103,32 +1222,33 @@ int nghttp2_session_close_stream(nghttp2_session *session, int32_t stream_id,
     /* On server side, retain stream at most MAX_CONCURRENT_STREAMS
        combined with the current active incoming streams to make
        dependency tree work better. */
-    nghttp2_session_keep_closed_stream(session, stream);
-  } else {
-    nghttp2_session_destroy_stream(session, stream);
+    return nghttp2_session_keep_closed_stream(session, stream);
   }
 
-  return 0;
+  return nghttp2_session_destroy_stream(session, stream);
 }
 
-void nghttp2_session_destroy_stream(nghttp2_session *session,
-                                    nghttp2_stream *stream) {
-  nghttp2_mem *mem;
+int nghttp2_session_destroy_stream(nghttp2_session *session,
+                                   nghttp2_stream *stream) {
+  int rv;
 
   DEBUGF(fprintf(stderr, "stream: destroy closed stream(%p)=%d\n", stream,
                  stream->stream_id));
 
-  mem = &session->mem;
-
-  nghttp2_stream_dep_remove(stream);
+  rv = nghttp2_stream_dep_remove(stream);
+  if (rv != 0) {
+    return rv;
+  }
 
   nghttp2_map_remove(&session->streams, stream->stream_id);
   nghttp2_stream_free(stream);
-  nghttp2_mem_free(mem, stream);
+  nghttp2_freelist_put(&session->stream_freelist, stream);
+
+  return 0;
 }
 
-void nghttp2_session_keep_closed_stream(nghttp2_session *session,
-                                        nghttp2_stream *stream) {
+int nghttp2_session_keep_closed_stream(nghttp2_session *session,
+                                       nghttp2_stream *stream) {
   DEBUGF(fprintf(stderr, "stream: keep closed stream(%p)=%d, state=%d\n",
                  stream, stream->stream_id, stream->state));
 
@@ -1142,11 +1262,11 @@ void nghttp2_session_keep_closed_stream(nghttp2_session *session,
 
   ++session->num_closed_streams;
 
-  nghttp2_session_adjust_closed_stream(session, 0);
+  return nghttp2_session_adjust_closed_stream(session, 0);
 }
 
-void nghttp2_session_keep_idle_stream(nghttp2_session *session,
-                                      nghttp2_stream *stream) {
+int nghttp2_session_keep_idle_stream(nghttp2_session *session,
+                                     nghttp2_stream *stream) {
   DEBUGF(fprintf(stderr, "stream: keep idle stream(%p)=%d, state=%d\n", stream,
                  stream->stream_id, stream->state));
 
@@ -1160,7 +1280,7 @@ void nghttp2_session_keep_idle_stream(nghttp2_session *session,
 
   ++session->num_idle_streams;
 
-  nghttp2_session_adjust_idle_stream(session);
+  return nghttp2_session_adjust_idle_stream(session);
 }
 
 void nghttp2_session_detach_idle_stream(nghttp2_session *session,
@@ -1191,9 +1311,10 @@ void nghttp2_session_detach_idle_stream(nghttp2_session *session,
   --session->num_idle_streams;
 }
 
-void nghttp2_session_adjust_closed_stream(nghttp2_session *session,
-                                          ssize_t offset) {
+int nghttp2_session_adjust_closed_stream(nghttp2_session *session,
+                                         ssize_t offset) {
   size_t num_stream_max;
+  int rv;
 
   num_stream_max = nghttp2_min(session->local_settings.max_concurrent_streams,
                                session->pending_local_max_concurrent_stream);
@@ -1221,14 +1342,21 @@ void nghttp2_session_adjust_closed_stream(nghttp2_session *session,
       session->closed_stream_tail = NULL;
     }
 
-    nghttp2_session_destroy_stream(session, head_stream);
+    rv = nghttp2_session_destroy_stream(session, head_stream);
+    if (rv != 0) {
+      return rv;
+    }
+
     /* head_stream is now freed */
     --session->num_closed_streams;
   }
+
+  return 0;
 }
 
-void nghttp2_session_adjust_idle_stream(nghttp2_session *session) {
+int nghttp2_session_adjust_idle_stream(nghttp2_session *session) {
   size_t max;
+  int rv;
 
   /* Make minimum number of idle streams 2 so that allocating 2
      streams at once is easy.  This happens when PRIORITY frame to
@@ -1256,10 +1384,16 @@ void nghttp2_session_adjust_idle_stream(nghttp2_session *session) {
       session->idle_stream_tail = NULL;
     }
 
-    nghttp2_session_destroy_stream(session, head);
+    rv = nghttp2_session_destroy_stream(session, head);
+    if (rv != 0) {
+      return rv;
+    }
+
     /* head is now destroyed */
     --session->num_idle_streams;
   }
+
+  return 0;
 }
 
 /*
@@ -1291,6 +1425,248 @@ static int session_is_closing(nghttp2_session *session) {
   return (session->goaway_flags & NGHTTP2_GOAWAY_TERM_ON_SEND) != 0;
 }
 
+/* Opaque data of PING used to measure RTT for the receive window
+   auto-tuning */
+static const uint8_t window_tuning_ping_data[8] = {'n', 'g', 'h', 't',
+                                                   't', 'p', '2', 'w'};
+
+static int session_window_tuning_enabled(nghttp2_session *session) {
+  return session->window_tuning.budget > 0;
+}
+
+static uint64_t session_window_tuning_rtt(nghttp2_session *session) {
+  /* Loopback RTT is often below the clock resolution */
+  return nghttp2_max(session->window_tuning.rtt_msec, 1);
+}
+
+typedef struct {
+  nghttp2_session *session;
+  uint64_t now;
+  uint64_t idle_msec;
+} nghttp2_window_tuning_reclaim_arg;
+
+static int window_tuning_reclaim_func(nghttp2_map_entry *entry, void *ptr) {
+  nghttp2_window_tuning_reclaim_arg *arg;
+  nghttp2_stream *stream;
+  int32_t growth;
+
+  arg = (nghttp2_window_tuning_reclaim_arg *)ptr;
+  stream = (nghttp2_stream *)entry;
+  growth = stream->window_growth;
+
+  if (growth == 0 || arg->now - stream->window_update_msec < arg->idle_msec ||
+      stream->local_window_size < growth) {
+    return 0;
+  }
+
+  /* Like negative WINDOW_UPDATE, we shrink the window without telling
+     the remote peer: the next WINDOW_UPDATE is just cut by |growth|
+     bytes. */
+  stream->local_window_size -= growth;
+  stream->recv_window_size -= growth;
+  stream->window_growth = 0;
+  arg->session->window_tuning.used -= (size_t)growth;
+
+  return 0;
+}
+
+/*
+ * Takes back the window growth from the streams which have not sent
+ * WINDOW_UPDATE for a while.
+ */
+static void session_window_tuning_reclaim(nghttp2_session *session,
+                                          uint64_t now) {
+  nghttp2_window_tuning_reclaim_arg arg;
+
+  session->window_tuning.reclaim_msec = now;
+
+  if (session->window_tuning.used == 0) {
+    return;
+  }
+
+  arg.session = session;
+  arg.now = now;
+  arg.idle_msec =
+      nghttp2_max(NGHTTP2_WINDOW_TUNING_IDLE_RTTS *
+                      session_window_tuning_rtt(session),
+                  (uint64_t)NGHTTP2_WINDOW_TUNING_MIN_IDLE);
+
+  nghttp2_map_each(&session->streams, window_tuning_reclaim_func, &arg);
+}
+
+/*
+ * Queues PING to measure RTT if it has not been measured recently.
+ *
+ * This function returns 0 if it succeeds, or one of the following
+ * negative error codes:
+ *
+ * NGHTTP2_ERR_NOMEM
+ *     Out of memory.
+ */
+static int session_window_tuning_sample_rtt(nghttp2_session *session,
+                                            uint64_t now) {
+  nghttp2_window_tuning *wt = &session->window_tuning;
+  int rv;
+
+  if (wt->ping_inflight || session_is_closing(session) ||
+      (wt->rtt_sampled_msec != 0 &&
+       now - wt->rtt_sampled_msec < NGHTTP2_WINDOW_TUNING_RTT_INTERVAL)) {
+    return 0;
+  }
+
+  rv = nghttp2_session_add_ping(session, NGHTTP2_FLAG_NONE,
+                                window_tuning_ping_data);
+  if (rv != 0) {
+    return rv;
+  }
+
+  wt->ping_inflight = 1;
+  /* This is refined when PING is actually sent */
+  wt->ping_sent_msec = now;
+
+  return 0;
+}
+
+/*
+ * Called when PING |frame| was sent.
+ */
+static void session_window_tuning_ping_sent(nghttp2_session *session,
+                                            nghttp2_frame *frame) {
+  if ((frame->hd.flags & NGHTTP2_FLAG_ACK) ||
+      memcmp(frame->ping.opaque_data, window_tuning_ping_data,
+             sizeof(window_tuning_ping_data)) != 0) {
+    return;
+  }
+
+  session->window_tuning.ping_sent_msec = nghttp2_time_now_msec();
+}
+
+/*
+ * Called when PING ACK |frame| was received.  If it acknowledges our
+ * PING, updates the smoothed RTT, and takes back the window growth
+ * from idle streams.
+ */
+static void session_window_tuning_ping_acked(nghttp2_session *session,
+                                             nghttp2_frame *frame) {
+  nghttp2_window_tuning *wt = &session->window_tuning;
+  uint64_t now, rtt;
+
+  if (!wt->ping_inflight ||
+      memcmp(frame->ping.opaque_data, window_tuning_ping_data,
+             sizeof(window_tuning_ping_data)) != 0) {
+    return;
+  }
+
+  now = nghttp2_time_now_msec();
+  rtt = now - wt->ping_sent_msec;
+
+  if (wt->rtt_sampled_msec == 0) {
+    wt->rtt_msec = rtt;
+  } else {
+    wt->rtt_msec = (wt->rtt_msec * 7 + rtt) / 8;
+  }
+
+  wt->rtt_sampled_msec = now;
+  wt->ping_inflight = 0;
+
+  DEBUGF(fprintf(stderr, "recv: window tuning rtt=%llums, smoothed "
+                         "rtt=%llums\n",
+                 (unsigned long long)rtt, (unsigned long long)wt->rtt_msec));
+
+  session_window_tuning_reclaim(session, now);
+}
+
+/*
+ * Decides the growth of the local window of |stream|, or the
+ * connection if |stream| is NULL, just before WINDOW_UPDATE is sent.
+ * If the previous WINDOW_UPDATE was sent less than 2 RTTs ago, the
+ * window is the bottleneck, and it is doubled within the budget.
+ * The growth is added to the local window size, and assigned to
+ * |*delta_ptr|.  The caller must add it to the WINDOW_UPDATE
+ * increment.
+ *
+ * This function returns 0 if it succeeds, or one of the following
+ * negative error codes:
+ *
+ * NGHTTP2_ERR_NOMEM
+ *     Out of memory.
+ */
+static int session_window_tuning_grow(nghttp2_session *session,
+                                      nghttp2_stream *stream,
+                                      int32_t *delta_ptr) {
+  nghttp2_window_tuning *wt = &session->window_tuning;
+  int32_t *local_window_size_ptr;
+  uint64_t *window_update_msec_ptr;
+  uint64_t now, last;
+  int32_t delta;
+  size_t avail;
+  int rv;
+
+  *delta_ptr = 0;
+
+  if (!session_window_tuning_enabled(session)) {
+    return 0;
+  }
+
+  if (stream) {
+    local_window_size_ptr = &stream->local_window_size;
+    window_update_msec_ptr = &stream->window_update_msec;
+  } else {
+    local_window_size_ptr = &session->local_window_size;
+    window_update_msec_ptr = &wt->window_update_msec;
+  }
+
+  now = nghttp2_time_now_msec();
+  last = *window_update_msec_ptr;
+  *window_update_msec_ptr = now;
+
+  rv = session_window_tuning_sample_rtt(session, now);
+  if (rv != 0) {
+    return rv;
+  }
+
+  if (last == 0 || wt->rtt_sampled_msec == 0 ||
+      now - last >= 2 * session_window_tuning_rtt(session)) {
+    return 0;
+  }
+
+  delta = nghttp2_min(*local_window_size_ptr,
+                      NGHTTP2_MAX_WINDOW_SIZE - *local_window_size_ptr);
+
+  if (stream) {
+    avail = wt->budget - wt->used;
+    if (avail < (size_t)delta &&
+        now - wt->reclaim_msec >= session_window_tuning_rtt(session)) {
+      session_window_tuning_reclaim(session, now);
+      avail = wt->budget - wt->used;
+    }
+    delta = (int32_t)nghttp2_min((size_t)delta, avail);
+
+    stream->window_growth += delta;
+    wt->used += (size_t)delta;
+  } else {
+    if ((size_t)*local_window_size_ptr >= wt->budget) {
+      return 0;
+    }
+    delta = (int32_t)nghttp2_min((size_t)delta,
+                                 wt->budget - (size_t)*local_window_size_ptr);
+  }
+
+  if (delta == 0) {
+    return 0;
+  }
+
+  DEBUGF(fprintf(stderr, "recv: window tuning stream_id=%d, local_window "
+                         "%d -> %d\n",
+                 stream ? stream->stream_id : 0, *local_window_size_ptr,
+                 *local_window_size_ptr + delta));
+
+  *local_window_size_ptr += delta;
+  *delta_ptr = delta;
+
+  return 0;
+}
+
 /*
  * Check that we can send a frame to the |stream|. This function
  * returns 0 if we can send a frame to the |frame|, or one of the
@@ -1730,9 +2106,7 @@ static int session_prep_frame(nghttp2_session *session,
                               nghttp2_outbound_item *item) {
   int rv;
   nghttp2_frame *frame;
-  nghttp2_mem *mem;
 
-  mem = &session->mem;
   frame = &item->frame;
 
   if (frame->hd.type != NGHTTP2_DATA) {
@@ -1794,13 +2168,7 @@ static int session_prep_frame(nghttp2_session *session,
 
           if (rv != 0) {
             if (stream && stream->item == item) {
-              int rv2;
-
-              rv2 = nghttp2_stream_detach_item(stream, session);
-
-              if (nghttp2_is_fatal(rv2)) {
-                return rv2;
-              }
+              nghttp2_stream_detach_item(stream);
             }
 
             return rv;
@@ -1815,6 +2183,11 @@ static int session_prep_frame(nghttp2_session *session,
         return rv;
       }
 
+      session_stats_deflated(
+          session, frame->headers.nva, frame->headers.nvlen,
+          frame->hd.length -
+              nghttp2_frame_headers_payload_nv_offset(&frame->headers));
+
       DEBUGF(fprintf(stderr,
                      "send: before padding, HEADERS serialized in %zd bytes\n",
                      nghttp2_bufs_len(&session->aob.framebufs)));
@@ -1905,6 +2278,10 @@ static int session_prep_frame(nghttp2_session *session,
       if (rv != 0) {
         return rv;
       }
+
+      /* 4 for Promised Stream ID field */
+      session_stats_deflated(session, frame->push_promise.nva,
+                             frame->push_promise.nvlen, frame->hd.length - 4);
       rv = session_headers_add_pad(session, frame);
       if (rv != 0) {
         return rv;
@@ -1952,13 +2329,7 @@ static int session_prep_frame(nghttp2_session *session,
     rv = nghttp2_session_predicate_data_send(session, stream);
     if (rv != 0) {
       if (stream) {
-        int rv2;
-
-        rv2 = nghttp2_stream_detach_item(stream, session);
-
-        if (nghttp2_is_fatal(rv2)) {
-          return rv2;
-        }
+        nghttp2_stream_detach_item(stream);
       }
 
       return rv;
@@ -1973,38 +2344,26 @@ static int session_prep_frame(nghttp2_session *session,
          queue when session->remote_window_size > 0 */
       assert(session->remote_window_size > 0);
 
-      rv = nghttp2_stream_defer_item(
-          stream, NGHTTP2_STREAM_FLAG_DEFERRED_FLOW_CONTROL, session);
-
-      if (nghttp2_is_fatal(rv)) {
-        return rv;
-      }
+      nghttp2_stream_defer_item(stream,
+                                NGHTTP2_STREAM_FLAG_DEFERRED_FLOW_CONTROL);
+      session_stats_stream_deferred(session, stream);
 
       session->aob.item = NULL;
-      active_outbound_item_reset(&session->aob, mem);
+      active_outbound_item_reset(session);
       return NGHTTP2_ERR_DEFERRED;
     }
 
     rv = nghttp2_session_pack_data(session, &session->aob.framebufs,
                                    next_readmax, frame, &item->aux_data.data);
     if (rv == NGHTTP2_ERR_DEFERRED) {
-      rv = nghttp2_stream_defer_item(stream, NGHTTP2_STREAM_FLAG_DEFERRED_USER,
-                                     session);
-
-      if (nghttp2_is_fatal(rv)) {
-        return rv;
-      }
+      nghttp2_stream_defer_item(stream, NGHTTP2_STREAM_FLAG_DEFERRED_USER);
 
       session->aob.item = NULL;
-      active_outbound_item_reset(&session->aob, mem);
+      active_outbound_item_reset(session);
       return NGHTTP2_ERR_DEFERRED;
     }
     if (rv == NGHTTP2_ERR_TEMPORAL_CALLBACK_FAILURE) {
-      rv = nghttp2_stream_detach_item(stream, session);
-
-      if (nghttp2_is_fatal(rv)) {
-        return rv;
-      }
+      nghttp2_stream_detach_item(stream);
 
       rv = nghttp2_session_add_rst_stream(session, frame->hd.stream_id,
                                           NGHTTP2_INTERNAL_ERROR);
@@ -2014,23 +2373,52 @@ static int session_prep_frame(nghttp2_session *session,
       return NGHTTP2_ERR_TEMPORAL_CALLBACK_FAILURE;
     }
     if (rv != 0) {
-      int rv2;
-
-      rv2 = nghttp2_stream_detach_item(stream, session);
-
-      if (nghttp2_is_fatal(rv2)) {
-        return rv2;
-      }
+      nghttp2_stream_detach_item(stream);
 
       return rv;
     }
+
+    /* Charge the DATA to be sent to the stream, so that its siblings
+       get their share before it is chosen again. */
+    if (stream->queued) {
+      nghttp2_stream_reschedule(stream, frame->hd.length);
+    }
+
     return 0;
   }
 }
 
+/*
+ * Returns the item at the top of |pq|, or NULL if |pq| is empty.
+ */
+static nghttp2_outbound_item *ob_pq_top(nghttp2_pq *pq) {
+  nghttp2_pq_entry *ent;
+
+  ent = nghttp2_pq_top(pq);
+  if (ent == NULL) {
+    return NULL;
+  }
+
+  return nghttp2_struct_of(ent, nghttp2_outbound_item, pq_entry);
+}
+
 /* Used only for tests */
 nghttp2_outbound_item *nghttp2_session_get_ob_pq_top(nghttp2_session *session) {
-  return (nghttp2_outbound_item *)nghttp2_pq_top(&session->ob_pq);
+  return ob_pq_top(&session->ob_pq);
+}
+
+/*
+ * Returns DATA item which should be sent next, or NULL if there is
+ * no DATA to send.  DATA is scheduled by the dependency tree, and the
+ * item stays attached to its stream while it is sent.
+ */
+static nghttp2_outbound_item *
+session_next_data_item(nghttp2_session *session) {
+  if (session->remote_window_size == 0) {
+    return NULL;
+  }
+
+  return nghttp2_stream_next_outbound_item(&session->roots.root);
 }
 
 nghttp2_outbound_item *
@@ -2039,34 +2427,24 @@ nghttp2_session_get_next_ob_item(nghttp2_session *session) {
 
   if (nghttp2_pq_empty(&session->ob_pq)) {
     if (nghttp2_pq_empty(&session->ob_ss_pq)) {
-      if (session->remote_window_size == 0 ||
-          nghttp2_pq_empty(&session->ob_da_pq)) {
-        return NULL;
-      }
-
-      return nghttp2_pq_top(&session->ob_da_pq);
+      return session_next_data_item(session);
     }
 
     /* Return item only when concurrent connection limit is not
        reached */
     if (session_is_outgoing_concurrent_streams_max(session)) {
-      if (session->remote_window_size == 0 ||
-          nghttp2_pq_empty(&session->ob_da_pq)) {
-        return NULL;
-      }
-
-      return nghttp2_pq_top(&session->ob_da_pq);
+      return session_next_data_item(session);
     }
 
-    return nghttp2_pq_top(&session->ob_ss_pq);
+    return ob_pq_top(&session->ob_ss_pq);
   }
 
   if (nghttp2_pq_empty(&session->ob_ss_pq)) {
-    return nghttp2_pq_top(&session->ob_pq);
+    return ob_pq_top(&session->ob_pq);
   }
 
-  item = nghttp2_pq_top(&session->ob_pq);
-  headers_item = nghttp2_pq_top(&session->ob_ss_pq);
+  item = ob_pq_top(&session->ob_pq);
+  headers_item = ob_pq_top(&session->ob_ss_pq);
 
   if (session_is_outgoing_concurrent_streams_max(session) ||
       item->weight > headers_item->weight ||
@@ -2083,36 +2461,16 @@ nghttp2_session_pop_next_ob_item(nghttp2_session *session) {
 
   if (nghttp2_pq_empty(&session->ob_pq)) {
     if (nghttp2_pq_empty(&session->ob_ss_pq)) {
-      if (session->remote_window_size == 0 ||
-          nghttp2_pq_empty(&session->ob_da_pq)) {
-        return NULL;
-      }
-
-      item = nghttp2_pq_top(&session->ob_da_pq);
-      nghttp2_pq_pop(&session->ob_da_pq);
-
-      item->queued = 0;
-
-      return item;
+      return session_next_data_item(session);
     }
 
     /* Pop item only when concurrent connection limit is not
        reached */
     if (session_is_outgoing_concurrent_streams_max(session)) {
-      if (session->remote_window_size == 0 ||
-          nghttp2_pq_empty(&session->ob_da_pq)) {
-        return NULL;
-      }
-
-      item = nghttp2_pq_top(&session->ob_da_pq);
-      nghttp2_pq_pop(&session->ob_da_pq);
-
-      item->queued = 0;
-
-      return item;
+      return session_next_data_item(session);
     }
 
-    item = nghttp2_pq_top(&session->ob_ss_pq);
+    item = ob_pq_top(&session->ob_ss_pq);
     nghttp2_pq_pop(&session->ob_ss_pq);
 
     item->queued = 0;
@@ -2121,7 +2479,7 @@ nghttp2_session_pop_next_ob_item(nghttp2_session *session) {
   }
 
   if (nghttp2_pq_empty(&session->ob_ss_pq)) {
-    item = nghttp2_pq_top(&session->ob_pq);
+    item = ob_pq_top(&session->ob_pq);
     nghttp2_pq_pop(&session->ob_pq);
 
     item->queued = 0;
@@ -2129,8 +2487,8 @@ nghttp2_session_pop_next_ob_item(nghttp2_session *session) {
     return item;
   }
 
-  item = nghttp2_pq_top(&session->ob_pq);
-  headers_item = nghttp2_pq_top(&session->ob_ss_pq);
+  item = ob_pq_top(&session->ob_pq);
+  headers_item = ob_pq_top(&session->ob_ss_pq);
 
   if (session_is_outgoing_concurrent_streams_max(session) ||
       item->weight > headers_item->weight ||
@@ -2249,23 +2607,6 @@ static int session_close_stream_on_goaway(nghttp2_session *session,
   return 0;
 }
 
-static void session_outbound_item_cycle_weight(nghttp2_session *session,
-                                               nghttp2_outbound_item *item,
-                                               int32_t ini_weight) {
-  if (item->weight == NGHTTP2_MIN_WEIGHT || item->weight > ini_weight) {
-
-    item->weight = ini_weight;
-
-    if (item->cycle == session->last_cycle) {
-      item->cycle = ++session->last_cycle;
-    } else {
-      item->cycle = session->last_cycle;
-    }
-  } else {
-    --item->weight;
-  }
-}
-
 /*
  * Called after a frame is sent.  This function runs
  * on_frame_send_callback and handles stream closure upon END_STREAM
@@ -2314,11 +2655,7 @@ static int session_after_frame_sent1(nghttp2_session *session) {
       }
 
       if (stream->item == item) {
-        rv = nghttp2_stream_detach_item(stream, session);
-
-        if (nghttp2_is_fatal(rv)) {
-          return rv;
-        }
+        nghttp2_stream_detach_item(stream);
       }
 
       switch (frame->headers.cat) {
@@ -2424,9 +2761,14 @@ static int session_after_frame_sent1(nghttp2_session *session) {
           return rv;
         }
       }
-
+
+      break;
+    }
+    case NGHTTP2_PING:
+      if (session_window_tuning_enabled(session)) {
+        session_window_tuning_ping_sent(session, frame);
+      }
       break;
-    }
     default:
       break;
     }
@@ -2447,12 +2789,14 @@ static int session_after_frame_sent1(nghttp2_session *session) {
       stream->remote_window_size -= frame->hd.length;
     }
 
-    if (stream && aux_data->eof) {
-      rv = nghttp2_stream_detach_item(stream, session);
+    if (session_stats_enabled(session) && frame->hd.length > 0 &&
+        session->remote_window_size <= 0) {
+      ++session->stats.connection_flow_control_stalls;
+      session->remote_window_exhausted_msec = nghttp2_time_now_msec();
+    }
 
-      if (nghttp2_is_fatal(rv)) {
-        return rv;
-      }
+    if (stream && aux_data->eof) {
+      nghttp2_stream_detach_item(stream);
 
       /* Call on_frame_send_callback after
          nghttp2_stream_detach_item(), so that application can issue
@@ -2500,6 +2844,32 @@ static int session_after_frame_sent1(nghttp2_session *session) {
   return 0;
 }
 
+/*
+ * Counts the |frame| which was just sent from the current buffer of
+ * |framebufs|.
+ */
+static void session_stats_frame_sent(nghttp2_session *session,
+                                     nghttp2_frame *frame,
+                                     nghttp2_bufs *framebufs) {
+  switch (frame->hd.type) {
+  case NGHTTP2_HEADERS:
+  case NGHTTP2_PUSH_PROMISE:
+    if (framebufs->cur != framebufs->head) {
+      ++session->stats.frames_sent[NGHTTP2_CONTINUATION];
+      return;
+    }
+    /* frame->headers.padlen and frame->push_promise.padlen are in the
+       same position */
+    session->stats.padding_sent += frame->headers.padlen;
+    break;
+  case NGHTTP2_DATA:
+    session->stats.padding_sent += frame->data.padlen;
+    break;
+  }
+
+  ++session->stats.frames_sent[frame->hd.type];
+}
+
 /*
  * Called after a frame is sent and session_after_frame_sent1.  This
  * function is responsible to reset session->aob.
@@ -2513,16 +2883,17 @@ static int session_after_frame_sent1(nghttp2_session *session) {
  *     The callback function failed.
  */
 static int session_after_frame_sent2(nghttp2_session *session) {
-  int rv;
   nghttp2_active_outbound_item *aob = &session->aob;
   nghttp2_outbound_item *item = aob->item;
   nghttp2_bufs *framebufs = &aob->framebufs;
   nghttp2_frame *frame;
-  nghttp2_mem *mem;
 
-  mem = &session->mem;
   frame = &item->frame;
 
+  if (session_stats_enabled(session)) {
+    session_stats_frame_sent(session, frame, framebufs);
+  }
+
   if (frame->hd.type != NGHTTP2_DATA) {
 
     if (frame->hd.type == NGHTTP2_HEADERS ||
@@ -2538,11 +2909,10 @@ static int session_after_frame_sent2(nghttp2_session *session) {
       }
     }
 
-    active_outbound_item_reset(&session->aob, mem);
+    active_outbound_item_reset(session);
 
     return 0;
   } else {
-    nghttp2_outbound_item *next_item;
     nghttp2_stream *stream;
     nghttp2_data_aux_data *aux_data;
 
@@ -2553,7 +2923,7 @@ static int session_after_frame_sent2(nghttp2_session *session) {
        on_frame_send_callback (call from session_after_frame_sent1),
        which attach data to stream.  We don't want to detach it. */
     if (aux_data->eof) {
-      active_outbound_item_reset(aob, mem);
+      active_outbound_item_reset(session);
 
       return 0;
     }
@@ -2564,128 +2934,27 @@ static int session_after_frame_sent2(nghttp2_session *session) {
        further data. */
     if (nghttp2_session_predicate_data_send(session, stream) != 0) {
       if (stream) {
-        rv = nghttp2_stream_detach_item(stream, session);
-
-        if (nghttp2_is_fatal(rv)) {
-          return rv;
-        }
-      }
-
-      active_outbound_item_reset(aob, mem);
-
-      return 0;
-    }
-
-    /* Assuming stream is not NULL */
-    assert(stream);
-    next_item = nghttp2_session_get_next_ob_item(session);
-
-    /* Imagine we hit connection window size limit while sending DATA
-       frame.  If we decrement weight here, its stream might get
-       inferior share because the other streams' weight is not
-       decremented because of flow control. */
-    if (session->remote_window_size > 0 || stream->remote_window_size <= 0) {
-      session_outbound_item_cycle_weight(session, aob->item,
-                                         stream->effective_weight);
-    }
-
-    /* If priority of this stream is higher or equal to other stream
-       waiting at the top of the queue, we continue to send this
-       data. */
-    if (stream->dpri == NGHTTP2_STREAM_DPRI_TOP &&
-        (next_item == NULL || outbound_item_compar(item, next_item) < 0)) {
-      size_t next_readmax;
-
-      next_readmax = nghttp2_session_next_data_read(session, stream);
-
-      if (next_readmax == 0) {
-
-        if (session->remote_window_size == 0 &&
-            stream->remote_window_size > 0) {
-
-          /* If DATA cannot be sent solely due to connection level
-             window size, just push item to queue again.  We never pop
-             DATA item while connection level window size is 0. */
-          rv = nghttp2_pq_push(&session->ob_da_pq, aob->item);
-
-          if (nghttp2_is_fatal(rv)) {
-            return rv;
-          }
-
-          aob->item->queued = 1;
-        } else {
-          rv = nghttp2_stream_defer_item(
-              stream, NGHTTP2_STREAM_FLAG_DEFERRED_FLOW_CONTROL, session);
-
-          if (nghttp2_is_fatal(rv)) {
-            return rv;
-          }
-        }
-
-        aob->item = NULL;
-        active_outbound_item_reset(aob, mem);
-
-        return 0;
-      }
-
-      nghttp2_bufs_reset(framebufs);
-
-      rv = nghttp2_session_pack_data(session, framebufs, next_readmax, frame,
-                                     aux_data);
-      if (nghttp2_is_fatal(rv)) {
-        return rv;
-      }
-      if (rv == NGHTTP2_ERR_DEFERRED) {
-        rv = nghttp2_stream_defer_item(
-            stream, NGHTTP2_STREAM_FLAG_DEFERRED_USER, session);
-
-        if (nghttp2_is_fatal(rv)) {
-          return rv;
-        }
-
-        aob->item = NULL;
-        active_outbound_item_reset(aob, mem);
-
-        return 0;
+        nghttp2_stream_detach_item(stream);
       }
-      if (rv == NGHTTP2_ERR_TEMPORAL_CALLBACK_FAILURE) {
-        /* Stop DATA frame chain and issue RST_STREAM to close the
-           stream.  We don't return
-           NGHTTP2_ERR_TEMPORAL_CALLBACK_FAILURE intentionally. */
-        rv = nghttp2_session_add_rst_stream(session, frame->hd.stream_id,
-                                            NGHTTP2_INTERNAL_ERROR);
-
-        if (nghttp2_is_fatal(rv)) {
-          return rv;
-        }
-
-        rv = nghttp2_stream_detach_item(stream, session);
-
-        if (nghttp2_is_fatal(rv)) {
-          return rv;
-        }
 
-        active_outbound_item_reset(aob, mem);
-
-        return 0;
-      }
-      assert(rv == 0);
+      active_outbound_item_reset(session);
 
       return 0;
     }
 
-    if (stream->dpri == NGHTTP2_STREAM_DPRI_TOP) {
-      rv = nghttp2_pq_push(&session->ob_da_pq, aob->item);
-
-      if (nghttp2_is_fatal(rv)) {
-        return rv;
-      }
-
-      aob->item->queued = 1;
+    /* If stream-level window is exhausted, stop scheduling this
+       stream until WINDOW_UPDATE arrives. */
+    if (stream->remote_window_size <= 0) {
+      nghttp2_stream_defer_item(stream,
+                                NGHTTP2_STREAM_FLAG_DEFERRED_FLOW_CONTROL);
+      session_stats_stream_deferred(session, stream);
     }
 
+    /* Otherwise, the item stays attached to the stream, and the
+       stream is chosen again by nghttp2_session_pop_next_ob_item()
+       when its turn comes. */
     aob->item = NULL;
-    active_outbound_item_reset(&session->aob, mem);
+    active_outbound_item_reset(session);
     return 0;
   }
   /* Unreachable */
@@ -2693,9 +2962,70 @@ static int session_after_frame_sent2(nghttp2_session *session) {
   return 0;
 }
 
+/*
+ * Calls send_data_callback to let application send DATA frame
+ * |item|, whose frame header is stored in |framebufs|, without
+ * copying payload into library buffer.
+ *
+ * This function returns 0 if it succeeds, or one of the following
+ * negative error codes:
+ *
+ * NGHTTP2_ERR_WOULDBLOCK
+ *     Application could not send anything.  Retry later.
+ * NGHTTP2_ERR_PAUSE
+ *     Frame was sent, and application wants to return immediately.
+ * NGHTTP2_ERR_TEMPORAL_CALLBACK_FAILURE
+ *     Application wants to reset the stream.
+ * NGHTTP2_ERR_CALLBACK_FAILURE
+ *     The callback function failed.
+ */
+static int session_call_send_data(nghttp2_session *session,
+                                  nghttp2_outbound_item *item,
+                                  nghttp2_bufs *framebufs) {
+  int rv;
+  nghttp2_buf *buf;
+  size_t length;
+  nghttp2_frame *frame;
+  nghttp2_data_aux_data *aux_data;
+
+  buf = &framebufs->cur->buf;
+  frame = &item->frame;
+  length = frame->hd.length - frame->data.padlen;
+  aux_data = &item->aux_data.data;
+
+  assert(nghttp2_buf_len(buf) == NGHTTP2_FRAME_HDLEN);
+
+  rv = session->callbacks.send_data_callback(session, frame, buf->pos, length,
+                                             &aux_data->data_prd.source,
+                                             session->user_data);
+
+  switch (rv) {
+  case 0:
+  case NGHTTP2_ERR_WOULDBLOCK:
+  case NGHTTP2_ERR_PAUSE:
+  case NGHTTP2_ERR_TEMPORAL_CALLBACK_FAILURE:
+    return rv;
+  default:
+    return NGHTTP2_ERR_CALLBACK_FAILURE;
+  }
+}
+
+/*
+ * Serializes the next chunk of data to send, and assigns the pointer
+ * to it to |*data_ptr|.  If |fast_cb| is nonzero, the caller is
+ * responsible to call session_after_frame_sent1() after the returned
+ * chunk is consumed.  If |stop_no_copy| is nonzero, this function
+ * returns 0 without invoking nghttp2_send_data_callback when the next
+ * frame is no-copy DATA, and returns 0 right after the callback
+ * wrote it.  aob->state is NGHTTP2_OB_SEND_NO_COPY in the former
+ * case.  In the latter case, if |pnocopylen| is not NULL, the length
+ * of the DATA frame written by the callback, including frame header
+ * and padding, is assigned to |*pnocopylen|.
+ */
 static ssize_t nghttp2_session_mem_send_internal(nghttp2_session *session,
                                                  const uint8_t **data_ptr,
-                                                 int fast_cb) {
+                                                 int fast_cb, int stop_no_copy,
+                                                 size_t *pnocopylen) {
   int rv;
   nghttp2_active_outbound_item *aob;
   nghttp2_bufs *framebufs;
@@ -2716,22 +3046,6 @@ static ssize_t nghttp2_session_mem_send_internal(nghttp2_session *session,
         return 0;
       }
 
-      if (item->frame.hd.type == NGHTTP2_DATA ||
-          item->frame.hd.type == NGHTTP2_HEADERS) {
-        nghttp2_frame *frame;
-        nghttp2_stream *stream;
-
-        frame = &item->frame;
-        stream = nghttp2_session_get_stream(session, frame->hd.stream_id);
-
-        if (stream && item == stream->item &&
-            stream->dpri != NGHTTP2_STREAM_DPRI_TOP) {
-          /* We have DATA with higher priority in queue within the
-             same dependency tree. */
-          break;
-        }
-      }
-
       rv = session_prep_frame(session, item);
       if (rv == NGHTTP2_ERR_DEFERRED) {
         DEBUGF(fprintf(stderr, "send: frame transmission deferred\n"));
@@ -2756,7 +3070,7 @@ static ssize_t nghttp2_session_mem_send_internal(nghttp2_session *session,
                   session, frame, rv, session->user_data) != 0) {
 
             nghttp2_outbound_item_free(item, mem);
-            nghttp2_mem_free(mem, item);
+            nghttp2_session_release_outbound_item(session, item);
 
             return NGHTTP2_ERR_CALLBACK_FAILURE;
           }
@@ -2788,8 +3102,8 @@ static ssize_t nghttp2_session_mem_send_internal(nghttp2_session *session,
         }
 
         nghttp2_outbound_item_free(item, mem);
-        nghttp2_mem_free(mem, item);
-        active_outbound_item_reset(aob, mem);
+        nghttp2_session_release_outbound_item(session, item);
+        active_outbound_item_reset(session);
 
         if (rv == NGHTTP2_ERR_HEADER_COMP) {
           /* If header compression error occurred, should terminiate
@@ -2830,6 +3144,15 @@ static ssize_t nghttp2_session_mem_send_internal(nghttp2_session *session,
                      framebufs->cur->buf.pos[3],
                      framebufs->cur->buf.last - framebufs->cur->buf.pos));
 
+      if (item->frame.hd.type == NGHTTP2_DATA &&
+          item->aux_data.data.no_copy) {
+        aob->state = NGHTTP2_OB_SEND_NO_COPY;
+        if (stop_no_copy) {
+          return 0;
+        }
+        break;
+      }
+
       aob->state = NGHTTP2_OB_SEND_DATA;
 
       break;
@@ -2873,6 +3196,81 @@ static ssize_t nghttp2_session_mem_send_internal(nghttp2_session *session,
 
       return datalen;
     }
+    case NGHTTP2_OB_SEND_NO_COPY: {
+      nghttp2_stream *stream;
+      int pause;
+      size_t nocopylen;
+
+      DEBUGF(fprintf(stderr, "send: no copy DATA\n"));
+
+      stream =
+          nghttp2_session_get_stream(session, aob->item->frame.hd.stream_id);
+
+      if (stream == NULL || stream->item != aob->item) {
+        /* Stream was closed while the frame was waiting for
+           transmission.  Nothing has been written yet, so just drop
+           it. */
+        DEBUGF(fprintf(stderr,
+                       "send: no copy DATA cancelled because stream was "
+                       "closed\n"));
+
+        active_outbound_item_reset(session);
+
+        break;
+      }
+
+      rv = session_call_send_data(session, aob->item, framebufs);
+      if (nghttp2_is_fatal(rv)) {
+        return rv;
+      }
+
+      if (rv == NGHTTP2_ERR_TEMPORAL_CALLBACK_FAILURE) {
+        nghttp2_stream_detach_item(stream);
+
+        rv = nghttp2_session_add_rst_stream(session, stream->stream_id,
+                                            NGHTTP2_INTERNAL_ERROR);
+        if (nghttp2_is_fatal(rv)) {
+          return rv;
+        }
+
+        active_outbound_item_reset(session);
+
+        break;
+      }
+
+      if (rv == NGHTTP2_ERR_WOULDBLOCK) {
+        return 0;
+      }
+
+      pause = (rv == NGHTTP2_ERR_PAUSE);
+      nocopylen = NGHTTP2_FRAME_HDLEN + aob->item->frame.hd.length;
+
+      /* The frame was completely sent by application, so
+         session_after_frame_sent1() is not called from
+         nghttp2_session_mem_send() for this frame.  Call both of
+         them here. */
+      rv = session_after_frame_sent1(session);
+      if (rv < 0) {
+        assert(nghttp2_is_fatal(rv));
+        return rv;
+      }
+      rv = session_after_frame_sent2(session);
+      if (rv < 0) {
+        assert(nghttp2_is_fatal(rv));
+        return rv;
+      }
+
+      /* We have already adjusted the next state */
+      if (stop_no_copy && pnocopylen) {
+        *pnocopylen = nocopylen;
+      }
+
+      if (pause || stop_no_copy) {
+        return 0;
+      }
+
+      break;
+    }
     }
   }
 }
@@ -2882,7 +3280,7 @@ ssize_t nghttp2_session_mem_send(nghttp2_session *session,
   int rv;
   ssize_t len;
 
-  len = nghttp2_session_mem_send_internal(session, data_ptr, 1);
+  len = nghttp2_session_mem_send_internal(session, data_ptr, 1, 0, NULL);
   if (len <= 0) {
     return len;
   }
@@ -2900,6 +3298,73 @@ ssize_t nghttp2_session_mem_send(nghttp2_session *session,
   return len;
 }
 
+ssize_t nghttp2_session_mem_send_batch(nghttp2_session *session, uint8_t *buf,
+                                       size_t buflen, size_t *pnocopylen) {
+  const uint8_t *data;
+  ssize_t datalen;
+  size_t n, total = 0;
+  nghttp2_active_outbound_item *aob;
+  nghttp2_outbound_item *no_copy_item;
+
+  aob = &session->aob;
+
+  *pnocopylen = 0;
+
+  for (;;) {
+    if (aob->state == NGHTTP2_OB_SEND_NO_COPY) {
+      if (total > 0) {
+        /* nghttp2_send_data_callback must write the frame after the
+           data we have already serialized in |buf|. */
+        return (ssize_t)total;
+      }
+      no_copy_item = aob->item;
+    } else {
+      no_copy_item = NULL;
+    }
+
+    /* If no-copy DATA is pending, nghttp2_send_data_callback is
+       invoked for it.  The DATA may be cancelled instead, and then
+       the frames following it are serialized here as usual. */
+    datalen =
+        nghttp2_session_mem_send_internal(session, &data, 0, 1, pnocopylen);
+    if (datalen < 0) {
+      return datalen;
+    }
+
+    if (datalen == 0) {
+      if (*pnocopylen > 0) {
+        /* nghttp2_send_data_callback may have written into the
+           memory region pointed by |buf|, so we cannot write more
+           frames there. */
+        return 0;
+      }
+
+      if (aob->state == NGHTTP2_OB_SEND_NO_COPY &&
+          aob->item != no_copy_item) {
+        /* Reached the next no-copy DATA */
+        continue;
+      }
+
+      /* Nothing to send, or nghttp2_send_data_callback returned
+         NGHTTP2_ERR_WOULDBLOCK. */
+      return (ssize_t)total;
+    }
+
+    n = nghttp2_min((size_t)datalen, buflen - total);
+
+    memcpy(buf + total, data, n);
+    total += n;
+
+    if (n < (size_t)datalen) {
+      /* Rewind the offset to the amount of data which did not fit
+         in |buf|.  It is returned in the next call. */
+      aob->framebufs.cur->buf.pos -= (size_t)datalen - n;
+
+      return (ssize_t)total;
+    }
+  }
+}
+
 int nghttp2_session_send(nghttp2_session *session) {
   const uint8_t *data;
   ssize_t datalen;
@@ -2909,7 +3374,7 @@ int nghttp2_session_send(nghttp2_session *session) {
   framebufs = &session->aob.framebufs;
 
   for (;;) {
-    datalen = nghttp2_session_mem_send_internal(session, &data, 0);
+    datalen = nghttp2_session_mem_send_internal(session, &data, 0, 0, NULL);
     if (datalen <= 0) {
       return (int)datalen;
     }
@@ -3174,6 +3639,13 @@ static int inflate_header_block(nghttp2_session *session, nghttp2_frame *frame,
 
     DEBUGF(fprintf(stderr, "recv: proclen=%zd\n", proclen));
 
+    if (session_stats_enabled(session)) {
+      session->stats.hd_inflate_inlen += (size_t)proclen;
+      if (inflate_flags & NGHTTP2_HD_INFLATE_EMIT) {
+        session->stats.hd_inflate_outlen += nv.namelen + nv.valuelen;
+      }
+    }
+
     if (call_header_cb && (inflate_flags & NGHTTP2_HD_INFLATE_EMIT)) {
       rv = 0;
       if (subject_stream && session_enforce_http_messaging(session)) {
@@ -3743,8 +4215,10 @@ static int update_remote_initial_window_size_func(nghttp2_map_entry *entry,
   if (stream->remote_window_size > 0 &&
       nghttp2_stream_check_deferred_by_flow_control(stream)) {
 
+    session_stats_stream_resumed(arg->session, stream);
+
     rv = nghttp2_stream_resume_deferred_item(
-        stream, NGHTTP2_STREAM_FLAG_DEFERRED_FLOW_CONTROL, arg->session);
+        stream, NGHTTP2_STREAM_FLAG_DEFERRED_FLOW_CONTROL);
 
     if (nghttp2_is_fatal(rv)) {
       return rv;
@@ -4218,6 +4692,10 @@ int nghttp2_session_on_ping_received(nghttp2_session *session,
       return rv;
     }
   }
+  if ((frame->hd.flags & NGHTTP2_FLAG_ACK) &&
+      session_window_tuning_enabled(session)) {
+    session_window_tuning_ping_acked(session, frame);
+  }
   return session_call_on_frame_received(session, frame);
 }
 
@@ -4291,6 +4769,15 @@ session_on_connection_window_update_received(nghttp2_session *session,
     return session_handle_invalid_connection(session, frame,
                                              NGHTTP2_FLOW_CONTROL_ERROR, NULL);
   }
+
+  if (session_stats_enabled(session) && session->remote_window_size <= 0 &&
+      session->remote_window_size +
+              frame->window_update.window_size_increment >
+          0) {
+    session->stats.connection_blocked_msec +=
+        nghttp2_time_now_msec() - session->remote_window_exhausted_msec;
+  }
+
   session->remote_window_size += frame->window_update.window_size_increment;
 
   return session_call_on_frame_received(session, frame);
@@ -4328,8 +4815,10 @@ static int session_on_stream_window_update_received(nghttp2_session *session,
   if (stream->remote_window_size > 0 &&
       nghttp2_stream_check_deferred_by_flow_control(stream)) {
 
+    session_stats_stream_resumed(session, stream);
+
     rv = nghttp2_stream_resume_deferred_item(
-        stream, NGHTTP2_STREAM_FLAG_DEFERRED_FLOW_CONTROL, session);
+        stream, NGHTTP2_STREAM_FLAG_DEFERRED_FLOW_CONTROL);
 
     if (nghttp2_is_fatal(rv)) {
       return rv;
@@ -4462,6 +4951,7 @@ static int session_update_recv_stream_window_size(nghttp2_session *session,
                                                   size_t delta_size,
                                                   int send_window_update) {
   int rv;
+  int32_t growth;
   rv = adjust_recv_window_size(&stream->recv_window_size, delta_size,
                                stream->local_window_size);
   if (rv != 0) {
@@ -4476,9 +4966,13 @@ static int session_update_recv_stream_window_size(nghttp2_session *session,
        the remote endpoint should honor. */
     if (nghttp2_should_send_window_update(stream->local_window_size,
                                           stream->recv_window_size)) {
+      rv = session_window_tuning_grow(session, stream, &growth);
+      if (rv != 0) {
+        return rv;
+      }
       rv = nghttp2_session_add_window_update(session, NGHTTP2_FLAG_NONE,
                                              stream->stream_id,
-                                             stream->recv_window_size);
+                                             stream->recv_window_size + growth);
       if (rv == 0) {
         stream->recv_window_size = 0;
       } else {
@@ -4504,6 +4998,7 @@ static int session_update_recv_stream_window_size(nghttp2_session *session,
 static int session_update_recv_connection_window_size(nghttp2_session *session,
                                                       size_t delta_size) {
   int rv;
+  int32_t growth;
   rv = adjust_recv_window_size(&session->recv_window_size, delta_size,
                                session->local_window_size);
   if (rv != 0) {
@@ -4514,10 +5009,15 @@ static int session_update_recv_connection_window_size(nghttp2_session *session,
 
     if (nghttp2_should_send_window_update(session->local_window_size,
                                           session->recv_window_size)) {
+      rv = session_window_tuning_grow(session, NULL, &growth);
+      if (rv != 0) {
+        return rv;
+      }
       /* Use stream ID 0 to update connection-level flow control
          window */
       rv = nghttp2_session_add_window_update(session, NGHTTP2_FLAG_NONE, 0,
-                                             session->recv_window_size);
+                                             session->recv_window_size +
+                                                 growth);
       if (rv != 0) {
         return rv;
       }
@@ -4528,12 +5028,19 @@ static int session_update_recv_connection_window_size(nghttp2_session *session,
   return 0;
 }
 
+/*
+ * Accumulates consumed bytes |delta_size| of |stream|, or the
+ * connection if |stream| is NULL, and decides whether to send
+ * WINDOW_UPDATE.
+ */
 static int session_update_consumed_size(nghttp2_session *session,
+                                        nghttp2_stream *stream,
                                         int32_t *consumed_size_ptr,
                                         int32_t *recv_window_size_ptr,
                                         int32_t stream_id, size_t delta_size,
                                         int32_t local_window_size) {
   int32_t recv_size;
+  int32_t growth;
   int rv;
 
   if ((size_t)*consumed_size_ptr > NGHTTP2_MAX_WINDOW_SIZE - delta_size) {
@@ -4549,8 +5056,13 @@ static int session_update_consumed_size(nghttp2_session *session,
   recv_size = nghttp2_min(*consumed_size_ptr, *recv_window_size_ptr);
 
   if (nghttp2_should_send_window_update(local_window_size, recv_size)) {
+    rv = session_window_tuning_grow(session, stream, &growth);
+    if (rv != 0) {
+      return rv;
+    }
+
     rv = nghttp2_session_add_window_update(session, NGHTTP2_FLAG_NONE,
-                                           stream_id, recv_size);
+                                           stream_id, recv_size + growth);
 
     if (rv != 0) {
       return rv;
@@ -4567,13 +5079,13 @@ static int session_update_stream_consumed_size(nghttp2_session *session,
                                                nghttp2_stream *stream,
                                                size_t delta_size) {
   return session_update_consumed_size(
-      session, &stream->consumed_size, &stream->recv_window_size,
+      session, stream, &stream->consumed_size, &stream->recv_window_size,
       stream->stream_id, delta_size, stream->local_window_size);
 }
 
 static int session_update_connection_consumed_size(nghttp2_session *session,
                                                    size_t delta_size) {
-  return session_update_consumed_size(session, &session->consumed_size,
+  return session_update_consumed_size(session, NULL, &session->consumed_size,
                                       &session->recv_window_size, 0, delta_size,
                                       session->local_window_size);
 }
@@ -4743,7 +5255,8 @@ static int inbound_frame_handle_pad(nghttp2_inbound_frame *iframe,
  * Computes number of padding based on flags. This function returns
  * the calculated length if it succeeds, or -1.
  */
-static ssize_t inbound_frame_compute_pad(nghttp2_inbound_frame *iframe) {
+static ssize_t inbound_frame_compute_pad(nghttp2_session *session,
+                                         nghttp2_inbound_frame *iframe) {
   size_t padlen;
 
   /* 1 for Pad Length field */
@@ -4758,6 +5271,10 @@ static ssize_t inbound_frame_compute_pad(nghttp2_inbound_frame *iframe) {
 
   iframe->padlen = padlen;
 
+  if (session_stats_enabled(session)) {
+    session->stats.padding_received += padlen;
+  }
+
   return padlen;
 }
 
@@ -4868,6 +5385,8 @@ ssize_t nghttp2_session_mem_recv(nghttp2_session *session, const uint8_t *in,
       nghttp2_frame_unpack_frame_hd(&iframe->frame.hd, iframe->sbuf.pos);
       iframe->payloadleft = iframe->frame.hd.length;
 
+      session_stats_frame_received(session, iframe->frame.hd.type);
+
       DEBUGF(fprintf(stderr, "recv: payloadlen=%zu, type=%u, flags=0x%02x, "
                              "stream_id=%d\n",
                      iframe->frame.hd.length, iframe->frame.hd.type,
@@ -5204,7 +5723,7 @@ ssize_t nghttp2_session_mem_recv(nghttp2_session *session, const uint8_t *in,
       case NGHTTP2_HEADERS:
         if (iframe->padlen == 0 &&
             (iframe->frame.hd.flags & NGHTTP2_FLAG_PADDED)) {
-          padlen = inbound_frame_compute_pad(iframe);
+          padlen = inbound_frame_compute_pad(session, iframe);
           if (padlen < 0) {
             busy = 1;
             rv = nghttp2_session_terminate_session_with_reason(
@@ -5270,7 +5789,7 @@ ssize_t nghttp2_session_mem_recv(nghttp2_session *session, const uint8_t *in,
       case NGHTTP2_PUSH_PROMISE:
         if (iframe->padlen == 0 &&
             (iframe->frame.hd.flags & NGHTTP2_FLAG_PADDED)) {
-          padlen = inbound_frame_compute_pad(iframe);
+          padlen = inbound_frame_compute_pad(session, iframe);
           if (padlen < 0) {
             busy = 1;
             rv = nghttp2_session_terminate_session_with_reason(
@@ -5585,6 +6104,8 @@ ssize_t nghttp2_session_mem_recv(nghttp2_session *session, const uint8_t *in,
       nghttp2_frame_unpack_frame_hd(&cont_hd, iframe->sbuf.pos);
       iframe->payloadleft = cont_hd.length;
 
+      session_stats_frame_received(session, cont_hd.type);
+
       DEBUGF(fprintf(stderr, "recv: payloadlen=%zu, type=%u, flags=0x%02x, "
                              "stream_id=%d\n",
                      cont_hd.length, cont_hd.type, cont_hd.flags,
@@ -5672,7 +6193,7 @@ ssize_t nghttp2_session_mem_recv(nghttp2_session *session, const uint8_t *in,
 
       busy = 1;
 
-      padlen = inbound_frame_compute_pad(iframe);
+      padlen = inbound_frame_compute_pad(session, iframe);
       if (padlen < 0) {
         rv = nghttp2_session_terminate_session_with_reason(
             session, NGHTTP2_PROTOCOL_ERROR, "DATA: invalid padding");
@@ -5899,7 +6420,7 @@ int nghttp2_session_want_write(nghttp2_session *session) {
    */
 
   if (session->aob.item == NULL && nghttp2_pq_empty(&session->ob_pq) &&
-      (nghttp2_pq_empty(&session->ob_da_pq) ||
+      (nghttp2_pq_empty(&session->roots.root.obq) ||
        session->remote_window_size == 0) &&
       (nghttp2_pq_empty(&session->ob_ss_pq) ||
        session_is_outgoing_concurrent_streams_max(session))) {
@@ -5921,10 +6442,8 @@ int nghttp2_session_add_ping(nghttp2_session *session, uint8_t flags,
   int rv;
   nghttp2_outbound_item *item;
   nghttp2_frame *frame;
-  nghttp2_mem *mem;
 
-  mem = &session->mem;
-  item = nghttp2_mem_malloc(mem, sizeof(nghttp2_outbound_item));
+  item = nghttp2_session_alloc_outbound_item(session);
   if (item == NULL) {
     return NGHTTP2_ERR_NOMEM;
   }
@@ -5939,7 +6458,7 @@ int nghttp2_session_add_ping(nghttp2_session *session, uint8_t flags,
 
   if (rv != 0) {
     nghttp2_frame_ping_free(&frame->ping);
-    nghttp2_mem_free(mem, item);
+    nghttp2_session_release_outbound_item(session, item);
     return rv;
   }
   return 0;
@@ -5972,7 +6491,7 @@ int nghttp2_session_add_goaway(nghttp2_session *session, int32_t last_stream_id,
     memcpy(opaque_data_copy, opaque_data, opaque_data_len);
   }
 
-  item = nghttp2_mem_malloc(mem, sizeof(nghttp2_outbound_item));
+  item = nghttp2_session_alloc_outbound_item(session);
   if (item == NULL) {
     nghttp2_mem_free(mem, opaque_data_copy);
     return NGHTTP2_ERR_NOMEM;
@@ -5995,7 +6514,7 @@ int nghttp2_session_add_goaway(nghttp2_session *session, int32_t last_stream_id,
   rv = nghttp2_session_add_item(session, item);
   if (rv != 0) {
     nghttp2_frame_goaway_free(&frame->goaway, mem);
-    nghttp2_mem_free(mem, item);
+    nghttp2_session_release_outbound_item(session, item);
     return rv;
   }
   return 0;
@@ -6007,10 +6526,8 @@ int nghttp2_session_add_window_update(nghttp2_session *session, uint8_t flags,
   int rv;
   nghttp2_outbound_item *item;
   nghttp2_frame *frame;
-  nghttp2_mem *mem;
 
-  mem = &session->mem;
-  item = nghttp2_mem_malloc(mem, sizeof(nghttp2_outbound_item));
+  item = nghttp2_session_alloc_outbound_item(session);
   if (item == NULL) {
     return NGHTTP2_ERR_NOMEM;
   }
@@ -6026,7 +6543,7 @@ int nghttp2_session_add_window_update(nghttp2_session *session, uint8_t flags,
 
   if (rv != 0) {
     nghttp2_frame_window_update_free(&frame->window_update);
-    nghttp2_mem_free(mem, item);
+    nghttp2_session_release_outbound_item(session, item);
     return rv;
   }
   return 0;
@@ -6055,7 +6572,7 @@ int nghttp2_session_add_settings(nghttp2_session *session, uint8_t flags,
     return NGHTTP2_ERR_INVALID_ARGUMENT;
   }
 
-  item = nghttp2_mem_malloc(mem, sizeof(nghttp2_outbound_item));
+  item = nghttp2_session_alloc_outbound_item(session);
   if (item == NULL) {
     return NGHTTP2_ERR_NOMEM;
   }
@@ -6063,7 +6580,7 @@ int nghttp2_session_add_settings(nghttp2_session *session, uint8_t flags,
   if (niv > 0) {
     iv_copy = nghttp2_frame_iv_copy(iv, niv, mem);
     if (iv_copy == NULL) {
-      nghttp2_mem_free(mem, item);
+      nghttp2_session_release_outbound_item(session, item);
       return NGHTTP2_ERR_NOMEM;
     }
   } else {
@@ -6076,7 +6593,7 @@ int nghttp2_session_add_settings(nghttp2_session *session, uint8_t flags,
 
       if (session->inflight_iv == NULL) {
         nghttp2_mem_free(mem, iv_copy);
-        nghttp2_mem_free(mem, item);
+        nghttp2_session_release_outbound_item(session, item);
         return NGHTTP2_ERR_NOMEM;
       }
     } else {
@@ -6103,7 +6620,7 @@ int nghttp2_session_add_settings(nghttp2_session *session, uint8_t flags,
     }
 
     nghttp2_frame_settings_free(&frame->settings, mem);
-    nghttp2_mem_free(mem, item);
+    nghttp2_session_release_outbound_item(session, item);
 
     return rv;
   }
@@ -6213,7 +6730,24 @@ int nghttp2_session_pack_data(nghttp2_session *session, nghttp2_bufs *bufs,
     return NGHTTP2_ERR_CALLBACK_FAILURE;
   }
 
-  buf->last = buf->pos + payloadlen;
+  aux_data->no_copy = 0;
+
+  if (data_flags & NGHTTP2_DATA_FLAG_NO_COPY) {
+    if (session->callbacks.send_data_callback == NULL) {
+      DEBUGF(fprintf(stderr, "send: NGHTTP2_DATA_FLAG_NO_COPY requires "
+                             "send_data_callback set\n"));
+      return NGHTTP2_ERR_CALLBACK_FAILURE;
+    }
+    aux_data->no_copy = 1;
+  }
+
+  if (aux_data->no_copy) {
+    /* Application sends payload by itself.  Just leave frame header
+       in buffer. */
+    buf->last = buf->pos;
+  } else {
+    buf->last = buf->pos + payloadlen;
+  }
   buf->pos -= NGHTTP2_FRAME_HDLEN;
 
   /* Clear flags, because this may contain previous flags of previous
@@ -6244,6 +6778,19 @@ int nghttp2_session_pack_data(nghttp2_session *session, nghttp2_bufs *bufs,
 
   frame->data.padlen = padded_payloadlen - payloadlen;
 
+  if (aux_data->no_copy) {
+    /* Padding is also written by application.  We just set up frame
+       header here. */
+    if (frame->data.padlen > 0) {
+      frame->hd.length += frame->data.padlen;
+      frame->hd.flags |= NGHTTP2_FLAG_PADDED;
+    }
+
+    nghttp2_frame_pack_frame_hd(buf->pos, &frame->hd);
+
+    return 0;
+  }
+
   nghttp2_frame_pack_frame_hd(buf->pos, &frame->hd);
 
   rv = nghttp2_frame_add_pad(bufs, &frame->hd, frame->data.padlen);
@@ -6286,7 +6833,7 @@ int nghttp2_session_resume_data(nghttp2_session *session, int32_t stream_id) {
   }
 
   rv = nghttp2_stream_resume_deferred_item(
-      stream, NGHTTP2_STREAM_FLAG_DEFERRED_USER, session);
+      stream, NGHTTP2_STREAM_FLAG_DEFERRED_USER);
 
   if (nghttp2_is_fatal(rv)) {
     return rv;
@@ -6297,8 +6844,7 @@ int nghttp2_session_resume_data(nghttp2_session *session, int32_t stream_id) {
 
 size_t nghttp2_session_get_outbound_queue_size(nghttp2_session *session) {
   return nghttp2_pq_size(&session->ob_pq) +
-         nghttp2_pq_size(&session->ob_ss_pq) +
-         nghttp2_pq_size(&session->ob_da_pq);
+         nghttp2_pq_size(&session->ob_ss_pq) + session->roots.num_active;
 }
 
 int32_t
@@ -6351,6 +6897,17 @@ int32_t nghttp2_session_get_remote_window_size(nghttp2_session *session) {
   return session->remote_window_size;
 }
 
+int nghttp2_session_get_stats(nghttp2_session *session,
+                              nghttp2_session_stats *stats) {
+  if (!session_stats_enabled(session)) {
+    return NGHTTP2_ERR_INVALID_STATE;
+  }
+
+  *stats = session->stats;
+
+  return 0;
+}
+
 uint32_t nghttp2_session_get_remote_settings(nghttp2_session *session,
                                              nghttp2_settings_id id) {
   switch (id) {
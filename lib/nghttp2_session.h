@@ -40,6 +40,7 @@
 #include "nghttp2_buf.h"
 #include "nghttp2_callbacks.h"
 #include "nghttp2_mem.h"
+#include "nghttp2_freelist.h"
 
 /*
  * Option flags.
@@ -48,11 +49,13 @@ typedef enum {
   NGHTTP2_OPTMASK_NO_AUTO_WINDOW_UPDATE = 1 << 0,
   NGHTTP2_OPTMASK_RECV_CLIENT_PREFACE = 1 << 1,
   NGHTTP2_OPTMASK_NO_HTTP_MESSAGING = 1 << 2,
+  NGHTTP2_OPTMASK_STATS = 1 << 3,
 } nghttp2_optmask;
 
 typedef enum {
   NGHTTP2_OB_POP_ITEM,
-  NGHTTP2_OB_SEND_DATA
+  NGHTTP2_OB_SEND_DATA,
+  NGHTTP2_OB_SEND_NO_COPY
 } nghttp2_outbound_state;
 
 typedef struct {
@@ -126,6 +129,37 @@ typedef struct {
   uint32_t max_header_list_size;
 } nghttp2_settings_storage;
 
+/* The interval between RTT measurements of the receive window
+   auto-tuning, in milliseconds */
+#define NGHTTP2_WINDOW_TUNING_RTT_INTERVAL 10000
+/* The stream which has not sent WINDOW_UPDATE for this many RTTs is
+   considered idle, and its window growth is taken back. */
+#define NGHTTP2_WINDOW_TUNING_IDLE_RTTS 4
+/* The lower bound of the idle period above, in milliseconds */
+#define NGHTTP2_WINDOW_TUNING_MIN_IDLE 1000
+
+/* State of the receive window auto-tuning */
+typedef struct {
+  /* The memory budget.  0 if the auto-tuning is disabled. */
+  size_t budget;
+  /* The sum of window_growth of all streams */
+  size_t used;
+  /* The time when WINDOW_UPDATE was last sent for the connection */
+  uint64_t window_update_msec;
+  /* The time when the outstanding PING was sent */
+  uint64_t ping_sent_msec;
+  /* The time when the last RTT sample was taken.  0 if RTT has not
+     been measured yet. */
+  uint64_t rtt_sampled_msec;
+  /* The time when the growth was last taken back from idle
+     streams */
+  uint64_t reclaim_msec;
+  /* Smoothed RTT in milliseconds */
+  uint64_t rtt_msec;
+  /* Nonzero if PING to measure RTT is queued or in flight */
+  uint8_t ping_inflight;
+} nghttp2_window_tuning;
+
 typedef enum {
   NGHTTP2_GOAWAY_NONE = 0,
   /* Flag means that connection should be terminated after sending GOAWAY. */
@@ -142,12 +176,11 @@ struct nghttp2_session {
   nghttp2_map /* <nghttp2_stream*> */ streams;
   nghttp2_stream_roots roots;
   /* Queue for outbound frames other than stream-creating HEADERS and
-     DATA */
+     DATA.  DATA is scheduled by the obq of streams, starting from
+     roots.root. */
   nghttp2_pq /* <nghttp2_outbound_item*> */ ob_pq;
   /* Queue for outbound stream-creating HEADERS frame */
   nghttp2_pq /* <nghttp2_outbound_item*> */ ob_ss_pq;
-  /* QUeue for DATA frame */
-  nghttp2_pq /* <nghttp2_outbound_item*> */ ob_da_pq;
   nghttp2_active_outbound_item aob;
   nghttp2_inbound_frame iframe;
   nghttp2_hd_deflater hd_deflater;
@@ -155,23 +188,23 @@ struct nghttp2_session {
   nghttp2_session_callbacks callbacks;
   /* Memory allocator */
   nghttp2_mem mem;
+  /* Free lists of nghttp2_outbound_item and nghttp2_stream.  Their
+     capacity is 0 unless nghttp2_option_set_free_list_size() is
+     used. */
+  nghttp2_freelist item_freelist;
+  nghttp2_freelist stream_freelist;
+  /* Frame level statistics.  Only updated if
+     nghttp2_option_set_stats() is used. */
+  nghttp2_session_stats stats;
+  /* The time when the connection level remote window was exhausted,
+     in milliseconds.  Only used with the statistics. */
+  uint64_t remote_window_exhausted_msec;
+  /* Receive window auto-tuning.  Only used if
+     nghttp2_option_set_window_auto_tuning() is used. */
+  nghttp2_window_tuning window_tuning;
   /* Sequence number of outbound frame to maintain the order of
      enqueue if priority is equal. */
   int64_t next_seq;
-  /* Reset count of nghttp2_outbound_item's weight.  We decrements
-     weight each time DATA is sent to simulate resource sharing.  We
-     use priority queue and larger weight has the precedence.  If
-     weight is reached to lowest weight, it resets to its initial
-     weight.  If this happens, other items which have the lower weight
-     currently but same initial weight cannot send DATA until item
-     having large weight is decreased.  To avoid this, we use this
-     cycle variable.  Initally, this is set to 1.  If weight gets
-     lowest weight, and if item's cycle == last_cycle, we increments
-     last_cycle and assigns it to item's cycle.  Otherwise, just
-     assign last_cycle.  In priority queue comparator, we first
-     compare items' cycle value.  Lower cycle value has the
-     precedence. */
-  uint64_t last_cycle;
   void *user_data;
   /* Points to the latest closed stream.  NULL if there is no closed
      stream.  Only used when session is initialized as server. */
@@ -298,6 +331,23 @@ int nghttp2_session_is_my_stream_id(nghttp2_session *session,
 void nghttp2_session_outbound_item_init(nghttp2_session *session,
                                         nghttp2_outbound_item *item);
 
+/*
+ * Allocates memory for nghttp2_outbound_item.  The memory released
+ * by nghttp2_session_release_outbound_item() is reused if
+ * available.  This function returns NULL if it fails to allocate
+ * memory.
+ */
+nghttp2_outbound_item *
+nghttp2_session_alloc_outbound_item(nghttp2_session *session);
+
+/*
+ * Releases the memory of |item| allocated by
+ * nghttp2_session_alloc_outbound_item().  This function does not
+ * call nghttp2_outbound_item_free().  |item| may be NULL.
+ */
+void nghttp2_session_release_outbound_item(nghttp2_session *session,
+                                           nghttp2_outbound_item *item);
+
 /*
  * Adds |item| to the outbound queue in |session|.  When this function
  * succeeds, it takes ownership of |item|. So caller must not free it
@@ -444,26 +494,43 @@ int nghttp2_session_close_stream(nghttp2_session *session, int32_t stream_id,
  * Deletes |stream| from memory.  After this function returns, stream
  * cannot be accessed.
  *
+ * This function returns 0 if it succeeds, or one the following
+ * negative error codes:
+ *
+ * NGHTTP2_ERR_NOMEM
+ *     Out of memory
  */
-void nghttp2_session_destroy_stream(nghttp2_session *session,
-                                    nghttp2_stream *stream);
+int nghttp2_session_destroy_stream(nghttp2_session *session,
+                                   nghttp2_stream *stream);
 
 /*
  * Tries to keep incoming closed stream |stream|.  Due to the
  * limitation of maximum number of streams in memory, |stream| is not
  * closed and just deleted from memory (see
  * nghttp2_session_destroy_stream).
+ *
+ * This function returns 0 if it succeeds, or one the following
+ * negative error codes:
+ *
+ * NGHTTP2_ERR_NOMEM
+ *     Out of memory
  */
-void nghttp2_session_keep_closed_stream(nghttp2_session *session,
-                                        nghttp2_stream *stream);
+int nghttp2_session_keep_closed_stream(nghttp2_session *session,
+                                       nghttp2_stream *stream);
 
 /*
  * Appends |stream| to linked list |session->idle_stream_head|.  We
  * apply fixed limit for list size.  To fit into that limit, one or
  * more oldest streams are removed from list as necessary.
+ *
+ * This function returns 0 if it succeeds, or one the following
+ * negative error codes:
+ *
+ * NGHTTP2_ERR_NOMEM
+ *     Out of memory
  */
-void nghttp2_session_keep_idle_stream(nghttp2_session *session,
-                                      nghttp2_stream *stream);
+int nghttp2_session_keep_idle_stream(nghttp2_session *session,
+                                     nghttp2_stream *stream);
 
 /*
  * Detaches |stream| from idle streams linked list.
@@ -477,15 +544,27 @@ void nghttp2_session_detach_idle_stream(nghttp2_session *session,
  * stream.  If |offset| is nonzero, it is decreased from the maximum
  * number of allowed stream when comparing number of active and closed
  * stream and the maximum number.
+ *
+ * This function returns 0 if it succeeds, or one the following
+ * negative error codes:
+ *
+ * NGHTTP2_ERR_NOMEM
+ *     Out of memory
  */
-void nghttp2_session_adjust_closed_stream(nghttp2_session *session,
-                                          ssize_t offset);
+int nghttp2_session_adjust_closed_stream(nghttp2_session *session,
+                                         ssize_t offset);
 
 /*
  * Deletes idle stream to ensure that number of idle streams is in
  * certain limit.
+ *
+ * This function returns 0 if it succeeds, or one the following
+ * negative error codes:
+ *
+ * NGHTTP2_ERR_NOMEM
+ *     Out of memory
  */
-void nghttp2_session_adjust_idle_stream(nghttp2_session *session);
+int nghttp2_session_adjust_idle_stream(nghttp2_session *session);
 
 /*
  * If further receptions and transmissions over the stream |stream_id|
@@ -687,7 +766,9 @@ nghttp2_stream *nghttp2_session_get_stream_raw(nghttp2_session *session,
 /*
  * Packs DATA frame |frame| in wire frame format and stores it in
  * |bufs|.  Payload will be read using |aux_data->data_prd|.  The
- * length of payload is at most |datamax| bytes.
+ * length of payload is at most |datamax| bytes.  If read_callback
+ * sets NGHTTP2_DATA_FLAG_NO_COPY, only frame header is stored in
+ * |bufs| and |aux_data->no_copy| is set to 1.
  *
  * This function returns 0 if it succeeds, or one of the following
  * negative error codes:
@@ -30,13 +30,28 @@
 #include "nghttp2_session.h"
 #include "nghttp2_helper.h"
 
+static int stream_compar(const void *lhsx, const void *rhsx) {
+  const nghttp2_stream *lhs, *rhs;
+
+  lhs = nghttp2_struct_of(lhsx, nghttp2_stream, pq_entry);
+  rhs = nghttp2_struct_of(rhsx, nghttp2_stream, pq_entry);
+
+  if (lhs->cycle == rhs->cycle) {
+    return lhs->seq < rhs->seq ? -1 : 1;
+  }
+
+  return lhs->cycle < rhs->cycle ? -1 : 1;
+}
+
 void nghttp2_stream_init(nghttp2_stream *stream, int32_t stream_id,
                          uint8_t flags, nghttp2_stream_state initial_state,
                          int32_t weight, nghttp2_stream_roots *roots,
                          int32_t remote_initial_window_size,
                          int32_t local_initial_window_size,
-                         void *stream_user_data) {
+                         void *stream_user_data, nghttp2_mem *mem) {
   nghttp2_map_entry_init(&stream->map_entry, stream_id);
+  nghttp2_pq_init(&stream->obq, stream_compar, mem);
+
   stream->stream_id = stream_id;
   stream->flags = flags;
   stream->state = initial_state;
@@ -57,25 +72,32 @@ void nghttp2_stream_init(nghttp2_stream *stream, int32_t stream_id,
   stream->closed_prev = NULL;
   stream->closed_next = NULL;
 
-  stream->dpri = NGHTTP2_STREAM_DPRI_NO_ITEM;
   stream->num_substreams = 1;
   stream->weight = weight;
-  stream->effective_weight = stream->weight;
   stream->sum_dep_weight = 0;
-  stream->sum_norest_weight = 0;
-  stream->sum_top_weight = 0;
 
   stream->roots = roots;
   stream->root_prev = NULL;
   stream->root_next = NULL;
 
+  stream->queued = 0;
+  stream->cycle = 0;
+  stream->descendant_last_cycle = 0;
+  stream->seq = 0;
+  stream->descendant_next_seq = 0;
+  stream->deferred_msec = 0;
+  stream->window_update_msec = 0;
+  stream->window_growth = 0;
+  stream->pending_penalty = 0;
+
   stream->http_flags = NGHTTP2_HTTP_FLAG_NONE;
   stream->content_length = -1;
   stream->recv_content_length = 0;
   stream->status_code = -1;
 }
 
-void nghttp2_stream_free(nghttp2_stream *stream _U_) {
+void nghttp2_stream_free(nghttp2_stream *stream) {
+  nghttp2_pq_free(&stream->obq);
   /* We don't free stream->item.  If it is assigned to aob, then
      active_outbound_item_reset() will delete it.  If it is queued,
      then it is deleted when pq is deleted in nghttp2_session_del().
@@ -86,351 +108,195 @@ void nghttp2_stream_shutdown(nghttp2_stream *stream, nghttp2_shut_flag flag) {
   stream->shut_flags |= flag;
 }
 
-static int stream_push_item(nghttp2_stream *stream, nghttp2_session *session) {
-  int rv;
-  nghttp2_outbound_item *item;
-
-  assert(stream->item);
-  assert(stream->item->queued == 0);
-
-  item = stream->item;
-
-  /* If item is now sent, don't push it to the queue.  Otherwise, we
-     may push same item twice. */
-  if (session->aob.item == item) {
-    return 0;
-  }
-
-  if (item->weight > stream->effective_weight) {
-    item->weight = stream->effective_weight;
+/*
+ * Returns the stream in whose obq |stream| is queued.  Root streams
+ * are queued in the obq of the pseudo root stream, roots->root.
+ */
+static nghttp2_stream *stream_obq_parent(nghttp2_stream *stream) {
+  if (stream->dep_prev) {
+    return stream->dep_prev;
   }
 
-  item->cycle = session->last_cycle;
-
-  switch (item->frame.hd.type) {
-  case NGHTTP2_DATA:
-    rv = nghttp2_pq_push(&session->ob_da_pq, item);
-    break;
-  case NGHTTP2_HEADERS:
-    if (stream->state == NGHTTP2_STREAM_RESERVED) {
-      rv = nghttp2_pq_push(&session->ob_ss_pq, item);
-    } else {
-      rv = nghttp2_pq_push(&session->ob_pq, item);
-    }
-    break;
-  default:
-    rv = 0;
-    /* should not reach here */
-    assert(0);
+  if (stream == &stream->roots->root) {
+    return NULL;
   }
 
-  if (rv != 0) {
-    return rv;
-  }
-
-  item->queued = 1;
-
-  return 0;
-}
-
-static nghttp2_stream *stream_first_sib(nghttp2_stream *stream) {
-  for (; stream->sib_prev; stream = stream->sib_prev)
-    ;
-
-  return stream;
+  return &stream->roots->root;
 }
 
-static nghttp2_stream *stream_last_sib(nghttp2_stream *stream) {
-  for (; stream->sib_next; stream = stream->sib_next)
-    ;
-
-  return stream;
-}
-
-static nghttp2_stream *stream_update_dep_length(nghttp2_stream *stream,
-                                                ssize_t delta) {
-  stream->num_substreams += delta;
-
-  stream = stream_first_sib(stream);
-
-  if (stream->dep_prev) {
-    return stream_update_dep_length(stream->dep_prev, delta);
-  }
-
-  return stream;
-}
-
-int32_t nghttp2_stream_dep_distributed_weight(nghttp2_stream *stream,
-                                              int32_t weight) {
-  weight = stream->weight * weight / stream->sum_dep_weight;
-
-  return nghttp2_max(1, weight);
+/*
+ * Returns nonzero if |stream| itself has DATA which can be sent now.
+ */
+static int stream_active(nghttp2_stream *stream) {
+  return stream->item && stream->item->frame.hd.type == NGHTTP2_DATA &&
+         (stream->flags & NGHTTP2_STREAM_FLAG_DEFERRED_ALL) == 0;
 }
 
-int32_t nghttp2_stream_dep_distributed_effective_weight(nghttp2_stream *stream,
-                                                        int32_t weight) {
-  if (stream->sum_norest_weight == 0) {
-    return stream->effective_weight;
-  }
-
-  weight = stream->effective_weight * weight / stream->sum_norest_weight;
-
-  return nghttp2_max(1, weight);
+/*
+ * Returns nonzero if |stream| or any of its descendants has DATA
+ * which can be sent now.
+ */
+static int stream_subtree_active(nghttp2_stream *stream) {
+  return stream_active(stream) || !nghttp2_pq_empty(&stream->obq);
 }
 
-static int32_t
-stream_dep_distributed_top_effective_weight(nghttp2_stream *stream,
-                                            int32_t weight) {
-  if (stream->sum_top_weight == 0) {
-    return stream->effective_weight;
-  }
+/*
+ * Computes the next cycle of |stream| after it sent |writelen| bytes
+ * of DATA, starting from |last_cycle|.
+ */
+static void stream_next_cycle(nghttp2_stream *stream, uint64_t last_cycle,
+                              size_t writelen) {
+  uint64_t penalty;
 
-  weight = stream->effective_weight * weight / stream->sum_top_weight;
+  penalty = (uint64_t)writelen + stream->pending_penalty;
 
-  return nghttp2_max(1, weight);
+  stream->cycle = last_cycle + penalty / (uint32_t)stream->weight;
+  stream->pending_penalty = (uint32_t)(penalty % (uint32_t)stream->weight);
 }
 
-static void stream_update_dep_set_rest(nghttp2_stream *stream);
+/*
+ * Queues |stream| in the obq of |dep_stream|, and then queues the
+ * ancestors of |stream| which are not queued yet.
+ *
+ * This function returns 0 if it succeeds, or one of the following
+ * negative error codes:
+ *
+ * NGHTTP2_ERR_NOMEM
+ *     Out of memory
+ */
+static int stream_obq_push(nghttp2_stream *dep_stream,
+                           nghttp2_stream *stream) {
+  int rv;
+  nghttp2_stream *first, *si;
 
-/* Updates effective_weight of descendant streams in subtree of
-   |stream|.  We assume that stream->effective_weight is already set
-   right. */
-static void stream_update_dep_effective_weight(nghttp2_stream *stream) {
-  nghttp2_stream *si;
+  first = stream;
 
-  DEBUGF(fprintf(stderr, "stream: update_dep_effective_weight "
-                         "stream(%p)=%d, weight=%d, sum_norest_weight=%d, "
-                         "sum_top_weight=%d\n",
-                 stream, stream->stream_id, stream->weight,
-                 stream->sum_norest_weight, stream->sum_top_weight));
+  for (; dep_stream && !stream->queued;
+       stream = dep_stream, dep_stream = stream_obq_parent(dep_stream)) {
+    DEBUGF(fprintf(stderr, "stream: stream=%d obq push to stream=%d\n",
+                   stream->stream_id, dep_stream->stream_id));
 
-  /* stream->sum_norest_weight == 0 means there is no
-     NGHTTP2_STREAM_DPRI_TOP under stream */
-  if (stream->dpri != NGHTTP2_STREAM_DPRI_NO_ITEM ||
-      stream->sum_norest_weight == 0) {
-    return;
-  }
+    stream_next_cycle(stream, dep_stream->descendant_last_cycle, 0);
+    stream->seq = dep_stream->descendant_next_seq++;
 
-  /* If there is no direct descendant whose dpri is
-     NGHTTP2_STREAM_DPRI_TOP, indirect descendants have the chance to
-     send data, so recursively set weight for descendants. */
-  if (stream->sum_top_weight == 0) {
-    for (si = stream->dep_next; si; si = si->sib_next) {
-      if (si->dpri != NGHTTP2_STREAM_DPRI_REST) {
-        si->effective_weight =
-            nghttp2_stream_dep_distributed_effective_weight(stream, si->weight);
+    rv = nghttp2_pq_push(&dep_stream->obq, &stream->pq_entry);
+    if (rv != 0) {
+      /* Undo the pushes done so far, so that the tree stays
+         consistent. */
+      for (si = first; si != stream; si = stream_obq_parent(si)) {
+        nghttp2_pq_remove(&stream_obq_parent(si)->obq, &si->pq_entry);
+        si->queued = 0;
+        si->cycle = 0;
+        si->pending_penalty = 0;
       }
 
-      stream_update_dep_effective_weight(si);
-    }
-    return;
-  }
-
-  /* If there is at least one direct descendant whose dpri is
-     NGHTTP2_STREAM_DPRI_TOP, we won't give a chance to indirect
-     descendants, since closed or blocked stream's weight is
-     distributed among its siblings */
-  for (si = stream->dep_next; si; si = si->sib_next) {
-    if (si->dpri == NGHTTP2_STREAM_DPRI_TOP) {
-      si->effective_weight =
-          stream_dep_distributed_top_effective_weight(stream, si->weight);
-
-      DEBUGF(fprintf(stderr, "stream: stream=%d top eweight=%d\n",
-                     si->stream_id, si->effective_weight));
-
-      continue;
+      return rv;
     }
 
-    if (si->dpri == NGHTTP2_STREAM_DPRI_NO_ITEM) {
-      DEBUGF(fprintf(stderr, "stream: stream=%d no_item, ignored\n",
-                     si->stream_id));
-
-      /* Since we marked NGHTTP2_STREAM_DPRI_TOP under si, we make
-         them NGHTTP2_STREAM_DPRI_REST again. */
-      stream_update_dep_set_rest(si->dep_next);
-    } else {
-      DEBUGF(
-          fprintf(stderr, "stream: stream=%d rest, ignored\n", si->stream_id));
-    }
+    stream->queued = 1;
   }
-}
 
-static void stream_update_dep_set_rest(nghttp2_stream *stream) {
-  if (stream == NULL) {
-    return;
-  }
-
-  DEBUGF(fprintf(stderr, "stream: stream=%d is rest\n", stream->stream_id));
-
-  if (stream->dpri == NGHTTP2_STREAM_DPRI_REST) {
-    return;
-  }
-
-  if (stream->dpri == NGHTTP2_STREAM_DPRI_TOP) {
-    stream->dpri = NGHTTP2_STREAM_DPRI_REST;
-
-    stream_update_dep_set_rest(stream->sib_next);
-
-    return;
-  }
-
-  stream_update_dep_set_rest(stream->sib_next);
-  stream_update_dep_set_rest(stream->dep_next);
+  return 0;
 }
 
 /*
- * Performs dfs starting |stream|, search stream which can become
- * NGHTTP2_STREAM_DPRI_TOP and set its dpri.
+ * Removes |stream| from the obq of its parent, and then removes the
+ * ancestors of |stream| whose subtree has no longer DATA to send.
  */
-static void stream_update_dep_set_top(nghttp2_stream *stream) {
-  nghttp2_stream *si;
+static void stream_obq_remove(nghttp2_stream *stream) {
+  nghttp2_stream *dep_stream;
 
-  if (stream->dpri == NGHTTP2_STREAM_DPRI_TOP) {
+  if (!stream->queued) {
     return;
   }
 
-  if (stream->dpri == NGHTTP2_STREAM_DPRI_REST) {
-    DEBUGF(
-        fprintf(stderr, "stream: stream=%d item is top\n", stream->stream_id));
+  for (dep_stream = stream_obq_parent(stream); dep_stream;
+       stream = dep_stream, dep_stream = stream_obq_parent(dep_stream)) {
+    DEBUGF(fprintf(stderr, "stream: stream=%d obq remove from stream=%d\n",
+                   stream->stream_id, dep_stream->stream_id));
 
-    stream->dpri = NGHTTP2_STREAM_DPRI_TOP;
+    nghttp2_pq_remove(&dep_stream->obq, &stream->pq_entry);
 
-    return;
-  }
+    stream->queued = 0;
+    stream->cycle = 0;
+    stream->pending_penalty = 0;
 
-  for (si = stream->dep_next; si; si = si->sib_next) {
-    stream_update_dep_set_top(si);
+    if (stream_subtree_active(dep_stream)) {
+      return;
+    }
   }
 }
 
 /*
- * Performs dfs starting |stream|, and dueue stream whose dpri is
- * NGHTTP2_STREAM_DPRI_TOP and has not been queued yet.
+ * Moves |stream|, which is queued in the obq of |src|, to the obq of
+ * |dest|.
  *
  * This function returns 0 if it succeeds, or one of the following
  * negative error codes:
  *
  * NGHTTP2_ERR_NOMEM
- *     Out of memory.
+ *     Out of memory
  */
-static int stream_update_dep_queue_top(nghttp2_stream *stream,
-                                       nghttp2_session *session) {
-  int rv;
-  nghttp2_stream *si;
-
-  if (stream->dpri == NGHTTP2_STREAM_DPRI_REST) {
-    return 0;
-  }
-
-  if (stream->dpri == NGHTTP2_STREAM_DPRI_TOP) {
-    if (!stream->item->queued) {
-      DEBUGF(fprintf(stderr, "stream: stream=%d enqueue\n", stream->stream_id));
-      rv = stream_push_item(stream, session);
-
-      if (rv != 0) {
-        return rv;
-      }
-    }
-
-    return 0;
-  }
+static int stream_obq_move(nghttp2_stream *dest, nghttp2_stream *src,
+                           nghttp2_stream *stream) {
+  assert(stream->queued);
 
-  for (si = stream->dep_next; si; si = si->sib_next) {
-    rv = stream_update_dep_queue_top(si, session);
+  nghttp2_pq_remove(&src->obq, &stream->pq_entry);
+  stream->queued = 0;
+  stream->pending_penalty = 0;
 
-    if (rv != 0) {
-      return rv;
-    }
-  }
-
-  return 0;
+  return stream_obq_push(dest, stream);
 }
 
-/*
- * Updates stream->sum_norest_weight and stream->sum_top_weight
- * recursively.  We have to gather effective sum of weight of
- * descendants.  If stream->dpri == NGHTTP2_STREAM_DPRI_NO_ITEM, we
- * have to go deeper and check that any of its descendants has dpri
- * value of NGHTTP2_STREAM_DPRI_TOP.  If so, we have to add weight of
- * its direct descendants to stream->sum_norest_weight.  To make this
- * work, this function returns 1 if any of its descendants has dpri
- * value of NGHTTP2_STREAM_DPRI_TOP, otherwise 0.
- *
- * Calculating stream->sum_top-weight is very simple compared to
- * stream->sum_norest_weight.  It just adds up the weight of direct
- * descendants whose dpri is NGHTTP2_STREAM_DPRI_TOP.
- */
-static int stream_update_dep_sum_norest_weight(nghttp2_stream *stream) {
+nghttp2_outbound_item *
+nghttp2_stream_next_outbound_item(nghttp2_stream *stream) {
+  nghttp2_pq_entry *ent;
   nghttp2_stream *si;
-  int rv;
-
-  stream->sum_norest_weight = 0;
-  stream->sum_top_weight = 0;
-
-  if (stream->dpri == NGHTTP2_STREAM_DPRI_TOP) {
-    return 1;
-  }
-
-  if (stream->dpri == NGHTTP2_STREAM_DPRI_REST) {
-    return 0;
-  }
-
-  rv = 0;
 
-  for (si = stream->dep_next; si; si = si->sib_next) {
-
-    if (stream_update_dep_sum_norest_weight(si)) {
-      rv = 1;
-      stream->sum_norest_weight += si->weight;
+  for (;;) {
+    if (stream_active(stream)) {
+      return stream->item;
     }
 
-    if (si->dpri == NGHTTP2_STREAM_DPRI_TOP) {
-      stream->sum_top_weight += si->weight;
+    ent = nghttp2_pq_top(&stream->obq);
+    if (!ent) {
+      return NULL;
     }
-  }
-
-  return rv;
-}
 
-static int stream_update_dep_on_attach_item(nghttp2_stream *stream,
-                                            nghttp2_session *session) {
-  nghttp2_stream *root_stream;
+    si = nghttp2_struct_of(ent, nghttp2_stream, pq_entry);
 
-  stream->dpri = NGHTTP2_STREAM_DPRI_REST;
+    /* The virtual time of |stream| advances to the cycle of the
+       descendant served now. */
+    stream->descendant_last_cycle = si->cycle;
 
-  stream_update_dep_set_rest(stream->dep_next);
-
-  root_stream = nghttp2_stream_get_dep_root(stream);
-
-  DEBUGF(fprintf(stderr, "root=%p, stream=%p\n", root_stream, stream));
-
-  stream_update_dep_set_top(root_stream);
-
-  stream_update_dep_sum_norest_weight(root_stream);
-  stream_update_dep_effective_weight(root_stream);
-
-  return stream_update_dep_queue_top(root_stream, session);
+    stream = si;
+  }
 }
 
-static int stream_update_dep_on_detach_item(nghttp2_stream *stream,
-                                            nghttp2_session *session) {
-  nghttp2_stream *root_stream;
+void nghttp2_stream_reschedule(nghttp2_stream *stream, size_t writelen) {
+  nghttp2_stream *dep_stream;
 
-  stream->dpri = NGHTTP2_STREAM_DPRI_NO_ITEM;
+  assert(stream->queued);
 
-  root_stream = nghttp2_stream_get_dep_root(stream);
+  for (dep_stream = stream_obq_parent(stream); dep_stream;
+       stream = dep_stream, dep_stream = stream_obq_parent(dep_stream)) {
+    nghttp2_pq_remove(&dep_stream->obq, &stream->pq_entry);
 
-  stream_update_dep_set_top(root_stream);
+    stream_next_cycle(stream, dep_stream->descendant_last_cycle, writelen);
+    stream->seq = dep_stream->descendant_next_seq++;
 
-  stream_update_dep_sum_norest_weight(root_stream);
-  stream_update_dep_effective_weight(root_stream);
+    /* This never fails since we have just removed an entry */
+    nghttp2_pq_push(&dep_stream->obq, &stream->pq_entry);
 
-  return stream_update_dep_queue_top(root_stream, session);
+    DEBUGF(fprintf(stderr, "stream: stream=%d rescheduled cycle=%llu\n",
+                   stream->stream_id, (unsigned long long)stream->cycle));
+  }
 }
 
 int nghttp2_stream_attach_item(nghttp2_stream *stream,
-                               nghttp2_outbound_item *item,
-                               nghttp2_session *session) {
+                               nghttp2_outbound_item *item) {
+  int rv;
+
   assert((stream->flags & NGHTTP2_STREAM_FLAG_DEFERRED_ALL) == 0);
   assert(stream->item == NULL);
 
@@ -439,46 +305,90 @@ int nghttp2_stream_attach_item(nghttp2_stream *stream,
 
   stream->item = item;
 
-  return stream_update_dep_on_attach_item(stream, session);
+  if (!stream_active(stream)) {
+    return 0;
+  }
+
+  rv = stream_obq_push(stream_obq_parent(stream), stream);
+  if (rv != 0) {
+    stream->item = NULL;
+
+    return rv;
+  }
+
+  ++stream->roots->num_active;
+
+  return 0;
 }
 
-int nghttp2_stream_detach_item(nghttp2_stream *stream,
-                               nghttp2_session *session) {
+void nghttp2_stream_detach_item(nghttp2_stream *stream) {
   DEBUGF(fprintf(stderr, "stream: stream=%d detach item=%p\n",
                  stream->stream_id, stream->item));
 
+  if (stream_active(stream)) {
+    --stream->roots->num_active;
+  }
+
   stream->item = NULL;
   stream->flags &= ~NGHTTP2_STREAM_FLAG_DEFERRED_ALL;
 
-  return stream_update_dep_on_detach_item(stream, session);
+  if (!stream_subtree_active(stream)) {
+    stream_obq_remove(stream);
+  }
 }
 
-int nghttp2_stream_defer_item(nghttp2_stream *stream, uint8_t flags,
-                              nghttp2_session *session) {
+void nghttp2_stream_defer_item(nghttp2_stream *stream, uint8_t flags) {
   assert(stream->item);
 
   DEBUGF(fprintf(stderr, "stream: stream=%d defer item=%p cause=%02x\n",
                  stream->stream_id, stream->item, flags));
 
+  if (!stream_active(stream)) {
+    stream->flags |= flags;
+
+    return;
+  }
+
   stream->flags |= flags;
 
-  return stream_update_dep_on_detach_item(stream, session);
+  --stream->roots->num_active;
+
+  if (!stream_subtree_active(stream)) {
+    stream_obq_remove(stream);
+  }
 }
 
-int nghttp2_stream_resume_deferred_item(nghttp2_stream *stream, uint8_t flags,
-                                        nghttp2_session *session) {
+int nghttp2_stream_resume_deferred_item(nghttp2_stream *stream,
+                                        uint8_t flags) {
+  int rv;
+  uint8_t old_flags;
+
   assert(stream->item);
 
   DEBUGF(fprintf(stderr, "stream: stream=%d resume item=%p flags=%02x\n",
                  stream->stream_id, stream->item, flags));
 
+  if (stream_active(stream)) {
+    return 0;
+  }
+
+  old_flags = stream->flags;
   stream->flags &= ~flags;
 
-  if (stream->flags & NGHTTP2_STREAM_FLAG_DEFERRED_ALL) {
+  if (!stream_active(stream)) {
     return 0;
   }
 
-  return stream_update_dep_on_attach_item(stream, session);
+  rv = stream_obq_push(stream_obq_parent(stream), stream);
+  if (rv != 0) {
+    stream->flags = old_flags;
+
+    return rv;
+  }
+
+  ++stream->roots->num_active;
+
+  return 0;
 }
 
 int nghttp2_stream_check_deferred_item(nghttp2_stream *stream) {
@@ -525,21 +435,8 @@ void nghttp2_stream_promise_fulfilled(nghttp2_stream *stream) {
 }
 
 nghttp2_stream *nghttp2_stream_get_dep_root(nghttp2_stream *stream) {
-  for (;;) {
-    if (stream->sib_prev) {
-      stream = stream->sib_prev;
-
-      continue;
-    }
-
-    if (stream->dep_prev) {
-      stream = stream->dep_prev;
-
-      continue;
-    }
-
-    break;
-  }
+  for (; stream->dep_prev; stream = stream->dep_prev)
+    ;
 
   return stream;
 }
@@ -561,38 +458,31 @@ int nghttp2_stream_dep_subtree_find(nghttp2_stream *stream,
   return nghttp2_stream_dep_subtree_find(stream->dep_next, target);
 }
 
-void nghttp2_stream_dep_insert(nghttp2_stream *dep_stream,
-                               nghttp2_stream *stream) {
-  nghttp2_stream *si;
-  nghttp2_stream *root_stream;
-
-  assert(stream->item == NULL);
+static nghttp2_stream *stream_last_sib(nghttp2_stream *stream) {
+  for (; stream->sib_next; stream = stream->sib_next)
+    ;
 
-  DEBUGF(fprintf(stderr,
-                 "stream: dep_insert dep_stream(%p)=%d, stream(%p)=%d\n",
-                 dep_stream, dep_stream->stream_id, stream, stream->stream_id));
+  return stream;
+}
 
-  stream->sum_dep_weight = dep_stream->sum_dep_weight;
-  dep_stream->sum_dep_weight = stream->weight;
+static nghttp2_stream *stream_update_dep_length(nghttp2_stream *stream,
+                                                ssize_t delta) {
+  for (;;) {
+    stream->num_substreams += delta;
 
-  if (dep_stream->dep_next) {
-    for (si = dep_stream->dep_next; si; si = si->sib_next) {
-      stream->num_substreams += si->num_substreams;
+    if (stream->dep_prev == NULL) {
+      return stream;
     }
 
-    stream->dep_next = dep_stream->dep_next;
-    stream->dep_next->dep_prev = stream;
+    stream = stream->dep_prev;
   }
+}
 
-  dep_stream->dep_next = stream;
-  stream->dep_prev = dep_stream;
-
-  root_stream = stream_update_dep_length(dep_stream, 1);
-
-  stream_update_dep_sum_norest_weight(root_stream);
-  stream_update_dep_effective_weight(root_stream);
+int32_t nghttp2_stream_dep_distributed_weight(nghttp2_stream *stream,
+                                              int32_t weight) {
+  weight = stream->weight * weight / stream->sum_dep_weight;
 
-  ++stream->roots->num_streams;
+  return nghttp2_max(1, weight);
 }
 
 static void link_dep(nghttp2_stream *dep_stream, nghttp2_stream *stream) {
@@ -605,6 +495,8 @@ static void link_sib(nghttp2_stream *prev_stream, nghttp2_stream *stream) {
   stream->sib_prev = prev_stream;
 }
 
+/* Makes |stream| the left most direct descendant of |dep_stream|,
+   which already has at least one direct descendant. */
 static void insert_link_dep(nghttp2_stream *dep_stream,
                             nghttp2_stream *stream) {
   nghttp2_stream *sib_next;
@@ -615,93 +507,68 @@ static void insert_link_dep(nghttp2_stream *dep_stream,
 
   link_sib(stream, sib_next);
 
-  sib_next->dep_prev = NULL;
-
   link_dep(dep_stream, stream);
 }
 
-static void unlink_sib(nghttp2_stream *stream) {
-  nghttp2_stream *prev, *next, *dep_next;
+/* Sets dep_prev of |stream| and its following siblings to
+   |dep_stream|. */
+static void set_dep_prev(nghttp2_stream *stream, nghttp2_stream *dep_stream) {
+  for (; stream; stream = stream->sib_next) {
+    stream->dep_prev = dep_stream;
+  }
+}
 
-  prev = stream->sib_prev;
-  dep_next = stream->dep_next;
+int nghttp2_stream_dep_insert(nghttp2_stream *dep_stream,
+                              nghttp2_stream *stream) {
+  nghttp2_stream *si;
+  int rv;
 
-  assert(prev);
+  assert(stream->item == NULL);
 
-  if (dep_next) {
-    /*
-     *  prev--stream(--sib_next--...)
-     *         |
-     *        dep_next
-     */
-    dep_next->dep_prev = NULL;
+  DEBUGF(fprintf(stderr,
+                 "stream: dep_insert dep_stream(%p)=%d, stream(%p)=%d\n",
+                 dep_stream, dep_stream->stream_id, stream, stream->stream_id));
 
-    link_sib(prev, dep_next);
+  stream->sum_dep_weight = dep_stream->sum_dep_weight;
+  dep_stream->sum_dep_weight = stream->weight;
 
-    if (stream->sib_next) {
-      link_sib(stream_last_sib(dep_next), stream->sib_next);
+  if (dep_stream->dep_next) {
+    for (si = dep_stream->dep_next; si; si = si->sib_next) {
+      stream->num_substreams += si->num_substreams;
     }
-  } else {
-    /*
-     *  prev--stream(--sib_next--...)
-     */
-    next = stream->sib_next;
 
-    prev->sib_next = next;
-
-    if (next) {
-      next->sib_prev = prev;
-    }
+    stream->dep_next = dep_stream->dep_next;
+    set_dep_prev(stream->dep_next, stream);
   }
-}
-
-static void unlink_dep(nghttp2_stream *stream) {
-  nghttp2_stream *prev, *next, *dep_next;
 
-  prev = stream->dep_prev;
-  dep_next = stream->dep_next;
+  link_dep(dep_stream, stream);
 
-  assert(prev);
+  stream_update_dep_length(dep_stream, 1);
 
-  if (dep_next) {
-    /*
-     * prev
-     *   |
-     * stream(--sib_next--...)
-     *   |
-     * dep_next
-     */
-    link_dep(prev, dep_next);
+  ++stream->roots->num_streams;
 
-    if (stream->sib_next) {
-      link_sib(stream_last_sib(dep_next), stream->sib_next);
+  for (si = stream->dep_next; si; si = si->sib_next) {
+    if (!si->queued) {
+      continue;
     }
-  } else if (stream->sib_next) {
-    /*
-     * prev
-     *   |
-     * stream--sib_next
-     */
-    next = stream->sib_next;
-
-    next->sib_prev = NULL;
 
-    link_dep(prev, next);
-  } else {
-    prev->dep_next = NULL;
+    rv = stream_obq_move(stream, dep_stream, si);
+    if (rv != 0) {
+      return rv;
+    }
   }
+
+  return 0;
 }
 
 void nghttp2_stream_dep_add(nghttp2_stream *dep_stream,
                             nghttp2_stream *stream) {
-  nghttp2_stream *root_stream;
-
   assert(stream->item == NULL);
 
   DEBUGF(fprintf(stderr, "stream: dep_add dep_stream(%p)=%d, stream(%p)=%d\n",
                  dep_stream, dep_stream->stream_id, stream, stream->stream_id));
 
-  root_stream = stream_update_dep_length(dep_stream, 1);
+  stream_update_dep_length(dep_stream, 1);
 
   dep_stream->sum_dep_weight += stream->weight;
 
@@ -711,17 +578,13 @@ void nghttp2_stream_dep_add(nghttp2_stream *dep_stream,
     insert_link_dep(dep_stream, stream);
   }
 
-  stream_update_dep_sum_norest_weight(root_stream);
-  stream_update_dep_effective_weight(root_stream);
-
   ++stream->roots->num_streams;
 }
 
-void nghttp2_stream_dep_remove(nghttp2_stream *stream) {
-  nghttp2_stream *prev, *next, *dep_prev, *si, *root_stream;
+int nghttp2_stream_dep_remove(nghttp2_stream *stream) {
+  nghttp2_stream *prev, *next, *dep_prev, *si, *dep_next, *obq_parent;
   int32_t sum_dep_weight_delta;
-
-  root_stream = NULL;
+  int rv;
 
   DEBUGF(fprintf(stderr, "stream: dep_remove stream(%p)=%d\n", stream,
                  stream->stream_id));
@@ -735,47 +598,89 @@ void nghttp2_stream_dep_remove(nghttp2_stream *stream) {
     sum_dep_weight_delta += si->weight;
   }
 
-  prev = stream_first_sib(stream);
+  /* Direct descendants which have something to send are queued in
+     the obq of the parent of |stream| from now on.  We move them
+     before removing |stream| from the obq, so that the ancestors are
+     not dequeued in between. */
+  obq_parent = stream_obq_parent(stream);
 
-  dep_prev = prev->dep_prev;
+  for (si = stream->dep_next; si; si = si->sib_next) {
+    if (!si->queued) {
+      continue;
+    }
+
+    rv = stream_obq_move(obq_parent, stream, si);
+    if (rv != 0) {
+      return rv;
+    }
+  }
+
+  stream_obq_remove(stream);
+
+  dep_prev = stream->dep_prev;
+  dep_next = stream->dep_next;
+  prev = stream->sib_prev;
+  next = stream->sib_next;
 
   if (dep_prev) {
-    root_stream = stream_update_dep_length(dep_prev, -1);
+    stream_update_dep_length(dep_prev, -1);
 
     dep_prev->sum_dep_weight += sum_dep_weight_delta;
-  }
 
-  if (stream->sib_prev) {
-    unlink_sib(stream);
-  } else if (stream->dep_prev) {
-    unlink_dep(stream);
+    if (dep_next) {
+      /*
+       * dep_prev
+       *    |
+       * (...--)stream(--next--...)
+       *          |
+       *        dep_next
+       */
+      set_dep_prev(dep_next, dep_prev);
+
+      if (prev) {
+        link_sib(prev, dep_next);
+      } else {
+        dep_prev->dep_next = dep_next;
+      }
+
+      if (next) {
+        link_sib(stream_last_sib(dep_next), next);
+      }
+    } else {
+      /*
+       * dep_prev
+       *    |
+       * (...--)stream(--next--...)
+       */
+      if (prev) {
+        prev->sib_next = next;
+      } else {
+        dep_prev->dep_next = next;
+      }
+
+      if (next) {
+        next->sib_prev = prev;
+      }
+    }
   } else {
     nghttp2_stream_roots_remove(stream->roots, stream);
 
     /* stream is a root of tree.  Removing stream makes its
        descendants a root of its own subtree. */
 
-    for (si = stream->dep_next; si;) {
+    for (si = dep_next; si;) {
       next = si->sib_next;
 
       si->dep_prev = NULL;
       si->sib_prev = NULL;
       si->sib_next = NULL;
 
-      /* We already distributed weight of |stream| to this. */
-      si->effective_weight = si->weight;
-
       nghttp2_stream_roots_add(si->roots, si);
 
       si = next;
     }
   }
 
-  if (root_stream) {
-    stream_update_dep_sum_norest_weight(root_stream);
-    stream_update_dep_effective_weight(root_stream);
-  }
-
   stream->num_substreams = 1;
   stream->sum_dep_weight = 0;
 
@@ -785,15 +690,17 @@ void nghttp2_stream_dep_remove(nghttp2_stream *stream) {
   stream->sib_next = NULL;
 
   --stream->roots->num_streams;
+
+  return 0;
 }
 
 int nghttp2_stream_dep_insert_subtree(nghttp2_stream *dep_stream,
-                                      nghttp2_stream *stream,
-                                      nghttp2_session *session) {
+                                      nghttp2_stream *stream) {
   nghttp2_stream *last_sib;
   nghttp2_stream *dep_next;
-  nghttp2_stream *root_stream;
+  nghttp2_stream *si;
   size_t delta_substreams;
+  int rv;
 
   DEBUGF(fprintf(stderr, "stream: dep_insert_subtree dep_stream(%p)=%d "
                          "stream(%p)=%d\n",
@@ -801,8 +708,6 @@ int nghttp2_stream_dep_insert_subtree(nghttp2_stream *dep_stream,
 
   delta_substreams = stream->num_substreams;
 
-  stream_update_dep_set_rest(stream);
-
   if (dep_stream->dep_next) {
     /* dep_stream->num_substreams includes dep_stream itself */
     stream->num_substreams += dep_stream->num_substreams - 1;
@@ -812,18 +717,27 @@ int nghttp2_stream_dep_insert_subtree(nghttp2_stream *dep_stream,
 
     dep_next = dep_stream->dep_next;
 
-    stream_update_dep_set_rest(dep_next);
-
-    link_dep(dep_stream, stream);
+    set_dep_prev(dep_next, stream);
 
     if (stream->dep_next) {
       last_sib = stream_last_sib(stream->dep_next);
 
       link_sib(last_sib, dep_next);
-
-      dep_next->dep_prev = NULL;
     } else {
-      link_dep(stream, dep_next);
+      stream->dep_next = dep_next;
+    }
+
+    link_dep(dep_stream, stream);
+
+    for (si = dep_next; si; si = si->sib_next) {
+      if (!si->queued) {
+        continue;
+      }
+
+      rv = stream_obq_move(stream, dep_stream, si);
+      if (rv != 0) {
+        return rv;
+      }
     }
   } else {
     link_dep(dep_stream, stream);
@@ -832,27 +746,21 @@ int nghttp2_stream_dep_insert_subtree(nghttp2_stream *dep_stream,
     dep_stream->sum_dep_weight = stream->weight;
   }
 
-  root_stream = stream_update_dep_length(dep_stream, delta_substreams);
-
-  stream_update_dep_set_top(root_stream);
+  stream_update_dep_length(dep_stream, delta_substreams);
 
-  stream_update_dep_sum_norest_weight(root_stream);
-  stream_update_dep_effective_weight(root_stream);
+  if (stream_subtree_active(stream)) {
+    return stream_obq_push(dep_stream, stream);
+  }
 
-  return stream_update_dep_queue_top(root_stream, session);
+  return 0;
 }
 
 int nghttp2_stream_dep_add_subtree(nghttp2_stream *dep_stream,
-                                   nghttp2_stream *stream,
-                                   nghttp2_session *session) {
-  nghttp2_stream *root_stream;
-
+                                   nghttp2_stream *stream) {
   DEBUGF(fprintf(stderr, "stream: dep_add_subtree dep_stream(%p)=%d "
                          "stream(%p)=%d\n",
                  dep_stream, dep_stream->stream_id, stream, stream->stream_id));
 
-  stream_update_dep_set_rest(stream);
-
   if (dep_stream->dep_next) {
     dep_stream->sum_dep_weight += stream->weight;
 
@@ -864,59 +772,43 @@ int nghttp2_stream_dep_add_subtree(nghttp2_stream *dep_stream,
     dep_stream->sum_dep_weight = stream->weight;
   }
 
-  root_stream = stream_update_dep_length(dep_stream, stream->num_substreams);
+  stream_update_dep_length(dep_stream, stream->num_substreams);
 
-  stream_update_dep_set_top(root_stream);
-
-  stream_update_dep_sum_norest_weight(root_stream);
-  stream_update_dep_effective_weight(root_stream);
+  if (stream_subtree_active(stream)) {
+    return stream_obq_push(dep_stream, stream);
+  }
 
-  return stream_update_dep_queue_top(root_stream, session);
+  return 0;
 }
 
 void nghttp2_stream_dep_remove_subtree(nghttp2_stream *stream) {
-  nghttp2_stream *prev, *next, *dep_prev, *root_stream;
+  nghttp2_stream *prev, *next, *dep_prev;
 
   DEBUGF(fprintf(stderr, "stream: dep_remove_subtree stream(%p)=%d\n", stream,
                  stream->stream_id));
 
-  if (stream->sib_prev) {
-    prev = stream->sib_prev;
-
-    prev->sib_next = stream->sib_next;
-    if (prev->sib_next) {
-      prev->sib_next->sib_prev = prev;
-    }
-
-    prev = stream_first_sib(prev);
-
-    dep_prev = prev->dep_prev;
+  stream_obq_remove(stream);
 
-  } else if (stream->dep_prev) {
-    dep_prev = stream->dep_prev;
-    next = stream->sib_next;
+  prev = stream->sib_prev;
+  next = stream->sib_next;
+  dep_prev = stream->dep_prev;
 
-    dep_prev->dep_next = next;
+  if (dep_prev) {
+    if (prev) {
+      prev->sib_next = next;
+    } else {
+      dep_prev->dep_next = next;
+    }
 
     if (next) {
-      next->dep_prev = dep_prev;
-
-      next->sib_prev = NULL;
+      next->sib_prev = prev;
     }
 
-  } else {
-    nghttp2_stream_roots_remove(stream->roots, stream);
-
-    dep_prev = NULL;
-  }
-
-  if (dep_prev) {
     dep_prev->sum_dep_weight -= stream->weight;
 
-    root_stream = stream_update_dep_length(dep_prev, -stream->num_substreams);
-
-    stream_update_dep_sum_norest_weight(root_stream);
-    stream_update_dep_effective_weight(root_stream);
+    stream_update_dep_length(dep_prev, -stream->num_substreams);
+  } else {
+    nghttp2_stream_roots_remove(stream->roots, stream);
   }
 
   stream->sib_prev = NULL;
@@ -924,82 +816,90 @@ void nghttp2_stream_dep_remove_subtree(nghttp2_stream *stream) {
   stream->dep_prev = NULL;
 }
 
-int nghttp2_stream_dep_make_root(nghttp2_stream *stream,
-                                 nghttp2_session *session) {
+int nghttp2_stream_dep_make_root(nghttp2_stream *stream) {
   DEBUGF(fprintf(stderr, "stream: dep_make_root stream(%p)=%d\n", stream,
                  stream->stream_id));
 
   nghttp2_stream_roots_add(stream->roots, stream);
 
-  stream_update_dep_set_rest(stream);
-
-  stream->effective_weight = stream->weight;
-
-  stream_update_dep_set_top(stream);
-
-  stream_update_dep_sum_norest_weight(stream);
-  stream_update_dep_effective_weight(stream);
+  if (stream_subtree_active(stream)) {
+    return stream_obq_push(&stream->roots->root, stream);
+  }
 
-  return stream_update_dep_queue_top(stream, session);
+  return 0;
 }
 
 int
-nghttp2_stream_dep_all_your_stream_are_belong_to_us(nghttp2_stream *stream,
-                                                    nghttp2_session *session) {
-  nghttp2_stream *first, *si;
+nghttp2_stream_dep_all_your_stream_are_belong_to_us(nghttp2_stream *stream) {
+  nghttp2_stream *first, *prev, *si, *next;
+  nghttp2_stream *root;
+  int rv;
 
   DEBUGF(fprintf(stderr, "stream: ALL YOUR STREAM ARE BELONG TO US "
                          "stream(%p)=%d\n",
                  stream, stream->stream_id));
 
+  root = &stream->roots->root;
   first = stream->roots->head;
 
   /* stream must not be include in stream->roots->head list */
   assert(first != stream);
 
-  if (first) {
-    nghttp2_stream *prev;
-
-    prev = first;
+  if (first == NULL) {
+    return nghttp2_stream_dep_make_root(stream);
+  }
 
-    DEBUGF(fprintf(stderr, "stream: root stream(%p)=%d\n", first,
-                   first->stream_id));
+  /* Link the root streams as siblings, followed by the existing
+     direct descendants of |stream|. */
+  prev = NULL;
 
-    stream->sum_dep_weight += first->weight;
-    stream->num_substreams += first->num_substreams;
+  for (si = first; si; si = next) {
+    assert(si != stream);
 
-    for (si = first->root_next; si; si = si->root_next) {
+    DEBUGF(fprintf(stderr, "stream: root stream(%p)=%d\n", si, si->stream_id));
 
-      assert(si != stream);
+    next = si->root_next;
 
-      DEBUGF(
-          fprintf(stderr, "stream: root stream(%p)=%d\n", si, si->stream_id));
+    stream->sum_dep_weight += si->weight;
+    stream->num_substreams += si->num_substreams;
 
-      stream->sum_dep_weight += si->weight;
-      stream->num_substreams += si->num_substreams;
+    si->dep_prev = stream;
 
+    if (prev) {
       link_sib(prev, si);
-
-      prev = si;
     }
 
-    if (stream->dep_next) {
-      nghttp2_stream *sib_next;
+    prev = si;
+  }
 
-      sib_next = stream->dep_next;
+  if (stream->dep_next) {
+    link_sib(prev, stream->dep_next);
+  }
 
-      sib_next->dep_prev = NULL;
+  link_dep(stream, first);
 
-      link_sib(first, sib_next);
-      link_dep(stream, prev);
-    } else {
-      link_dep(stream, first);
+  nghttp2_stream_roots_remove_all(stream->roots);
+  nghttp2_stream_roots_add(stream->roots, stream);
+
+  /* The former root streams are queued under |stream| from now on. */
+  for (si = first; si; si = si->sib_next) {
+    if (si->queued) {
+      rv = stream_obq_move(stream, root, si);
+      if (rv != 0) {
+        return rv;
+      }
+    }
+
+    if (si == prev) {
+      break;
     }
   }
 
-  nghttp2_stream_roots_remove_all(stream->roots);
+  if (stream_subtree_active(stream)) {
+    return stream_obq_push(root, stream);
+  }
 
-  return nghttp2_stream_dep_make_root(stream, session);
+  return 0;
 }
 
 int nghttp2_stream_in_dep_tree(nghttp2_stream *stream) {
@@ -1008,12 +908,19 @@ int nghttp2_stream_in_dep_tree(nghttp2_stream *stream) {
          stream->roots->head == stream;
 }
 
-void nghttp2_stream_roots_init(nghttp2_stream_roots *roots) {
+void nghttp2_stream_roots_init(nghttp2_stream_roots *roots, nghttp2_mem *mem) {
+  nghttp2_stream_init(&roots->root, 0, NGHTTP2_STREAM_FLAG_NONE,
+                      NGHTTP2_STREAM_IDLE, NGHTTP2_DEFAULT_WEIGHT, roots, 0, 0,
+                      NULL, mem);
+
   roots->head = NULL;
   roots->num_streams = 0;
+  roots->num_active = 0;
 }
 
-void nghttp2_stream_roots_free(nghttp2_stream_roots *roots _U_) {}
+void nghttp2_stream_roots_free(nghttp2_stream_roots *roots) {
+  nghttp2_stream_free(&roots->root);
+}
 
 void nghttp2_stream_roots_add(nghttp2_stream_roots *roots,
                               nghttp2_stream *stream) {
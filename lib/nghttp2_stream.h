@@ -126,13 +126,6 @@ typedef enum {
   NGHTTP2_HTTP_FLAG_EXPECT_FINAL_RESPONSE = 1 << 9,
 } nghttp2_http_flag;
 
-typedef enum {
-  NGHTTP2_STREAM_DPRI_NONE = 0,
-  NGHTTP2_STREAM_DPRI_NO_ITEM = 0x01,
-  NGHTTP2_STREAM_DPRI_TOP = 0x02,
-  NGHTTP2_STREAM_DPRI_REST = 0x04
-} nghttp2_stream_dpri;
-
 struct nghttp2_stream_roots;
 
 typedef struct nghttp2_stream_roots nghttp2_stream_roots;
@@ -144,13 +137,20 @@ typedef struct nghttp2_stream nghttp2_stream;
 struct nghttp2_stream {
   /* Intrusive Map */
   nghttp2_map_entry map_entry;
+  /* Entry for the obq of the parent stream, or the obq of
+     roots->root if this stream is a root of dependency tree. */
+  nghttp2_pq_entry pq_entry;
+  /* Priority queue of direct descendants which have DATA to send
+     themselves, or have such a stream in their subtree.  The
+     descendant with the smallest cycle is served first. */
+  nghttp2_pq obq;
   /* pointers to form dependency tree.  If multiple streams depend on
-     a stream, only one stream (left most) has non-NULL dep_prev which
-     points to the stream it depends on. The remaining streams are
-     linked using sib_prev and sib_next.  The stream which has
-     non-NULL dep_prev always NULL sib_prev.  The right most stream
-     has NULL sib_next.  If this stream is a root of dependency tree,
-     dep_prev and sib_prev are NULL. */
+     a stream, all of them have dep_prev which points to the stream
+     they depend on, and the left most one is pointed by dep_next of
+     that stream.  Siblings are linked using sib_prev and sib_next.
+     The left most stream has NULL sib_prev, and the right most
+     stream has NULL sib_next.  If this stream is a root of dependency
+     tree, dep_prev and sib_prev are NULL. */
   nghttp2_stream *dep_prev, *dep_next;
   nghttp2_stream *sib_prev, *sib_next;
   /* pointers to track dependency tree root streams.  This is
@@ -170,11 +170,27 @@ struct nghttp2_stream {
   nghttp2_outbound_item *item;
   /* stream ID */
   int32_t stream_id;
-  /* categorized priority of this stream.  Only stream bearing
-     NGHTTP2_STREAM_DPRI_TOP can send item. */
-  nghttp2_stream_dpri dpri;
   /* the number of streams in subtree */
   size_t num_substreams;
+  /* The virtual finish time of this stream among its siblings.  Each
+     time DATA is sent, it is advanced by the amount of data divided
+     by weight, so that the bandwidth is shared in proportion to
+     weight. */
+  uint64_t cycle;
+  /* The cycle of the descendant which was served last.  A descendant
+     which is newly queued starts from this value. */
+  uint64_t descendant_last_cycle;
+  /* Sequence number to serve the streams of the same cycle in the
+     order of queueing */
+  uint64_t seq;
+  /* The sequence number assigned to the next queued descendant */
+  uint64_t descendant_next_seq;
+  /* The time when DATA was deferred by flow control, in
+     milliseconds.  Only used with the session statistics. */
+  uint64_t deferred_msec;
+  /* The time when WINDOW_UPDATE was last sent for this stream, in
+     milliseconds.  Only used with the receive window auto-tuning. */
+  uint64_t window_update_msec;
   /* Current remote window size. This value is computed against the
      current initial window size of remote endpoint. */
   int32_t remote_window_size;
@@ -193,24 +209,24 @@ struct nghttp2_stream {
      NGHTTP2_INITIAL_WINDOW_SIZE and could be increased/decreased by
      submitting WINDOW_UPDATE. See nghttp2_submit_window_update(). */
   int32_t local_window_size;
+  /* The amount of local_window_size grown by the receive window
+     auto-tuning.  It is accounted in the session's budget. */
+  int32_t window_growth;
   /* weight of this stream */
   int32_t weight;
-  /* effective weight of this stream in belonging dependency tree */
-  int32_t effective_weight;
-  /* sum of weight (not effective_weight) of direct descendants */
+  /* sum of weight of direct descendants */
   int32_t sum_dep_weight;
-  /* sum of weight of direct descendants which have at least one
-     descendant with dpri == NGHTTP2_STREAM_DPRI_TOP.  We use this
-     value to calculate effective weight. */
-  int32_t sum_norest_weight;
-  /* sum of weight of direct descendants whose dpri value is
-     NGHTTP2_STREAM_DPRI_TOP */
-  int32_t sum_top_weight;
+  /* The remainder of the division by weight when cycle was advanced
+     last time.  It is carried over to the next advance, so that no
+     share is lost to rounding. */
+  uint32_t pending_penalty;
   nghttp2_stream_state state;
   /* This is bitwise-OR of 0 or more of nghttp2_stream_flag. */
   uint8_t flags;
   /* Bitwise OR of zero or more nghttp2_shut_flag values */
   uint8_t shut_flags;
+  /* nonzero if this stream is queued in the obq of its parent */
+  uint8_t queued;
   /* Content-Length of request/response body.  -1 if unknown. */
   int64_t content_length;
   /* Received body so far */
@@ -226,7 +242,7 @@ void nghttp2_stream_init(nghttp2_stream *stream, int32_t stream_id,
                          int32_t weight, nghttp2_stream_roots *roots,
                          int32_t remote_initial_window_size,
                          int32_t local_initial_window_size,
-                         void *stream_user_data);
+                         void *stream_user_data, nghttp2_mem *mem);
 
 void nghttp2_stream_free(nghttp2_stream *stream);
 
@@ -242,15 +258,8 @@ void nghttp2_stream_shutdown(nghttp2_stream *stream, nghttp2_shut_flag flag);
  * more of NGHTTP2_STREAM_FLAG_DEFERRED_USER and
  * NGHTTP2_STREAM_FLAG_DEFERRED_FLOW_CONTROL.  The |flags| indicates
  * the reason of this action.
- *
- * This function returns 0 if it succeeds, or one of the following
- * negative error codes:
- *
- * NGHTTP2_ERR_NOMEM
- *     Out of memory
  */
-int nghttp2_stream_defer_item(nghttp2_stream *stream, uint8_t flags,
-                              nghttp2_session *session);
+void nghttp2_stream_defer_item(nghttp2_stream *stream, uint8_t flags);
 
 /*
  * Put back deferred data in this stream to active state.  The |flags|
@@ -259,9 +268,15 @@ int nghttp2_stream_defer_item(nghttp2_stream *stream, uint8_t flags,
  * NGHTTP2_STREAM_FLAG_DEFERRED_FLOW_CONTROL and given masks are
  * cleared if they are set.  So even if this function is called, if
  * one of flag is still set, data does not become active.
+ *
+ * This function returns 0 if it succeeds, or one of the following
+ * negative error codes:
+ *
+ * NGHTTP2_ERR_NOMEM
+ *     Out of memory
  */
-int nghttp2_stream_resume_deferred_item(nghttp2_stream *stream, uint8_t flags,
-                                        nghttp2_session *session);
+int nghttp2_stream_resume_deferred_item(nghttp2_stream *stream,
+                                        uint8_t flags);
 
 /*
  * Returns nonzero if item is deferred by whatever reason.
@@ -318,48 +333,35 @@ int nghttp2_stream_dep_subtree_find(nghttp2_stream *stream,
 
 /*
  * Computes distributed weight of a stream of the |weight| under the
- * |stream| if |stream| is removed from a dependency tree.  The result
- * is computed using stream->weight rather than
- * stream->effective_weight.
+ * |stream| if |stream| is removed from a dependency tree.
  */
 int32_t nghttp2_stream_dep_distributed_weight(nghttp2_stream *stream,
                                               int32_t weight);
 
-/*
- * Computes effective weight of a stream of the |weight| under the
- * |stream|.  The result is computed using stream->effective_weight
- * rather than stream->weight.  This function is used to determine
- * weight in dependency tree.
- */
-int32_t nghttp2_stream_dep_distributed_effective_weight(nghttp2_stream *stream,
-                                                        int32_t weight);
-
 /*
  * Makes the |stream| depend on the |dep_stream|.  This dependency is
  * exclusive.  All existing direct descendants of |dep_stream| become
  * the descendants of the |stream|.  This function assumes
- * |stream->data| is NULL and no dpri members are changed in this
- * dependency tree.
+ * |stream->item| is NULL.
+ *
+ * This function returns 0 if it succeeds, or one of the following
+ * negative error codes:
+ *
+ * NGHTTP2_ERR_NOMEM
+ *     Out of memory
  */
-void nghttp2_stream_dep_insert(nghttp2_stream *dep_stream,
-                               nghttp2_stream *stream);
+int nghttp2_stream_dep_insert(nghttp2_stream *dep_stream,
+                              nghttp2_stream *stream);
 
 /*
  * Makes the |stream| depend on the |dep_stream|.  This dependency is
- * not exclusive.  This function assumes |stream->data| is NULL and no
- * dpri members are changed in this dependency tree.
+ * not exclusive.  This function assumes |stream->item| is NULL.
  */
 void nghttp2_stream_dep_add(nghttp2_stream *dep_stream, nghttp2_stream *stream);
 
 /*
  * Removes the |stream| from the current dependency tree.  This
- * function assumes |stream->data| is NULL.
- */
-void nghttp2_stream_dep_remove(nghttp2_stream *stream);
-
-/*
- * Attaches |item| to |stream|.  Updates dpri members in this
- * dependency tree.
+ * function assumes |stream->item| is NULL.
  *
  * This function returns 0 if it succeeds, or one of the following
  * negative error codes:
@@ -367,14 +369,11 @@ void nghttp2_stream_dep_remove(nghttp2_stream *stream);
  * NGHTTP2_ERR_NOMEM
  *     Out of memory
  */
-int nghttp2_stream_attach_item(nghttp2_stream *stream,
-                               nghttp2_outbound_item *item,
-                               nghttp2_session *session);
+int nghttp2_stream_dep_remove(nghttp2_stream *stream);
 
 /*
- * Detaches |stream->item|.  Updates dpri members in this dependency
- * tree.  This function does not free |stream->item|.  The caller must
- * free it.
+ * Attaches |item| to |stream|.  If |item| is DATA, |stream| is
+ * scheduled for transmission.
  *
  * This function returns 0 if it succeeds, or one of the following
  * negative error codes:
@@ -382,12 +381,18 @@ int nghttp2_stream_attach_item(nghttp2_stream *stream,
  * NGHTTP2_ERR_NOMEM
  *     Out of memory
  */
-int nghttp2_stream_detach_item(nghttp2_stream *stream,
-                               nghttp2_session *session);
+int nghttp2_stream_attach_item(nghttp2_stream *stream,
+                               nghttp2_outbound_item *item);
+
+/*
+ * Detaches |stream->item|.  This function does not free
+ * |stream->item|.  The caller must free it.
+ */
+void nghttp2_stream_detach_item(nghttp2_stream *stream);
 
 /*
  * Makes the |stream| depend on the |dep_stream|.  This dependency is
- * exclusive.  Updates dpri members in this dependency tree.
+ * exclusive.
  *
  * This function returns 0 if it succeeds, or one of the following
  * negative error codes:
@@ -396,12 +401,11 @@ int nghttp2_stream_detach_item(nghttp2_stream *stream,
  *     Out of memory
  */
 int nghttp2_stream_dep_insert_subtree(nghttp2_stream *dep_stream,
-                                      nghttp2_stream *stream,
-                                      nghttp2_session *session);
+                                      nghttp2_stream *stream);
 
 /*
  * Makes the |stream| depend on the |dep_stream|.  This dependency is
- * not exclusive.  Updates dpri members in this dependency tree.
+ * not exclusive.
  *
  * This function returns 0 if it succeeds, or one of the following
  * negative error codes:
@@ -410,25 +414,17 @@ int nghttp2_stream_dep_insert_subtree(nghttp2_stream *dep_stream,
  *     Out of memory
  */
 int nghttp2_stream_dep_add_subtree(nghttp2_stream *dep_stream,
-                                   nghttp2_stream *stream,
-                                   nghttp2_session *session);
+                                   nghttp2_stream *stream);
 
 /*
- * Removes subtree whose root stream is |stream|.  Removing subtree
- * does not change dpri values.  The effective_weight of streams in
- * removed subtree is not updated.
- *
- * This function returns 0 if it succeeds, or one of the following
- * negative error codes:
- *
- * NGHTTP2_ERR_NOMEM
- *     Out of memory
+ * Removes subtree whose root stream is |stream|.  The scheduling
+ * state of streams in removed subtree is kept, and it is queued
+ * again when the subtree is added to a dependency tree.
  */
 void nghttp2_stream_dep_remove_subtree(nghttp2_stream *stream);
 
 /*
- * Makes the |stream| as root.  Updates dpri members in this
- * dependency tree.
+ * Makes the |stream| as root.
  *
  * This function returns 0 if it succeeds, or one of the following
  * negative error codes:
@@ -436,8 +432,7 @@ void nghttp2_stream_dep_remove_subtree(nghttp2_stream *stream);
  * NGHTTP2_ERR_NOMEM
  *     Out of memory
  */
-int nghttp2_stream_dep_make_root(nghttp2_stream *stream,
-                                 nghttp2_session *session);
+int nghttp2_stream_dep_make_root(nghttp2_stream *stream);
 
 /*
  * Makes the |stream| as root and all existing root streams become
@@ -450,8 +445,22 @@ int nghttp2_stream_dep_make_root(nghttp2_stream *stream,
  *     Out of memory
  */
 int
-nghttp2_stream_dep_all_your_stream_are_belong_to_us(nghttp2_stream *stream,
-                                                    nghttp2_session *session);
+nghttp2_stream_dep_all_your_stream_are_belong_to_us(nghttp2_stream *stream);
+
+/*
+ * Returns the item of the stream which should send DATA next in the
+ * subtree of |stream|, following the weights of streams.  If no
+ * stream in the subtree has DATA to send, this function returns NULL.
+ */
+nghttp2_outbound_item *
+nghttp2_stream_next_outbound_item(nghttp2_stream *stream);
+
+/*
+ * Charges |writelen| bytes of DATA sent from |stream| to |stream| and
+ * its ancestors, and updates their positions in the obq of their
+ * parents.  |stream| must be queued.
+ */
+void nghttp2_stream_reschedule(nghttp2_stream *stream, size_t writelen);
 
 /*
  * Returns nonzero if |stream| is in any dependency tree.
@@ -459,12 +468,20 @@ nghttp2_stream_dep_all_your_stream_are_belong_to_us(nghttp2_stream *stream,
 int nghttp2_stream_in_dep_tree(nghttp2_stream *stream);
 
 struct nghttp2_stream_roots {
+  /* Pseudo stream which represents stream 0.  It is not a part of
+     dependency tree, but root streams are queued in its obq, so that
+     the bandwidth is shared among trees by their weight. */
+  nghttp2_stream root;
+
   nghttp2_stream *head;
 
   int32_t num_streams;
+  /* The number of streams which have DATA to send and are not
+     deferred */
+  size_t num_active;
 };
 
-void nghttp2_stream_roots_init(nghttp2_stream_roots *roots);
+void nghttp2_stream_roots_init(nghttp2_stream_roots *roots, nghttp2_mem *mem);
 
 void nghttp2_stream_roots_free(nghttp2_stream_roots *roots);
 
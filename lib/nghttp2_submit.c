@@ -56,7 +56,7 @@ static int32_t submit_headers_shared(nghttp2_session *session, uint8_t flags,
     goto fail;
   }
 
-  item = nghttp2_mem_malloc(mem, sizeof(nghttp2_outbound_item));
+  item = nghttp2_session_alloc_outbound_item(session);
   if (item == NULL) {
     rv = NGHTTP2_ERR_NOMEM;
     goto fail;
@@ -111,7 +111,7 @@ fail:
   /* nghttp2_frame_headers_init() takes ownership of nva_copy. */
   nghttp2_nv_array_del(nva_copy, mem);
 fail2:
-  nghttp2_mem_free(mem, item);
+  nghttp2_session_release_outbound_item(session, item);
 
   return rv;
 }
@@ -190,9 +190,6 @@ int nghttp2_submit_priority(nghttp2_session *session, uint8_t flags _U_,
   nghttp2_outbound_item *item;
   nghttp2_frame *frame;
   nghttp2_priority_spec copy_pri_spec;
-  nghttp2_mem *mem;
-
-  mem = &session->mem;
 
   if (stream_id == 0 || pri_spec == NULL) {
     return NGHTTP2_ERR_INVALID_ARGUMENT;
@@ -206,7 +203,7 @@ int nghttp2_submit_priority(nghttp2_session *session, uint8_t flags _U_,
 
   adjust_priority_spec_weight(&copy_pri_spec);
 
-  item = nghttp2_mem_malloc(mem, sizeof(nghttp2_outbound_item));
+  item = nghttp2_session_alloc_outbound_item(session);
 
   if (item == NULL) {
     return NGHTTP2_ERR_NOMEM;
@@ -222,7 +219,7 @@ int nghttp2_submit_priority(nghttp2_session *session, uint8_t flags _U_,
 
   if (rv != 0) {
     nghttp2_frame_priority_free(&frame->priority);
-    nghttp2_mem_free(mem, item);
+    nghttp2_session_release_outbound_item(session, item);
 
     return rv;
   }
@@ -294,7 +291,7 @@ int32_t nghttp2_submit_push_promise(nghttp2_session *session, uint8_t flags _U_,
     return NGHTTP2_ERR_STREAM_ID_NOT_AVAILABLE;
   }
 
-  item = nghttp2_mem_malloc(mem, sizeof(nghttp2_outbound_item));
+  item = nghttp2_session_alloc_outbound_item(session);
   if (item == NULL) {
     return NGHTTP2_ERR_NOMEM;
   }
@@ -307,7 +304,7 @@ int32_t nghttp2_submit_push_promise(nghttp2_session *session, uint8_t flags _U_,
 
   rv = nghttp2_nv_array_copy(&nva_copy, nva, nvlen, mem);
   if (rv < 0) {
-    nghttp2_mem_free(mem, item);
+    nghttp2_session_release_outbound_item(session, item);
     return rv;
   }
 
@@ -323,7 +320,7 @@ int32_t nghttp2_submit_push_promise(nghttp2_session *session, uint8_t flags _U_,
 
   if (rv != 0) {
     nghttp2_frame_push_promise_free(&frame->push_promise, mem);
-    nghttp2_mem_free(mem, item);
+    nghttp2_session_release_outbound_item(session, item);
 
     return rv;
   }
@@ -440,15 +437,12 @@ int nghttp2_submit_data(nghttp2_session *session, uint8_t flags,
   nghttp2_frame *frame;
   nghttp2_data_aux_data *aux_data;
   uint8_t nflags = flags & NGHTTP2_FLAG_END_STREAM;
-  nghttp2_mem *mem;
-
-  mem = &session->mem;
 
   if (stream_id == 0) {
     return NGHTTP2_ERR_INVALID_ARGUMENT;
   }
 
-  item = nghttp2_mem_malloc(mem, sizeof(nghttp2_outbound_item));
+  item = nghttp2_session_alloc_outbound_item(session);
   if (item == NULL) {
     return NGHTTP2_ERR_NOMEM;
   }
@@ -467,7 +461,7 @@ int nghttp2_submit_data(nghttp2_session *session, uint8_t flags,
   rv = nghttp2_session_add_item(session, item);
   if (rv != 0) {
     nghttp2_frame_data_free(&frame->data);
-    nghttp2_mem_free(mem, item);
+    nghttp2_session_release_outbound_item(session, item);
     return rv;
   }
   return 0;
@@ -49,8 +49,13 @@ def insert(node, sym, bits):
             child = node.right
         insert(child, sym, bits[1:])
 
+# The number of input bits consumed by one decoding table lookup.
+# With 8 bits, at most 2 symbols are emitted per lookup, since the
+# shortest code is 5 bits long.
+STRIDE = 8
+
 def traverse(node, bits, syms, start_node, root, depth):
-    if depth == 4:
+    if depth == STRIDE:
         if 256 in syms:
             syms = []
             node = None
@@ -94,21 +99,24 @@ def dfs(node, root):
 NGHTTP2_HUFF_ACCEPTED = 1
 NGHTTP2_HUFF_SYM = 1 << 1
 NGHTTP2_HUFF_FAIL = 1 << 2
+NGHTTP2_HUFF_SYM2 = 1 << 3
 
 def dfs_print(node):
     if node.term is not None:
         return
-    print '/* {} */'.format(node.id)
-    print '{'
+    print '    /* {} */'.format(node.id)
+    print '    {'
     for nd, bits, syms in node.trans:
         outlen = len(syms)
         flags = 0
-        if outlen == 0:
-            out = 0
-        else:
-            assert(outlen == 1)
-            out = syms[0]
+        out = [0, 0]
+        assert(outlen <= 2)
+        if outlen >= 1:
+            out[0] = syms[0]
             flags |= NGHTTP2_HUFF_SYM
+        if outlen == 2:
+            out[1] = syms[1]
+            flags |= NGHTTP2_HUFF_SYM2
         if nd is None:
             id = 0
             flags |= NGHTTP2_HUFF_FAIL
@@ -120,8 +128,9 @@ def dfs_print(node):
                 flags |= NGHTTP2_HUFF_ACCEPTED
             elif nd.accept:
                 flags |= NGHTTP2_HUFF_ACCEPTED
-        print '  {{{}, 0x{:02x}, {}}},'.format(id, flags, out)
-    print '},'
+        print '     {{{}, 0x{:02x}, {{{}, {}}}}},'.format(id, flags, out[0],
+                                                      out[1])
+    print '    },'
     dfs_print(node.left)
     dfs_print(node.right)
 
@@ -172,18 +181,20 @@ enum {{
   NGHTTP2_HUFF_ACCEPTED = {},
   NGHTTP2_HUFF_SYM = {},
   NGHTTP2_HUFF_FAIL = {},
+  NGHTTP2_HUFF_SYM2 = {},
 }} nghttp2_huff_decode_flag;
-'''.format(NGHTTP2_HUFF_ACCEPTED, NGHTTP2_HUFF_SYM, NGHTTP2_HUFF_FAIL)
+'''.format(NGHTTP2_HUFF_ACCEPTED, NGHTTP2_HUFF_SYM, NGHTTP2_HUFF_FAIL,
+           NGHTTP2_HUFF_SYM2)
 
 print '''\
 typedef struct {
   uint8_t state;
   uint8_t flags;
-  uint8_t sym;
+  uint8_t sym[2];
 } nghttp2_huff_decode;
 '''
 
 print '''\
-const nghttp2_huff_decode huff_decode_table[][16] = {'''
+const nghttp2_huff_decode huff_decode_table[][{}] = {{'''.format(1 << STRIDE)
 dfs_print(root)
 print '};'
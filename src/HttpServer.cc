@@ -25,6 +25,8 @@
 #include "HttpServer.h"
 
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
 #include <sys/socket.h>
 #include <netdb.h>
 #include <unistd.h>
@@ -35,9 +37,11 @@
 
 #include <cassert>
 #include <set>
+#include <unordered_map>
 #include <iostream>
 #include <thread>
 #include <mutex>
+#include <condition_variable>
 #include <deque>
 
 #include <openssl/err.h>
@@ -66,6 +70,67 @@ const std::string DEFAULT_HTML = "index.html";
 const std::string NGHTTPD_SERVER = "nghttpd nghttp2/" NGHTTP2_VERSION;
 } // namespace
 
+namespace {
+// The cached file entry is used without checking the file system for
+// this many seconds.
+constexpr ev_tstamp FILE_ENTRY_MAX_FRESHNESS = 2.;
+// The maximum number of file entries cached per worker.  The entries
+// in use are never evicted, so this may be exceeded temporarily.
+constexpr size_t FILE_ENTRY_MAX_ENTRIES = 1024;
+// The size of a file read issued to the read threads
+constexpr size_t FILE_READ_CHUNK_SIZE = 64 * 1024;
+// The maximum number of completed reads buffered per stream.  The
+// next read is issued while they are sent.
+constexpr size_t FILE_READ_MAX_CHUNKS = 2;
+} // namespace
+
+namespace {
+// The number of bytes of mapped file which are requested ahead of the
+// position being sent.
+constexpr int64_t MMAP_READAHEAD = 1024 * 1024;
+// The maximum number of mapped DATA payloads queued per connection.
+constexpr size_t MAX_MAPPED_SEGMENTS = 16;
+} // namespace
+
+namespace {
+// Files smaller than this are not compressed on the fly.
+constexpr int64_t GZIP_MIN_LENGTH = 256;
+// Files larger than this are not compressed on the fly unless the
+// read threads are enabled, since compression blocks the event loop
+// otherwise.
+constexpr int64_t GZIP_MAX_INLINE_LENGTH = 1024 * 1024;
+} // namespace
+
+namespace {
+// Returns the cache key of file |path|.  If |gzip| is true, it is the
+// key of gzip encoded representation, and ends with a character which
+// never appears in path.
+std::string file_entry_key(const std::string &path, bool gzip) {
+  if (!gzip) {
+    return path;
+  }
+  auto key = path;
+  key += '\0';
+  key += "gzip";
+  return key;
+}
+} // namespace
+
+FileEntry::FileEntry(std::string path, int64_t length, int64_t mtime,
+                     ino_t ino, int fd, ev_tstamp last_valid)
+    : path(std::move(path)), key(this->path),
+      content_length(util::utos(length)),
+      last_modified(mtime == 0 ? "" : util::http_date(mtime)), length(length),
+      file_length(length), mtime(mtime), ino(ino), last_valid(last_valid),
+      map(nullptr), fd(fd), usecount(1), stale(false), gzip(false) {}
+
+FileEntry::~FileEntry() {
+  if (map) {
+    munmap(map, length);
+  }
+  close(fd);
+}
+
 namespace {
 void delete_handler(Http2Handler *handler) {
   handler->remove_self();
@@ -94,9 +159,10 @@ template <typename Array> void append_nv(Stream *stream, const Array &nva) {
 Config::Config()
     : stream_read_timeout(60.), stream_write_timeout(60.),
       session_option(nullptr), data_ptr(nullptr), padding(0), num_worker(1),
-      header_table_size(-1), port(0), verbose(false), daemon(false),
-      verify_client(false), no_tls(false), error_gzip(false),
-      early_response(false) {
+      num_read_thread(0), max_concurrent_push(0), header_table_size(-1),
+      port(0), verbose(false), daemon(false), verify_client(false),
+      no_tls(false), error_gzip(false), early_response(false), stats(false),
+      use_mmap(false), gzip_static(false), gzip(false) {
   nghttp2_option_new(&session_option);
   nghttp2_option_set_recv_client_preface(session_option, 1);
 }
@@ -169,6 +235,114 @@ namespace {
 void fill_callback(nghttp2_session_callbacks *callbacks, const Config *config);
 } // namespace
 
+namespace {
+int gzip_file(int fd, int64_t length);
+} // namespace
+
+// A read of FileEntry issued to FileReader.  The objects are pooled
+// by Sessions.
+struct FileReadJob {
+  // The stream which issued this read.  nullptr if the stream was
+  // closed while the read was in flight.
+  Stream *stream;
+  // The file to read.  The job holds a reference to it.
+  FileEntry *file_ent;
+  int64_t offset;
+  size_t len;
+  // The number of bytes read, or -1 if read failed
+  ssize_t nread;
+  // The number of bytes already sent
+  size_t pos;
+  // true if this job compresses the whole file by gzip instead of
+  // reading a chunk of it
+  bool gzip;
+  // The file descriptor of the compressed copy, or -1
+  int gzip_fd;
+  uint8_t buf[FILE_READ_CHUNK_SIZE];
+};
+
+// Pool of threads which read files with pread(), or compress them, so
+// that a cold page cache or a large file does not block the event
+// loop.  |done_ev| is signaled when jobs complete.
+class FileReader {
+public:
+  FileReader(size_t num_thread, struct ev_loop *loop, ev_async *done_ev)
+      : loop_(loop), done_ev_(done_ev), shutdown_(false) {
+    for (size_t i = 0; i < num_thread; ++i) {
+      threads_.emplace_back([this]() { run(); });
+    }
+  }
+  ~FileReader() {
+    {
+      std::lock_guard<std::mutex> g(mu_);
+      shutdown_ = true;
+    }
+    cv_.notify_all();
+    for (auto &t : threads_) {
+      t.join();
+    }
+  }
+  void submit(FileReadJob *job) {
+    {
+      std::lock_guard<std::mutex> g(mu_);
+      queue_.push_back(job);
+    }
+    cv_.notify_one();
+  }
+  // Appends completed reads to |jobs|.
+  void get_done(std::vector<FileReadJob *> &jobs) {
+    std::lock_guard<std::mutex> g(mu_);
+    jobs.insert(std::end(jobs), std::begin(done_), std::end(done_));
+    done_.clear();
+  }
+
+private:
+  void run() {
+    for (;;) {
+      FileReadJob *job;
+      {
+        std::unique_lock<std::mutex> ul(mu_);
+        cv_.wait(ul, [this]() { return shutdown_ || !queue_.empty(); });
+        if (shutdown_) {
+          return;
+        }
+        job = queue_.front();
+        queue_.pop_front();
+      }
+
+      if (job->gzip) {
+        job->gzip_fd = gzip_file(job->file_ent->fd, job->file_ent->length);
+      } else {
+        ssize_t nread;
+        while ((nread = pread(job->file_ent->fd, job->buf, job->len,
+                              job->offset)) == -1 &&
+               errno == EINTR)
+          ;
+        job->nread = nread;
+      }
+
+      {
+        std::lock_guard<std::mutex> g(mu_);
+        done_.push_back(job);
+      }
+      ev_async_send(loop_, done_ev_);
+    }
+  }
+
+  std::mutex mu_;
+  std::condition_variable cv_;
+  std::deque<FileReadJob *> queue_;
+  std::vector<FileReadJob *> done_;
+  std::vector<std::thread> threads_;
+  struct ev_loop *loop_;
+  ev_async *done_ev_;
+  bool shutdown_;
+};
+
+namespace {
+void file_read_done_cb(struct ev_loop *loop, ev_async *w, int revents);
+} // namespace
+
 class Sessions {
 public:
   Sessions(struct ev_loop *loop, const Config *config, SSL_CTX *ssl_ctx)
@@ -178,11 +352,27 @@ public:
     nghttp2_session_callbacks_new(&callbacks_);
 
     fill_callback(callbacks_, config_);
+
+    ev_async_init(&read_done_ev_, file_read_done_cb);
+    read_done_ev_.data = this;
   }
   ~Sessions() {
+    if (file_reader_) {
+      file_reader_.reset();
+      ev_async_stop(loop_, &read_done_ev_);
+    }
     for (auto handler : handlers_) {
       delete handler;
     }
+    // Jobs which were in flight still hold their file entries
+    for (auto &job : read_jobs_) {
+      if (job->file_ent) {
+        release_fd(job->file_ent);
+      }
+      if (job->gzip_fd != -1) {
+        close(job->gzip_fd);
+      }
+    }
     nghttp2_session_callbacks_del(callbacks_);
   }
   void add_handler(Http2Handler *handler) { handlers_.insert(handler); }
@@ -244,8 +434,257 @@ public:
     }
     return cached_date_;
   }
+  // Returns cached file entry for |path| after incrementing its
+  // usecount, or nullptr if it is not cached.  If |gzip| is true,
+  // returns gzip encoded one.  If the entry was not checked for a
+  // while, its file is stat()ed, and if it was modified, the entry is
+  // dropped from the cache.
+  FileEntry *get_cached_fd(const std::string &path, bool gzip = false) {
+    auto it = fd_cache_.find(file_entry_key(path, gzip));
+    if (it == std::end(fd_cache_)) {
+      return nullptr;
+    }
+    auto ent = (*it).second.get();
+    auto now = ev_now(loop_);
+    if (ent->last_valid + FILE_ENTRY_MAX_FRESHNESS < now) {
+      struct stat buf;
+      if (stat(path.c_str(), &buf) != 0 || buf.st_size != ent->file_length ||
+          buf.st_mtime != ent->mtime || buf.st_ino != ent->ino) {
+        drop_fd(it);
+        return nullptr;
+      }
+      ent->last_valid = now;
+    }
+    if (ent->usecount++ == 0) {
+      lru_.erase(ent->lru_it);
+    }
+    return ent;
+  }
+  // Caches opened file |fd| for |path|, and returns its entry with
+  // usecount 1.  The entry takes the ownership of |fd|.  If |gzip| is
+  // true, the file is gzip encoded representation of another file,
+  // and it is returned by get_cached_fd(|path|, true).
+  FileEntry *cache_fd(const std::string &path, const struct stat &buf, int fd,
+                      bool gzip = false) {
+    auto ent = new FileEntry(path, buf.st_size, buf.st_mtime, buf.st_ino, fd,
+                             ev_now(loop_));
+    if (gzip) {
+      ent->key = file_entry_key(path, true);
+      ent->gzip = true;
+    }
+    return add_fd(ent, S_ISREG(buf.st_mode));
+  }
+  // Caches |fd| of length |length| which contains the contents of
+  // |file_ent| compressed by gzip, and returns its entry with
+  // usecount 1.  The entry takes the ownership of |fd|, and is
+  // invalidated when the file of |file_ent| is modified.
+  FileEntry *cache_gzip_fd(const FileEntry *file_ent, int fd,
+                           int64_t length) {
+    auto ent = new FileEntry(file_ent->path, length, file_ent->mtime,
+                             file_ent->ino, fd, file_ent->last_valid);
+    ent->key = file_entry_key(file_ent->path, true);
+    ent->file_length = file_ent->file_length;
+    ent->gzip = true;
+    return add_fd(ent, true);
+  }
+  // Decrements usecount of |ent|.  The entry is kept for the next
+  // stream unless it is stale.
+  void release_fd(FileEntry *ent) {
+    if (--ent->usecount > 0) {
+      return;
+    }
+    if (ent->stale) {
+      delete ent;
+      return;
+    }
+    ent->lru_it = lru_.insert(std::end(lru_), ent);
+    evict_fd();
+  }
+  // Issues the next read of |stream|->file_ent to the read threads,
+  // unless a read is already in flight, enough reads are buffered,
+  // or the whole file was read.
+  void submit_read(Stream *stream) {
+    auto file_ent = stream->file_ent;
+    if (stream->read_job ||
+        stream->read_chunks.size() >= FILE_READ_MAX_CHUNKS ||
+        stream->read_offset >= file_ent->length) {
+      return;
+    }
+    auto job = get_read_job();
+    job->stream = stream;
+    job->file_ent = file_ent;
+    job->offset = stream->read_offset;
+    job->len = std::min(static_cast<int64_t>(FILE_READ_CHUNK_SIZE),
+                        file_ent->length - stream->read_offset);
+    job->nread = 0;
+    job->pos = 0;
+
+    ++file_ent->usecount;
+    stream->read_job = job;
+
+    file_reader_->submit(job);
+  }
+  // Compresses |file_ent| by gzip in the read threads, unless it is
+  // already being compressed.  The compressed copy is cached when it
+  // is done.
+  void submit_gzip(FileEntry *file_ent) {
+    if (!gzip_pending_.insert(file_ent->path).second) {
+      return;
+    }
+    auto job = get_read_job();
+    job->stream = nullptr;
+    job->file_ent = file_ent;
+    job->gzip = true;
+
+    ++file_ent->usecount;
+
+    file_reader_->submit(job);
+  }
+  // Returns |job| to the pool.
+  void release_read_job(FileReadJob *job) {
+    release_fd(job->file_ent);
+    job->file_ent = nullptr;
+    job->stream = nullptr;
+    job->gzip = false;
+    job->gzip_fd = -1;
+    read_job_pool_.push_back(job);
+  }
+  // Hands completed reads to their streams, and resumes the streams
+  // which were waiting for them.
+  void on_read_done() {
+    std::vector<FileReadJob *> jobs;
+    file_reader_->get_done(jobs);
+    for (auto job : jobs) {
+      if (job->gzip) {
+        on_gzip_done(job);
+        continue;
+      }
+      // The stream may have been closed by the processing of the
+      // previous jobs.
+      auto stream = job->stream;
+      if (!stream) {
+        release_read_job(job);
+        continue;
+      }
+      stream->read_job = nullptr;
+      if (job->nread > 0) {
+        stream->read_offset += job->nread;
+      }
+      if (job->nread >= 0 && static_cast<size_t>(job->nread) < job->len) {
+        // The file was truncated or replaced after we opened it.
+        // Sending the rest would shift the content, so fail the
+        // stream.
+        job->nread = -1;
+      }
+      stream->read_chunks.push_back(job);
+      if (job->nread > 0) {
+        submit_read(stream);
+      }
+      if (!stream->read_deferred) {
+        continue;
+      }
+      stream->read_deferred = false;
+      auto hd = stream->handler;
+      if (hd->resume_data(stream) != 0 || hd->on_write() == -1) {
+        delete_handler(hd);
+      }
+    }
+  }
 
 private:
+  // Returns unused FileReadJob, and starts the read threads if they
+  // have not been started yet.
+  FileReadJob *get_read_job() {
+    if (!file_reader_) {
+      ev_async_start(loop_, &read_done_ev_);
+      file_reader_ = make_unique<FileReader>(config_->num_read_thread, loop_,
+                                             &read_done_ev_);
+    }
+    FileReadJob *job;
+    if (read_job_pool_.empty()) {
+      read_jobs_.push_back(make_unique<FileReadJob>());
+      job = read_jobs_.back().get();
+    } else {
+      job = read_job_pool_.back();
+      read_job_pool_.pop_back();
+    }
+    job->gzip = false;
+    job->gzip_fd = -1;
+    return job;
+  }
+  // Caches the compressed copy made by |job|, unless the file was
+  // modified while it was compressed.
+  void on_gzip_done(FileReadJob *job) {
+    auto file_ent = job->file_ent;
+    gzip_pending_.erase(file_ent->path);
+
+    auto fd = job->gzip_fd;
+    job->gzip_fd = -1;
+
+    if (fd != -1) {
+      struct stat buf;
+      if (file_ent->stale || fstat(fd, &buf) != 0) {
+        close(fd);
+      } else {
+        release_fd(cache_gzip_fd(file_ent, fd, buf.st_size));
+      }
+    }
+
+    release_read_job(job);
+  }
+  // Adds |ent| to the cache.  If |regular| is true, the file of |ent|
+  // may be mmap()ed.
+  FileEntry *add_fd(FileEntry *ent, bool regular) {
+    auto it = fd_cache_.find(ent->key);
+    if (it != std::end(fd_cache_)) {
+      // Another stream opened the modified file first.
+      drop_fd(it);
+    }
+    if (config_->use_mmap && regular && ent->length > 0) {
+      auto map =
+          mmap(nullptr, ent->length, PROT_READ, MAP_SHARED, ent->fd, 0);
+      if (map != MAP_FAILED) {
+        ent->map = static_cast<uint8_t *>(map);
+        madvise(map, ent->length, MADV_SEQUENTIAL);
+      }
+    }
+    fd_cache_.emplace(ent->key, std::unique_ptr<FileEntry>(ent));
+    evict_fd();
+    return ent;
+  }
+  void drop_fd(std::unordered_map<std::string,
+                                  std::unique_ptr<FileEntry>>::iterator it) {
+    auto ent = (*it).second.release();
+    fd_cache_.erase(it);
+    if (ent->usecount == 0) {
+      lru_.erase(ent->lru_it);
+      delete ent;
+      return;
+    }
+    // Streams still serve this entry.  It is deleted by release_fd().
+    ent->stale = true;
+  }
+  // Closes least recently used entries while the cache is larger
+  // than FILE_ENTRY_MAX_ENTRIES.
+  void evict_fd() {
+    while (fd_cache_.size() > FILE_ENTRY_MAX_ENTRIES && !lru_.empty()) {
+      auto ent = lru_.front();
+      drop_fd(fd_cache_.find(ent->key));
+    }
+  }
+
+  std::unordered_map<std::string, std::unique_ptr<FileEntry>> fd_cache_;
+  // Cached entries which no stream uses, least recently used first.
+  std::list<FileEntry *> lru_;
+  // All FileReadJob objects ever allocated, and the ones not in use
+  std::vector<std::unique_ptr<FileReadJob>> read_jobs_;
+  std::vector<FileReadJob *> read_job_pool_;
+  // Paths of the files being compressed by the read threads
+  std::set<std::string> gzip_pending_;
+  // Created on the first read, so that the thread pool is not
+  // spawned for Sessions which serve no files.
+  std::unique_ptr<FileReader> file_reader_;
+  ev_async read_done_ev_;
   std::set<Http2Handler *> handlers_;
   struct ev_loop *loop_;
   const Config *config_;
@@ -257,7 +696,9 @@ private:
 };
 
 Stream::Stream(Http2Handler *handler, int32_t stream_id)
-    : handler(handler), body_left(0), stream_id(stream_id), file(-1) {
+    : handler(handler), file_ent(nullptr), read_job(nullptr), read_offset(0),
+      readahead_offset(0), body_left(0), stream_id(stream_id), file(-1),
+      read_deferred(false), push_started(false) {
   auto config = handler->get_config();
   ev_timer_init(&rtimer, stream_timeout_cb, 0., config->stream_read_timeout);
   ev_timer_init(&wtimer, stream_timeout_cb, 0., config->stream_write_timeout);
@@ -270,6 +711,17 @@ Stream::Stream(Http2Handler *handler, int32_t stream_id)
 }
 
 Stream::~Stream() {
+  auto sessions = handler->get_sessions();
+  if (read_job) {
+    // The job is returned to the pool when it completes.
+    read_job->stream = nullptr;
+  }
+  for (auto job : read_chunks) {
+    sessions->release_read_job(job);
+  }
+  if (file_ent) {
+    sessions->release_fd(file_ent);
+  }
   if (file != -1) {
     close(file);
   }
@@ -279,6 +731,13 @@ Stream::~Stream() {
   ev_timer_stop(loop, &wtimer);
 }
 
+namespace {
+void file_read_done_cb(struct ev_loop *loop, ev_async *w, int revents) {
+  auto sessions = static_cast<Sessions *>(w->data);
+  sessions->on_read_done();
+}
+} // namespace
+
 namespace {
 void on_session_closed(Http2Handler *hd, int64_t session_id) {
   if (hd->get_config()->verbose) {
@@ -324,7 +783,8 @@ void writecb(struct ev_loop *loop, ev_io *w, int revents) {
 Http2Handler::Http2Handler(Sessions *sessions, int fd, SSL *ssl,
                            int64_t session_id)
     : session_id_(session_id), session_(nullptr), sessions_(sessions),
-      ssl_(ssl), data_pending_(nullptr), data_pendinglen_(0), fd_(fd) {
+      ssl_(ssl), data_pending_(nullptr), data_pendinglen_(0), num_push_(0),
+      fd_(fd) {
   ev_timer_init(&settings_timerev_, settings_timeout_cb, 10., 0.);
   ev_io_init(&wev_, writecb, fd, EV_WRITE);
   ev_io_init(&rev_, readcb, fd, EV_READ);
@@ -348,7 +808,19 @@ Http2Handler::Http2Handler(Sessions *sessions, int fd, SSL *ssl,
 
 Http2Handler::~Http2Handler() {
   on_session_closed(this, session_id_);
+  if (session_ && sessions_->get_config()->stats) {
+    nghttp2_session_stats stats;
+    if (nghttp2_session_get_stats(session_, &stats) == 0) {
+      print_session_id(session_id_);
+      print_timer();
+      std::cout << " ";
+      print_session_stats(stats);
+    }
+  }
   nghttp2_session_del(session_);
+  for (auto &seg : mapped_segs_) {
+    sessions_->release_fd(seg.file_ent);
+  }
   if (ssl_) {
     SSL_set_shutdown(ssl_, SSL_RECEIVED_SHUTDOWN);
     ERR_clear_error();
@@ -409,6 +881,68 @@ int Http2Handler::fill_wb() {
   return 0;
 }
 
+int Http2Handler::send_mapped_data(Stream *stream, nghttp2_frame *frame,
+                                   const uint8_t *framehd, size_t length) {
+  auto padlen = frame->data.padlen;
+  if (wb_.wleft() < 9 + padlen) {
+    return NGHTTP2_ERR_WOULDBLOCK;
+  }
+
+  wb_.write(framehd, 9);
+  if (padlen > 0) {
+    uint8_t padfield = padlen - 1;
+    wb_.write(&padfield, 1);
+  }
+
+  if (length > 0) {
+    auto file_ent = stream->file_ent;
+    auto offset = file_ent->length - stream->body_left - length;
+
+    // The stream may be closed before the payload is written, so we
+    // hold the mapping on our own.
+    ++file_ent->usecount;
+    mapped_segs_.push_back(
+        {wb_.last, file_ent->map + offset, length, file_ent});
+  }
+
+  if (padlen > 1) {
+    std::fill_n(wb_.last, padlen - 1, 0);
+    wb_.write(padlen - 1);
+  }
+
+  if (mapped_segs_.size() == MAX_MAPPED_SEGMENTS) {
+    // Make nghttp2_session_mem_send() return, so that the queued
+    // payloads are written before the next frame.
+    return NGHTTP2_ERR_PAUSE;
+  }
+
+  return 0;
+}
+
+void Http2Handler::consume_output(size_t n) {
+  while (n > 0 && !mapped_segs_.empty()) {
+    auto &seg = mapped_segs_.front();
+    if (wb_.pos < seg.wb_pos) {
+      n -= wb_.drain(std::min(n, static_cast<size_t>(seg.wb_pos - wb_.pos)));
+      continue;
+    }
+
+    auto m = std::min(n, seg.len);
+    seg.data += m;
+    seg.len -= m;
+    n -= m;
+
+    if (seg.len > 0) {
+      return;
+    }
+
+    sessions_->release_fd(seg.file_ent);
+    mapped_segs_.pop_front();
+  }
+
+  wb_.drain(n);
+}
+
 int Http2Handler::read_clear() {
   int rv;
   std::array<uint8_t, 8192> buf;
@@ -442,9 +976,29 @@ int Http2Handler::read_clear() {
 int Http2Handler::write_clear() {
   auto loop = sessions_->get_loop();
   for (;;) {
-    if (wb_.rleft() > 0) {
+    if (wb_.rleft() > 0 || !mapped_segs_.empty()) {
+      // Each mapped payload is preceded by the frames in wb_.
+      std::array<struct iovec, MAX_MAPPED_SEGMENTS * 2 + 1> iov;
+      int iovcnt = 0;
+      auto pos = wb_.pos;
+      for (auto &seg : mapped_segs_) {
+        if (pos < seg.wb_pos) {
+          iov[iovcnt].iov_base = pos;
+          iov[iovcnt].iov_len = seg.wb_pos - pos;
+          ++iovcnt;
+        }
+        iov[iovcnt].iov_base = const_cast<uint8_t *>(seg.data);
+        iov[iovcnt].iov_len = seg.len;
+        ++iovcnt;
+        pos = seg.wb_pos;
+      }
+      if (pos < wb_.last) {
+        iov[iovcnt].iov_base = pos;
+        iov[iovcnt].iov_len = wb_.last - pos;
+        ++iovcnt;
+      }
       ssize_t nwrite;
-      while ((nwrite = write(fd_, wb_.pos, wb_.rleft())) == -1 &&
+      while ((nwrite = writev(fd_, iov.data(), iovcnt)) == -1 &&
              errno == EINTR)
         ;
       if (nwrite == -1) {
@@ -454,7 +1008,7 @@ int Http2Handler::write_clear() {
         }
         return -1;
       }
-      wb_.drain(nwrite);
+      consume_output(nwrite);
       continue;
     }
     wb_.reset();
@@ -680,21 +1234,27 @@ int Http2Handler::verify_npn_result() {
 }
 
 int Http2Handler::submit_file_response(const std::string &status,
-                                       Stream *stream, time_t last_modified,
-                                       off_t file_length,
+                                       Stream *stream,
+                                       const FileEntry *file_ent,
                                        nghttp2_data_provider *data_prd) {
-  std::string content_length = util::utos(file_length);
-  std::string last_modified_str;
-  auto nva = make_array(http2::make_nv_ls(":status", status),
-                        http2::make_nv_ls("server", NGHTTPD_SERVER),
-                        http2::make_nv_ls("content-length", content_length),
-                        http2::make_nv_ll("cache-control", "max-age=3600"),
-                        http2::make_nv_ls("date", sessions_->get_cached_date()),
-                        http2::make_nv_ll("", ""), http2::make_nv_ll("", ""));
+  auto nva = make_array(
+      http2::make_nv_ls(":status", status),
+      http2::make_nv_ls("server", NGHTTPD_SERVER),
+      http2::make_nv_ls("content-length", file_ent->content_length),
+      http2::make_nv_ll("cache-control", "max-age=3600"),
+      http2::make_nv_ls("date", sessions_->get_cached_date()),
+      http2::make_nv_ll("", ""), http2::make_nv_ll("", ""),
+      http2::make_nv_ll("", ""), http2::make_nv_ll("", ""));
   size_t nvlen = 5;
-  if (last_modified != 0) {
-    last_modified_str = util::http_date(last_modified);
-    nva[nvlen++] = http2::make_nv_ls("last-modified", last_modified_str);
+  if (!file_ent->last_modified.empty()) {
+    nva[nvlen++] = http2::make_nv_ls("last-modified", file_ent->last_modified);
+  }
+  if (file_ent->gzip) {
+    nva[nvlen++] = http2::make_nv_ll("content-encoding", "gzip");
+  }
+  auto config = get_config();
+  if (config->gzip_static || config->gzip) {
+    nva[nvlen++] = http2::make_nv_ll("vary", "accept-encoding");
   }
   auto &trailer = get_config()->trailer;
   std::string trailer_names;
@@ -782,13 +1342,70 @@ int Http2Handler::submit_rst_stream(Stream *stream, uint32_t error_code) {
                                    stream->stream_id, error_code);
 }
 
+int Http2Handler::resume_data(Stream *stream) {
+  int rv = nghttp2_session_resume_data(session_, stream->stream_id);
+  if (nghttp2_is_fatal(rv)) {
+    return -1;
+  }
+  return 0;
+}
+
 void Http2Handler::add_stream(int32_t stream_id,
                               std::unique_ptr<Stream> stream) {
   id2stream_[stream_id] = std::move(stream);
 }
 
 void Http2Handler::remove_stream(int32_t stream_id) {
-  id2stream_.erase(stream_id);
+  auto it = id2stream_.find(stream_id);
+  if (it == std::end(id2stream_)) {
+    return;
+  }
+  if ((*it).second->push_started) {
+    --num_push_;
+  }
+  id2stream_.erase(it);
+}
+
+void Http2Handler::push_resources(Stream *stream,
+                                  const std::vector<PushResource> &resources) {
+  if (nghttp2_session_get_remote_settings(
+          session_, NGHTTP2_SETTINGS_ENABLE_PUSH) == 0) {
+    return;
+  }
+  for (auto &res : resources) {
+    if (!push_seen_.insert(res.path).second) {
+      continue;
+    }
+    auto rv = submit_push_promise(stream, res.path);
+    if (rv != 0) {
+      std::cerr << "nghttp2_submit_push_promise() returned error: "
+                << nghttp2_strerror(rv) << std::endl;
+    }
+  }
+}
+
+void Http2Handler::add_requested_path(const std::string &path) {
+  push_seen_.insert(path);
+}
+
+void Http2Handler::add_pending_push(int32_t stream_id) {
+  push_pending_.push_back(stream_id);
+}
+
+Stream *Http2Handler::pop_pending_push() {
+  auto max_push = get_config()->max_concurrent_push;
+  while (!push_pending_.empty() && (max_push == 0 || num_push_ < max_push)) {
+    auto stream = get_stream(push_pending_.front());
+    push_pending_.pop_front();
+    if (!stream) {
+      // Client reset the stream while it was waiting.
+      continue;
+    }
+    stream->push_started = true;
+    ++num_push_;
+    return stream;
+  }
+  return nullptr;
 }
 
 Stream *Http2Handler::get_stream(int32_t stream_id) {
@@ -808,6 +1425,8 @@ const Config *Http2Handler::get_config() const {
   return sessions_->get_config();
 }
 
+bool Http2Handler::no_copy_allowed() const { return ssl_ == nullptr; }
+
 void Http2Handler::remove_settings_timer() {
   ev_timer_stop(sessions_->get_loop(), &settings_timerev_);
 }
@@ -816,6 +1435,64 @@ void Http2Handler::terminate_session(uint32_t error_code) {
   nghttp2_session_terminate_session(session_, error_code);
 }
 
+namespace {
+// Copies at most |length| bytes of the file being served to |buf|
+// from the reads completed by the read threads, and returns the
+// number of bytes copied.  0 means end of file.  If no read has
+// completed yet, returns NGHTTP2_ERR_DEFERRED.  Returns -1 if read
+// failed, or it returned fewer bytes than requested.
+ssize_t read_file_chunk(Stream *stream, uint8_t *buf, size_t length) {
+  auto sessions = stream->handler->get_sessions();
+  auto &chunks = stream->read_chunks;
+
+  if (chunks.empty()) {
+    sessions->submit_read(stream);
+    if (!stream->read_job) {
+      // File was truncated after we opened it
+      return 0;
+    }
+    stream->read_deferred = true;
+    return NGHTTP2_ERR_DEFERRED;
+  }
+
+  auto job = chunks.front();
+  if (job->nread == -1) {
+    return -1;
+  }
+
+  auto n = std::min(length, static_cast<size_t>(job->nread) - job->pos);
+  memcpy(buf, job->buf + job->pos, n);
+  job->pos += n;
+
+  if (job->pos == static_cast<size_t>(job->nread)) {
+    chunks.pop_front();
+    sessions->release_read_job(job);
+    sessions->submit_read(stream);
+  }
+
+  return n;
+}
+} // namespace
+
+namespace {
+// Asks the kernel to read the mapped file of |stream| ahead of
+// |offset| in MMAP_READAHEAD bytes units, so that sending the mapped
+// payload does not block on page faults.
+void readahead_mapped_file(Stream *stream, int64_t offset) {
+  auto file_ent = stream->file_ent;
+  if (stream->readahead_offset >= file_ent->length ||
+      offset + MMAP_READAHEAD / 2 < stream->readahead_offset) {
+    return;
+  }
+  // madvise() requires page aligned address.
+  static auto pagesize = sysconf(_SC_PAGESIZE);
+  auto start = stream->readahead_offset / pagesize * pagesize;
+  auto end = std::min(file_ent->length, offset + MMAP_READAHEAD);
+  madvise(file_ent->map + start, end - start, MADV_WILLNEED);
+  stream->readahead_offset = end;
+}
+} // namespace
+
 ssize_t file_read_callback(nghttp2_session *session, int32_t stream_id,
                            uint8_t *buf, size_t length, uint32_t *data_flags,
                            nghttp2_data_source *source, void *user_data) {
@@ -826,8 +1503,31 @@ ssize_t file_read_callback(nghttp2_session *session, int32_t stream_id,
   int fd = source->fd;
   ssize_t nread;
 
-  while ((nread = read(fd, buf, length)) == -1 && errno == EINTR)
-    ;
+  if (stream->file_ent && stream->file_ent->map) {
+    auto offset = stream->file_ent->length - stream->body_left;
+    nread = std::min(static_cast<int64_t>(length), stream->body_left);
+    readahead_mapped_file(stream, offset);
+    if (hd->no_copy_allowed()) {
+      // The payload is sent from the mapping by send_data_callback.
+      *data_flags |= NGHTTP2_DATA_FLAG_NO_COPY;
+    } else {
+      std::copy_n(stream->file_ent->map + offset, nread, buf);
+    }
+  } else if (stream->file_ent && hd->get_config()->num_read_thread > 0) {
+    nread = read_file_chunk(stream, buf, length);
+    if (nread == NGHTTP2_ERR_DEFERRED) {
+      return nread;
+    }
+  } else if (stream->file_ent) {
+    // The file descriptor is shared with other streams, so we cannot
+    // rely on its file offset.
+    auto offset = stream->file_ent->length - stream->body_left;
+    while ((nread = pread(fd, buf, length, offset)) == -1 && errno == EINTR)
+      ;
+  } else {
+    while ((nread = read(fd, buf, length)) == -1 && errno == EINTR)
+      ;
+  }
 
   if (nread == -1) {
     remove_stream_read_timeout(stream);
@@ -942,10 +1642,130 @@ void prepare_redirect_response(Stream *stream, Http2Handler *hd,
 }
 } // namespace
 
+namespace {
+// Returns true if file |path| is worth compressing, judging from its
+// extension.
+bool compressible(const std::string &path) {
+  static const char *exts[] = {".html", ".htm", ".css", ".js",
+                               ".json", ".txt", ".xml", ".svg"};
+  for (auto ext : exts) {
+    if (util::iendsWith(path, ext)) {
+      return true;
+    }
+  }
+  return false;
+}
+} // namespace
+
+namespace {
+// Compresses |length| bytes of file |fd| by gzip into an unlinked
+// temporary file, and returns its file descriptor.  Returns -1 on
+// error.
+int gzip_file(int fd, int64_t length) {
+  char tempfn[] = "/tmp/nghttpd.gzip.XXXXXX";
+  auto tmpfd = mkstemp(tempfn);
+  if (tmpfd == -1) {
+    return -1;
+  }
+  unlink(tempfn);
+
+  // gzclose() closes the file descriptor given to gzdopen().
+  auto gzfd = dup(tmpfd);
+  if (gzfd == -1) {
+    close(tmpfd);
+    return -1;
+  }
+  auto gz = gzdopen(gzfd, "wb");
+  if (gz == nullptr) {
+    close(gzfd);
+    close(tmpfd);
+    return -1;
+  }
+
+  std::array<uint8_t, 16384> buf;
+  int64_t offset = 0;
+  while (offset < length) {
+    ssize_t nread;
+    while ((nread = pread(fd, buf.data(), buf.size(), offset)) == -1 &&
+           errno == EINTR)
+      ;
+    if (nread <= 0 || gzwrite(gz, buf.data(), nread) != nread) {
+      gzclose(gz);
+      close(tmpfd);
+      return -1;
+    }
+    offset += nread;
+  }
+
+  if (gzclose(gz) != Z_OK) {
+    close(tmpfd);
+    return -1;
+  }
+
+  return tmpfd;
+}
+} // namespace
+
+namespace {
+// Returns gzip encoded representation of |file_ent| with its usecount
+// incremented, or nullptr if it is not available.  foo.gz is used for
+// foo if exists.  Otherwise, the file is compressed, and the copy is
+// cached.  If the read threads are enabled, the file is compressed by
+// them, and nullptr is returned until it is done.  Otherwise, files
+// larger than GZIP_MAX_INLINE_LENGTH are not compressed.
+FileEntry *get_gzip_file_entry(Sessions *sessions, const Config *config,
+                               FileEntry *file_ent) {
+  if (config->gzip_static) {
+    auto gzpath = file_ent->path + ".gz";
+    auto ent = sessions->get_cached_fd(gzpath, true);
+    if (ent) {
+      return ent;
+    }
+    auto fd = open(gzpath.c_str(), O_RDONLY | O_BINARY);
+    if (fd != -1) {
+      struct stat buf;
+      if (fstat(fd, &buf) == 0 && S_ISREG(buf.st_mode)) {
+        return sessions->cache_fd(gzpath, buf, fd, true);
+      }
+      close(fd);
+    }
+  }
+
+  if (!config->gzip || file_ent->length < GZIP_MIN_LENGTH ||
+      !compressible(file_ent->path)) {
+    return nullptr;
+  }
+
+  auto ent = sessions->get_cached_fd(file_ent->path, true);
+  if (ent) {
+    return ent;
+  }
+
+  if (config->num_read_thread > 0) {
+    sessions->submit_gzip(file_ent);
+    return nullptr;
+  }
+
+  if (file_ent->length > GZIP_MAX_INLINE_LENGTH) {
+    return nullptr;
+  }
+
+  auto fd = gzip_file(file_ent->fd, file_ent->length);
+  if (fd == -1) {
+    return nullptr;
+  }
+  struct stat buf;
+  if (fstat(fd, &buf) != 0) {
+    close(fd);
+    return nullptr;
+  }
+  return sessions->cache_gzip_fd(file_ent, fd, buf.st_size);
+}
+} // namespace
+
 namespace {
 void prepare_response(Stream *stream, Http2Handler *hd,
                       bool allow_push = true) {
-  int rv;
   auto reqpath =
       http2::get_header(stream->hdidx, http2::HD__PATH, stream->headers)->value;
   auto ims =
@@ -975,66 +1795,94 @@ void prepare_response(Stream *stream, Http2Handler *hd,
     prepare_status_response(stream, hd, STATUS_404);
     return;
   }
-  auto push_itr = hd->get_config()->push.find(url);
-  if (allow_push && push_itr != std::end(hd->get_config()->push)) {
-    for (auto &push_path : (*push_itr).second) {
-      rv = hd->submit_push_promise(stream, push_path);
-      if (rv != 0) {
-        std::cerr << "nghttp2_submit_push_promise() returned error: "
-                  << nghttp2_strerror(rv) << std::endl;
-      }
+  if (allow_push) {
+    hd->add_requested_path(reqpath);
+    auto push_itr = hd->get_config()->push.find(url);
+    if (push_itr != std::end(hd->get_config()->push)) {
+      hd->push_resources(stream, (*push_itr).second);
     }
   }
   std::string path = hd->get_config()->htdocs + url;
   if (path[path.size() - 1] == '/') {
     path += DEFAULT_HTML;
   }
-  int file = open(path.c_str(), O_RDONLY | O_BINARY);
-  if (file == -1) {
-    prepare_status_response(stream, hd, STATUS_404);
+  auto sessions = hd->get_sessions();
 
-    return;
-  }
+  auto file_ent = sessions->get_cached_fd(path);
 
-  struct stat buf;
+  if (!file_ent) {
+    int file = open(path.c_str(), O_RDONLY | O_BINARY);
+    if (file == -1) {
+      prepare_status_response(stream, hd, STATUS_404);
 
-  if (fstat(file, &buf) == -1) {
-    close(file);
-    prepare_status_response(stream, hd, STATUS_404);
+      return;
+    }
 
-    return;
-  }
+    struct stat buf;
 
-  if (buf.st_mode & S_IFDIR) {
-    close(file);
+    if (fstat(file, &buf) == -1) {
+      close(file);
+      prepare_status_response(stream, hd, STATUS_404);
 
-    if (query_pos == std::string::npos) {
-      reqpath += "/";
-    } else {
-      reqpath.insert(query_pos, "/");
+      return;
     }
 
-    prepare_redirect_response(stream, hd, reqpath, STATUS_301);
+    if (buf.st_mode & S_IFDIR) {
+      close(file);
 
-    return;
+      if (query_pos == std::string::npos) {
+        reqpath += "/";
+      } else {
+        reqpath.insert(query_pos, "/");
+      }
+
+      prepare_redirect_response(stream, hd, reqpath, STATUS_301);
+
+      return;
+    }
+
+    file_ent = sessions->cache_fd(path, buf, file);
   }
 
-  stream->file = file;
-  stream->body_left = buf.st_size;
+  auto config = hd->get_config();
+  if (config->gzip_static || config->gzip) {
+    auto accept_encoding = get_header(stream->hdidx, http2::HD_ACCEPT_ENCODING,
+                                      stream->headers);
+    if (accept_encoding && http2::gzip_accepted(accept_encoding->value)) {
+      auto gzip_ent = get_gzip_file_entry(sessions, config, file_ent);
+      if (gzip_ent) {
+        sessions->release_fd(file_ent);
+        file_ent = gzip_ent;
+      }
+    }
+  }
+
+  stream->file_ent = file_ent;
+  stream->body_left = file_ent->length;
 
   nghttp2_data_provider data_prd;
 
-  data_prd.source.fd = file;
+  data_prd.source.fd = file_ent->fd;
   data_prd.read_callback = file_read_callback;
 
-  if (last_mod_found && buf.st_mtime <= last_mod) {
+  if (last_mod_found && file_ent->mtime <= last_mod) {
     prepare_status_response(stream, hd, STATUS_304);
 
     return;
   }
 
-  hd->submit_file_response(STATUS_200, stream, buf.st_mtime, buf.st_size,
-                           &data_prd);
+  hd->submit_file_response(STATUS_200, stream, file_ent, &data_prd);
+}
+} // namespace
+
+namespace {
+// Starts responses of pushed streams as long as
+// Config::max_concurrent_push allows.
+void start_pending_pushes(Http2Handler *hd) {
+  Stream *stream;
+  while ((stream = hd->pop_pending_push())) {
+    prepare_response(stream, hd, /*allow_push */ false);
+  }
 }
 } // namespace
 
@@ -1203,7 +2051,8 @@ int hd_on_frame_send_callback(nghttp2_session *session,
     add_stream_read_timeout_if_pending(stream);
     add_stream_write_timeout(stream);
 
-    prepare_response(promised_stream, hd, /*allow_push */ false);
+    hd->add_pending_push(promised_stream_id);
+    start_pending_pushes(hd);
   }
   }
   return 0;
@@ -1243,6 +2092,7 @@ int on_stream_close_callback(nghttp2_session *session, int32_t stream_id,
                              uint32_t error_code, void *user_data) {
   auto hd = static_cast<Http2Handler *>(user_data);
   hd->remove_stream(stream_id);
+  start_pending_pushes(hd);
   if (hd->get_config()->verbose) {
     print_session_id(hd->session_id());
     print_timer();
@@ -1253,6 +2103,31 @@ int on_stream_close_callback(nghttp2_session *session, int32_t stream_id,
 }
 } // namespace
 
+namespace {
+int on_frame_not_send_callback(nghttp2_session *session,
+                               const nghttp2_frame *frame, int lib_error_code,
+                               void *user_data) {
+  auto hd = static_cast<Http2Handler *>(user_data);
+  if (frame->hd.type == NGHTTP2_PUSH_PROMISE) {
+    // The promised stream is never opened, and its close callback is
+    // not called.
+    hd->remove_stream(frame->push_promise.promised_stream_id);
+  }
+  return 0;
+}
+} // namespace
+
+namespace {
+int send_data_callback(nghttp2_session *session, nghttp2_frame *frame,
+                       const uint8_t *framehd, size_t length,
+                       nghttp2_data_source *source, void *user_data) {
+  auto hd = static_cast<Http2Handler *>(user_data);
+  auto stream = hd->get_stream(frame->hd.stream_id);
+
+  return hd->send_mapped_data(stream, frame, framehd, length);
+}
+} // namespace
+
 namespace {
 void fill_callback(nghttp2_session_callbacks *callbacks, const Config *config) {
   nghttp2_session_callbacks_set_on_stream_close_callback(
@@ -1264,6 +2139,9 @@ void fill_callback(nghttp2_session_callbacks *callbacks, const Config *config) {
   nghttp2_session_callbacks_set_on_frame_send_callback(
       callbacks, hd_on_frame_send_callback);
 
+  nghttp2_session_callbacks_set_on_frame_not_send_callback(
+      callbacks, on_frame_not_send_callback);
+
   if (config->verbose) {
     nghttp2_session_callbacks_set_on_invalid_frame_recv_callback(
         callbacks, verbose_on_invalid_frame_recv_callback);
@@ -1282,6 +2160,11 @@ void fill_callback(nghttp2_session_callbacks *callbacks, const Config *config) {
     nghttp2_session_callbacks_set_select_padding_callback(
         callbacks, select_padding_callback);
   }
+
+  if (config->use_mmap) {
+    nghttp2_session_callbacks_set_send_data_callback(callbacks,
+                                                     send_data_callback);
+  }
 }
 } // namespace
 
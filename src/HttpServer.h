@@ -35,6 +35,9 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <set>
+#include <list>
+#include <deque>
 #include <memory>
 
 #include <openssl/ssl.h>
@@ -48,8 +51,16 @@
 
 namespace nghttp2 {
 
+// Resource pushed when its associated path is requested
+struct PushResource {
+  std::string path;
+  // Resources with larger weight are pushed first.  [1, 256]
+  int32_t weight;
+};
+
 struct Config {
-  std::map<std::string, std::vector<std::string>> push;
+  // Pushed resources per path, in the order they are pushed
+  std::map<std::string, std::vector<PushResource>> push;
   Headers trailer;
   std::string htdocs;
   std::string host;
@@ -63,6 +74,12 @@ struct Config {
   void *data_ptr;
   size_t padding;
   size_t num_worker;
+  // The number of threads per worker to read files.  If 0, files are
+  // read on the event loop thread.
+  size_t num_read_thread;
+  // The maximum number of pushed responses per connection which are
+  // served at the same time.  0 means unlimited.
+  size_t max_concurrent_push;
   ssize_t header_table_size;
   uint16_t port;
   bool verbose;
@@ -71,21 +88,98 @@ struct Config {
   bool no_tls;
   bool error_gzip;
   bool early_response;
+  bool stats;
+  // true if regular files are mmap()ed, and sent without copying.
+  bool use_mmap;
+  // true if foo.gz is served for foo when client accepts gzip.
+  bool gzip_static;
+  // true if compressible files are compressed when client accepts
+  // gzip.  The compressed copy is cached.
+  bool gzip;
   Config();
   ~Config();
 };
 
 class Http2Handler;
 
+// Opened file shared by the streams which serve the same path.  The
+// entry is cached by Sessions, and its response header field values
+// are computed only once.
+struct FileEntry {
+  FileEntry(std::string path, int64_t length, int64_t mtime, ino_t ino,
+            int fd, ev_tstamp last_valid);
+  // Unmaps the file, and closes fd.
+  ~FileEntry();
+  std::string path;
+  // The key of this entry in the cache.  It is path, with a suffix
+  // appended if this entry is gzip encoded.
+  std::string key;
+  std::string content_length;
+  // Empty if mtime is 0
+  std::string last_modified;
+  // Position in the list of unused entries.  Only valid if usecount
+  // is 0.
+  std::list<FileEntry *>::iterator lru_it;
+  int64_t length;
+  // The size of the file at path when this entry was created.  It
+  // differs from length if this entry is a compressed copy of the
+  // file.
+  int64_t file_length;
+  int64_t mtime;
+  ino_t ino;
+  // The time when this entry was last checked against the file
+  // system.
+  ev_tstamp last_valid;
+  // The whole file mapped into memory, or nullptr if it is not
+  // mapped.
+  uint8_t *map;
+  int fd;
+  // The number of streams using this entry
+  int usecount;
+  // true if the file was modified, and this entry is no longer
+  // cached.  It is deleted when usecount drops to 0.
+  bool stale;
+  // true if the content is gzip encoded
+  bool gzip;
+};
+
+// DATA payload sent directly from the mapping of file_ent.  It is
+// written right before wb_pos in the write buffer of Http2Handler.
+struct MappedSegment {
+  uint8_t *wb_pos;
+  const uint8_t *data;
+  size_t len;
+  FileEntry *file_ent;
+};
+
+struct FileReadJob;
+
 struct Stream {
   Headers headers;
+  // Completed reads of file_ent waiting to be sent, in file order.
+  // Only used if files are read by threads.
+  std::deque<FileReadJob *> read_chunks;
   Http2Handler *handler;
+  // Cached file being served, or nullptr
+  FileEntry *file_ent;
+  // Read of file_ent in flight, or nullptr
+  FileReadJob *read_job;
+  // The offset in file_ent where the next read starts
+  int64_t read_offset;
+  // The offset in file_ent->map up to which read-ahead was requested
+  int64_t readahead_offset;
   ev_timer rtimer;
   ev_timer wtimer;
   int64_t body_left;
   int32_t stream_id;
+  // File descriptor of generated response body, which is not cached
   int file;
   http2::HeaderIndex hdidx;
+  // true if the data provider returned NGHTTP2_ERR_DEFERRED waiting
+  // for read_job.
+  bool read_deferred;
+  // true if this is a pushed stream, and its response was started.
+  bool push_started;
   Stream(Http2Handler *handler, int32_t stream_id);
   ~Stream();
 };
@@ -105,7 +199,7 @@ public:
   int verify_npn_result();
 
   int submit_file_response(const std::string &status, Stream *stream,
-                           time_t last_modified, off_t file_length,
+                           const FileEntry *file_ent,
                            nghttp2_data_provider *data_prd);
 
   int submit_response(const std::string &status, int32_t stream_id,
@@ -118,14 +212,38 @@ public:
 
   int submit_push_promise(Stream *stream, const std::string &push_path);
 
+  // Pushes |resources| associated to |stream|, except for the ones
+  // which were already pushed or requested in this connection.
+  void push_resources(Stream *stream,
+                      const std::vector<PushResource> &resources);
+  // Remembers that |path| was requested so that it is not pushed.
+  void add_requested_path(const std::string &path);
+  // Queues pushed stream |stream_id| whose PUSH_PROMISE was sent.
+  void add_pending_push(int32_t stream_id);
+  // Returns the next pushed stream whose response should be started,
+  // or nullptr if there is none, or Config::max_concurrent_push
+  // responses are being served.
+  Stream *pop_pending_push();
+
   int submit_rst_stream(Stream *stream, uint32_t error_code);
 
+  int resume_data(Stream *stream);
+
+  int send_mapped_data(Stream *stream, nghttp2_frame *frame,
+                       const uint8_t *framehd, size_t length);
+  // Consumes |n| bytes written from wb_ and mapped_segs_.
+  void consume_output(size_t n);
+
   void add_stream(int32_t stream_id, std::unique_ptr<Stream> stream);
   void remove_stream(int32_t stream_id);
   Stream *get_stream(int32_t stream_id);
   int64_t session_id() const;
   Sessions *get_sessions() const;
   const Config *get_config() const;
+  // Returns true if DATA payload can be sent from mapped file without
+  // copying it.  This is false for TLS connection, since payload is
+  // copied anyway to be encrypted.
+  bool no_copy_allowed() const;
   void remove_settings_timer();
   void terminate_session(uint32_t error_code);
 
@@ -144,6 +262,11 @@ private:
   ev_io rev_;
   ev_timer settings_timerev_;
   std::map<int32_t, std::unique_ptr<Stream>> id2stream_;
+  // Paths pushed or requested in this connection
+  std::set<std::string> push_seen_;
+  // Pushed streams waiting for the number of pushed responses being
+  // served to drop below Config::max_concurrent_push
+  std::deque<int32_t> push_pending_;
   Buffer<65536> wb_;
   std::function<int(Http2Handler &)> read_, write_;
   int64_t session_id_;
@@ -152,6 +275,11 @@ private:
   SSL *ssl_;
   const uint8_t *data_pending_;
   size_t data_pendinglen_;
+  // DATA payloads queued to be written together with wb_ by one
+  // writev().
+  std::deque<MappedSegment> mapped_segs_;
+  // The number of pushed responses being served
+  size_t num_push_;
   int fd_;
 };
 
@@ -0,0 +1,166 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2015 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef ALLOCATOR_H
+#define ALLOCATOR_H
+
+#include "nghttp2_config.h"
+
+#include <cstdint>
+#include <cstring>
+
+#include "template.h"
+
+namespace nghttp2 {
+
+struct MemBlock {
+  // The next MemBlock to chain them.  This is for book keeping
+  // purpose to free them later.
+  MemBlock *next;
+  // begin is the pointer to the beginning of buffer.  last is the
+  // location of next write.  end is the one beyond of the end of the
+  // buffer.
+  uint8_t *begin, *last, *end;
+};
+
+// BlockAllocator allocates memory block with given size at once, and
+// cuts the region from it when allocation is requested.  If the
+// requested size is larger than given threshold, it will be allocated
+// in a distinct buffer on demand.  The allocated memory is not
+// released individually; all of them are released at once by reset()
+// or destructor.  The returned memory is not aligned, so this is
+// meant to be used for strings.
+struct BlockAllocator {
+  BlockAllocator(size_t block_size, size_t isolation_threshold)
+      : retain(nullptr), head(nullptr), block_size(block_size),
+        isolation_threshold(std::min(block_size, isolation_threshold)) {}
+
+  ~BlockAllocator() { reset(); }
+
+  BlockAllocator(const BlockAllocator &) = delete;
+  BlockAllocator &operator=(const BlockAllocator &) = delete;
+
+  void reset() {
+    for (auto mb = retain; mb;) {
+      auto next = mb->next;
+      delete[] reinterpret_cast<uint8_t *>(mb);
+      mb = next;
+    }
+
+    retain = nullptr;
+    head = nullptr;
+  }
+
+  MemBlock *alloc_mem_block(size_t size) {
+    auto block = new uint8_t[sizeof(MemBlock) + size];
+    auto mb = reinterpret_cast<MemBlock *>(block);
+
+    mb->next = retain;
+    mb->begin = mb->last = block + sizeof(MemBlock);
+    mb->end = mb->begin + size;
+    retain = mb;
+    return mb;
+  }
+
+  void *alloc(size_t size) {
+    if (size >= isolation_threshold) {
+      auto mb = alloc_mem_block(size);
+      mb->last = mb->end;
+      return mb->begin;
+    }
+
+    if (!head || static_cast<size_t>(head->end - head->last) < size) {
+      head = alloc_mem_block(block_size);
+    }
+
+    auto res = head->last;
+
+    head->last += size;
+
+    return res;
+  }
+
+  // Extends the region ending at |last|, which must be the last
+  // region cut from the current block, by |size| bytes in place.
+  // Returns true if it succeeds, or false if the region is not the
+  // last one or the block does not have enough room.
+  bool extend(const void *last, size_t size) {
+    if (!head || head->last != last ||
+        static_cast<size_t>(head->end - head->last) < size) {
+      return false;
+    }
+
+    head->last += size;
+
+    return true;
+  }
+
+  // This holds live memory block to free them in dtor.
+  MemBlock *retain;
+  // Current memory block to use.
+  MemBlock *head;
+  // size of single memory block
+  size_t block_size;
+  // if allocation greater or equal to isolation_threshold bytes is
+  // requested, allocate dedicated block.
+  size_t isolation_threshold;
+};
+
+// Makes a copy of |src| in memory allocated by |alloc|.  The returned
+// string is NUL-terminated.  If |src| is empty, nothing is allocated.
+inline StringRef make_string_ref(BlockAllocator &alloc, const StringRef &src) {
+  if (src.empty()) {
+    return StringRef{};
+  }
+
+  auto dst = static_cast<char *>(alloc.alloc(src.size() + 1));
+  auto p = std::copy(std::begin(src), std::end(src), dst);
+  *p = '\0';
+  return StringRef{dst, src.size()};
+}
+
+// Returns NUL-terminated string which is the concatenation of |s| and
+// |data| of length |len|.  |s| must be the string returned by
+// make_string_ref() or this function with the same |alloc|, or an
+// empty string.  If |s| is the last string made from |alloc|, it is
+// extended in place.  Otherwise, new string is allocated.
+inline StringRef append_string_ref(BlockAllocator &alloc, const StringRef &s,
+                                   const char *data, size_t len) {
+  if (!s.empty() && alloc.extend(s.c_str() + s.size() + 1, len)) {
+    auto dst = const_cast<char *>(s.c_str()) + s.size();
+    auto p = std::copy_n(data, len, dst);
+    *p = '\0';
+    return StringRef{s.c_str(), s.size() + len};
+  }
+
+  auto dst = static_cast<char *>(alloc.alloc(s.size() + len + 1));
+  auto p = std::copy(std::begin(s), std::end(s), dst);
+  p = std::copy_n(data, len, p);
+  *p = '\0';
+  return StringRef{dst, s.size() + len};
+}
+
+} // namespace nghttp2
+
+#endif // ALLOCATOR_H
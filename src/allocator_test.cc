@@ -0,0 +1,96 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2015 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "allocator_test.h"
+
+#include <CUnit/CUnit.h>
+
+#include "allocator.h"
+
+namespace nghttp2 {
+
+void test_block_allocator_alloc(void) {
+  BlockAllocator balloc(12, 8);
+
+  auto a = static_cast<uint8_t *>(balloc.alloc(4));
+  auto b = static_cast<uint8_t *>(balloc.alloc(4));
+
+  CU_ASSERT(a + 4 == b);
+  CU_ASSERT(balloc.head == balloc.retain);
+
+  // Does not fit in the current block
+  auto c = static_cast<uint8_t *>(balloc.alloc(7));
+  auto block = balloc.head;
+
+  CU_ASSERT(block->begin == c);
+  CU_ASSERT(block->next->begin == a);
+
+  // Too large; allocated in dedicated block, and current block is
+  // still used.
+  auto d = static_cast<uint8_t *>(balloc.alloc(8));
+
+  CU_ASSERT(block == balloc.head);
+  CU_ASSERT(balloc.retain->begin == d);
+  CU_ASSERT(balloc.retain->next == block);
+
+  balloc.reset();
+
+  CU_ASSERT(nullptr == balloc.head);
+  CU_ASSERT(nullptr == balloc.retain);
+}
+
+void test_block_allocator_append_string_ref(void) {
+  BlockAllocator balloc(1024, 1024);
+
+  auto s = make_string_ref(balloc, StringRef::from_lit("alpha"));
+
+  CU_ASSERT("alpha" == s);
+  CU_ASSERT('\0' == s.c_str()[s.size()]);
+
+  // s is the last allocation, and it is extended in place.
+  auto t = append_string_ref(balloc, s, "bravo", 5);
+
+  CU_ASSERT("alphabravo" == t);
+  CU_ASSERT(s.c_str() == t.c_str());
+  CU_ASSERT('\0' == t.c_str()[t.size()]);
+
+  auto u = make_string_ref(balloc, StringRef::from_lit("charlie"));
+
+  // t is not the last allocation, so it is copied.
+  auto v = append_string_ref(balloc, t, "delta", 5);
+
+  CU_ASSERT("alphabravodelta" == v);
+  CU_ASSERT(t.c_str() != v.c_str());
+  CU_ASSERT("alphabravo" == t);
+  CU_ASSERT("charlie" == u);
+
+  // Empty string is never allocated.
+  auto e = make_string_ref(balloc, StringRef{});
+  auto w = append_string_ref(balloc, e, "echo", 4);
+
+  CU_ASSERT("echo" == w);
+  CU_ASSERT(e.empty());
+}
+
+} // namespace nghttp2
@@ -32,6 +32,7 @@
 #include <poll.h>
 
 #include <cassert>
+#include <cinttypes>
 #include <cstdio>
 #include <cerrno>
 #include <cstdlib>
@@ -130,6 +131,8 @@ const char *strframetype(uint8_t type) {
     return "GOAWAY";
   case NGHTTP2_WINDOW_UPDATE:
     return "WINDOW_UPDATE";
+  case NGHTTP2_CONTINUATION:
+    return "CONTINUATION";
   case NGHTTP2_EXT_ALTSVC:
     return "ALTSVC";
   default:
@@ -189,6 +192,41 @@ void print_timer() {
           ansi_escend());
 }
 
+void print_session_stats(const nghttp2_session_stats &stats) {
+  fprintf(outfile, "statistics:\n");
+  for (size_t i = 0; i < NGHTTP2_STATS_NUM_FRAME_TYPES; ++i) {
+    if (stats.frames_sent[i] == 0 && stats.frames_received[i] == 0) {
+      continue;
+    }
+    print_frame_attr_indent();
+    fprintf(outfile, "%s: sent=%" PRIu64 ", recv=%" PRIu64 "\n",
+            strframetype(i), stats.frames_sent[i], stats.frames_received[i]);
+  }
+  if (stats.unknown_frames_received) {
+    print_frame_attr_indent();
+    fprintf(outfile, "UNKNOWN: recv=%" PRIu64 "\n",
+            stats.unknown_frames_received);
+  }
+  print_frame_attr_indent();
+  fprintf(outfile, "padding: sent=%" PRIu64 ", recv=%" PRIu64 "\n",
+          stats.padding_sent, stats.padding_received);
+  print_frame_attr_indent();
+  fprintf(outfile, "deflate: in=%" PRIu64 ", out=%" PRIu64 "\n",
+          stats.hd_deflate_inlen, stats.hd_deflate_outlen);
+  print_frame_attr_indent();
+  fprintf(outfile, "inflate: in=%" PRIu64 ", out=%" PRIu64 "\n",
+          stats.hd_inflate_inlen, stats.hd_inflate_outlen);
+  print_frame_attr_indent();
+  fprintf(outfile,
+          "stream flow control: stalls=%" PRIu64 ", blocked=%" PRIu64 "ms\n",
+          stats.stream_flow_control_stalls, stats.stream_blocked_msec);
+  print_frame_attr_indent();
+  fprintf(outfile, "connection flow control: stalls=%" PRIu64
+                   ", blocked=%" PRIu64 "ms\n",
+          stats.connection_flow_control_stalls, stats.connection_blocked_msec);
+  fflush(outfile);
+}
+
 namespace {
 void print_frame_hd(const nghttp2_frame_hd &hd) {
   fprintf(outfile, "<length=%zu, flags=0x%02x, stream_id=%d>\n", hd.length,
@@ -77,6 +77,10 @@ std::chrono::steady_clock::time_point get_time();
 
 void print_timer();
 
+// Prints the counters in |stats| obtained by
+// nghttp2_session_get_stats().
+void print_session_stats(const nghttp2_session_stats &stats);
+
 // Setting true will print characters with ANSI color escape codes
 // when printing HTTP2 frames. This function changes a static
 // variable.
@@ -36,13 +36,13 @@ json_t *dump_header_table(nghttp2_hd_context *context) {
   obj = json_object();
   entries = json_array();
   for (i = 0; i < context->hd_table.len; ++i) {
-    nghttp2_hd_entry *ent = nghttp2_hd_table_get(context, i);
+    nghttp2_nv nv = nghttp2_hd_table_get(context, i);
     json_t *outent = json_object();
     json_object_set_new(outent, "index", json_integer(i + 1));
-    dump_val(outent, "name", ent->nv.name, ent->nv.namelen);
-    dump_val(outent, "value", ent->nv.value, ent->nv.valuelen);
+    dump_val(outent, "name", nv.name, nv.namelen);
+    dump_val(outent, "value", nv.value, nv.valuelen);
     json_object_set_new(outent, "size",
-                        json_integer(ent->nv.namelen + ent->nv.valuelen +
+                        json_integer(nv.namelen + nv.valuelen +
                                      NGHTTP2_HD_ENTRY_OVERHEAD));
     json_array_append_new(entries, outent);
   }
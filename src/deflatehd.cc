@@ -35,7 +35,9 @@
 #include <cerrno>
 #include <cstdlib>
 #include <vector>
+#include <string>
 #include <iostream>
+#include <chrono>
 
 #include <jansson.h>
 
@@ -52,6 +54,7 @@ typedef struct {
   size_t deflate_table_size;
   int http1text;
   int dump_header_table;
+  int benchmark;
 } deflate_config;
 
 static deflate_config config;
@@ -59,6 +62,10 @@ static deflate_config config;
 static size_t input_sum;
 static size_t output_sum;
 
+// Header sets read from input in benchmark mode.
+static std::vector<std::vector<std::pair<std::string, std::string>>>
+    bench_input;
+
 static char to_hex_digit(uint8_t n) {
   if (n > 9) {
     return n - 10 + 'a';
@@ -120,6 +127,16 @@ static void deflate_hd(nghttp2_hd_deflater *deflater,
   ssize_t rv;
   nghttp2_bufs bufs;
 
+  if (config.benchmark) {
+    bench_input.emplace_back();
+    auto &hdrs = bench_input.back();
+    for (auto &nv : nva) {
+      hdrs.emplace_back(std::string(nv.name, nv.name + nv.namelen),
+                        std::string(nv.value, nv.value + nv.valuelen));
+    }
+    return;
+  }
+
   nghttp2_bufs_init2(&bufs, 4096, 16, 0, nghttp2_mem_default());
 
   rv = nghttp2_hd_deflate_hd_bufs(deflater, &bufs, (nghttp2_nv *)nva.data(),
@@ -220,7 +237,9 @@ static int perform(void) {
   }
 
   auto deflater = init_deflater();
-  output_json_header();
+  if (!config.benchmark) {
+    output_json_header();
+  }
   auto len = json_array_size(cases);
 
   for (size_t i = 0; i < len; ++i) {
@@ -232,11 +251,13 @@ static int perform(void) {
     if (deflate_hd_json(obj, deflater, i) != 0) {
       continue;
     }
-    if (i + 1 < len) {
+    if (!config.benchmark && i + 1 < len) {
       printf(",\n");
     }
   }
-  output_json_footer();
+  if (!config.benchmark) {
+    output_json_footer();
+  }
   deinit_deflater(deflater);
   json_decref(json);
   return 0;
@@ -247,7 +268,9 @@ static int perform_from_http1text(void) {
   int seq = 0;
 
   auto deflater = init_deflater();
-  output_json_header();
+  if (!config.benchmark) {
+    output_json_header();
+  }
   for (;;) {
     std::vector<nghttp2_nv> nva;
     int end = 0;
@@ -290,7 +313,7 @@ static int perform_from_http1text(void) {
     }
 
     if (!end) {
-      if (seq > 0) {
+      if (!config.benchmark && seq > 0) {
         printf(",\n");
       }
       deflate_hd(deflater, nva, inputlen, seq);
@@ -305,11 +328,76 @@ static int perform_from_http1text(void) {
       break;
     ++seq;
   }
-  output_json_footer();
+  if (!config.benchmark) {
+    output_json_footer();
+  }
   deinit_deflater(deflater);
   return 0;
 }
 
+// Encodes the header sets in bench_input repeatedly for each dynamic
+// table size, and reports the encoding throughput.
+static void benchmark(void) {
+  static const size_t table_sizes[] = {1 << 12, 1 << 14, 1 << 16, 1 << 18,
+                                       1 << 20};
+  size_t inputlen = 0;
+  auto nvas = std::vector<std::vector<nghttp2_nv>>();
+
+  for (auto &hdrs : bench_input) {
+    nvas.emplace_back();
+    auto &nva = nvas.back();
+    for (auto &kv : hdrs) {
+      auto &name = kv.first;
+      auto &value = kv.second;
+      nva.push_back({(uint8_t *)name.c_str(), (uint8_t *)value.c_str(),
+                     name.size(), value.size(), NGHTTP2_NV_FLAG_NONE});
+      inputlen += name.size() + value.size();
+    }
+  }
+
+  if (inputlen == 0) {
+    fprintf(stderr, "No header field to encode\n");
+    exit(EXIT_FAILURE);
+  }
+
+  for (auto table_size : table_sizes) {
+    nghttp2_hd_deflater *deflater;
+    nghttp2_bufs bufs;
+    size_t rounds = 0;
+    size_t outputlen = 0;
+    std::chrono::duration<double> elapsed;
+
+    nghttp2_hd_deflate_new(&deflater, table_size);
+    nghttp2_hd_deflate_change_table_size(deflater, table_size);
+    nghttp2_bufs_init2(&bufs, 4096, 16, 0, nghttp2_mem_default());
+
+    auto start = std::chrono::steady_clock::now();
+    do {
+      for (auto &nva : nvas) {
+        nghttp2_bufs_reset(&bufs);
+        auto rv = nghttp2_hd_deflate_hd_bufs(deflater, &bufs, nva.data(),
+                                             nva.size());
+        if (rv < 0) {
+          fprintf(stderr, "deflate failed with error code %d\n", rv);
+          exit(EXIT_FAILURE);
+        }
+        outputlen += nghttp2_bufs_len(&bufs);
+      }
+      ++rounds;
+      elapsed = std::chrono::steady_clock::now() - start;
+    } while (elapsed.count() < 1.0);
+
+    printf("table-size=%zu entries=%zu rounds=%zu ratio=%.02f "
+           "throughput=%.02fMB/s\n",
+           table_size, deflater->ctx.hd_table.len, rounds,
+           (double)outputlen / (inputlen * rounds),
+           inputlen * rounds / elapsed.count() / 1000000);
+
+    nghttp2_bufs_free(&bufs);
+    nghttp2_hd_deflate_del(deflater);
+  }
+}
+
 static void print_help(void) {
   std::cout << R"(HPACK HTTP/2 header encoder
 Usage: deflatehd [OPTIONS] < INPUT
@@ -375,7 +463,12 @@ OPTIONS:
                       buffer.
                       Default: 4096
     -d, --dump-header-table
-                      Output dynamic header table.)" << std::endl;
+                      Output dynamic header table.
+    -b, --benchmark   Instead  of  outputting  deflated  header block,
+                      encode input header sets  repeatedly for about 1
+                      second with dynamic table  sizes from 4KiB up to
+                      1MiB, and report the  throughput per table size.
+                      -s and -S options are ignored.)" << std::endl;
 }
 
 static struct option long_options[] = {
@@ -383,6 +476,7 @@ static struct option long_options[] = {
     {"table-size", required_argument, nullptr, 's'},
     {"deflate-table-size", required_argument, nullptr, 'S'},
     {"dump-header-table", no_argument, nullptr, 'd'},
+    {"benchmark", no_argument, nullptr, 'b'},
     {nullptr, 0, nullptr, 0}};
 
 int main(int argc, char **argv) {
@@ -392,9 +486,10 @@ int main(int argc, char **argv) {
   config.deflate_table_size = NGHTTP2_HD_DEFAULT_MAX_DEFLATE_BUFFER_SIZE;
   config.http1text = 0;
   config.dump_header_table = 0;
+  config.benchmark = 0;
   while (1) {
     int option_index = 0;
-    int c = getopt_long(argc, argv, "S:dhs:t", long_options, &option_index);
+    int c = getopt_long(argc, argv, "S:bdhs:t", long_options, &option_index);
     if (c == -1) {
       break;
     }
@@ -428,6 +523,10 @@ int main(int argc, char **argv) {
       // --dump-header-table
       config.dump_header_table = 1;
       break;
+    case 'b':
+      // --benchmark
+      config.benchmark = 1;
+      break;
     case '?':
       exit(EXIT_FAILURE);
     default:
@@ -440,6 +539,11 @@ int main(int argc, char **argv) {
     perform();
   }
 
+  if (config.benchmark) {
+    benchmark();
+    return 0;
+  }
+
   auto comp_ratio = input_sum == 0 ? 0.0 : (double)output_sum / input_sum;
 
   fprintf(stderr, "Overall: input=%zu output=%zu ratio=%.02f\n", input_sum,
@@ -203,10 +203,21 @@ std::string value_to_str(const Headers::value_type *nv) {
   return "";
 }
 
+std::string value_to_str(const HeaderRefs::value_type *nv) {
+  if (nv) {
+    return nv->value.str();
+  }
+  return "";
+}
+
 bool non_empty_value(const Headers::value_type *nv) {
   return nv && !nv->value.empty();
 }
 
+bool non_empty_value(const HeaderRefs::value_type *nv) {
+  return nv && !nv->value.empty();
+}
+
 nghttp2_nv make_nv(const std::string &name, const std::string &value,
                    bool no_index) {
   uint8_t flags;
@@ -217,7 +228,20 @@ nghttp2_nv make_nv(const std::string &name, const std::string &value,
           value.size(), flags};
 }
 
-void copy_headers_to_nva(std::vector<nghttp2_nv> &nva, const Headers &headers) {
+nghttp2_nv make_nv(const StringRef &name, const StringRef &value,
+                   bool no_index) {
+  uint8_t flags;
+
+  flags = no_index ? NGHTTP2_NV_FLAG_NO_INDEX : NGHTTP2_NV_FLAG_NONE;
+
+  return {(uint8_t *)name.c_str(), (uint8_t *)value.c_str(), name.size(),
+          value.size(), flags};
+}
+
+namespace {
+template <typename HeadersT>
+void copy_headers_to_nva_impl(std::vector<nghttp2_nv> &nva,
+                              const HeadersT &headers) {
   for (auto &kv : headers) {
     if (kv.name.empty() || kv.name[0] == ':') {
       continue;
@@ -240,9 +264,21 @@ void copy_headers_to_nva(std::vector<nghttp2_nv> &nva, const Headers &headers) {
     nva.push_back(make_nv(kv.name, kv.value, kv.no_index));
   }
 }
+} // namespace
 
-void build_http1_headers_from_headers(std::string &hdrs,
-                                      const Headers &headers) {
+void copy_headers_to_nva(std::vector<nghttp2_nv> &nva, const Headers &headers) {
+  copy_headers_to_nva_impl(nva, headers);
+}
+
+void copy_headers_to_nva(std::vector<nghttp2_nv> &nva,
+                         const HeaderRefs &headers) {
+  copy_headers_to_nva_impl(nva, headers);
+}
+
+namespace {
+template <typename HeadersT>
+void build_http1_headers_from_headers_impl(std::string &hdrs,
+                                           const HeadersT &headers) {
   for (auto &kv : headers) {
     if (kv.name.empty() || kv.name[0] == ':') {
       continue;
@@ -261,13 +297,24 @@ void build_http1_headers_from_headers(std::string &hdrs,
     case HD_X_FORWARDED_PROTO:
       continue;
     }
-    hdrs += kv.name;
+    hdrs.append(std::begin(kv.name), std::end(kv.name));
     capitalize(hdrs, hdrs.size() - kv.name.size());
     hdrs += ": ";
-    hdrs += kv.value;
+    hdrs.append(std::begin(kv.value), std::end(kv.value));
     hdrs += "\r\n";
   }
 }
+} // namespace
+
+void build_http1_headers_from_headers(std::string &hdrs,
+                                      const Headers &headers) {
+  build_http1_headers_from_headers_impl(hdrs, headers);
+}
+
+void build_http1_headers_from_headers(std::string &hdrs,
+                                      const HeaderRefs &headers) {
+  build_http1_headers_from_headers_impl(hdrs, headers);
+}
 
 int32_t determine_window_update_transmission(nghttp2_session *session,
                                              int32_t stream_id) {
@@ -312,7 +359,8 @@ void dump_nv(FILE *out, const nghttp2_nv *nva, size_t nvlen) {
   fflush(out);
 }
 
-void dump_nv(FILE *out, const Headers &nva) {
+namespace {
+template <typename HeadersT> void dump_nv_impl(FILE *out, const HeadersT &nva) {
   for (auto &nv : nva) {
     fwrite(nv.name.c_str(), nv.name.size(), 1, out);
     fwrite(": ", 2, 1, out);
@@ -322,6 +370,11 @@ void dump_nv(FILE *out, const Headers &nva) {
   fwrite("\n", 1, 1, out);
   fflush(out);
 }
+} // namespace
+
+void dump_nv(FILE *out, const Headers &nva) { dump_nv_impl(out, nva); }
+
+void dump_nv(FILE *out, const HeaderRefs &nva) { dump_nv_impl(out, nva); }
 
 std::string rewrite_location_uri(const std::string &uri,
                                  const http_parser_url &u,
@@ -672,6 +725,15 @@ const Headers::value_type *get_header(const HeaderIndex &hdidx, int16_t token,
   return &nva[i];
 }
 
+const HeaderRefs::value_type *get_header(const HeaderIndex &hdidx,
+                                         int16_t token, const HeaderRefs &nva) {
+  auto i = hdidx[token];
+  if (i == -1) {
+    return nullptr;
+  }
+  return &nva[i];
+}
+
 namespace {
 template <typename InputIt> InputIt skip_lws(InputIt first, InputIt last) {
   for (; first != last; ++first) {
@@ -1098,6 +1160,80 @@ bool expect_response_body(const std::string &method, int status_code) {
   return method != "HEAD" && expect_response_body(status_code);
 }
 
+namespace {
+bool is_ows(char c) { return c == ' ' || c == '\t'; }
+} // namespace
+
+namespace {
+// Strips optional white spaces around [*first, *last).
+void trim_ows(const char **first, const char **last) {
+  for (; *first != *last && is_ows(**first); ++*first)
+    ;
+  for (; *first != *last && is_ows(*(*last - 1)); --*last)
+    ;
+}
+} // namespace
+
+namespace {
+// Returns true if parameters [first, last) of an Accept-Encoding
+// element, each of which starts with ';', do not include qvalue 0.
+bool qvalue_nonzero(const char *first, const char *last) {
+  while (first != last) {
+    // skip ';'
+    ++first;
+    auto end = std::find(first, last, ';');
+    auto param_first = first;
+    auto param_last = end;
+    trim_ows(&param_first, &param_last);
+    first = end;
+
+    if (param_last - param_first < 2 ||
+        (*param_first != 'q' && *param_first != 'Q') ||
+        *(param_first + 1) != '=') {
+      continue;
+    }
+    // qvalue is 0 if it consists of "0" followed by optional "." and
+    // zeros.
+    for (auto p = param_first + 2; p != param_last; ++p) {
+      if (*p != '0' && *p != '.') {
+        return true;
+      }
+    }
+    return false;
+  }
+  return true;
+}
+} // namespace
+
+bool gzip_accepted(const std::string &accept_encoding) {
+  // -1: not mentioned, 0: not acceptable, 1: acceptable
+  int gzip = -1;
+  int any = -1;
+  auto first = accept_encoding.c_str();
+  auto last = first + accept_encoding.size();
+  while (first != last) {
+    auto end = std::find(first, last, ',');
+    auto params = std::find(first, end, ';');
+    auto coding_first = first;
+    auto coding_last = params;
+    trim_ows(&coding_first, &coding_last);
+    auto coding_len = coding_last - coding_first;
+
+    if (util::strieq_l("gzip", coding_first, coding_len) ||
+        util::strieq_l("x-gzip", coding_first, coding_len)) {
+      gzip = qvalue_nonzero(params, end);
+    } else if (util::strieq_l("*", coding_first, coding_len)) {
+      any = qvalue_nonzero(params, end);
+    }
+
+    first = end == last ? last : end + 1;
+  }
+  if (gzip != -1) {
+    return gzip;
+  }
+  return any == 1;
+}
+
 } // namespace http2
 
 } // namespace nghttp2
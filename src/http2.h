@@ -37,6 +37,8 @@
 
 #include "http-parser/http_parser.h"
 
+#include "template.h"
+
 namespace nghttp2 {
 
 struct Header {
@@ -63,6 +65,28 @@ struct Header {
 
 typedef std::vector<Header> Headers;
 
+// HeaderRef is the same as Header, but it does not own its name and
+// value.  The memory they point to is typically allocated by
+// BlockAllocator in allocator.h, and must outlive HeaderRef.
+struct HeaderRef {
+  HeaderRef(const StringRef &name, const StringRef &value,
+            bool no_index = false, int16_t token = -1)
+      : name(name), value(value), token(token), no_index(no_index) {}
+
+  HeaderRef() : token(-1), no_index(false) {}
+
+  bool operator==(const HeaderRef &other) const {
+    return name == other.name && value == other.value;
+  }
+
+  StringRef name;
+  StringRef value;
+  int16_t token;
+  bool no_index;
+};
+
+typedef std::vector<HeaderRef> HeaderRefs;
+
 namespace http2 {
 
 std::string get_status_string(unsigned int status_code);
@@ -96,9 +120,11 @@ const Headers::value_type *get_header(const Headers &nva, const char *name);
 
 // Returns nv->second if nv is not nullptr. Otherwise, returns "".
 std::string value_to_str(const Headers::value_type *nv);
+std::string value_to_str(const HeaderRefs::value_type *nv);
 
 // Returns true if the value of |nv| is not empty.
 bool non_empty_value(const Headers::value_type *nv);
+bool non_empty_value(const HeaderRefs::value_type *nv);
 
 // Creates nghttp2_nv using |name| and |value| and returns it. The
 // returned value only references the data pointer to name.c_str() and
@@ -107,6 +133,9 @@ bool non_empty_value(const Headers::value_type *nv);
 nghttp2_nv make_nv(const std::string &name, const std::string &value,
                    bool no_index = false);
 
+nghttp2_nv make_nv(const StringRef &name, const StringRef &value,
+                   bool no_index = false);
+
 // Create nghttp2_nv from string literal |name| and |value|.
 template <size_t N, size_t M>
 nghttp2_nv make_nv_ll(const char (&name)[N], const char (&value)[M]) {
@@ -129,11 +158,20 @@ nghttp2_nv make_nv_ls(const char (&name)[N], const std::string &value) {
           NGHTTP2_NV_FLAG_NONE};
 }
 
+// Create nghttp2_nv from string literal |name| and StringRef |value|.
+template <size_t N>
+nghttp2_nv make_nv_ls(const char (&name)[N], const StringRef &value) {
+  return {(uint8_t *)name, (uint8_t *)value.c_str(), N - 1, value.size(),
+          NGHTTP2_NV_FLAG_NONE};
+}
+
 // Appends headers in |headers| to |nv|.  |headers| must be indexed
 // before this call (its element's token field is assigned).  Certain
 // headers, including disallowed headers in HTTP/2 spec and headers
 // which require special handling (i.e. via), are not copied.
 void copy_headers_to_nva(std::vector<nghttp2_nv> &nva, const Headers &headers);
+void copy_headers_to_nva(std::vector<nghttp2_nv> &nva,
+                         const HeaderRefs &headers);
 
 // Appends HTTP/1.1 style header lines to |hdrs| from headers in
 // |headers|.  |headers| must be indexed before this call (its
@@ -141,6 +179,8 @@ void copy_headers_to_nva(std::vector<nghttp2_nv> &nva, const Headers &headers);
 // requires special handling (i.e. via and cookie), are not appended.
 void build_http1_headers_from_headers(std::string &hdrs,
                                       const Headers &headers);
+void build_http1_headers_from_headers(std::string &hdrs,
+                                      const HeaderRefs &headers);
 
 // Return positive window_size_increment if WINDOW_UPDATE should be
 // sent for the stream |stream_id|. If |stream_id| == 0, this function
@@ -160,6 +200,7 @@ void dump_nv(FILE *out, const nghttp2_nv *nva, size_t nvlen);
 
 // Dumps name/value pairs in |nva| to |out|.
 void dump_nv(FILE *out, const Headers &nva);
+void dump_nv(FILE *out, const HeaderRefs &nva);
 
 // Rewrites redirection URI which usually appears in location header
 // field. The |uri| is the URI in the location header field. The |u|
@@ -259,6 +300,8 @@ bool http2_mandatory_request_headers_presence(const HeaderIndex &hdidx);
 // Returns header denoted by |token| using index |hdidx|.
 const Headers::value_type *get_header(const HeaderIndex &hdidx, int16_t token,
                                       const Headers &nva);
+const HeaderRefs::value_type *get_header(const HeaderIndex &hdidx,
+                                         int16_t token, const HeaderRefs &nva);
 
 struct LinkHeader {
   // The region of URI is [uri.first, uri.second).
@@ -289,6 +332,11 @@ bool expect_response_body(const std::string &method, int status_code);
 // true if response has body, taking into account status code only.
 bool expect_response_body(int status_code);
 
+// true if Accept-Encoding header field value |accept_encoding| allows
+// gzip content-coding.  Content-coding with qvalue 0 is not
+// acceptable.
+bool gzip_accepted(const std::string &accept_encoding);
+
 } // namespace http2
 
 } // namespace nghttp2
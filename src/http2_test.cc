@@ -810,4 +810,21 @@ void test_http2_path_join(void) {
   }
 }
 
+void test_http2_gzip_accepted(void) {
+  CU_ASSERT(http2::gzip_accepted("gzip"));
+  CU_ASSERT(http2::gzip_accepted("deflate, gzip"));
+  CU_ASSERT(http2::gzip_accepted("  GZIP ;q=0.5 , br"));
+  CU_ASSERT(http2::gzip_accepted("x-gzip"));
+  CU_ASSERT(http2::gzip_accepted("*"));
+  CU_ASSERT(http2::gzip_accepted("gzip;q=1, *;q=0"));
+
+  CU_ASSERT(!http2::gzip_accepted(""));
+  CU_ASSERT(!http2::gzip_accepted("deflate, br"));
+  CU_ASSERT(!http2::gzip_accepted("gzipx"));
+  CU_ASSERT(!http2::gzip_accepted("gzip;q=0"));
+  CU_ASSERT(!http2::gzip_accepted("gzip; q=0.000, deflate"));
+  CU_ASSERT(!http2::gzip_accepted("gzip;q=0, *"));
+  CU_ASSERT(!http2::gzip_accepted("*;q=0"));
+}
+
 } // namespace shrpx
@@ -41,6 +41,7 @@ void test_http2_http2_header_allowed(void);
 void test_http2_mandatory_request_headers_presence(void);
 void test_http2_parse_link_header(void);
 void test_http2_path_join(void);
+void test_http2_gzip_accepted(void);
 
 } // namespace shrpx
 
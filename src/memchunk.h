@@ -33,6 +33,7 @@
 #include <cstring>
 #include <memory>
 #include <array>
+#include <limits>
 #include <algorithm>
 
 #include "template.h"
@@ -59,13 +60,18 @@ template <size_t N> struct Memchunk {
 };
 
 template <typename T> struct Pool {
-  Pool() : pool(nullptr), freelist(nullptr), poolsize(0) {}
+  Pool()
+      : pool(nullptr), freelist(nullptr), poolsize(0), freelistsize(0),
+        freelistsize_lowat(0),
+        freelistmax(std::numeric_limits<size_t>::max()) {}
   T *get() {
     if (freelist) {
       auto m = freelist;
       freelist = freelist->next;
       m->next = nullptr;
       m->reset();
+      freelistsize -= T::size;
+      freelistsize_lowat = std::min(freelistsize_lowat, freelistsize);
       return m;
     }
 
@@ -74,38 +80,67 @@ template <typename T> struct Pool {
     return pool.get();
   }
   void recycle(T *m) {
+    if (freelistsize + T::size > freelistmax) {
+      // We already have enough unused objects.  Just release it.
+      destroy(m);
+      return;
+    }
     if (freelist) {
       m->next = freelist;
     } else {
       m->next = nullptr;
     }
     freelist = m;
+    freelistsize += T::size;
   }
   void shrink(size_t max) {
     auto m = freelist;
     for (; m && poolsize > max;) {
       auto next = m->next;
-      poolsize -= T::size;
-      auto p = m->kprev;
-      if (p) {
-        p->knext = std::move(m->knext);
-        if (p->knext) {
-          p->knext->kprev = p;
-        }
-      } else {
-        pool = std::move(m->knext);
-        if (pool) {
-          pool->kprev = nullptr;
-        }
-      }
+      freelistsize -= T::size;
+      destroy(m);
       m = next;
     }
     freelist = m;
+    freelistsize_lowat = std::min(freelistsize_lowat, freelistsize);
+  }
+  // Releases objects in freelist which have not been used since the
+  // last call of this function.  This function is intended to be
+  // called periodically to return memory kept for past peak usage.
+  void shrink_idle() {
+    shrink(poolsize - freelistsize_lowat);
+    freelistsize_lowat = freelistsize;
+  }
+  // Unlinks |m| from the list of all allocated objects and deletes
+  // it.  |m| must not be in freelist.
+  void destroy(T *m) {
+    poolsize -= T::size;
+    auto p = m->kprev;
+    if (p) {
+      p->knext = std::move(m->knext);
+      if (p->knext) {
+        p->knext->kprev = p;
+      }
+    } else {
+      pool = std::move(m->knext);
+      if (pool) {
+        pool->kprev = nullptr;
+      }
+    }
   }
   using value_type = T;
   std::unique_ptr<T> pool;
   T *freelist;
+  // The total size of objects allocated by this pool.
   size_t poolsize;
+  // The total size of objects in freelist.
+  size_t freelistsize;
+  // The minimum value of freelistsize since the last call of
+  // shrink_idle().
+  size_t freelistsize_lowat;
+  // The maximum total size of objects kept in freelist.  The object
+  // recycled beyond this limit is deleted immediately.
+  size_t freelistmax;
 };
 
 template <typename Memchunk> struct Memchunks {
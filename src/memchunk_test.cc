@@ -79,6 +79,58 @@ void test_pool_recycle(void) {
   CU_ASSERT(m1 == pool.freelist);
   CU_ASSERT(m2 == m1->next);
   CU_ASSERT(nullptr == m2->next);
+  CU_ASSERT(2 * MemchunkPool::value_type::size == pool.freelistsize);
+}
+
+void test_pool_shrink(void) {
+  MemchunkPool pool;
+
+  pool.freelistmax = 2 * MemchunkPool::value_type::size;
+
+  auto m1 = pool.get();
+  auto m2 = pool.get();
+  auto m3 = pool.get();
+
+  CU_ASSERT(3 * MemchunkPool::value_type::size == pool.poolsize);
+
+  pool.recycle(m1);
+  pool.recycle(m2);
+
+  CU_ASSERT(2 * MemchunkPool::value_type::size == pool.freelistsize);
+
+  // freelist is full; m3 is deleted immediately.
+  pool.recycle(m3);
+
+  CU_ASSERT(2 * MemchunkPool::value_type::size == pool.poolsize);
+  CU_ASSERT(2 * MemchunkPool::value_type::size == pool.freelistsize);
+  CU_ASSERT(m2 == pool.freelist);
+  CU_ASSERT(m2 == pool.pool.get());
+  CU_ASSERT(m1 == m2->knext.get());
+  CU_ASSERT(m2 == m1->kprev);
+
+  // Nothing was taken from freelist since construction.
+  pool.freelistsize_lowat = pool.freelistsize;
+
+  m1 = pool.get();
+
+  CU_ASSERT(MemchunkPool::value_type::size == pool.freelistsize_lowat);
+
+  pool.recycle(m1);
+
+  // The chunk which was not used during the period is released.
+  pool.shrink_idle();
+
+  CU_ASSERT(MemchunkPool::value_type::size == pool.poolsize);
+  CU_ASSERT(MemchunkPool::value_type::size == pool.freelistsize);
+  CU_ASSERT(MemchunkPool::value_type::size == pool.freelistsize_lowat);
+  CU_ASSERT(nullptr == pool.freelist->next);
+
+  pool.shrink_idle();
+
+  CU_ASSERT(0 == pool.poolsize);
+  CU_ASSERT(0 == pool.freelistsize);
+  CU_ASSERT(nullptr == pool.freelist);
+  CU_ASSERT(!pool.pool);
 }
 
 using Memchunk16 = Memchunk<16>;
@@ -28,6 +28,7 @@
 namespace nghttp2 {
 
 void test_pool_recycle(void);
+void test_pool_shrink(void);
 void test_memchunks_append(void);
 void test_memchunks_drain(void);
 void test_memchunks_riovec(void);
@@ -0,0 +1,114 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2014 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef MPSC_RING_H
+#define MPSC_RING_H
+
+#include "nghttp2_config.h"
+
+#include <cstdint>
+#include <atomic>
+#include <memory>
+
+#include "template.h"
+
+namespace nghttp2 {
+
+// Bounded lock-free queue which allows multiple producers and single
+// consumer.  N is the capacity of the queue, and must be power of 2.
+// T must be trivially copyable.  Each slot carries the sequence
+// number, which tells whether the slot is ready to be written by
+// producer or to be read by consumer.
+template <typename T, size_t N> class MPSCRing {
+public:
+  MPSCRing() : cells_(make_unique<Cell[]>(N)), tail_(0), head_(0) {
+    static_assert((N & (N - 1)) == 0, "N must be power of 2");
+
+    for (size_t i = 0; i < N; ++i) {
+      cells_[i].seq.store(i, std::memory_order_relaxed);
+    }
+  }
+  // Appends |v| to the queue.  Returns false if the queue is full.
+  // This function can be called from multiple threads concurrently.
+  bool push(const T &v) {
+    auto pos = tail_.load(std::memory_order_relaxed);
+    for (;;) {
+      auto &cell = cells_[pos & (N - 1)];
+      auto seq = cell.seq.load(std::memory_order_acquire);
+      auto diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+      if (diff == 0) {
+        if (tail_.compare_exchange_weak(pos, pos + 1,
+                                        std::memory_order_relaxed)) {
+          cell.data = v;
+          cell.seq.store(pos + 1, std::memory_order_release);
+          return true;
+        }
+        // pos was updated by compare_exchange_weak
+        continue;
+      }
+      if (diff < 0) {
+        // queue is full
+        return false;
+      }
+      pos = tail_.load(std::memory_order_relaxed);
+    }
+  }
+  // Removes the first element of the queue, and assigns it to |v|.
+  // Returns false if the queue is empty.  Only the consumer thread
+  // can call this function.
+  bool pop(T &v) {
+    auto &cell = cells_[head_ & (N - 1)];
+    auto seq = cell.seq.load(std::memory_order_acquire);
+    if (seq != head_ + 1) {
+      return false;
+    }
+    v = cell.data;
+    cell.seq.store(head_ + N, std::memory_order_release);
+    ++head_;
+    return true;
+  }
+  static const size_t capacity = N;
+
+private:
+  struct Cell {
+    std::atomic<size_t> seq;
+    T data;
+  };
+  // The size of cache line we assume.  Explicit padding keeps tail_
+  // and head_ on different cache lines without requiring over-aligned
+  // allocation of the object.
+  static const size_t CACHE_LINE_SIZE = 64;
+  std::unique_ptr<Cell[]> cells_;
+  char pad0_[CACHE_LINE_SIZE - sizeof(std::unique_ptr<Cell[]>)];
+  // Written by producers.
+  std::atomic<size_t> tail_;
+  char pad1_[CACHE_LINE_SIZE - sizeof(std::atomic<size_t>)];
+  // Written by consumer.
+  size_t head_;
+  char pad2_[CACHE_LINE_SIZE - sizeof(size_t)];
+};
+
+} // namespace nghttp2
+
+#endif // MPSC_RING_H
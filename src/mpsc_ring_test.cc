@@ -0,0 +1,119 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2014 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "mpsc_ring_test.h"
+
+#include <thread>
+#include <vector>
+
+#include <CUnit/CUnit.h>
+
+#include "mpsc_ring.h"
+
+namespace nghttp2 {
+
+void test_mpsc_ring_push_pop(void) {
+  MPSCRing<int, 4> ring;
+  int v;
+
+  CU_ASSERT(!ring.pop(v));
+
+  for (int i = 0; i < 4; ++i) {
+    CU_ASSERT(ring.push(i));
+  }
+
+  // queue is full
+  CU_ASSERT(!ring.push(4));
+
+  CU_ASSERT(ring.pop(v));
+  CU_ASSERT(0 == v);
+  CU_ASSERT(ring.pop(v));
+  CU_ASSERT(1 == v);
+
+  // wrap around
+  CU_ASSERT(ring.push(4));
+  CU_ASSERT(ring.push(5));
+  CU_ASSERT(!ring.push(6));
+
+  for (int i = 2; i < 6; ++i) {
+    CU_ASSERT(ring.pop(v));
+    CU_ASSERT(i == v);
+  }
+
+  CU_ASSERT(!ring.pop(v));
+}
+
+namespace {
+struct Item {
+  size_t producer;
+  size_t seq;
+};
+} // namespace
+
+void test_mpsc_ring_concurrent_push(void) {
+  constexpr size_t NUM_PRODUCERS = 4;
+  constexpr size_t NUM_ITEMS = 100000;
+
+  MPSCRing<Item, 64> ring;
+  std::vector<std::thread> producers;
+
+  for (size_t i = 0; i < NUM_PRODUCERS; ++i) {
+    producers.emplace_back([&ring, i]() {
+      for (size_t j = 0; j < NUM_ITEMS; ++j) {
+        while (!ring.push(Item{i, j})) {
+          std::this_thread::yield();
+        }
+      }
+    });
+  }
+
+  std::vector<size_t> next(NUM_PRODUCERS);
+  size_t n = 0;
+  bool ordered = true;
+
+  while (n < NUM_PRODUCERS * NUM_ITEMS) {
+    Item item;
+    if (!ring.pop(item)) {
+      std::this_thread::yield();
+      continue;
+    }
+    // Items from the same producer must be popped in the order they
+    // were pushed.
+    if (item.producer >= NUM_PRODUCERS || next[item.producer] != item.seq) {
+      ordered = false;
+    } else {
+      ++next[item.producer];
+    }
+    ++n;
+  }
+
+  for (auto &p : producers) {
+    p.join();
+  }
+
+  CU_ASSERT(ordered);
+  CU_ASSERT(NUM_PRODUCERS * NUM_ITEMS == n);
+}
+
+} // namespace nghttp2
@@ -34,6 +34,9 @@
 #include <string>
 #include <iostream>
 #include <string>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
 
 #include <openssl/ssl.h>
 #include <openssl/err.h>
@@ -61,7 +64,7 @@ int parse_push_config(Config &config, const char *optarg) {
     if (j == NULL) {
       j = optarg_end;
     }
-    paths.emplace_back(i, j);
+    paths.push_back(PushResource{std::string(i, j), NGHTTP2_DEFAULT_WEIGHT});
     if (j == optarg_end) {
       break;
     }
@@ -73,6 +76,49 @@ int parse_push_config(Config &config, const char *optarg) {
 }
 } // namespace
 
+namespace {
+// Reads push manifest file |path|.  Each line has <PATH>, <PUSH_PATH>
+// and optional <WEIGHT>, separated by white spaces.  Text after '#'
+// is ignored.
+int parse_push_manifest(Config &config, const char *path) {
+  std::ifstream f(path);
+  if (!f) {
+    std::cerr << "--push-manifest: Could not open file " << path << std::endl;
+    return -1;
+  }
+  std::string line;
+  for (size_t lineno = 1; std::getline(f, line); ++lineno) {
+    auto comment = line.find('#');
+    if (comment != std::string::npos) {
+      line.erase(comment);
+    }
+    std::istringstream in(line);
+    std::string req_path, push_path, weight, extra;
+    if (!(in >> req_path)) {
+      continue;
+    }
+    if (!(in >> push_path) || (in >> weight && in >> extra)) {
+      std::cerr << "--push-manifest: " << path << ":" << lineno
+                << ": Bad line" << std::endl;
+      return -1;
+    }
+    int32_t w = NGHTTP2_DEFAULT_WEIGHT;
+    if (!weight.empty()) {
+      auto n = util::parse_uint(weight);
+      if (n < NGHTTP2_MIN_WEIGHT || n > NGHTTP2_MAX_WEIGHT) {
+        std::cerr << "--push-manifest: " << path << ":" << lineno
+                  << ": Weight must be in [" << NGHTTP2_MIN_WEIGHT << ", "
+                  << NGHTTP2_MAX_WEIGHT << "]: " << weight << std::endl;
+        return -1;
+      }
+      w = n;
+    }
+    config.push[req_path].push_back(PushResource{push_path, w});
+  }
+  return 0;
+}
+} // namespace
+
 namespace {
 void print_version(std::ostream &out) {
   out << "nghttpd nghttp2/" NGHTTP2_VERSION << std::endl;
@@ -125,14 +171,57 @@ Options:
               push  configurations.    <PATH>  and   <PUSH_PATH>s  are
               relative  to   document  root.   See   --htdocs  option.
               Example: -p/=/foo.png -p/doc=/bar.css
+  --push-manifest=<PATH>
+              Read push configurations from file <PATH>.  Each line of
+              the file is  "<PATH> <PUSH_PATH> [<WEIGHT>]".  When
+              <PATH> is  requested, <PUSH_PATH>s  are pushed in  the
+              descending order  of <WEIGHT>,  which is  an integer in
+              [1,  256].  The  default  <WEIGHT>  is  16,  which  is
+              also used for --push.  Text after '#' is ignored.  This
+              option can be combined with --push.
+  --max-concurrent-push=<N>
+              Set the maximum number  of pushed responses which are
+              served at the same time per connection.  PUSH_PROMISE is
+              sent  for all  pushed resources,  but the  responses
+              beyond this  limit wait until  one of  the others is
+              closed.   Regardless of  this option, a  resource is
+              pushed at most once per connection, and is not pushed
+              if client has already requested it.  0 means unlimited.
+              Default: 0
   -b, --padding=<N>
               Add at  most <N>  bytes to a  frame payload  as padding.
               Specify 0 to disable padding.
   -n, --workers=<N>
               Set the number of worker threads.
               Default: 1
+  --read-threads=<N>
+              Set the number of threads per worker which read files.
+              If  nonzero, files  are read  ahead  in 64KiB  chunks
+              without blocking the event loop, so that a cold page
+              cache does  not stall the  other connections.  If 0,
+              files are read on the worker thread.
+              Default: 0
+  --mmap      Map  files  into memory,  and send  DATA  payload  from
+              the mapping without copying it.  Over TLS, the payload
+              is copied from the mapping, since it is encrypted
+              anyway.  A mapped file is shared by all streams which
+              serve it.  Files must not be truncated while they are
+              served.
   -e, --error-gzip
               Make error response gzipped.
+  --gzip-static
+              If client accepts gzip, and a file named  <PATH>.gz
+              exists, serve it  with content-encoding: gzip for
+              <PATH>.
+  --gzip      If client accepts gzip, compress .html, .htm, .css,
+              .js, .json, .txt, .xml and .svg files which are not
+              smaller than  256 bytes.  The compressed copy is cached
+              until the file is modified.  If --read-threads is
+              nonzero, files are compressed by the read threads, and
+              served  uncompressed until  it is  done.   Otherwise,
+              files larger than 1MiB are not compressed, since the
+              compression blocks the  event loop.  --gzip-static
+              takes precedence over this option.
   --dh-param-file=<PATH>
               Path to file that contains  DH parameters in PEM format.
               Without  this   option,  DHE   cipher  suites   are  not
@@ -145,6 +234,9 @@ Options:
               include pseudo header field  (header field name starting
               with ':').  The  trailer is sent only if  a response has
               body part.  Example: --trailer 'foo: bar'.
+  --stats     Print per connection  statistics, such as the number
+              of frames  sent and received and  the time spent
+              blocked by flow control, when a connection is closed.
   --version   Display version information and exit.
   -h, --help  Display this help and exit.
 
@@ -176,6 +268,13 @@ int main(int argc, char **argv) {
         {"dh-param-file", required_argument, &flag, 4},
         {"early-response", no_argument, &flag, 5},
         {"trailer", required_argument, &flag, 6},
+        {"stats", no_argument, &flag, 7},
+        {"read-threads", required_argument, &flag, 8},
+        {"mmap", no_argument, &flag, 9},
+        {"gzip-static", no_argument, &flag, 10},
+        {"gzip", no_argument, &flag, 11},
+        {"push-manifest", required_argument, &flag, 12},
+        {"max-concurrent-push", required_argument, &flag, 13},
         {nullptr, 0, nullptr, 0}};
     int option_index = 0;
     int c = getopt_long(argc, argv, "DVb:c:d:ehn:p:va:", long_options,
@@ -284,12 +383,67 @@ int main(int argc, char **argv) {
         util::inp_strlower(config.trailer.back().name);
         break;
       }
+      case 7:
+        // stats option
+        config.stats = true;
+        nghttp2_option_set_stats(config.session_option, 1);
+        break;
+      case 8:
+        // read-threads option
+#ifdef NOTHREADS
+        std::cerr << "--read-threads: WARNING: Threading disabled at build "
+                  << "time, no threads created." << std::endl;
+#else
+        errno = 0;
+        config.num_read_thread = strtoul(optarg, &end, 10);
+        if (errno == ERANGE || *end != '\0') {
+          std::cerr << "--read-threads: Bad option value: " << optarg
+                    << std::endl;
+          exit(EXIT_FAILURE);
+        }
+#endif // NOTHREADS
+        break;
+      case 9:
+        // mmap option
+        config.use_mmap = true;
+        break;
+      case 10:
+        // gzip-static option
+        config.gzip_static = true;
+        break;
+      case 11:
+        // gzip option
+        config.gzip = true;
+        break;
+      case 12:
+        // push-manifest option
+        if (parse_push_manifest(config, optarg) != 0) {
+          exit(EXIT_FAILURE);
+        }
+        break;
+      case 13:
+        // max-concurrent-push option
+        errno = 0;
+        config.max_concurrent_push = strtoul(optarg, &end, 10);
+        if (errno == ERANGE || *end != '\0') {
+          std::cerr << "--max-concurrent-push: Bad option value: " << optarg
+                    << std::endl;
+          exit(EXIT_FAILURE);
+        }
+        break;
       }
       break;
     default:
       break;
     }
   }
+  for (auto &kv : config.push) {
+    std::stable_sort(std::begin(kv.second), std::end(kv.second),
+                     [](const PushResource &a, const PushResource &b) {
+                       return a.weight > b.weight;
+                     });
+  }
+
   if (argc - optind < (config.no_tls ? 1 : 3)) {
     print_usage(std::cerr);
     std::cerr << "Too few arguments" << std::endl;
@@ -35,11 +35,16 @@
 #include "shrpx_ssl_test.h"
 #include "shrpx_downstream_test.h"
 #include "shrpx_config_test.h"
+#include "shrpx_response_cache_test.h"
+#include "shrpx_worker_test.h"
+#include "shrpx_downstream_connection_pool_test.h"
 #include "http2_test.h"
 #include "util_test.h"
 #include "nghttp2_gzip_test.h"
 #include "buffer_test.h"
 #include "memchunk_test.h"
+#include "allocator_test.h"
+#include "mpsc_ring_test.h"
 #include "shrpx_config.h"
 
 static int init_suite1(void) { return 0; }
@@ -96,6 +101,8 @@ int main(int argc, char *argv[]) {
       !CU_add_test(pSuite, "http2_parse_link_header",
                    shrpx::test_http2_parse_link_header) ||
       !CU_add_test(pSuite, "http2_path_join", shrpx::test_http2_path_join) ||
+      !CU_add_test(pSuite, "http2_gzip_accepted",
+                   shrpx::test_http2_gzip_accepted) ||
       !CU_add_test(pSuite, "downstream_index_request_headers",
                    shrpx::test_downstream_index_request_headers) ||
       !CU_add_test(pSuite, "downstream_index_response_headers",
@@ -118,6 +125,16 @@ int main(int argc, char *argv[]) {
                    shrpx::test_shrpx_config_parse_log_format) ||
       !CU_add_test(pSuite, "config_read_tls_ticket_key_file",
                    shrpx::test_shrpx_config_read_tls_ticket_key_file) ||
+      !CU_add_test(pSuite, "response_cache_parse_cache_control",
+                   shrpx::test_shrpx_response_cache_parse_cache_control) ||
+      !CU_add_test(pSuite, "response_cache_get_freshness_lifetime",
+                   shrpx::test_shrpx_response_cache_get_freshness_lifetime) ||
+      !CU_add_test(pSuite, "response_cache_store_lookup",
+                   shrpx::test_shrpx_response_cache_store_lookup) ||
+      !CU_add_test(pSuite, "response_cache_vary",
+                   shrpx::test_shrpx_response_cache_vary) ||
+      !CU_add_test(pSuite, "response_cache_evict",
+                   shrpx::test_shrpx_response_cache_evict) ||
       !CU_add_test(pSuite, "util_streq", shrpx::test_util_streq) ||
       !CU_add_test(pSuite, "util_strieq", shrpx::test_util_strieq) ||
       !CU_add_test(pSuite, "util_inp_strlower",
@@ -155,11 +172,30 @@ int main(int argc, char *argv[]) {
       !CU_add_test(pSuite, "gzip_inflate", test_nghttp2_gzip_inflate) ||
       !CU_add_test(pSuite, "buffer_write", nghttp2::test_buffer_write) ||
       !CU_add_test(pSuite, "pool_recycle", nghttp2::test_pool_recycle) ||
+      !CU_add_test(pSuite, "pool_shrink", nghttp2::test_pool_shrink) ||
       !CU_add_test(pSuite, "memchunk_append", nghttp2::test_memchunks_append) ||
       !CU_add_test(pSuite, "memchunk_drain", nghttp2::test_memchunks_drain) ||
       !CU_add_test(pSuite, "memchunk_riovec", nghttp2::test_memchunks_riovec) ||
       !CU_add_test(pSuite, "memchunk_recycle",
-                   nghttp2::test_memchunks_recycle)) {
+                   nghttp2::test_memchunks_recycle) ||
+      !CU_add_test(pSuite, "block_allocator_alloc",
+                   nghttp2::test_block_allocator_alloc) ||
+      !CU_add_test(pSuite, "block_allocator_append_string_ref",
+                   nghttp2::test_block_allocator_append_string_ref) ||
+      !CU_add_test(pSuite, "mpsc_ring_push_pop",
+                   nghttp2::test_mpsc_ring_push_pop) ||
+      !CU_add_test(pSuite, "mpsc_ring_concurrent_push",
+                   nghttp2::test_mpsc_ring_concurrent_push) ||
+      !CU_add_test(
+          pSuite, "worker_select_downstream_addr_health_check",
+          shrpx::test_shrpx_worker_select_downstream_addr_health_check) ||
+      !CU_add_test(
+          pSuite, "worker_select_downstream_addr_least_requests",
+          shrpx::test_shrpx_worker_select_downstream_addr_least_requests) ||
+      !CU_add_test(pSuite, "downstream_connection_pool_reuse",
+                   shrpx::test_shrpx_downstream_connection_pool_reuse) ||
+      !CU_add_test(pSuite, "downstream_connection_pool_limit",
+                   shrpx::test_shrpx_downstream_connection_pool_limit)) {
     CU_cleanup_registry();
     return CU_get_error();
   }
@@ -311,6 +311,16 @@ std::unique_ptr<AcceptHandler> create_acceptor(ConnectionHandler *handler,
       continue;
     }
 
+#ifdef SO_REUSEPORT
+    // SO_REUSEPORT must be set before bind() so that worker sockets
+    // created later can share the same address.
+    if (get_config()->listener_reuseport &&
+        setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &val,
+                   static_cast<socklen_t>(sizeof(val))) == -1) {
+      LOG(WARN) << "Failed to set SO_REUSEPORT option to listener socket";
+    }
+#endif // SO_REUSEPORT
+
 #ifdef IPV6_V6ONLY
     if (family == AF_INET6) {
       if (setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &val,
@@ -365,6 +375,143 @@ std::unique_ptr<AcceptHandler> create_acceptor(ConnectionHandler *handler,
 }
 } // namespace
 
+namespace {
+// Creates new listening socket bound to the same address as |fd|
+// with SO_REUSEPORT.  |fd| must be bound with SO_REUSEPORT as well.
+// The returned socket is not inherited by new binary.  Returns -1 if
+// it fails.
+int create_reuseport_socket(int fd) {
+#ifdef SO_REUSEPORT
+  sockaddr_union addr;
+  socklen_t addrlen = sizeof(addr);
+  if (getsockname(fd, &addr.sa, &addrlen) != 0) {
+    return -1;
+  }
+
+  auto family = addr.storage.ss_family;
+
+#ifdef SOCK_NONBLOCK
+  auto nfd = socket(family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (nfd == -1) {
+    return -1;
+  }
+#else  // !SOCK_NONBLOCK
+  auto nfd = socket(family, SOCK_STREAM, 0);
+  if (nfd == -1) {
+    return -1;
+  }
+  util::make_socket_nonblocking(nfd);
+  util::make_socket_closeonexec(nfd);
+#endif // !SOCK_NONBLOCK
+  int val = 1;
+  if (setsockopt(nfd, SOL_SOCKET, SO_REUSEADDR, &val,
+                 static_cast<socklen_t>(sizeof(val))) == -1 ||
+      setsockopt(nfd, SOL_SOCKET, SO_REUSEPORT, &val,
+                 static_cast<socklen_t>(sizeof(val))) == -1) {
+    close(nfd);
+    return -1;
+  }
+
+#ifdef IPV6_V6ONLY
+  if (family == AF_INET6) {
+    if (setsockopt(nfd, IPPROTO_IPV6, IPV6_V6ONLY, &val,
+                   static_cast<socklen_t>(sizeof(val))) == -1) {
+      close(nfd);
+      return -1;
+    }
+  }
+#endif // IPV6_V6ONLY
+
+#ifdef TCP_DEFER_ACCEPT
+  val = 3;
+  if (setsockopt(nfd, IPPROTO_TCP, TCP_DEFER_ACCEPT, &val,
+                 static_cast<socklen_t>(sizeof(val))) == -1) {
+    LOG(WARN) << "Failed to set TCP_DEFER_ACCEPT option to listener socket";
+  }
+#endif // TCP_DEFER_ACCEPT
+
+  if (bind(nfd, &addr.sa, addrlen) != 0 ||
+      listen(nfd, get_config()->backlog) != 0) {
+    close(nfd);
+    return -1;
+  }
+
+  return nfd;
+#else  // !SO_REUSEPORT
+  return -1;
+#endif // !SO_REUSEPORT
+}
+} // namespace
+
+namespace {
+// Duplicates |fd| so that worker can own it.  The returned socket is
+// not inherited by new binary.  Returns -1 if it fails.
+int dup_listener_socket(int fd) {
+  auto nfd = dup(fd);
+  if (nfd == -1) {
+    return -1;
+  }
+  util::make_socket_closeonexec(nfd);
+  return nfd;
+}
+} // namespace
+
+namespace {
+// Creates listening sockets for each worker thread if
+// --listener-reuseport is given.  The first worker shares the sockets
+// of main thread, which are passed to new binary on binary upgrade.
+// Other workers get their own sockets bound with SO_REUSEPORT.  If
+// SO_REUSEPORT is not available, or listener is UNIX domain socket,
+// they share the socket of main thread, but still accept connections
+// in their own event loop.  This must be called before privileges are
+// dropped, since the sockets may be bound to privileged port.
+void create_worker_listeners(ConnectionHandler *conn_handler) {
+  std::vector<std::vector<int>> worker_fds(get_config()->num_worker);
+
+  for (auto acceptor :
+       {conn_handler->get_acceptor(), conn_handler->get_acceptor6()}) {
+    if (!acceptor) {
+      continue;
+    }
+
+    auto fd = acceptor->get_fd();
+
+    for (size_t i = 0; i < worker_fds.size(); ++i) {
+      auto nfd = -1;
+
+      if (i > 0 && !get_config()->host_unix) {
+        nfd = create_reuseport_socket(fd);
+        if (nfd == -1) {
+          auto error = errno;
+          LOG(WARN) << "Could not create SO_REUSEPORT listener for worker #"
+                    << i << ", errno=" << error
+                    << "; share listener of main thread instead";
+        }
+      }
+
+      if (nfd == -1) {
+        nfd = dup_listener_socket(fd);
+      }
+
+      if (nfd == -1) {
+        auto error = errno;
+        LOG(FATAL) << "Could not create listener for worker #" << i
+                   << ", errno=" << error;
+        exit(EXIT_FAILURE);
+      }
+
+      worker_fds[i].push_back(nfd);
+    }
+  }
+
+  // Workers accept connections by themselves.  Listeners in main
+  // thread are kept to pass them to new binary, and to accept pending
+  // connections on graceful shutdown.
+  conn_handler->disable_acceptor();
+  conn_handler->set_worker_listener_fds(std::move(worker_fds));
+}
+} // namespace
+
 namespace {
 void drop_privileges() {
   if (getuid() == 0 && get_config()->uid != 0) {
@@ -689,6 +836,12 @@ int event_loop() {
     }
   }
 
+#ifndef NOTHREADS
+  if (get_config()->listener_reuseport && get_config()->num_worker > 1) {
+    create_worker_listeners(conn_handler.get());
+  }
+#endif // !NOTHREADS
+
   // ListenHandler loads private key, and we listen on a priveleged port.
   // After that, we drop the root privileges if needed.
   drop_privileges();
@@ -910,12 +1063,23 @@ void fill_default_config() {
   mod_config()->argc = 0;
   mod_config()->argv = nullptr;
   mod_config()->downstream_connections_per_host = 8;
+  mod_config()->downstream_http2_connections_per_worker = 1;
+  mod_config()->downstream_health_check_interval = 0.;
+  mod_config()->downstream_health_check_timeout = 2.;
+  mod_config()->downstream_lb_method = LB_ROUND_ROBIN;
+  mod_config()->downstream_max_idle_connections_per_host = 32;
+  mod_config()->downstream_max_idle_connections = 256;
   mod_config()->downstream_connections_per_frontend = 0;
   mod_config()->listener_disable_timeout = 0.;
   mod_config()->tls_ctx_per_worker = false;
   mod_config()->downstream_request_buffer_size = 16 * 1024;
   mod_config()->downstream_response_buffer_size = 16 * 1024;
   mod_config()->no_server_push = false;
+  mod_config()->worker_buffer_pool_size = 4 * 1024 * 1024;
+  mod_config()->response_cache_max_size = 0;
+  mod_config()->response_cache_max_entry_size = 1024 * 1024;
+  mod_config()->http2_upstream_window_auto_tuning = 0;
+  mod_config()->listener_reuseport = false;
   mod_config()->host_unix = false;
 }
 } // namespace
@@ -948,12 +1112,11 @@ Options:
 
 Connections:
   -b, --backend=<HOST,PORT>
-              Set backend host and port.  For HTTP/1 backend, multiple
-              backend addresses are accepted by repeating this option.
-              HTTP/2  backend   does  not  support   multiple  backend
-              addresses  and the  first occurrence  of this  option is
-              used.  UNIX domain socket  can be specified by prefixing
-              path        name        with       "unix:"        (e.g.,
+              Set backend host  and  port.  Multiple backend addresses
+              are  accepted  by  repeating  this  option.   For HTTP/2
+              backend, see  --backend-http2-connections-per-worker for
+              how they are used.  UNIX  domain socket can be specified
+              by   prefixing   path    name    with   "unix:"   (e.g.,
               unix:/var/run/backend.sock)
               Default: )" << DEFAULT_DOWNSTREAM_HOST << ","
       << DEFAULT_DOWNSTREAM_PORT << R"(
@@ -984,11 +1147,53 @@ Connections:
               timeouts when connecting and  making CONNECT request can
               be     specified    by     --backend-read-timeout    and
               --backend-write-timeout options.
+  --backend-http1-load-balancing=<METHOD>
+              Specify the method to  select  backend address for a new
+              HTTP/1   backend   connection.    "round-robin"  selects
+              addresses in turn.  "least-requests" selects the address
+              which has  the  fewest  outstanding  requests  from this
+              worker.  Unhealthy addresses  found  by health check are
+              skipped in both methods.
+              Default: )"
+      << (get_config()->downstream_lb_method == LB_ROUND_ROBIN
+              ? "round-robin"
+              : "least-requests") << R"(
+  --backend-health-check-interval=<DURATION>
+              Specify the interval of  active  health check of backend
+              addresses.   Each   worker   periodically  probes  every
+              backend address given  in  -b  option,  and excludes the
+              unhealthy ones from load  balancing  until they pass the
+              check again.  If  all  backend  addresses are unhealthy,
+              all of them are  used.   0  disables health check.  This
+              option is meaningful when HTTP/1 backend is used.
+              Default: )"
+      << util::duration_str(get_config()->downstream_health_check_interval)
+      << R"(
+  --backend-health-check-timeout=<DURATION>
+              Specify the timeout of a health check probe.
+              Default: )"
+      << util::duration_str(get_config()->downstream_health_check_timeout)
+      << R"(
+  --backend-health-check-path=<PATH>
+              Specify the path  of  HTTP  request  sent to backend for
+              health check.  If this  option  is given, GET request to
+              <PATH> is sent after  connection is established, and the
+              backend is considered healthy if it responds with 2xx or
+              3xx status code.  Otherwise, a successful TCP connection
+              establishment is considered healthy.
 
 Performance:
   -n, --workers=<N>
               Set the number of worker threads.
               Default: )" << get_config()->num_worker << R"(
+  --listener-reuseport
+              Let each worker  thread  accept  connections  on its own
+              listening socket instead of receiving them from the main
+              thread.  For TCP  listeners,  the additional sockets are
+              bound with SO_REUSEPORT  so  that the kernel distributes
+              incoming connections among  workers.  UNIX domain socket
+              listener is shared by  all  workers.  This option has no
+              effect if -n1 is used.
   --read-rate=<SIZE>
               Set maximum  average read  rate on  frontend connection.
               Setting 0 to this option means read rate is unlimited.
@@ -1047,6 +1252,32 @@ Performance:
               (-s option), use --backend-http1-connections-per-host.
               Default: )" << get_config()->downstream_connections_per_frontend
       << R"(
+  --backend-http1-max-idle-connections-per-host=<N>
+              Set  the   maximum   number   of   idle  backend  HTTP/1
+              connections a worker keeps  per  backend address.  If it
+              is exceeded, the least  recently used idle connection is
+              closed.  0 means unlimited.
+              Default: )"
+      << get_config()->downstream_max_idle_connections_per_host << R"(
+  --backend-http1-max-idle-connections=<N>
+              Set  the   maximum   number   of   idle  backend  HTTP/1
+              connections a worker keeps in total.  If it is exceeded,
+              the least recently  used  idle  connection is closed.  0
+              means unlimited.
+              Default: )" << get_config()->downstream_max_idle_connections
+      << R"(
+  --backend-http2-connections-per-worker=<N>
+              Set the number of backend HTTP/2 connections per worker.
+              The connections are  distributed among backend addresses
+              given in -b option in round robin manner.  A new request
+              is sent over the connection  which has the fewest active
+              streams.     If    all    connections    have    reached
+              SETTINGS_MAX_CONCURRENT_STREAMS    of     backend,    an
+              additional connection is made, and it is closed after it
+              becomes idle.   This  option  is  meaningful when HTTP/2
+              backend is used.
+              Default: )"
+      << get_config()->downstream_http2_connections_per_worker << R"(
   --rlimit-nofile=<N>
               Set maximum number of open files (RLIMIT_NOFILE) to <N>.
               If 0 is given, nghttpx does not set the limit.
@@ -1061,6 +1292,32 @@ Performance:
               Default: )"
       << util::utos_with_unit(get_config()->downstream_response_buffer_size)
       << R"(
+  --worker-buffer-pool-size=<SIZE>
+              Set the maximum size  of  unused  buffers which a worker
+              keeps for reuse.  Buffers  are shared by all connections
+              handled by  the  worker.   Buffers  released beyond this
+              limit are freed immediately,  and buffers which were not
+              used for  a  while  are  freed  periodically.  Setting 0
+              means unlimited.
+              Default: )"
+      << util::utos_with_unit(get_config()->worker_buffer_pool_size) << R"(
+  --cache-max-size=<SIZE>
+              Enable in-memory  response  cache,  and  set the maximum
+              size  of  responses  a  worker  stores  in  total.   GET
+              responses from backend are stored if they are allowed by
+              Cache-Control and have explicit expiration time given by
+              s-maxage,  max-age  or  Expires.   Fresh  responses  are
+              served from the  cache  without  contacting backend.  If
+              the limit is exceeded, the least recently used responses
+              are evicted.  0 disables the cache.
+              Default: )"
+      << util::utos_with_unit(get_config()->response_cache_max_size) << R"(
+  --cache-max-entry-size=<SIZE>
+              Set the maximum  size  of  response  body  stored in the
+              response cache.  Larger responses are not stored.
+              Default: )"
+      << util::utos_with_unit(get_config()->response_cache_max_entry_size)
+      << R"(
 
 Timeout:
   --frontend-http2-read-timeout=<DURATION>
@@ -1206,6 +1463,17 @@ HTTP/2 and SPDY:
               2**<N>-1. For SPDY, the size is 2**<N>.
               Default: )" << get_config()->http2_upstream_connection_window_bits
       << R"(
+  --frontend-http2-window-auto-tuning=<SIZE>
+              Enable receive  window auto-tuning of  HTTP/2 frontend
+              connection.   The  per-stream and  per-connection window
+              sizes above are grown while a client fills them in less
+              than 2  round trips, and  taken back from  idle streams.
+              <SIZE> is the memory budget per connection, which bounds
+              the connection window and the sum of the window growth
+              of streams.  0 disables the auto-tuning.
+              Default: )"
+      << util::utos_with_unit(get_config()->http2_upstream_window_auto_tuning)
+      << R"(
   --frontend-no-tls
               Disable SSL/TLS on frontend connections.
   --backend-http2-window-bits=<N>
@@ -1489,6 +1757,19 @@ int main(int argc, char **argv) {
         {"backend-request-buffer", required_argument, &flag, 72},
         {"no-host-rewrite", no_argument, &flag, 73},
         {"no-server-push", no_argument, &flag, 74},
+        {"worker-buffer-pool-size", required_argument, &flag, 75},
+        {"listener-reuseport", no_argument, &flag, 76},
+        {"backend-http2-connections-per-worker", required_argument, &flag, 77},
+        {"backend-health-check-interval", required_argument, &flag, 78},
+        {"backend-health-check-timeout", required_argument, &flag, 79},
+        {"backend-health-check-path", required_argument, &flag, 80},
+        {"backend-http1-load-balancing", required_argument, &flag, 81},
+        {"backend-http1-max-idle-connections-per-host", required_argument,
+         &flag, 82},
+        {"backend-http1-max-idle-connections", required_argument, &flag, 83},
+        {"cache-max-size", required_argument, &flag, 84},
+        {"cache-max-entry-size", required_argument, &flag, 85},
+        {"frontend-http2-window-auto-tuning", required_argument, &flag, 86},
         {nullptr, 0, nullptr, 0}};
 
     int option_index = 0;
@@ -1826,6 +2107,58 @@ int main(int argc, char **argv) {
         // --no-server-push
         cmdcfgs.emplace_back(SHRPX_OPT_NO_SERVER_PUSH, "yes");
         break;
+      case 75:
+        // --worker-buffer-pool-size
+        cmdcfgs.emplace_back(SHRPX_OPT_WORKER_BUFFER_POOL_SIZE, optarg);
+        break;
+      case 76:
+        // --listener-reuseport
+        cmdcfgs.emplace_back(SHRPX_OPT_LISTENER_REUSEPORT, "yes");
+        break;
+      case 77:
+        // --backend-http2-connections-per-worker
+        cmdcfgs.emplace_back(SHRPX_OPT_BACKEND_HTTP2_CONNECTIONS_PER_WORKER,
+                             optarg);
+        break;
+      case 78:
+        // --backend-health-check-interval
+        cmdcfgs.emplace_back(SHRPX_OPT_BACKEND_HEALTH_CHECK_INTERVAL, optarg);
+        break;
+      case 79:
+        // --backend-health-check-timeout
+        cmdcfgs.emplace_back(SHRPX_OPT_BACKEND_HEALTH_CHECK_TIMEOUT, optarg);
+        break;
+      case 80:
+        // --backend-health-check-path
+        cmdcfgs.emplace_back(SHRPX_OPT_BACKEND_HEALTH_CHECK_PATH, optarg);
+        break;
+      case 81:
+        // --backend-http1-load-balancing
+        cmdcfgs.emplace_back(SHRPX_OPT_BACKEND_HTTP1_LOAD_BALANCING, optarg);
+        break;
+      case 82:
+        // --backend-http1-max-idle-connections-per-host
+        cmdcfgs.emplace_back(
+            SHRPX_OPT_BACKEND_HTTP1_MAX_IDLE_CONNECTIONS_PER_HOST, optarg);
+        break;
+      case 83:
+        // --backend-http1-max-idle-connections
+        cmdcfgs.emplace_back(SHRPX_OPT_BACKEND_HTTP1_MAX_IDLE_CONNECTIONS,
+                             optarg);
+        break;
+      case 84:
+        // --cache-max-size
+        cmdcfgs.emplace_back(SHRPX_OPT_CACHE_MAX_SIZE, optarg);
+        break;
+      case 85:
+        // --cache-max-entry-size
+        cmdcfgs.emplace_back(SHRPX_OPT_CACHE_MAX_ENTRY_SIZE, optarg);
+        break;
+      case 86:
+        // --frontend-http2-window-auto-tuning
+        cmdcfgs.emplace_back(SHRPX_OPT_FRONTEND_HTTP2_WINDOW_AUTO_TUNING,
+                             optarg);
+        break;
       default:
         break;
       }
@@ -2000,6 +2333,18 @@ int main(int argc, char **argv) {
     mod_config()->downstream_addrs.push_back(std::move(addr));
   }
 
+  if (LOG_ENABLED(INFO)) {
+    // Per session statistics are logged when HTTP/2 upstream session
+    // is closed.
+    nghttp2_option_set_stats(get_config()->http2_option, 1);
+  }
+
+  if (get_config()->http2_upstream_window_auto_tuning > 0) {
+    nghttp2_option_set_window_auto_tuning(
+        get_config()->http2_option,
+        get_config()->http2_upstream_window_auto_tuning);
+  }
+
   if (LOG_ENABLED(INFO)) {
     LOG(INFO) << "Resolving backend address";
   }
@@ -29,7 +29,9 @@
 #include <cerrno>
 
 #include "shrpx_connection_handler.h"
+#include "shrpx_worker.h"
 #include "shrpx_config.h"
+#include "shrpx_log.h"
 #include "util.h"
 
 using namespace nghttp2;
@@ -44,14 +46,22 @@ void acceptcb(struct ev_loop *loop, ev_io *w, int revent) {
 } // namespace
 
 AcceptHandler::AcceptHandler(int fd, ConnectionHandler *h)
-    : conn_hnr_(h), fd_(fd) {
+    : loop_(h->get_loop()), conn_hnr_(h), worker_(nullptr), fd_(fd) {
   ev_io_init(&wev_, acceptcb, fd_, EV_READ);
   wev_.data = this;
-  ev_io_start(conn_hnr_->get_loop(), &wev_);
+  ev_io_start(loop_, &wev_);
+}
+
+AcceptHandler::AcceptHandler(int fd, Worker *worker)
+    : loop_(worker->get_loop()), conn_hnr_(nullptr), worker_(worker),
+      fd_(fd) {
+  ev_io_init(&wev_, acceptcb, fd_, EV_READ);
+  wev_.data = this;
+  ev_io_start(loop_, &wev_);
 }
 
 AcceptHandler::~AcceptHandler() {
-  ev_io_stop(conn_hnr_->get_loop(), &wev_);
+  ev_io_stop(loop_, &wev_);
   close(fd_);
 }
 
@@ -81,6 +91,18 @@ void AcceptHandler::accept_connection() {
       case EOPNOTSUPP:
       case ENETUNREACH:
         continue;
+      case EMFILE:
+      case ENFILE:
+        LOG(WARN) << "acceptor: running out file descriptor; disable acceptor "
+                     "temporarily";
+        if (worker_) {
+          worker_->disable_acceptor_temporary(
+              get_config()->listener_disable_timeout);
+        } else {
+          conn_hnr_->disable_acceptor_temporary(
+              get_config()->listener_disable_timeout);
+        }
+        break;
       }
 
       break;
@@ -93,13 +115,17 @@ void AcceptHandler::accept_connection() {
 
     util::make_socket_nodelay(cfd);
 
-    conn_hnr_->handle_connection(cfd, &sockaddr.sa, addrlen);
+    if (worker_) {
+      worker_->handle_connection(cfd, &sockaddr.sa, addrlen);
+    } else {
+      conn_hnr_->handle_connection(cfd, &sockaddr.sa, addrlen);
+    }
   }
 }
 
-void AcceptHandler::enable() { ev_io_start(conn_hnr_->get_loop(), &wev_); }
+void AcceptHandler::enable() { ev_io_start(loop_, &wev_); }
 
-void AcceptHandler::disable() { ev_io_stop(conn_hnr_->get_loop(), &wev_); }
+void AcceptHandler::disable() { ev_io_stop(loop_, &wev_); }
 
 int AcceptHandler::get_fd() const { return fd_; }
 
@@ -32,10 +32,16 @@
 namespace shrpx {
 
 class ConnectionHandler;
+class Worker;
 
 class AcceptHandler {
 public:
+  // Creates acceptor which runs in main event loop, and dispatches
+  // accepted connections through |h|.
   AcceptHandler(int fd, ConnectionHandler *h);
+  // Creates acceptor which runs in |worker|'s event loop, and hands
+  // accepted connections to |worker| directly.
+  AcceptHandler(int fd, Worker *worker);
   ~AcceptHandler();
   void accept_connection();
   void enable();
@@ -44,7 +50,10 @@ public:
 
 private:
   ev_io wev_;
+  struct ev_loop *loop_;
+  // Exactly one of conn_hnr_ and worker_ is not nullptr.
   ConnectionHandler *conn_hnr_;
+  Worker *worker_;
   int fd_;
 };
 
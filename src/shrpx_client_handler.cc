@@ -576,6 +576,12 @@ void ClientHandler::set_should_close_after_write(bool f) {
 
 void ClientHandler::pool_downstream_connection(
     std::unique_ptr<DownstreamConnection> dconn) {
+  if (get_config()->downstream_proto == PROTO_HTTP2) {
+    // Http2DownstreamConnection is bound to Http2Session.  We do not
+    // pool it so that new request can be placed on the least loaded
+    // session.
+    return;
+  }
   if (LOG_ENABLED(INFO)) {
     CLOG(INFO, this) << "Pooling downstream connection DCONN:" << dconn.get();
   }
@@ -596,22 +602,29 @@ void ClientHandler::remove_downstream_connection(DownstreamConnection *dconn) {
 std::unique_ptr<DownstreamConnection>
 ClientHandler::get_downstream_connection() {
   auto dconn_pool = worker_->get_dconn_pool();
-  auto dconn = dconn_pool->pop_downstream_connection();
+
+  if (get_config()->downstream_proto == PROTO_HTTP2) {
+    auto http2session = worker_->next_http2_session();
+    auto dconn =
+        make_unique<Http2DownstreamConnection>(dconn_pool, http2session);
+    dconn->set_client_handler(this);
+    return std::move(dconn);
+  }
+
+  auto addr_idx = worker_->select_downstream_addr();
+  auto dconn = dconn_pool->pop_downstream_connection(addr_idx);
 
   if (!dconn) {
     if (LOG_ENABLED(INFO)) {
-      CLOG(INFO, this) << "Downstream connection pool is empty."
-                       << " Create new one";
+      CLOG(INFO, this) << "Downstream connection pool has no connection to "
+                       << "backend address " << addr_idx
+                       << ". Create new one (hits="
+                       << dconn_pool->get_num_hits()
+                       << ", misses=" << dconn_pool->get_num_misses() << ")";
     }
 
-    auto dconn_pool = worker_->get_dconn_pool();
-    auto http2session = worker_->get_http2_session();
-
-    if (http2session) {
-      dconn = make_unique<Http2DownstreamConnection>(dconn_pool, http2session);
-    } else {
-      dconn = make_unique<HttpDownstreamConnection>(dconn_pool, conn_.loop);
-    }
+    dconn =
+        make_unique<HttpDownstreamConnection>(dconn_pool, addr_idx, conn_.loop);
     dconn->set_client_handler(this);
     return dconn;
   }
@@ -620,7 +633,8 @@ ClientHandler::get_downstream_connection() {
 
   if (LOG_ENABLED(INFO)) {
     CLOG(INFO, this) << "Reuse downstream connection DCONN:" << dconn.get()
-                     << " from pool";
+                     << " from pool (hits=" << dconn_pool->get_num_hits()
+                     << ", misses=" << dconn_pool->get_num_misses() << ")";
   }
 
   return dconn;
@@ -628,10 +642,6 @@ ClientHandler::get_downstream_connection() {
 
 SSL *ClientHandler::get_ssl() const { return conn_.tls.ssl; }
 
-Http2Session *ClientHandler::get_http2_session() const {
-  return worker_->get_http2_session();
-}
-
 ConnectBlocker *ClientHandler::get_http1_connect_blocker() const {
   return worker_->get_http1_connect_blocker();
 }
@@ -146,6 +146,25 @@ const char SHRPX_OPT_TLS_CTX_PER_WORKER[] = "tls-ctx-per-worker";
 const char SHRPX_OPT_BACKEND_REQUEST_BUFFER[] = "backend-request-buffer";
 const char SHRPX_OPT_BACKEND_RESPONSE_BUFFER[] = "backend-response-buffer";
 const char SHRPX_OPT_NO_SERVER_PUSH[] = "no-server-push";
+const char SHRPX_OPT_WORKER_BUFFER_POOL_SIZE[] = "worker-buffer-pool-size";
+const char SHRPX_OPT_LISTENER_REUSEPORT[] = "listener-reuseport";
+const char SHRPX_OPT_BACKEND_HTTP2_CONNECTIONS_PER_WORKER[] =
+    "backend-http2-connections-per-worker";
+const char SHRPX_OPT_BACKEND_HEALTH_CHECK_INTERVAL[] =
+    "backend-health-check-interval";
+const char SHRPX_OPT_BACKEND_HEALTH_CHECK_TIMEOUT[] =
+    "backend-health-check-timeout";
+const char SHRPX_OPT_BACKEND_HEALTH_CHECK_PATH[] = "backend-health-check-path";
+const char SHRPX_OPT_BACKEND_HTTP1_LOAD_BALANCING[] =
+    "backend-http1-load-balancing";
+const char SHRPX_OPT_BACKEND_HTTP1_MAX_IDLE_CONNECTIONS_PER_HOST[] =
+    "backend-http1-max-idle-connections-per-host";
+const char SHRPX_OPT_BACKEND_HTTP1_MAX_IDLE_CONNECTIONS[] =
+    "backend-http1-max-idle-connections";
+const char SHRPX_OPT_CACHE_MAX_SIZE[] = "cache-max-size";
+const char SHRPX_OPT_CACHE_MAX_ENTRY_SIZE[] = "cache-max-entry-size";
+const char SHRPX_OPT_FRONTEND_HTTP2_WINDOW_AUTO_TUNING[] =
+    "frontend-http2-window-auto-tuning";
 
 namespace {
 Config *config = nullptr;
@@ -1193,6 +1212,98 @@ int parse_config(const char *opt, const char *optarg) {
     return 0;
   }
 
+  if (util::strieq(opt, SHRPX_OPT_WORKER_BUFFER_POOL_SIZE)) {
+    return parse_uint_with_unit(&mod_config()->worker_buffer_pool_size, opt,
+                                optarg);
+  }
+
+  if (util::strieq(opt, SHRPX_OPT_LISTENER_REUSEPORT)) {
+    mod_config()->listener_reuseport = util::strieq(optarg, "yes");
+
+    return 0;
+  }
+
+  if (util::strieq(opt, SHRPX_OPT_BACKEND_HTTP2_CONNECTIONS_PER_WORKER)) {
+    int n;
+
+    if (parse_uint(&n, opt, optarg) != 0) {
+      return -1;
+    }
+
+    if (n == 0) {
+      LOG(ERROR) << opt << ": specify an integer strictly more than 0";
+
+      return -1;
+    }
+
+    mod_config()->downstream_http2_connections_per_worker = n;
+
+    return 0;
+  }
+
+  if (util::strieq(opt, SHRPX_OPT_BACKEND_HEALTH_CHECK_INTERVAL)) {
+    return parse_duration(&mod_config()->downstream_health_check_interval,
+                          opt, optarg);
+  }
+
+  if (util::strieq(opt, SHRPX_OPT_BACKEND_HEALTH_CHECK_TIMEOUT)) {
+    return parse_duration(&mod_config()->downstream_health_check_timeout, opt,
+                          optarg);
+  }
+
+  if (util::strieq(opt, SHRPX_OPT_BACKEND_HEALTH_CHECK_PATH)) {
+    if (optarg[0] != '/') {
+      LOG(ERROR) << opt << ": path must start with '/'";
+
+      return -1;
+    }
+
+    mod_config()->downstream_health_check_path = strcopy(optarg);
+
+    return 0;
+  }
+
+  if (util::strieq(opt, SHRPX_OPT_BACKEND_HTTP1_LOAD_BALANCING)) {
+    if (util::strieq(optarg, "round-robin")) {
+      mod_config()->downstream_lb_method = LB_ROUND_ROBIN;
+    } else if (util::strieq(optarg, "least-requests")) {
+      mod_config()->downstream_lb_method = LB_LEAST_REQUESTS;
+    } else {
+      LOG(ERROR) << opt
+                 << ": must be either \"round-robin\" or \"least-requests\"";
+
+      return -1;
+    }
+
+    return 0;
+  }
+
+  if (util::strieq(opt,
+                   SHRPX_OPT_BACKEND_HTTP1_MAX_IDLE_CONNECTIONS_PER_HOST)) {
+    return parse_uint(&mod_config()->downstream_max_idle_connections_per_host,
+                      opt, optarg);
+  }
+
+  if (util::strieq(opt, SHRPX_OPT_BACKEND_HTTP1_MAX_IDLE_CONNECTIONS)) {
+    return parse_uint(&mod_config()->downstream_max_idle_connections, opt,
+                      optarg);
+  }
+
+  if (util::strieq(opt, SHRPX_OPT_CACHE_MAX_SIZE)) {
+    return parse_uint_with_unit(&mod_config()->response_cache_max_size, opt,
+                                optarg);
+  }
+
+  if (util::strieq(opt, SHRPX_OPT_CACHE_MAX_ENTRY_SIZE)) {
+    return parse_uint_with_unit(&mod_config()->response_cache_max_entry_size,
+                                opt, optarg);
+  }
+
+  if (util::strieq(opt, SHRPX_OPT_FRONTEND_HTTP2_WINDOW_AUTO_TUNING)) {
+    return parse_uint_with_unit(
+        &mod_config()->http2_upstream_window_auto_tuning, opt, optarg);
+  }
+
   if (util::strieq(opt, "conf")) {
     LOG(WARN) << "conf: ignored";
 
@@ -136,6 +136,18 @@ extern const char SHRPX_OPT_TLS_CTX_PER_WORKER[];
 extern const char SHRPX_OPT_BACKEND_REQUEST_BUFFER[];
 extern const char SHRPX_OPT_BACKEND_RESPONSE_BUFFER[];
 extern const char SHRPX_OPT_NO_SERVER_PUSH[];
+extern const char SHRPX_OPT_WORKER_BUFFER_POOL_SIZE[];
+extern const char SHRPX_OPT_LISTENER_REUSEPORT[];
+extern const char SHRPX_OPT_BACKEND_HTTP2_CONNECTIONS_PER_WORKER[];
+extern const char SHRPX_OPT_BACKEND_HEALTH_CHECK_INTERVAL[];
+extern const char SHRPX_OPT_BACKEND_HEALTH_CHECK_TIMEOUT[];
+extern const char SHRPX_OPT_BACKEND_HEALTH_CHECK_PATH[];
+extern const char SHRPX_OPT_BACKEND_HTTP1_LOAD_BALANCING[];
+extern const char SHRPX_OPT_BACKEND_HTTP1_MAX_IDLE_CONNECTIONS_PER_HOST[];
+extern const char SHRPX_OPT_BACKEND_HTTP1_MAX_IDLE_CONNECTIONS[];
+extern const char SHRPX_OPT_CACHE_MAX_SIZE[];
+extern const char SHRPX_OPT_CACHE_MAX_ENTRY_SIZE[];
+extern const char SHRPX_OPT_FRONTEND_HTTP2_WINDOW_AUTO_TUNING[];
 
 union sockaddr_union {
   sockaddr_storage storage;
@@ -147,6 +159,9 @@ union sockaddr_union {
 
 enum shrpx_proto { PROTO_HTTP2, PROTO_HTTP };
 
+// Method to select backend address for HTTP/1 backend connection.
+enum shrpx_lb_method { LB_ROUND_ROBIN, LB_LEAST_REQUESTS };
+
 struct AltSvc {
   AltSvc()
       : protocol_id(nullptr), host(nullptr), origin(nullptr),
@@ -208,6 +223,10 @@ struct Config {
   ev_tstamp stream_write_timeout;
   ev_tstamp downstream_idle_read_timeout;
   ev_tstamp listener_disable_timeout;
+  // The interval of backend health check.  0 means health check is
+  // disabled.
+  ev_tstamp downstream_health_check_interval;
+  ev_tstamp downstream_health_check_timeout;
   // address of frontend connection.  This could be a path to UNIX
   // domain socket.  In this case, |host_unix| must be true.
   std::unique_ptr<char[]> host;
@@ -217,6 +236,9 @@ struct Config {
   std::unique_ptr<char[]> dh_param_file;
   const char *server_name;
   std::unique_ptr<char[]> backend_tls_sni_name;
+  // The path of HTTP request for backend health check.  If nullptr,
+  // only TCP connection is checked.
+  std::unique_ptr<char[]> downstream_health_check_path;
   std::unique_ptr<char[]> pid_file;
   std::unique_ptr<char[]> conf_path;
   std::unique_ptr<char[]> ciphers;
@@ -261,6 +283,15 @@ struct Config {
   size_t http2_downstream_connection_window_bits;
   size_t downstream_connections_per_host;
   size_t downstream_connections_per_frontend;
+  // The number of HTTP/2 backend connections per worker, excluding
+  // the ones made when all of them reach the stream limit.
+  size_t downstream_http2_connections_per_worker;
+  // The maximum number of idle HTTP/1 backend connections per
+  // backend address and per worker.  0 means unlimited.
+  size_t downstream_max_idle_connections_per_host;
+  // The maximum number of idle HTTP/1 backend connections per worker.
+  // 0 means unlimited.
+  size_t downstream_max_idle_connections;
   // actual size of downstream_http_proxy_addr
   size_t downstream_http_proxy_addrlen;
   size_t read_rate;
@@ -276,11 +307,23 @@ struct Config {
   size_t rlimit_nofile;
   size_t downstream_request_buffer_size;
   size_t downstream_response_buffer_size;
+  // The maximum size of unused buffers retained by a worker for
+  // reuse.  0 means unlimited.
+  size_t worker_buffer_pool_size;
+  // The maximum total size of responses stored in ResponseCache per
+  // worker.  0 disables the cache.
+  size_t response_cache_max_size;
+  // The maximum size of response body stored in ResponseCache.
+  size_t response_cache_max_entry_size;
+  // The memory budget of receive window auto-tuning of HTTP/2
+  // frontend connection.  0 disables the auto-tuning.
+  size_t http2_upstream_window_auto_tuning;
   // Bit mask to disable SSL/TLS protocol versions.  This will be
   // passed to SSL_CTX_set_options().
   long int tls_proto_mask;
   // downstream protocol; this will be determined by given options.
   shrpx_proto downstream_proto;
+  shrpx_lb_method downstream_lb_method;
   int syslog_facility;
   int backlog;
   int argc;
@@ -320,6 +363,9 @@ struct Config {
   bool no_host_rewrite;
   bool tls_ctx_per_worker;
   bool no_server_push;
+  // true if each worker accepts connections on its own listening
+  // socket bound with SO_REUSEPORT.
+  bool listener_reuseport;
   // true if host contains UNIX domain socket path
   bool host_unix;
 };
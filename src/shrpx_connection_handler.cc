@@ -82,14 +82,8 @@ void ConnectionHandler::worker_reopen_log_files() {
 
 void ConnectionHandler::worker_renew_ticket_keys(
     const std::shared_ptr<TicketKeys> &ticket_keys) {
-  WorkerEvent wev;
-
-  memset(&wev, 0, sizeof(wev));
-  wev.type = RENEW_TICKET_KEYS;
-  wev.ticket_keys = ticket_keys;
-
   for (auto &worker : workers_) {
-    worker->send(wev);
+    worker->send_ticket_keys(ticket_keys);
   }
 }
 
@@ -126,6 +120,13 @@ void ConnectionHandler::create_worker_thread(size_t num) {
 
     auto worker = make_unique<Worker>(loop, sv_ssl_ctx, cl_ssl_ctx, cert_tree,
                                       ticket_keys_);
+
+    if (i < worker_listener_fds_.size()) {
+      for (auto fd : worker_listener_fds_[i]) {
+        worker->add_acceptor(make_unique<AcceptHandler>(fd, worker.get()));
+      }
+    }
+
     worker->run_async();
     workers_.push_back(std::move(worker));
 
@@ -133,6 +134,8 @@ void ConnectionHandler::create_worker_thread(size_t num) {
       LLOG(INFO, this) << "Created thread #" << workers_.size() - 1;
     }
   }
+
+  worker_listener_fds_.clear();
 #endif // NOTHREADS
 }
 
@@ -246,6 +249,11 @@ AcceptHandler *ConnectionHandler::get_acceptor6() const {
   return acceptor6_.get();
 }
 
+void ConnectionHandler::set_worker_listener_fds(
+    std::vector<std::vector<int>> fds) {
+  worker_listener_fds_ = std::move(fds);
+}
+
 void ConnectionHandler::enable_acceptor() {
   if (acceptor_) {
     acceptor_->enable();
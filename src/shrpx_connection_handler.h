@@ -69,6 +69,10 @@ public:
   AcceptHandler *get_acceptor() const;
   void set_acceptor6(std::unique_ptr<AcceptHandler> h);
   AcceptHandler *get_acceptor6() const;
+  // Sets listening sockets owned by each worker.  |fds[i]| is used by
+  // i-th worker created by create_worker_thread().  This must be
+  // called before create_worker_thread().
+  void set_worker_listener_fds(std::vector<std::vector<int>> fds);
   void enable_acceptor();
   void disable_acceptor();
   void disable_acceptor_temporary(ev_tstamp t);
@@ -93,6 +97,9 @@ private:
   std::unique_ptr<AcceptHandler> acceptor_;
   // acceptor for IPv6 address
   std::unique_ptr<AcceptHandler> acceptor6_;
+  // Listening sockets passed to workers if
+  // get_config()->listener_reuseport is true.
+  std::vector<std::vector<int>> worker_listener_fds_;
   ev_timer disable_acceptor_timer_;
   unsigned int worker_round_robin_cnt_;
   bool graceful_shutdown_;
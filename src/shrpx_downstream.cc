@@ -33,6 +33,7 @@
 #include "shrpx_config.h"
 #include "shrpx_error.h"
 #include "shrpx_downstream_connection.h"
+#include "shrpx_response_cache.h"
 #include "util.h"
 #include "http2.h"
 
@@ -106,7 +107,8 @@ void downstream_wtimeoutcb(struct ev_loop *loop, ev_timer *w, int revents) {
 
 // upstream could be nullptr for unittests
 Downstream::Downstream(Upstream *upstream, int32_t stream_id, int32_t priority)
-    : request_start_time_(std::chrono::high_resolution_clock::now()),
+    : balloc_(1024, 1024),
+      request_start_time_(std::chrono::high_resolution_clock::now()),
       request_buf_(upstream ? upstream->get_mcpool() : nullptr),
       response_buf_(upstream ? upstream->get_mcpool() : nullptr),
       request_bodylen_(0), response_bodylen_(0), response_sent_bodylen_(0),
@@ -123,7 +125,8 @@ Downstream::Downstream(Upstream *upstream, int32_t stream_id, int32_t priority)
       request_trailer_key_prev_(false), request_http2_expect_body_(false),
       chunked_response_(false), response_connection_close_(false),
       response_header_key_prev_(false), response_trailer_key_prev_(false),
-      expect_final_response_(false), request_pending_(false) {
+      expect_final_response_(false), request_pending_(false),
+      response_cached_(false) {
 
   ev_timer_init(&upstream_rtimer_, &upstream_rtimeoutcb, 0.,
                 get_config()->stream_read_timeout);
@@ -218,9 +221,9 @@ void Downstream::force_resume_read() {
 }
 
 namespace {
-const Headers::value_type *get_header_linear(const Headers &headers,
-                                             const std::string &name) {
-  const Headers::value_type *res = nullptr;
+const HeaderRefs::value_type *get_header_linear(const HeaderRefs &headers,
+                                                const std::string &name) {
+  const HeaderRefs::value_type *res = nullptr;
   for (auto &kv : headers) {
     if (kv.name == name) {
       res = &kv;
@@ -230,7 +233,7 @@ const Headers::value_type *get_header_linear(const Headers &headers,
 }
 } // namespace
 
-const Headers &Downstream::get_request_headers() const {
+const HeaderRefs &Downstream::get_request_headers() const {
   return request_headers_;
 }
 
@@ -243,12 +246,14 @@ void Downstream::assemble_request_cookie() {
       continue;
     }
 
-    auto end = kv.value.find_last_not_of(" ;");
-    if (end == std::string::npos) {
-      cookie += kv.value;
-    } else {
-      cookie.append(std::begin(kv.value), std::begin(kv.value) + end + 1);
+    auto first = std::begin(kv.value);
+    auto end = std::end(kv.value);
+    for (; end != first && (*(end - 1) == ' ' || *(end - 1) == ';'); --end)
+      ;
+    if (end == first) {
+      end = std::end(kv.value);
     }
+    cookie.append(first, end);
     cookie += "; ";
   }
   if (cookie.size() >= 2) {
@@ -263,22 +268,20 @@ Headers Downstream::crumble_request_cookie() {
         !util::streq_l("cooki", kv.name.c_str(), 5)) {
       continue;
     }
-    size_t last = kv.value.size();
+    auto last = std::end(kv.value);
 
-    for (size_t j = 0; j < last;) {
-      j = kv.value.find_first_not_of("\t ;", j);
-      if (j == std::string::npos) {
+    for (auto p = std::begin(kv.value); p != last;) {
+      p = std::find_if(
+          p, last, [](char c) { return c != '\t' && c != ' ' && c != ';'; });
+      if (p == last) {
         break;
       }
-      auto first = j;
+      auto first = p;
 
-      j = kv.value.find(';', j);
-      if (j == std::string::npos) {
-        j = last;
-      }
+      p = std::find(p, last, ';');
 
       cookie_hdrs.push_back(
-          Header("cookie", kv.value.substr(first, j - first), kv.no_index));
+          Header("cookie", std::string(first, p), kv.no_index));
     }
   }
   return cookie_hdrs;
@@ -289,50 +292,85 @@ const std::string &Downstream::get_assembled_request_cookie() const {
 }
 
 namespace {
-void add_header(bool &key_prev, size_t &sum, Headers &headers, std::string name,
-                std::string value) {
+void add_header(bool &key_prev, size_t &sum, HeaderRefs &headers,
+                BlockAllocator &balloc, const StringRef &name,
+                const StringRef &value) {
   key_prev = true;
   sum += name.size() + value.size();
-  headers.emplace_back(std::move(name), std::move(value));
+  // An empty value is not allocated, so that the name stays the last
+  // allocation and append_last_header_key() can extend it in place.
+  headers.emplace_back(make_string_ref(balloc, name),
+                       make_string_ref(balloc, value));
+}
+} // namespace
+
+namespace {
+// Adds name/value pair to |headers|.  This function strips white
+// spaces around |value|.
+void add_header(size_t &sum, HeaderRefs &headers, BlockAllocator &balloc,
+                const uint8_t *name, size_t namelen, const uint8_t *value,
+                size_t valuelen, bool no_index, int16_t token) {
+  sum += namelen + valuelen;
+  if (valuelen > 0) {
+    size_t i, j;
+    for (i = 0; i < valuelen && (value[i] == ' ' || value[i] == '\t'); ++i)
+      ;
+    for (j = valuelen - 1; j > i && (value[j] == ' ' || value[j] == '\t'); --j)
+      ;
+    value += i;
+    valuelen -= i + (valuelen - j - 1);
+  }
+  headers.emplace_back(
+      make_string_ref(balloc,
+                      StringRef{reinterpret_cast<const char *>(name), namelen}),
+      make_string_ref(balloc, StringRef{reinterpret_cast<const char *>(value),
+                                        valuelen}),
+      no_index, token);
 }
 } // namespace
 
 namespace {
-void append_last_header_key(bool key_prev, size_t &sum, Headers &headers,
-                            const char *data, size_t len) {
+void append_last_header_key(bool key_prev, size_t &sum, HeaderRefs &headers,
+                            BlockAllocator &balloc, const char *data,
+                            size_t len) {
   assert(key_prev);
   sum += len;
   auto &item = headers.back();
-  item.name.append(data, len);
+  item.name = append_string_ref(balloc, item.name, data, len);
 }
 } // namespace
 
 namespace {
-void append_last_header_value(bool key_prev, size_t &sum, Headers &headers,
-                              const char *data, size_t len) {
+void append_last_header_value(bool key_prev, size_t &sum, HeaderRefs &headers,
+                              BlockAllocator &balloc, const char *data,
+                              size_t len) {
   assert(!key_prev);
   sum += len;
   auto &item = headers.back();
-  item.value.append(data, len);
+  item.value = append_string_ref(balloc, item.value, data, len);
 }
 } // namespace
 
 namespace {
-void set_last_header_value(bool &key_prev, size_t &sum, Headers &headers,
-                           const char *data, size_t len) {
+void set_last_header_value(bool &key_prev, size_t &sum, HeaderRefs &headers,
+                           BlockAllocator &balloc, const char *data,
+                           size_t len) {
   key_prev = false;
   sum += len;
   auto &item = headers.back();
-  item.value.assign(data, len);
+  item.value = make_string_ref(balloc, StringRef{data, len});
 }
 } // namespace
 
 namespace {
-int index_headers(http2::HeaderIndex &hdidx, Headers &headers,
+int index_headers(http2::HeaderIndex &hdidx, HeaderRefs &headers,
                   int64_t &content_length) {
   for (size_t i = 0; i < headers.size(); ++i) {
     auto &kv = headers[i];
-    util::inp_strlower(kv.name);
+    // The name is allocated from BlockAllocator owned by Downstream,
+    // so it is safe to lower it in place.
+    auto name = const_cast<char *>(kv.name.c_str());
+    std::transform(name, name + kv.name.size(), name, util::lowcase);
 
     auto token = http2::lookup_token(
         reinterpret_cast<const uint8_t *>(kv.name.c_str()), kv.name.size());
@@ -344,7 +382,8 @@ int index_headers(http2::HeaderIndex &hdidx, Headers &headers,
     http2::index_header(hdidx, token, i);
 
     if (token == http2::HD_CONTENT_LENGTH) {
-      auto len = util::parse_uint(kv.value);
+      auto len = util::parse_uint(
+          reinterpret_cast<const uint8_t *>(kv.value.c_str()), kv.value.size());
       if (len == -1) {
         return -1;
       }
@@ -363,32 +402,33 @@ int Downstream::index_request_headers() {
                        request_content_length_);
 }
 
-const Headers::value_type *Downstream::get_request_header(int16_t token) const {
+const HeaderRefs::value_type *
+Downstream::get_request_header(int16_t token) const {
   return http2::get_header(request_hdidx_, token, request_headers_);
 }
 
-const Headers::value_type *
+const HeaderRefs::value_type *
 Downstream::get_request_header(const std::string &name) const {
   return get_header_linear(request_headers_, name);
 }
 
-void Downstream::add_request_header(std::string name, std::string value) {
+void Downstream::add_request_header(const StringRef &name,
+                                    const StringRef &value) {
   add_header(request_header_key_prev_, request_headers_sum_, request_headers_,
-             std::move(name), std::move(value));
+             balloc_, name, value);
 }
 
 void Downstream::set_last_request_header_value(const char *data, size_t len) {
   set_last_header_value(request_header_key_prev_, request_headers_sum_,
-                        request_headers_, data, len);
+                        request_headers_, balloc_, data, len);
 }
 
 void Downstream::add_request_header(const uint8_t *name, size_t namelen,
                                     const uint8_t *value, size_t valuelen,
                                     bool no_index, int16_t token) {
   http2::index_header(request_hdidx_, token, request_headers_.size());
-  request_headers_sum_ += namelen + valuelen;
-  http2::add_header(request_headers_, name, namelen, value, valuelen, no_index,
-                    token);
+  add_header(request_headers_sum_, request_headers_, balloc_, name, namelen,
+             value, valuelen, no_index, token);
 }
 
 bool Downstream::get_request_header_key_prev() const {
@@ -397,17 +437,17 @@ bool Downstream::get_request_header_key_prev() const {
 
 void Downstream::append_last_request_header_key(const char *data, size_t len) {
   append_last_header_key(request_header_key_prev_, request_headers_sum_,
-                         request_headers_, data, len);
+                         request_headers_, balloc_, data, len);
 }
 
 void Downstream::append_last_request_header_value(const char *data,
                                                   size_t len) {
   append_last_header_value(request_header_key_prev_, request_headers_sum_,
-                           request_headers_, data, len);
+                           request_headers_, balloc_, data, len);
 }
 
 void Downstream::clear_request_headers() {
-  Headers().swap(request_headers_);
+  HeaderRefs().swap(request_headers_);
   http2::init_hdidx(request_hdidx_);
 }
 
@@ -420,23 +460,23 @@ void Downstream::add_request_trailer(const uint8_t *name, size_t namelen,
                                      bool no_index, int16_t token) {
   // we never index trailer part.  Header size limit should be applied
   // to all request header fields combined.
-  request_headers_sum_ += namelen + valuelen;
-  http2::add_header(request_trailers_, name, namelen, value, valuelen, no_index,
-                    -1);
+  add_header(request_headers_sum_, request_trailers_, balloc_, name, namelen,
+             value, valuelen, no_index, -1);
 }
 
-const Headers &Downstream::get_request_trailers() const {
+const HeaderRefs &Downstream::get_request_trailers() const {
   return request_trailers_;
 }
 
-void Downstream::add_request_trailer(std::string name, std::string value) {
+void Downstream::add_request_trailer(const StringRef &name,
+                                     const StringRef &value) {
   add_header(request_trailer_key_prev_, request_headers_sum_, request_trailers_,
-             std::move(name), std::move(value));
+             balloc_, name, value);
 }
 
 void Downstream::set_last_request_trailer_value(const char *data, size_t len) {
   set_last_header_value(request_trailer_key_prev_, request_headers_sum_,
-                        request_trailers_, data, len);
+                        request_trailers_, balloc_, data, len);
 }
 
 bool Downstream::get_request_trailer_key_prev() const {
@@ -445,13 +485,13 @@ bool Downstream::get_request_trailer_key_prev() const {
 
 void Downstream::append_last_request_trailer_key(const char *data, size_t len) {
   append_last_header_key(request_trailer_key_prev_, request_headers_sum_,
-                         request_trailers_, data, len);
+                         request_trailers_, balloc_, data, len);
 }
 
 void Downstream::append_last_request_trailer_value(const char *data,
                                                    size_t len) {
   append_last_header_value(request_trailer_key_prev_, request_headers_sum_,
-                           request_trailers_, data, len);
+                           request_trailers_, balloc_, data, len);
 }
 
 void Downstream::set_request_method(std::string method) {
@@ -590,7 +630,7 @@ int Downstream::end_upload_data() {
   return dconn_->end_upload_data();
 }
 
-const Headers &Downstream::get_response_headers() const {
+const HeaderRefs &Downstream::get_response_headers() const {
   return response_headers_;
 }
 
@@ -599,7 +639,7 @@ int Downstream::index_response_headers() {
                        response_content_length_);
 }
 
-const Headers::value_type *
+const HeaderRefs::value_type *
 Downstream::get_response_header(int16_t token) const {
   return http2::get_header(response_hdidx_, token, response_headers_);
 }
@@ -618,21 +658,23 @@ void Downstream::rewrite_location_response_header(
   if (rv != 0) {
     return;
   }
+  auto uri = (*hd).value.str();
   std::string new_uri;
   if (get_config()->no_host_rewrite) {
     if (!request_http2_authority_.empty()) {
       new_uri = http2::rewrite_location_uri(
-          (*hd).value, u, request_http2_authority_, request_http2_authority_,
+          uri, u, request_http2_authority_, request_http2_authority_,
           upstream_scheme);
     }
     if (new_uri.empty()) {
       auto host = get_request_header(http2::HD_HOST);
       if (host) {
-        new_uri = http2::rewrite_location_uri((*hd).value, u, (*host).value,
-                                              (*host).value, upstream_scheme);
+        auto host_value = (*host).value.str();
+        new_uri = http2::rewrite_location_uri(uri, u, host_value, host_value,
+                                              upstream_scheme);
       } else if (!request_downstream_host_.empty()) {
         new_uri = http2::rewrite_location_uri(
-            (*hd).value, u, request_downstream_host_, "", upstream_scheme);
+            uri, u, request_downstream_host_, "", upstream_scheme);
       } else {
         return;
       }
@@ -643,51 +685,51 @@ void Downstream::rewrite_location_response_header(
     }
     if (!request_http2_authority_.empty()) {
       new_uri = http2::rewrite_location_uri(
-          (*hd).value, u, request_downstream_host_, request_http2_authority_,
+          uri, u, request_downstream_host_, request_http2_authority_,
           upstream_scheme);
     } else {
       auto host = get_request_header(http2::HD_HOST);
       if (host) {
-        new_uri = http2::rewrite_location_uri((*hd).value, u,
-                                              request_downstream_host_,
-                                              (*host).value, upstream_scheme);
+        new_uri = http2::rewrite_location_uri(uri, u, request_downstream_host_,
+                                              (*host).value.str(),
+                                              upstream_scheme);
       } else {
         new_uri = http2::rewrite_location_uri(
-            (*hd).value, u, request_downstream_host_, "", upstream_scheme);
+            uri, u, request_downstream_host_, "", upstream_scheme);
       }
     }
   }
   if (!new_uri.empty()) {
     auto idx = response_hdidx_[http2::HD_LOCATION];
-    response_headers_[idx].value = std::move(new_uri);
+    response_headers_[idx].value = make_string_ref(balloc_, StringRef{new_uri});
   }
 }
 
-void Downstream::add_response_header(std::string name, std::string value) {
+void Downstream::add_response_header(const StringRef &name,
+                                     const StringRef &value) {
   add_header(response_header_key_prev_, response_headers_sum_,
-             response_headers_, std::move(name), std::move(value));
+             response_headers_, balloc_, name, value);
 }
 
 void Downstream::set_last_response_header_value(const char *data, size_t len) {
   set_last_header_value(response_header_key_prev_, response_headers_sum_,
-                        response_headers_, data, len);
+                        response_headers_, balloc_, data, len);
 }
 
-void Downstream::add_response_header(std::string name, std::string value,
-                                     int16_t token) {
+void Downstream::add_response_header(const StringRef &name,
+                                     const StringRef &value, int16_t token) {
   http2::index_header(response_hdidx_, token, response_headers_.size());
   response_headers_sum_ += name.size() + value.size();
-  response_headers_.emplace_back(std::move(name), std::move(value), false,
-                                 token);
+  response_headers_.emplace_back(make_string_ref(balloc_, name),
+                                 make_string_ref(balloc_, value), false, token);
 }
 
 void Downstream::add_response_header(const uint8_t *name, size_t namelen,
                                      const uint8_t *value, size_t valuelen,
                                      bool no_index, int16_t token) {
   http2::index_header(response_hdidx_, token, response_headers_.size());
-  response_headers_sum_ += namelen + valuelen;
-  http2::add_header(response_headers_, name, namelen, value, valuelen, no_index,
-                    token);
+  add_header(response_headers_sum_, response_headers_, balloc_, name, namelen,
+             value, valuelen, no_index, token);
 }
 
 bool Downstream::get_response_header_key_prev() const {
@@ -696,17 +738,17 @@ bool Downstream::get_response_header_key_prev() const {
 
 void Downstream::append_last_response_header_key(const char *data, size_t len) {
   append_last_header_key(response_header_key_prev_, response_headers_sum_,
-                         response_headers_, data, len);
+                         response_headers_, balloc_, data, len);
 }
 
 void Downstream::append_last_response_header_value(const char *data,
                                                    size_t len) {
   append_last_header_value(response_header_key_prev_, response_headers_sum_,
-                           response_headers_, data, len);
+                           response_headers_, balloc_, data, len);
 }
 
 void Downstream::clear_response_headers() {
-  Headers().swap(response_headers_);
+  HeaderRefs().swap(response_headers_);
   http2::init_hdidx(response_hdidx_);
 }
 
@@ -714,30 +756,30 @@ size_t Downstream::get_response_headers_sum() const {
   return response_headers_sum_;
 }
 
-const Headers &Downstream::get_response_trailers() const {
+const HeaderRefs &Downstream::get_response_trailers() const {
   return response_trailers_;
 }
 
 void Downstream::add_response_trailer(const uint8_t *name, size_t namelen,
                                       const uint8_t *value, size_t valuelen,
                                       bool no_index, int16_t token) {
-  response_headers_sum_ += namelen + valuelen;
-  http2::add_header(response_trailers_, name, namelen, value, valuelen,
-                    no_index, -1);
+  add_header(response_headers_sum_, response_trailers_, balloc_, name, namelen,
+             value, valuelen, no_index, -1);
 }
 
 unsigned int Downstream::get_response_http_status() const {
   return response_http_status_;
 }
 
-void Downstream::add_response_trailer(std::string name, std::string value) {
+void Downstream::add_response_trailer(const StringRef &name,
+                                      const StringRef &value) {
   add_header(response_trailer_key_prev_, response_headers_sum_,
-             response_trailers_, std::move(name), std::move(value));
+             response_trailers_, balloc_, name, value);
 }
 
 void Downstream::set_last_response_trailer_value(const char *data, size_t len) {
   set_last_header_value(response_trailer_key_prev_, response_headers_sum_,
-                        response_trailers_, data, len);
+                        response_trailers_, balloc_, data, len);
 }
 
 bool Downstream::get_response_trailer_key_prev() const {
@@ -747,13 +789,13 @@ bool Downstream::get_response_trailer_key_prev() const {
 void Downstream::append_last_response_trailer_key(const char *data,
                                                   size_t len) {
   append_last_header_key(response_trailer_key_prev_, response_headers_sum_,
-                         response_trailers_, data, len);
+                         response_trailers_, balloc_, data, len);
 }
 
 void Downstream::append_last_response_trailer_value(const char *data,
                                                     size_t len) {
   append_last_header_value(response_trailer_key_prev_, response_headers_sum_,
-                           response_trailers_, data, len);
+                           response_trailers_, balloc_, data, len);
 }
 
 void Downstream::set_response_http_status(unsigned int status) {
@@ -960,14 +1002,10 @@ bool Downstream::get_http2_upgrade_request() const {
          request_hdidx_[http2::HD_HTTP2_SETTINGS] != -1;
 }
 
-namespace {
-const std::string EMPTY;
-} // namespace
-
-const std::string &Downstream::get_http2_settings() const {
+StringRef Downstream::get_http2_settings() const {
   auto idx = request_hdidx_[http2::HD_HTTP2_SETTINGS];
   if (idx == -1) {
-    return EMPTY;
+    return StringRef{};
   }
   return request_headers_[idx].value;
 }
@@ -1021,7 +1059,7 @@ bool Downstream::expect_response_body() const {
 }
 
 namespace {
-bool pseudo_header_allowed(const Headers &headers) {
+bool pseudo_header_allowed(const HeaderRefs &headers) {
   if (headers.empty()) {
     return true;
   }
@@ -1166,6 +1204,10 @@ void Downstream::set_request_downstream_host(std::string host) {
   request_downstream_host_ = std::move(host);
 }
 
+const std::string &Downstream::get_request_downstream_host() const {
+  return request_downstream_host_;
+}
+
 void Downstream::set_request_pending(bool f) { request_pending_ = f; }
 
 bool Downstream::get_request_pending() const { return request_pending_; }
@@ -1176,4 +1218,20 @@ bool Downstream::request_submission_ready() const {
          request_pending_ && response_state_ == Downstream::INITIAL;
 }
 
+void Downstream::set_cache_response(std::unique_ptr<CachedResponse> ent) {
+  cache_response_ = std::move(ent);
+}
+
+CachedResponse *Downstream::get_cache_response() {
+  return cache_response_.get();
+}
+
+std::unique_ptr<CachedResponse> Downstream::pop_cache_response() {
+  return std::move(cache_response_);
+}
+
+void Downstream::set_response_cached(bool f) { response_cached_ = f; }
+
+bool Downstream::get_response_cached() const { return response_cached_; }
+
 } // namespace shrpx
@@ -41,6 +41,7 @@
 #include "shrpx_io_control.h"
 #include "http2.h"
 #include "memchunk.h"
+#include "allocator.h"
 
 using namespace nghttp2;
 
@@ -48,6 +49,7 @@ namespace shrpx {
 
 class Upstream;
 class DownstreamConnection;
+struct CachedResponse;
 
 class Downstream {
 public:
@@ -92,9 +94,9 @@ public:
   // Returns true if the request is HTTP Upgrade for HTTP/2
   bool get_http2_upgrade_request() const;
   // Returns the value of HTTP2-Settings request header field.
-  const std::string &get_http2_settings() const;
+  StringRef get_http2_settings() const;
   // downstream request API
-  const Headers &get_request_headers() const;
+  const HeaderRefs &get_request_headers() const;
   // Crumbles (split cookie by ";") in request_headers_ and returns
   // them.  Headers::no_index is inherited.
   Headers crumble_request_cookie();
@@ -108,11 +110,14 @@ public:
   // multiple header have |name| as name, return last occurrence from
   // the beginning.  If no such header is found, returns nullptr.
   // This function must be called after headers are indexed
-  const Headers::value_type *get_request_header(int16_t token) const;
+  const HeaderRefs::value_type *get_request_header(int16_t token) const;
   // Returns pointer to the request header with the name |name|.  If
   // no such header is found, returns nullptr.
-  const Headers::value_type *get_request_header(const std::string &name) const;
-  void add_request_header(std::string name, std::string value);
+  const HeaderRefs::value_type *
+  get_request_header(const std::string &name) const;
+  // Adds request header field |name| and |value|.  They are copied
+  // into the memory owned by this object.
+  void add_request_header(const StringRef &name, const StringRef &value);
   void set_last_request_header_value(const char *data, size_t len);
 
   void add_request_header(const uint8_t *name, size_t namelen,
@@ -127,11 +132,11 @@ public:
 
   size_t get_request_headers_sum() const;
 
-  const Headers &get_request_trailers() const;
+  const HeaderRefs &get_request_trailers() const;
   void add_request_trailer(const uint8_t *name, size_t namelen,
                            const uint8_t *value, size_t valuelen, bool no_index,
                            int16_t token);
-  void add_request_trailer(std::string name, std::string value);
+  void add_request_trailer(const StringRef &name, const StringRef &value);
   void set_last_request_trailer_value(const char *data, size_t len);
   bool get_request_trailer_key_prev() const;
   void append_last_request_trailer_key(const char *data, size_t len);
@@ -177,6 +182,7 @@ public:
   void set_request_content_length(int64_t len);
   bool request_pseudo_header_allowed(int16_t token) const;
   void set_request_downstream_host(std::string host);
+  const std::string &get_request_downstream_host() const;
   bool expect_response_body() const;
   enum {
     INITIAL,
@@ -198,7 +204,7 @@ public:
   // Returns true if request is ready to be submitted to downstream.
   bool request_submission_ready() const;
   // downstream response API
-  const Headers &get_response_headers() const;
+  const HeaderRefs &get_response_headers() const;
   // Lower the response header field names and indexes response
   // headers.  If there are invalid headers (e.g., multiple
   // Content-Length with different values), returns -1.
@@ -207,13 +213,14 @@ public:
   // multiple header have |name| as name, return last occurrence from
   // the beginning.  If no such header is found, returns nullptr.
   // This function must be called after response headers are indexed.
-  const Headers::value_type *get_response_header(int16_t token) const;
+  const HeaderRefs::value_type *get_response_header(int16_t token) const;
   // Rewrites the location response header field.
   void rewrite_location_response_header(const std::string &upstream_scheme);
-  void add_response_header(std::string name, std::string value);
+  void add_response_header(const StringRef &name, const StringRef &value);
   void set_last_response_header_value(const char *data, size_t len);
 
-  void add_response_header(std::string name, std::string value, int16_t token);
+  void add_response_header(const StringRef &name, const StringRef &value,
+                           int16_t token);
   void add_response_header(const uint8_t *name, size_t namelen,
                            const uint8_t *value, size_t valuelen, bool no_index,
                            int16_t token);
@@ -226,11 +233,11 @@ public:
 
   size_t get_response_headers_sum() const;
 
-  const Headers &get_response_trailers() const;
+  const HeaderRefs &get_response_trailers() const;
   void add_response_trailer(const uint8_t *name, size_t namelen,
                             const uint8_t *value, size_t valuelen,
                             bool no_index, int16_t token);
-  void add_response_trailer(std::string name, std::string value);
+  void add_response_trailer(const StringRef &name, const StringRef &value);
   void set_last_response_trailer_value(const char *data, size_t len);
   bool get_response_trailer_key_prev() const;
   void append_last_response_trailer_key(const char *data, size_t len);
@@ -274,6 +281,14 @@ public:
   size_t get_response_datalen() const;
   void reset_response_datalen();
   bool response_pseudo_header_allowed(int16_t token) const;
+  // Sets the response being collected to be stored in ResponseCache.
+  void set_cache_response(std::unique_ptr<CachedResponse> ent);
+  CachedResponse *get_cache_response();
+  // Returns the response being collected, and nullifies it.
+  std::unique_ptr<CachedResponse> pop_cache_response();
+  // true if the response is served from ResponseCache.
+  void set_response_cached(bool f);
+  bool get_response_cached() const;
 
   // Call this method when there is incoming data in downstream
   // connection.
@@ -325,13 +340,18 @@ public:
   };
 
 private:
-  Headers request_headers_;
-  Headers response_headers_;
+  // Holds the names and values of the header fields and trailer
+  // fields below.  They are released all at once when this object is
+  // destroyed.
+  BlockAllocator balloc_;
+
+  HeaderRefs request_headers_;
+  HeaderRefs response_headers_;
 
   // trailer part.  For HTTP/1.1, trailer part is only included with
   // chunked encoding.  For HTTP/2, there is no such limit.
-  Headers request_trailers_;
-  Headers response_trailers_;
+  HeaderRefs request_trailers_;
+  HeaderRefs response_trailers_;
 
   std::chrono::high_resolution_clock::time_point request_start_time_;
 
@@ -369,6 +389,8 @@ private:
 
   Upstream *upstream_;
   std::unique_ptr<DownstreamConnection> dconn_;
+  // Response being collected to be stored in ResponseCache.
+  std::unique_ptr<CachedResponse> cache_response_;
 
   size_t request_headers_sum_;
   size_t response_headers_sum_;
@@ -422,6 +444,8 @@ private:
   // has not been established or should be checked before use;
   // currently used only with HTTP/2 connection.
   bool request_pending_;
+  // true if the response is served from ResponseCache.
+  bool response_cached_;
 };
 
 } // namespace shrpx
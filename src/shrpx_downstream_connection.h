@@ -57,6 +57,9 @@ public:
 
   virtual void on_upstream_change(Upstream *uptream) = 0;
   virtual int on_priority_change(int32_t pri) = 0;
+  // Returns the index of backend address in
+  // get_config()->downstream_addrs this object is connected to.
+  virtual size_t get_addr_idx() const = 0;
 
   void set_client_handler(ClientHandler *client_handler);
   ClientHandler *get_client_handler();
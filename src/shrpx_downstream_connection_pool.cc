@@ -24,37 +24,93 @@
  */
 #include "shrpx_downstream_connection_pool.h"
 #include "shrpx_downstream_connection.h"
+#include "shrpx_config.h"
 
 namespace shrpx {
 
-DownstreamConnectionPool::DownstreamConnectionPool() {}
+DownstreamConnectionPool::DownstreamConnectionPool()
+    : num_hits_(0), num_misses_(0), num_evictions_(0) {}
 
 DownstreamConnectionPool::~DownstreamConnectionPool() {
-  for (auto dconn : pool_) {
+  for (auto dconn : lru_) {
     delete dconn;
   }
 }
 
 void DownstreamConnectionPool::add_downstream_connection(
     std::unique_ptr<DownstreamConnection> dconn) {
-  pool_.insert(dconn.release());
+  auto addr_idx = dconn->get_addr_idx();
+
+  if (addr_pools_.size() <= addr_idx) {
+    addr_pools_.resize(addr_idx + 1);
+  }
+
+  auto &addr_pool = addr_pools_[addr_idx];
+  auto p = dconn.release();
+
+  lru_.push_front(p);
+  addr_pool.push_front(p);
+
+  Entry ent;
+  ent.lru_pos = std::begin(lru_);
+  ent.addr_pos = std::begin(addr_pool);
+  ent.addr_idx = addr_idx;
+
+  entries_.emplace(p, ent);
+
+  auto max_per_host = get_config()->downstream_max_idle_connections_per_host;
+  if (max_per_host != 0 && addr_pool.size() > max_per_host) {
+    ++num_evictions_;
+    unlink(addr_pool.back());
+  }
+
+  auto max_idle = get_config()->downstream_max_idle_connections;
+  if (max_idle != 0 && lru_.size() > max_idle) {
+    ++num_evictions_;
+    unlink(lru_.back());
+  }
 }
 
 std::unique_ptr<DownstreamConnection>
-DownstreamConnectionPool::pop_downstream_connection() {
-  if (pool_.empty()) {
+DownstreamConnectionPool::pop_downstream_connection(size_t addr_idx) {
+  if (addr_pools_.size() <= addr_idx || addr_pools_[addr_idx].empty()) {
+    ++num_misses_;
     return nullptr;
   }
 
-  auto dconn = std::unique_ptr<DownstreamConnection>(*std::begin(pool_));
-  pool_.erase(std::begin(pool_));
-  return dconn;
+  ++num_hits_;
+  return unlink(addr_pools_[addr_idx].front());
 }
 
 void DownstreamConnectionPool::remove_downstream_connection(
     DownstreamConnection *dconn) {
-  pool_.erase(dconn);
-  delete dconn;
+  unlink(dconn);
+}
+
+std::unique_ptr<DownstreamConnection>
+DownstreamConnectionPool::unlink(DownstreamConnection *dconn) {
+  auto it = entries_.find(dconn);
+  if (it == std::end(entries_)) {
+    return std::unique_ptr<DownstreamConnection>(dconn);
+  }
+
+  auto &ent = (*it).second;
+
+  lru_.erase(ent.lru_pos);
+  addr_pools_[ent.addr_idx].erase(ent.addr_pos);
+  entries_.erase(it);
+
+  return std::unique_ptr<DownstreamConnection>(dconn);
+}
+
+size_t DownstreamConnectionPool::size() const { return lru_.size(); }
+
+size_t DownstreamConnectionPool::get_num_hits() const { return num_hits_; }
+
+size_t DownstreamConnectionPool::get_num_misses() const { return num_misses_; }
+
+size_t DownstreamConnectionPool::get_num_evictions() const {
+  return num_evictions_;
 }
 
 } // namespace shrpx
@@ -28,23 +28,69 @@
 #include "shrpx.h"
 
 #include <memory>
-#include <set>
+#include <list>
+#include <vector>
+#include <unordered_map>
 
 namespace shrpx {
 
 class DownstreamConnection;
 
+// DownstreamConnectionPool keeps idle backend connections for reuse,
+// keyed by the index of backend address.  The most recently pooled
+// connection is reused first.  The number of idle connections is
+// limited per backend address by
+// get_config()->downstream_max_idle_connections_per_host, and per
+// worker by get_config()->downstream_max_idle_connections.  If a
+// limit is exceeded, the least recently pooled connection is
+// deleted.
 class DownstreamConnectionPool {
 public:
   DownstreamConnectionPool();
   ~DownstreamConnectionPool();
 
   void add_downstream_connection(std::unique_ptr<DownstreamConnection> dconn);
-  std::unique_ptr<DownstreamConnection> pop_downstream_connection();
+  // Returns the most recently pooled connection to the backend
+  // address |addr_idx|, or nullptr if there is none.
+  std::unique_ptr<DownstreamConnection>
+  pop_downstream_connection(size_t addr_idx);
   void remove_downstream_connection(DownstreamConnection *dconn);
 
+  // Returns the number of idle connections in this pool.
+  size_t size() const;
+  // Returns the number of pop_downstream_connection() calls which
+  // returned a pooled connection.
+  size_t get_num_hits() const;
+  // Returns the number of pop_downstream_connection() calls which
+  // returned nullptr.
+  size_t get_num_misses() const;
+  // Returns the number of connections deleted because limits were
+  // exceeded.
+  size_t get_num_evictions() const;
+
 private:
-  std::set<DownstreamConnection *> pool_;
+  using DconnList = std::list<DownstreamConnection *>;
+
+  struct Entry {
+    // Position in lru_
+    DconnList::iterator lru_pos;
+    // Position in addr_pools_[addr_idx]
+    DconnList::iterator addr_pos;
+    size_t addr_idx;
+  };
+
+  // Unlinks |dconn| from lists, and returns its ownership.
+  std::unique_ptr<DownstreamConnection> unlink(DownstreamConnection *dconn);
+
+  // All pooled connections.  The front is the most recently pooled.
+  DconnList lru_;
+  // Pooled connections per backend address.  The front is the most
+  // recently pooled.
+  std::vector<DconnList> addr_pools_;
+  std::unordered_map<DownstreamConnection *, Entry> entries_;
+  size_t num_hits_;
+  size_t num_misses_;
+  size_t num_evictions_;
 };
 
 } // namespace shrpx
@@ -0,0 +1,183 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2015 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "shrpx_downstream_connection_pool_test.h"
+
+#include <set>
+
+#include <CUnit/CUnit.h>
+
+#include "shrpx_downstream_connection_pool.h"
+#include "shrpx_downstream_connection.h"
+#include "shrpx_config.h"
+#include "template.h"
+
+using namespace nghttp2;
+
+namespace shrpx {
+
+namespace {
+// DownstreamConnection which only has backend address index.  Its
+// id is added to |deleted| when it is deleted.
+class MockDownstreamConnection : public DownstreamConnection {
+public:
+  MockDownstreamConnection(size_t addr_idx, int id, std::set<int> &deleted)
+      : DownstreamConnection(nullptr), deleted_(deleted), addr_idx_(addr_idx),
+        id_(id) {}
+  virtual ~MockDownstreamConnection() { deleted_.insert(id_); }
+  virtual int attach_downstream(Downstream *downstream) { return 0; }
+  virtual void detach_downstream(Downstream *downstream) {}
+  virtual int push_request_headers() { return 0; }
+  virtual int push_upload_data_chunk(const uint8_t *data, size_t datalen) {
+    return 0;
+  }
+  virtual int end_upload_data() { return 0; }
+  virtual void pause_read(IOCtrlReason reason) {}
+  virtual int resume_read(IOCtrlReason reason, size_t consumed) { return 0; }
+  virtual void force_resume_read() {}
+  virtual int on_read() { return 0; }
+  virtual int on_write() { return 0; }
+  virtual void on_upstream_change(Upstream *uptream) {}
+  virtual int on_priority_change(int32_t pri) { return 0; }
+  virtual size_t get_addr_idx() const { return addr_idx_; }
+  int get_id() const { return id_; }
+
+private:
+  std::set<int> &deleted_;
+  size_t addr_idx_;
+  int id_;
+};
+} // namespace
+
+namespace {
+int pop_id(DownstreamConnectionPool &pool, size_t addr_idx) {
+  auto dconn = pool.pop_downstream_connection(addr_idx);
+  if (!dconn) {
+    return -1;
+  }
+  return static_cast<MockDownstreamConnection *>(dconn.get())->get_id();
+}
+} // namespace
+
+void test_shrpx_downstream_connection_pool_reuse(void) {
+  std::set<int> deleted;
+  DownstreamConnectionPool pool;
+
+  CU_ASSERT(-1 == pop_id(pool, 0));
+  CU_ASSERT(0 == pool.get_num_hits());
+  CU_ASSERT(1 == pool.get_num_misses());
+
+  pool.add_downstream_connection(
+      make_unique<MockDownstreamConnection>(0, 1, deleted));
+  pool.add_downstream_connection(
+      make_unique<MockDownstreamConnection>(1, 2, deleted));
+  pool.add_downstream_connection(
+      make_unique<MockDownstreamConnection>(0, 3, deleted));
+
+  CU_ASSERT(3 == pool.size());
+
+  // Connection to the other backend is never returned.
+  CU_ASSERT(-1 == pop_id(pool, 2));
+
+  // The most recently pooled connection is reused first.
+  CU_ASSERT(3 == pop_id(pool, 0));
+  CU_ASSERT(1 == pop_id(pool, 0));
+  CU_ASSERT(-1 == pop_id(pool, 0));
+  CU_ASSERT(2 == pop_id(pool, 1));
+
+  CU_ASSERT(0 == pool.size());
+  CU_ASSERT(3 == pool.get_num_hits());
+  CU_ASSERT(3 == pool.get_num_misses());
+  CU_ASSERT(0 == pool.get_num_evictions());
+
+  // Removed connection is not reused, and caller owns it.
+  auto dconn = make_unique<MockDownstreamConnection>(0, 4, deleted);
+  auto p = dconn.get();
+  pool.add_downstream_connection(std::move(dconn));
+  pool.remove_downstream_connection(p);
+
+  CU_ASSERT(0 == pool.size());
+  CU_ASSERT(1 == deleted.count(4));
+  CU_ASSERT(-1 == pop_id(pool, 0));
+}
+
+void test_shrpx_downstream_connection_pool_limit(void) {
+  auto config = mod_config();
+  auto max_per_host = config->downstream_max_idle_connections_per_host;
+  auto max_idle = config->downstream_max_idle_connections;
+
+  config->downstream_max_idle_connections_per_host = 2;
+  config->downstream_max_idle_connections = 3;
+
+  std::set<int> deleted;
+
+  {
+    DownstreamConnectionPool pool;
+
+    pool.add_downstream_connection(
+        make_unique<MockDownstreamConnection>(0, 1, deleted));
+    pool.add_downstream_connection(
+        make_unique<MockDownstreamConnection>(0, 2, deleted));
+    pool.add_downstream_connection(
+        make_unique<MockDownstreamConnection>(1, 3, deleted));
+
+    CU_ASSERT(deleted.empty());
+
+    // The per backend limit deletes the least recently pooled
+    // connection to the same backend.
+    pool.add_downstream_connection(
+        make_unique<MockDownstreamConnection>(0, 4, deleted));
+
+    CU_ASSERT(3 == pool.size());
+    CU_ASSERT(1 == pool.get_num_evictions());
+    CU_ASSERT(std::set<int>{1} == deleted);
+
+    // The per worker limit deletes the least recently pooled
+    // connection among all backends.
+    pool.add_downstream_connection(
+        make_unique<MockDownstreamConnection>(2, 5, deleted));
+
+    CU_ASSERT(3 == pool.size());
+    CU_ASSERT(2 == pool.get_num_evictions());
+    CU_ASSERT((std::set<int>{1, 2} == deleted));
+
+    CU_ASSERT(4 == pop_id(pool, 0));
+    CU_ASSERT(-1 == pop_id(pool, 0));
+    CU_ASSERT(3 == pop_id(pool, 1));
+
+    pool.add_downstream_connection(
+        make_unique<MockDownstreamConnection>(1, 6, deleted));
+
+    CU_ASSERT(2 == pool.size());
+  }
+
+  // Pooled connections are deleted with the pool.
+  CU_ASSERT(1 == deleted.count(5));
+  CU_ASSERT(1 == deleted.count(6));
+
+  config->downstream_max_idle_connections_per_host = max_per_host;
+  config->downstream_max_idle_connections = max_idle;
+}
+
+} // namespace shrpx
@@ -94,7 +94,8 @@ private:
   std::map<std::string, HostEntry> host_entries_;
   // Downstream objects, not processed yet
   DownstreamMap pending_downstreams_;
-  // Downstream objects, failed to connect to downstream server
+  // Downstream objects, failed to connect to downstream server, or
+  // served from cache without downstream connection
   DownstreamMap failure_downstreams_;
   // Downstream objects, downstream connection started
   DownstreamMap active_downstreams_;
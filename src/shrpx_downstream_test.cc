@@ -44,14 +44,14 @@ void test_downstream_index_request_headers(void) {
   d.add_request_header(":authority", "7");
   d.index_request_headers();
 
-  auto ans = Headers{{"1", "0"},
-                     {"2", "1"},
-                     {"charlie", "2"},
-                     {"alpha", "3"},
-                     {"delta", "4"},
-                     {"bravo", "5"},
-                     {":method", "6"},
-                     {":authority", "7"}};
+  auto ans = HeaderRefs{{"1", "0"},
+                        {"2", "1"},
+                        {"charlie", "2"},
+                        {"alpha", "3"},
+                        {"delta", "4"},
+                        {"bravo", "5"},
+                        {":method", "6"},
+                        {":authority", "7"}};
   CU_ASSERT(ans == d.get_request_headers());
 }
 
@@ -63,8 +63,8 @@ void test_downstream_index_response_headers(void) {
   d.add_response_header("BravO", "3");
   d.index_response_headers();
 
-  auto ans =
-      Headers{{"charlie", "0"}, {"alpha", "1"}, {"delta", "2"}, {"bravo", "3"}};
+  auto ans = HeaderRefs{
+      {"charlie", "0"}, {"alpha", "1"}, {"delta", "2"}, {"bravo", "3"}};
   CU_ASSERT(ans == d.get_response_headers());
 }
 
@@ -76,12 +76,12 @@ void test_downstream_get_request_header(void) {
   d.index_request_headers();
 
   // By token
-  CU_ASSERT(Header(":authority", "1") ==
+  CU_ASSERT(HeaderRef(":authority", "1") ==
             *d.get_request_header(http2::HD__AUTHORITY));
   CU_ASSERT(nullptr == d.get_request_header(http2::HD__METHOD));
 
   // By name
-  CU_ASSERT(Header("alpha", "0") == *d.get_request_header("alpha"));
+  CU_ASSERT(HeaderRef("alpha", "0") == *d.get_request_header("alpha"));
   CU_ASSERT(nullptr == d.get_request_header("bravo"));
 }
 
@@ -93,7 +93,7 @@ void test_downstream_get_response_header(void) {
   d.index_response_headers();
 
   // By token
-  CU_ASSERT(Header(":status", "1") ==
+  CU_ASSERT(HeaderRef(":status", "1") ==
             *d.get_response_header(http2::HD__STATUS));
   CU_ASSERT(nullptr == d.get_response_header(http2::HD__METHOD));
 }
@@ -0,0 +1,282 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2015 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "shrpx_health_checker.h"
+
+#include <unistd.h>
+
+#include <cerrno>
+#include <array>
+
+#include "shrpx_config.h"
+#include "shrpx_log.h"
+#include "shrpx_worker.h"
+#include "util.h"
+
+using namespace nghttp2;
+
+namespace shrpx {
+
+namespace {
+void intervalcb(struct ev_loop *loop, ev_timer *w, int revents) {
+  auto hc = static_cast<HealthChecker *>(w->data);
+  hc->probe();
+}
+} // namespace
+
+namespace {
+void timeoutcb(struct ev_loop *loop, ev_timer *w, int revents) {
+  auto hc = static_cast<HealthChecker *>(w->data);
+  hc->finish(false);
+}
+} // namespace
+
+namespace {
+void writecb(struct ev_loop *loop, ev_io *w, int revents) {
+  auto hc = static_cast<HealthChecker *>(w->data);
+  if (hc->on_write() != 0) {
+    hc->finish(false);
+  }
+}
+} // namespace
+
+namespace {
+void readcb(struct ev_loop *loop, ev_io *w, int revents) {
+  auto hc = static_cast<HealthChecker *>(w->data);
+  if (hc->on_read() != 0) {
+    hc->finish(false);
+  }
+}
+} // namespace
+
+namespace {
+int htp_hdrs_completecb(http_parser *htp) {
+  auto hc = static_cast<HealthChecker *>(htp->data);
+  hc->on_response(htp->status_code);
+  return 0;
+}
+} // namespace
+
+namespace {
+http_parser_settings htp_hooks = {
+    nullptr,             // http_cb on_message_begin;
+    nullptr,             // http_data_cb on_url;
+    nullptr,             // http_data_cb on_status;
+    nullptr,             // http_data_cb on_header_field;
+    nullptr,             // http_data_cb on_header_value;
+    htp_hdrs_completecb, // http_cb      on_headers_complete;
+    nullptr,             // http_data_cb on_body;
+    nullptr              // http_cb      on_message_complete;
+};
+} // namespace
+
+HealthChecker::HealthChecker(struct ev_loop *loop, size_t addr_idx,
+                             DownstreamAddrStat *addr_stat)
+    : loop_(loop), addr_stat_(addr_stat), addr_idx_(addr_idx), reqoff_(0),
+      fd_(-1), status_code_(0), connected_(false) {
+  // Probe the address as soon as the event loop starts.
+  ev_timer_init(&interval_timer_, intervalcb, 0.,
+                get_config()->downstream_health_check_interval);
+  interval_timer_.data = this;
+  ev_timer_start(loop_, &interval_timer_);
+
+  ev_timer_init(&timeout_timer_, timeoutcb, 0.,
+                get_config()->downstream_health_check_timeout);
+  timeout_timer_.data = this;
+
+  ev_io_init(&wev_, writecb, 0, EV_WRITE);
+  wev_.data = this;
+  ev_io_init(&rev_, readcb, 0, EV_READ);
+  rev_.data = this;
+
+  if (get_config()->downstream_health_check_path) {
+    auto &addr = get_config()->downstream_addrs[addr_idx_];
+
+    req_ = "GET ";
+    req_ += get_config()->downstream_health_check_path.get();
+    req_ += " HTTP/1.1\r\nHost: ";
+    req_ += addr.hostport.get();
+    req_ += "\r\nConnection: close\r\n\r\n";
+  }
+}
+
+HealthChecker::~HealthChecker() {
+  ev_timer_stop(loop_, &interval_timer_);
+  ev_timer_stop(loop_, &timeout_timer_);
+  ev_io_stop(loop_, &wev_);
+  ev_io_stop(loop_, &rev_);
+
+  if (fd_ != -1) {
+    close(fd_);
+  }
+}
+
+void HealthChecker::probe() {
+  if (fd_ != -1) {
+    return;
+  }
+
+  auto &addr = get_config()->downstream_addrs[addr_idx_];
+
+  fd_ = util::create_nonblock_socket(addr.addr.storage.ss_family);
+  if (fd_ == -1) {
+    auto error = errno;
+    LOG(WARN) << "Health check: socket() failed; errno=" << error;
+    // We cannot tell anything about backend.
+    return;
+  }
+
+  if (connect(fd_, &addr.addr.sa, addr.addrlen) != 0 &&
+      errno != EINPROGRESS) {
+    finish(false);
+    return;
+  }
+
+  reqoff_ = 0;
+  status_code_ = 0;
+  connected_ = false;
+
+  ev_io_set(&wev_, fd_, EV_WRITE);
+  ev_io_set(&rev_, fd_, EV_READ);
+
+  ev_io_start(loop_, &wev_);
+
+  ev_timer_again(loop_, &timeout_timer_);
+}
+
+int HealthChecker::on_connect() {
+  if (!util::check_socket_connected(fd_)) {
+    return -1;
+  }
+
+  connected_ = true;
+
+  if (req_.empty()) {
+    finish(true);
+    return 0;
+  }
+
+  http_parser_init(&htp_, HTTP_RESPONSE);
+  htp_.data = this;
+
+  return on_write();
+}
+
+int HealthChecker::on_write() {
+  if (!connected_) {
+    return on_connect();
+  }
+
+  while (reqoff_ < req_.size()) {
+    ssize_t nwrite;
+    while ((nwrite = write(fd_, req_.c_str() + reqoff_,
+                           req_.size() - reqoff_)) == -1 &&
+           errno == EINTR)
+      ;
+
+    if (nwrite == -1) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        return 0;
+      }
+      return -1;
+    }
+
+    reqoff_ += nwrite;
+  }
+
+  ev_io_stop(loop_, &wev_);
+  ev_io_start(loop_, &rev_);
+
+  return 0;
+}
+
+int HealthChecker::on_read() {
+  std::array<uint8_t, 4096> buf;
+
+  for (;;) {
+    ssize_t nread;
+    while ((nread = read(fd_, buf.data(), buf.size())) == -1 &&
+           errno == EINTR)
+      ;
+
+    if (nread == -1) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        return 0;
+      }
+      return -1;
+    }
+
+    if (nread == 0) {
+      // Connection was closed before response header was received.
+      return -1;
+    }
+
+    auto nproc =
+        http_parser_execute(&htp_, &htp_hooks,
+                            reinterpret_cast<const char *>(buf.data()), nread);
+
+    if (status_code_ != 0) {
+      finish(status_code_ >= 200 && status_code_ < 400);
+      return 0;
+    }
+
+    if (nproc != static_cast<size_t>(nread) ||
+        HTTP_PARSER_ERRNO(&htp_) != HPE_OK) {
+      return -1;
+    }
+  }
+}
+
+void HealthChecker::on_response(unsigned int status_code) {
+  status_code_ = status_code;
+}
+
+void HealthChecker::finish(bool healthy) {
+  ev_timer_stop(loop_, &timeout_timer_);
+  ev_io_stop(loop_, &wev_);
+  ev_io_stop(loop_, &rev_);
+
+  if (fd_ != -1) {
+    close(fd_);
+    fd_ = -1;
+  }
+
+  if (addr_stat_->healthy == healthy) {
+    return;
+  }
+
+  addr_stat_->healthy = healthy;
+
+  auto &addr = get_config()->downstream_addrs[addr_idx_];
+
+  if (healthy) {
+    LOG(NOTICE) << "Health check: backend " << addr.hostport.get()
+                << " is healthy";
+  } else {
+    LOG(WARN) << "Health check: backend " << addr.hostport.get()
+              << " is unhealthy";
+  }
+}
+
+} // namespace shrpx
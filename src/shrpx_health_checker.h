@@ -0,0 +1,85 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2015 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef SHRPX_HEALTH_CHECKER_H
+#define SHRPX_HEALTH_CHECKER_H
+
+#include "shrpx.h"
+
+#include <string>
+
+#include <ev.h>
+
+#include "http-parser/http_parser.h"
+
+namespace shrpx {
+
+struct DownstreamAddrStat;
+
+// HealthChecker periodically probes a backend address, and records
+// the result to DownstreamAddrStat.  The probe succeeds if TCP
+// connection is established.  If
+// get_config()->downstream_health_check_path is set, the backend
+// must also respond to GET request to the path with 2xx or 3xx
+// status code.
+class HealthChecker {
+public:
+  // |addr_idx| is the index of backend address in
+  // get_config()->downstream_addrs.
+  HealthChecker(struct ev_loop *loop, size_t addr_idx,
+                DownstreamAddrStat *addr_stat);
+  ~HealthChecker();
+
+  // Starts new probe.  This function does nothing if the previous
+  // probe is still in progress.
+  void probe();
+  int on_connect();
+  int on_write();
+  int on_read();
+  // Finishes the current probe with the result |healthy|.
+  void finish(bool healthy);
+  // Called when response header is received from backend.
+  void on_response(unsigned int status_code);
+
+private:
+  ev_timer interval_timer_;
+  ev_timer timeout_timer_;
+  ev_io wev_;
+  ev_io rev_;
+  http_parser htp_;
+  // Request to send if health check path is set.
+  std::string req_;
+  struct ev_loop *loop_;
+  DownstreamAddrStat *addr_stat_;
+  size_t addr_idx_;
+  size_t reqoff_;
+  int fd_;
+  // 0 if response header has not been received yet.
+  unsigned int status_code_;
+  bool connected_;
+};
+
+} // namespace shrpx
+
+#endif // SHRPX_HEALTH_CHECKER_H
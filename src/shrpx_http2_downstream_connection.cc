@@ -256,13 +256,12 @@ int Http2DownstreamConnection::push_request_headers() {
   const char *authority = nullptr, *host = nullptr;
   if (!get_config()->no_host_rewrite && !get_config()->http2_proxy &&
       !get_config()->client_proxy) {
-    // HTTP/2 backend does not support multiple address, so we always
-    // use index = 0.
+    auto &addr = get_config()->downstream_addrs[http2session_->get_addr_idx()];
     if (!downstream_->get_request_http2_authority().empty()) {
-      authority = get_config()->downstream_addrs[0].hostport.get();
+      authority = addr.hostport.get();
     }
     if (downstream_->get_request_header(http2::HD_HOST)) {
-      host = get_config()->downstream_addrs[0].hostport.get();
+      host = addr.hostport.get();
     }
   } else {
     if (!downstream_->get_request_http2_authority().empty()) {
@@ -277,7 +276,9 @@ int Http2DownstreamConnection::push_request_headers() {
   if (!authority && !host) {
     // upstream is HTTP/1.0.  We use backend server's host
     // nonetheless.
-    host = get_config()->downstream_addrs[0].hostport.get();
+    host = get_config()
+               ->downstream_addrs[http2session_->get_addr_idx()]
+               .hostport.get();
   }
 
   if (authority) {
@@ -401,7 +402,8 @@ int Http2DownstreamConnection::push_request_headers() {
   auto transfer_encoding =
       downstream_->get_request_header(http2::HD_TRANSFER_ENCODING);
   if (transfer_encoding &&
-      util::strieq_l("chunked", (*transfer_encoding).value)) {
+      util::strieq_l("chunked", (*transfer_encoding).value.c_str(),
+                     (*transfer_encoding).value.size())) {
     chunked_encoding = true;
   }
 
@@ -412,7 +414,7 @@ int Http2DownstreamConnection::push_request_headers() {
   auto xff = downstream_->get_request_header(http2::HD_X_FORWARDED_FOR);
   if (get_config()->add_x_forwarded_for) {
     if (xff && !get_config()->strip_incoming_x_forwarded_for) {
-      xff_value = (*xff).value;
+      xff_value = (*xff).value.str();
       xff_value += ", ";
     }
     xff_value +=
@@ -443,7 +445,7 @@ int Http2DownstreamConnection::push_request_headers() {
     }
   } else {
     if (via) {
-      via_value = (*via).value;
+      via_value = (*via).value.str();
       via_value += ", ";
     }
     via_value += http::create_via_header_value(
@@ -610,4 +612,8 @@ int Http2DownstreamConnection::on_timeout() {
   return submit_rst_stream(downstream_, NGHTTP2_NO_ERROR);
 }
 
+size_t Http2DownstreamConnection::get_addr_idx() const {
+  return http2session_->get_addr_idx();
+}
+
 } // namespace shrpx
@@ -28,6 +28,7 @@
 #include <unistd.h>
 
 #include <vector>
+#include <limits>
 
 #include <openssl/err.h>
 
@@ -120,13 +121,14 @@ void writecb(struct ev_loop *loop, ev_io *w, int revents) {
 }
 } // namespace
 
-Http2Session::Http2Session(struct ev_loop *loop, SSL_CTX *ssl_ctx)
+Http2Session::Http2Session(struct ev_loop *loop, SSL_CTX *ssl_ctx,
+                           size_t addr_idx)
     : conn_(loop, -1, nullptr, get_config()->downstream_write_timeout,
             get_config()->downstream_read_timeout, 0, 0, 0, 0, writecb, readcb,
             timeoutcb, this),
-      ssl_ctx_(ssl_ctx), session_(nullptr), data_pending_(nullptr),
-      data_pendinglen_(0), state_(DISCONNECTED),
-      connection_check_state_(CONNECTION_CHECK_NONE), flow_control_(false) {
+      ssl_ctx_(ssl_ctx), session_(nullptr), addr_idx_(addr_idx),
+      state_(DISCONNECTED), connection_check_state_(CONNECTION_CHECK_NONE),
+      flow_control_(false) {
 
   read_ = write_ = &Http2Session::noop;
   on_read_ = on_write_ = &Http2Session::noop;
@@ -257,6 +259,8 @@ int Http2Session::initiate_connection() {
   }
 
   if (state_ == DISCONNECTED || state_ == PROXY_CONNECTED) {
+    auto &downstream_addr = get_config()->downstream_addrs[addr_idx_];
+
     if (LOG_ENABLED(INFO)) {
       SSLOG(INFO, this) << "Connecting to downstream server";
     }
@@ -273,7 +277,7 @@ int Http2Session::initiate_connection() {
       if (get_config()->backend_tls_sni_name) {
         sni_name = get_config()->backend_tls_sni_name.get();
       } else {
-        sni_name = get_config()->downstream_addrs[0].host.get();
+        sni_name = downstream_addr.host.get();
       }
 
       if (sni_name && !util::numeric_host(sni_name)) {
@@ -288,16 +292,15 @@ int Http2Session::initiate_connection() {
         assert(conn_.fd == -1);
 
         conn_.fd = util::create_nonblock_socket(
-            get_config()->downstream_addrs[0].addr.storage.ss_family);
+            downstream_addr.addr.storage.ss_family);
         if (conn_.fd == -1) {
           return -1;
         }
 
-        rv = connect(
-            conn_.fd,
-            // TODO maybe not thread-safe?
-            const_cast<sockaddr *>(&get_config()->downstream_addrs[0].addr.sa),
-            get_config()->downstream_addrs[0].addrlen);
+        rv = connect(conn_.fd,
+                     // TODO maybe not thread-safe?
+                     const_cast<sockaddr *>(&downstream_addr.addr.sa),
+                     downstream_addr.addrlen);
         if (rv != 0 && errno != EINPROGRESS) {
           return -1;
         }
@@ -317,15 +320,15 @@ int Http2Session::initiate_connection() {
         assert(conn_.fd == -1);
 
         conn_.fd = util::create_nonblock_socket(
-            get_config()->downstream_addrs[0].addr.storage.ss_family);
+            downstream_addr.addr.storage.ss_family);
 
         if (conn_.fd == -1) {
           return -1;
         }
 
-        rv = connect(conn_.fd, const_cast<sockaddr *>(
-                                   &get_config()->downstream_addrs[0].addr.sa),
-                     get_config()->downstream_addrs[0].addrlen);
+        rv = connect(conn_.fd,
+                     const_cast<sockaddr *>(&downstream_addr.addr.sa),
+                     downstream_addr.addrlen);
         if (rv != 0 && errno != EINPROGRESS) {
           return -1;
         }
@@ -451,9 +454,9 @@ int Http2Session::downstream_connect_proxy() {
     SSLOG(INFO, this) << "Connected to the proxy";
   }
   std::string req = "CONNECT ";
-  req += get_config()->downstream_addrs[0].hostport.get();
+  req += get_config()->downstream_addrs[addr_idx_].hostport.get();
   req += " HTTP/1.1\r\nHost: ";
-  req += get_config()->downstream_addrs[0].host.get();
+  req += get_config()->downstream_addrs[addr_idx_].host.get();
   req += "\r\n";
   if (get_config()->downstream_http_proxy_userinfo) {
     req += "Proxy-Authorization: Basic ";
@@ -750,7 +753,7 @@ int on_response_headers(Http2Session *http2session, Downstream *downstream,
 
   auto status = downstream->get_response_header(http2::HD__STATUS);
   // libnghttp2 guarantees this exists and can be parsed
-  auto status_code = http2::parse_http_status_code(status->value);
+  auto status_code = http2::parse_http_status_code(status->value.str());
 
   downstream->set_response_http_status(status_code);
   downstream->set_response_major(2);
@@ -1279,37 +1282,28 @@ int Http2Session::downstream_read() {
 }
 
 int Http2Session::downstream_write() {
-  if (data_pending_) {
-    auto n = std::min(wb_.wleft(), data_pendinglen_);
-    wb_.write(data_pending_, n);
-    if (n < data_pendinglen_) {
-      data_pending_ += n;
-      data_pendinglen_ -= n;
+  for (;;) {
+    if (wb_.wleft() == 0) {
       return 0;
     }
 
-    data_pending_ = nullptr;
-    data_pendinglen_ = 0;
-  }
+    size_t nocopylen;
 
-  for (;;) {
-    const uint8_t *data;
-    auto datalen = nghttp2_session_mem_send(session_, &data);
+    // Serialize as many frames as possible directly into write
+    // buffer, so that they are written at once.  We do not use
+    // send_data_callback, so nocopylen is always 0.
+    auto nwrite = nghttp2_session_mem_send_batch(session_, wb_.last,
+                                                 wb_.wleft(), &nocopylen);
 
-    if (datalen < 0) {
-      SSLOG(ERROR, this) << "nghttp2_session_mem_send() returned error: "
-                         << nghttp2_strerror(datalen);
+    if (nwrite < 0) {
+      SSLOG(ERROR, this) << "nghttp2_session_mem_send_batch() returned error: "
+                         << nghttp2_strerror(nwrite);
       return -1;
     }
-    if (datalen == 0) {
+    if (nwrite == 0) {
       break;
     }
-    auto n = wb_.write(data, datalen);
-    if (n < static_cast<decltype(n)>(datalen)) {
-      data_pending_ = data + n;
-      data_pendinglen_ = datalen - n;
-      return 0;
-    }
+    wb_.write(nwrite);
   }
 
   if (nghttp2_session_want_read(session_) == 0 &&
@@ -1653,4 +1647,17 @@ bool Http2Session::should_hard_fail() const {
   }
 }
 
+size_t Http2Session::get_addr_idx() const { return addr_idx_; }
+
+size_t Http2Session::get_num_dconns() const { return dconns_.size(); }
+
+uint32_t Http2Session::get_max_concurrent_streams() const {
+  if (state_ != CONNECTED) {
+    return std::numeric_limits<uint32_t>::max();
+  }
+
+  return nghttp2_session_get_remote_settings(
+      session_, NGHTTP2_SETTINGS_MAX_CONCURRENT_STREAMS);
+}
+
 } // namespace shrpx
@@ -53,7 +53,9 @@ struct StreamData {
 
 class Http2Session {
 public:
-  Http2Session(struct ev_loop *loop, SSL_CTX *ssl_ctx);
+  // |addr_idx| is the index of backend address in
+  // get_config()->downstream_addrs this session connects to.
+  Http2Session(struct ev_loop *loop, SSL_CTX *ssl_ctx, size_t addr_idx);
   ~Http2Session();
 
   int check_cert();
@@ -141,6 +143,15 @@ public:
 
   void submit_pending_requests();
 
+  size_t get_addr_idx() const;
+  // Returns the number of Http2DownstreamConnection objects
+  // associated to this session.
+  size_t get_num_dconns() const;
+  // Returns the maximum number of concurrent streams allowed by
+  // backend.  If connection has not been established, returns
+  // std::numeric_limits<uint32_t>::max().
+  uint32_t get_max_concurrent_streams() const;
+
   enum {
     // Disconnected
     DISCONNECTED,
@@ -185,8 +196,7 @@ private:
   // NULL if no TLS is configured
   SSL_CTX *ssl_ctx_;
   nghttp2_session *session_;
-  const uint8_t *data_pending_;
-  size_t data_pendinglen_;
+  size_t addr_idx_;
   int state_;
   int connection_check_state_;
   bool flow_control_;
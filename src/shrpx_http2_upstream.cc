@@ -36,6 +36,7 @@
 #include "shrpx_config.h"
 #include "shrpx_http.h"
 #include "shrpx_worker.h"
+#include "shrpx_response_cache.h"
 #include "http2.h"
 #include "util.h"
 #include "base64.h"
@@ -135,7 +136,7 @@ int Http2Upstream::upgrade_upstream(HttpsUpstream *http) {
     }
   }
 
-  auto http2_settings = http->get_downstream()->get_http2_settings();
+  auto http2_settings = http->get_downstream()->get_http2_settings().str();
   util::to_base64(http2_settings);
 
   auto settings_payload =
@@ -332,6 +333,28 @@ void Http2Upstream::start_downstream(Downstream *downstream) {
       downstream_queue_.pop_pending(downstream->get_stream_id());
   assert(next_downstream);
 
+  auto cache = handler_->get_worker()->get_response_cache();
+  if (cache) {
+    auto ent = cache->lookup(downstream, ev_now(handler_->get_loop()));
+    if (ent) {
+      if (LOG_ENABLED(INFO)) {
+        ULOG(INFO, this) << "Serving response from cache, stream_id="
+                         << downstream->get_stream_id()
+                         << ", hits=" << cache->get_num_hits()
+                         << ", misses=" << cache->get_num_misses();
+      }
+
+      if (ResponseCache::serve_response(this, downstream, *ent,
+                                        ev_now(handler_->get_loop())) != 0) {
+        rst_stream(downstream, NGHTTP2_INTERNAL_ERROR);
+      }
+
+      downstream_queue_.add_failure(std::move(next_downstream));
+
+      return;
+    }
+  }
+
   if (downstream_queue_.can_activate(
           downstream->get_request_http2_authority())) {
     initiate_downstream(std::move(next_downstream));
@@ -645,6 +668,63 @@ void Http2Upstream::check_shutdown() {
   }
 }
 
+namespace {
+// The length of frame header of HTTP/2 frame
+constexpr size_t FRAME_HDLEN = 9;
+} // namespace
+
+namespace {
+// Writes complete DATA frame, whose payload is taken directly from
+// response body buffer of Downstream, to the write buffer of
+// ClientHandler.  This saves one copy of payload compared with
+// copying it into nghttp2_session first.
+int send_data_callback(nghttp2_session *session, nghttp2_frame *frame,
+                       const uint8_t *framehd, size_t length,
+                       nghttp2_data_source *source, void *user_data) {
+  auto downstream = static_cast<Downstream *>(source->ptr);
+  auto upstream = static_cast<Http2Upstream *>(user_data);
+  auto body = downstream->get_response_buf();
+  auto wb = upstream->get_client_handler()->get_wb();
+
+  size_t padlen = frame->data.padlen;
+
+  if (wb->wleft() < FRAME_HDLEN + padlen + length) {
+    return NGHTTP2_ERR_WOULDBLOCK;
+  }
+
+  wb->write(framehd, FRAME_HDLEN);
+
+  if (padlen > 0) {
+    uint8_t padlen_field = padlen - 1;
+    wb->write(&padlen_field, 1);
+  }
+
+  auto nread = body->remove(wb->last, length);
+  wb->write(nread);
+
+  assert(nread == length);
+
+  if (padlen > 1) {
+    std::fill_n(wb->last, padlen - 1, 0);
+    wb->write(padlen - 1);
+  }
+
+  if (body->rleft() == 0) {
+    downstream->disable_upstream_wtimer();
+  } else {
+    downstream->reset_upstream_wtimer();
+  }
+
+  if (nread > 0 && downstream->resume_read(SHRPX_NO_BUFFER, nread) != 0) {
+    return NGHTTP2_ERR_CALLBACK_FAILURE;
+  }
+
+  downstream->add_response_sent_bodylen(nread);
+
+  return 0;
+}
+} // namespace
+
 nghttp2_session_callbacks *create_http2_upstream_callbacks() {
   int rv;
   nghttp2_session_callbacks *callbacks;
@@ -676,6 +756,9 @@ nghttp2_session_callbacks *create_http2_upstream_callbacks() {
   nghttp2_session_callbacks_set_on_begin_headers_callback(
       callbacks, on_begin_headers_callback);
 
+  nghttp2_session_callbacks_set_send_data_callback(callbacks,
+                                                   send_data_callback);
+
   if (get_config()->padding) {
     nghttp2_session_callbacks_set_select_padding_callback(
         callbacks, http::select_padding_callback);
@@ -692,8 +775,7 @@ Http2Upstream::Http2Upstream(ClientHandler *handler)
                     ? get_config()->downstream_connections_per_frontend
                     : 0,
           !get_config()->http2_proxy),
-      handler_(handler), session_(nullptr), data_pending_(nullptr),
-      data_pendinglen_(0), shutdown_handled_(false) {
+      handler_(handler), session_(nullptr), shutdown_handled_(false) {
 
   int rv;
 
@@ -770,6 +852,30 @@ Http2Upstream::Http2Upstream(ClientHandler *handler)
 }
 
 Http2Upstream::~Http2Upstream() {
+  if (LOG_ENABLED(INFO)) {
+    nghttp2_session_stats stats;
+    if (nghttp2_session_get_stats(session_, &stats) == 0) {
+      uint64_t frames_sent = 0, frames_received = 0;
+      for (size_t i = 0; i < NGHTTP2_STATS_NUM_FRAME_TYPES; ++i) {
+        frames_sent += stats.frames_sent[i];
+        frames_received += stats.frames_received[i];
+      }
+      ULOG(INFO, this) << "frames sent=" << frames_sent
+                       << ", received=" << frames_received
+                       << ", padding sent=" << stats.padding_sent
+                       << ", received=" << stats.padding_received
+                       << ", deflate in=" << stats.hd_deflate_inlen
+                       << ", out=" << stats.hd_deflate_outlen
+                       << ", inflate in=" << stats.hd_inflate_inlen
+                       << ", out=" << stats.hd_inflate_outlen
+                       << ", stream flow control stalls="
+                       << stats.stream_flow_control_stalls
+                       << ", blocked=" << stats.stream_blocked_msec
+                       << "ms, connection flow control stalls="
+                       << stats.connection_flow_control_stalls
+                       << ", blocked=" << stats.connection_blocked_msec << "ms";
+    }
+  }
   nghttp2_session_del(session_);
   ev_prepare_stop(handler_->get_loop(), &prep_);
   ev_timer_stop(handler_->get_loop(), &shutdown_timer_);
@@ -815,37 +921,32 @@ int Http2Upstream::on_read() {
 int Http2Upstream::on_write() {
   auto wb = handler_->get_wb();
 
-  if (data_pending_) {
-    auto n = std::min(wb->wleft(), data_pendinglen_);
-    wb->write(data_pending_, n);
-    if (n < data_pendinglen_) {
-      data_pending_ += n;
-      data_pendinglen_ -= n;
+  for (;;) {
+    if (wb->wleft() == 0) {
       return 0;
     }
 
-    data_pending_ = nullptr;
-    data_pendinglen_ = 0;
-  }
+    size_t nocopylen;
 
-  for (;;) {
-    const uint8_t *data;
-    auto datalen = nghttp2_session_mem_send(session_, &data);
+    // Serialize as many frames as possible directly into write
+    // buffer, so that they are written at once.
+    auto nwrite = nghttp2_session_mem_send_batch(session_, wb->last,
+                                                 wb->wleft(), &nocopylen);
 
-    if (datalen < 0) {
-      ULOG(ERROR, this) << "nghttp2_session_mem_send() returned error: "
-                        << nghttp2_strerror(datalen);
+    if (nwrite < 0) {
+      ULOG(ERROR, this) << "nghttp2_session_mem_send_batch() returned error: "
+                        << nghttp2_strerror(nwrite);
       return -1;
     }
-    if (datalen == 0) {
+    if (nwrite == 0) {
+      // send_data_callback appended DATA frame to wb.  Continue to
+      // fill the rest of wb.
+      if (nocopylen > 0) {
+        continue;
+      }
       break;
     }
-    auto n = wb->write(data, datalen);
-    if (n < static_cast<decltype(n)>(datalen)) {
-      data_pending_ = data + n;
-      data_pendinglen_ = datalen - n;
-      return 0;
-    }
+    wb->write(nwrite);
   }
 
   if (nghttp2_session_want_read(session_) == 0 &&
@@ -1085,8 +1186,12 @@ ssize_t downstream_data_read_callback(nghttp2_session *session,
     }
   }
 
-  auto nread = body->remove(buf, length);
-  auto body_empty = body->rleft() == 0;
+  // Payload is written directly into the write buffer in
+  // send_data_callback, so we do not touch |buf| here.
+  auto nread = std::min(body->rleft(), length);
+  auto body_empty = body->rleft() == nread;
+
+  *data_flags |= NGHTTP2_DATA_FLAG_NO_COPY;
 
   if (body_empty &&
       downstream->get_response_state() == Downstream::MSG_COMPLETE) {
@@ -1124,24 +1229,12 @@ ssize_t downstream_data_read_callback(nghttp2_session *session,
     }
   }
 
-  if (body_empty) {
+  if (nread == 0 && ((*data_flags) & NGHTTP2_DATA_FLAG_EOF) == 0) {
     downstream->disable_upstream_wtimer();
-  } else {
-    downstream->reset_upstream_wtimer();
-  }
 
-  if (nread > 0 && downstream->resume_read(SHRPX_NO_BUFFER, nread) != 0) {
-    return NGHTTP2_ERR_CALLBACK_FAILURE;
-  }
-
-  if (nread == 0 && ((*data_flags) & NGHTTP2_DATA_FLAG_EOF) == 0) {
     return NGHTTP2_ERR_DEFERRED;
   }
 
-  if (nread > 0) {
-    downstream->add_response_sent_bodylen(nread);
-  }
-
   return nread;
 }
 } // namespace
@@ -1215,6 +1308,11 @@ int Http2Upstream::on_downstream_header_complete(Downstream *downstream) {
     }
   }
 
+  auto cache = handler_->get_worker()->get_response_cache();
+  if (cache) {
+    cache->on_response_header(downstream, ev_now(handler_->get_loop()));
+  }
+
   if (!get_config()->http2_proxy && !get_config()->client_proxy &&
       !get_config()->no_location_rewrite) {
     downstream->rewrite_location_response_header(
@@ -1266,7 +1364,7 @@ int Http2Upstream::on_downstream_header_complete(Downstream *downstream) {
     }
   } else {
     if (via) {
-      via_value = (*via).value;
+      via_value = (*via).value.str();
       via_value += ", ";
     }
     via_value += http::create_via_header_value(
@@ -1343,6 +1441,11 @@ int Http2Upstream::on_downstream_header_complete(Downstream *downstream) {
 int Http2Upstream::on_downstream_body(Downstream *downstream,
                                       const uint8_t *data, size_t len,
                                       bool flush) {
+  auto cache = handler_->get_worker()->get_response_cache();
+  if (cache) {
+    cache->on_response_body(downstream, data, len);
+  }
+
   auto body = downstream->get_response_buf();
   body->append(data, len);
 
@@ -1362,6 +1465,11 @@ int Http2Upstream::on_downstream_body_complete(Downstream *downstream) {
     DLOG(INFO, downstream) << "HTTP response completed";
   }
 
+  auto cache = handler_->get_worker()->get_response_cache();
+  if (cache) {
+    cache->on_response_complete(downstream);
+  }
+
   if (!downstream->validate_response_bodylen()) {
     rst_stream(downstream, NGHTTP2_PROTOCOL_ERROR);
     downstream->set_response_connection_close(true);
@@ -1498,7 +1606,9 @@ int Http2Upstream::on_downstream_reset(bool no_retry) {
   return 0;
 }
 
-MemchunkPool *Http2Upstream::get_mcpool() { return &mcpool_; }
+MemchunkPool *Http2Upstream::get_mcpool() {
+  return handler_->get_worker()->get_mcpool();
+}
 
 int Http2Upstream::prepare_push_promise(Downstream *downstream) {
   int rv;
@@ -109,14 +109,17 @@ void connectcb(struct ev_loop *loop, ev_io *w, int revents) {
 } // namespace
 
 HttpDownstreamConnection::HttpDownstreamConnection(
-    DownstreamConnectionPool *dconn_pool, struct ev_loop *loop)
+    DownstreamConnectionPool *dconn_pool, size_t addr_idx,
+    struct ev_loop *loop)
     : DownstreamConnection(dconn_pool),
       conn_(loop, -1, nullptr, get_config()->downstream_write_timeout,
             get_config()->downstream_read_timeout, 0, 0, 0, 0, connectcb,
             readcb, timeoutcb, this),
-      ioctrl_(&conn_.rlimit), response_htp_{0}, addr_idx_(0) {}
+      ioctrl_(&conn_.rlimit), response_htp_{0}, addr_stat_(nullptr),
+      addr_idx_(addr_idx) {}
 
 HttpDownstreamConnection::~HttpDownstreamConnection() {
+  release_addr_stat();
   // Downstream and DownstreamConnection may be deleted
   // asynchronously.
   if (downstream_) {
@@ -124,6 +127,15 @@ HttpDownstreamConnection::~HttpDownstreamConnection() {
   }
 }
 
+void HttpDownstreamConnection::release_addr_stat() {
+  if (!addr_stat_) {
+    return;
+  }
+
+  --addr_stat_->num_requests;
+  addr_stat_ = nullptr;
+}
+
 int HttpDownstreamConnection::attach_downstream(Downstream *downstream) {
   if (LOG_ENABLED(INFO)) {
     DCLOG(INFO, this) << "Attaching to DOWNSTREAM:" << downstream;
@@ -140,14 +152,10 @@ int HttpDownstreamConnection::attach_downstream(Downstream *downstream) {
       return -1;
     }
 
-    auto worker = client_handler_->get_worker();
-    auto worker_stat = worker->get_worker_stat();
-    auto end = worker_stat->next_downstream;
+    auto naddrs = get_config()->downstream_addrs.size();
+    auto i = addr_idx_;
+    auto end = i;
     for (;;) {
-      auto i = worker_stat->next_downstream;
-      ++worker_stat->next_downstream;
-      worker_stat->next_downstream %= get_config()->downstream_addrs.size();
-
       conn_.fd = util::create_nonblock_socket(
           get_config()->downstream_addrs[i].addr.storage.ss_family);
 
@@ -171,7 +179,9 @@ int HttpDownstreamConnection::attach_downstream(Downstream *downstream) {
         close(conn_.fd);
         conn_.fd = -1;
 
-        if (end == worker_stat->next_downstream) {
+        i = (i + 1) % naddrs;
+
+        if (i == end) {
           return SHRPX_ERR_NETWORK;
         }
 
@@ -196,6 +206,11 @@ int HttpDownstreamConnection::attach_downstream(Downstream *downstream) {
 
   downstream_ = downstream;
 
+  addr_stat_ = &client_handler_->get_worker()
+                    ->get_worker_stat()
+                    ->downstream_addr_stats[addr_idx_];
+  ++addr_stat_->num_requests;
+
   http_parser_init(&response_htp_, HTTP_RESPONSE);
   response_htp_.data = downstream_;
 
@@ -308,14 +323,14 @@ int HttpDownstreamConnection::push_request_headers() {
   if (get_config()->add_x_forwarded_for) {
     hdrs += "X-Forwarded-For: ";
     if (xff && !get_config()->strip_incoming_x_forwarded_for) {
-      hdrs += (*xff).value;
+      hdrs.append(std::begin((*xff).value), std::end((*xff).value));
       hdrs += ", ";
     }
     hdrs += client_handler_->get_ipaddr();
     hdrs += "\r\n";
   } else if (xff && !get_config()->strip_incoming_x_forwarded_for) {
     hdrs += "X-Forwarded-For: ";
-    hdrs += (*xff).value;
+    hdrs.append(std::begin((*xff).value), std::end((*xff).value));
     hdrs += "\r\n";
   }
   if (!get_config()->http2_proxy && !get_config()->client_proxy &&
@@ -333,20 +348,20 @@ int HttpDownstreamConnection::push_request_headers() {
   auto expect = downstream_->get_request_header(http2::HD_EXPECT);
   if (expect && !util::strifind((*expect).value.c_str(), "100-continue")) {
     hdrs += "Expect: ";
-    hdrs += (*expect).value;
+    hdrs.append(std::begin((*expect).value), std::end((*expect).value));
     hdrs += "\r\n";
   }
   auto via = downstream_->get_request_header(http2::HD_VIA);
   if (get_config()->no_via) {
     if (via) {
       hdrs += "Via: ";
-      hdrs += (*via).value;
+      hdrs.append(std::begin((*via).value), std::end((*via).value));
       hdrs += "\r\n";
     }
   } else {
     hdrs += "Via: ";
     if (via) {
-      hdrs += (*via).value;
+      hdrs.append(std::begin((*via).value), std::end((*via).value));
       hdrs += ", ";
     }
     hdrs += http::create_via_header_value(downstream_->get_request_major(),
@@ -450,6 +465,7 @@ void HttpDownstreamConnection::detach_downstream(Downstream *downstream) {
     DCLOG(INFO, this) << "Detaching from DOWNSTREAM:" << downstream;
   }
   downstream_ = nullptr;
+  release_addr_stat();
   ioctrl_.force_resume_read();
 
   conn_.rlimit.startw();
@@ -568,14 +584,14 @@ int htp_hdr_keycb(http_parser *htp, const char *data, size_t len) {
     if (downstream->get_response_header_key_prev()) {
       downstream->append_last_response_header_key(data, len);
     } else {
-      downstream->add_response_header(std::string(data, len), "");
+      downstream->add_response_header(StringRef{data, len}, "");
     }
   } else {
     // trailer part
     if (downstream->get_response_trailer_key_prev()) {
       downstream->append_last_response_trailer_key(data, len);
     } else {
-      downstream->add_response_trailer(std::string(data, len), "");
+      downstream->add_response_trailer(StringRef{data, len}, "");
     }
   }
   if (downstream->get_response_headers_sum() > Downstream::MAX_HEADERS_SUM) {
@@ -791,4 +807,6 @@ void HttpDownstreamConnection::on_upstream_change(Upstream *upstream) {}
 
 void HttpDownstreamConnection::signal_write() { conn_.wlimit.startw(); }
 
+size_t HttpDownstreamConnection::get_addr_idx() const { return addr_idx_; }
+
 } // namespace shrpx
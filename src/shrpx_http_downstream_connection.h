@@ -36,11 +36,12 @@
 namespace shrpx {
 
 class DownstreamConnectionPool;
+struct DownstreamAddrStat;
 
 class HttpDownstreamConnection : public DownstreamConnection {
 public:
   HttpDownstreamConnection(DownstreamConnectionPool *dconn_pool,
-                           struct ev_loop *loop);
+                           size_t addr_idx, struct ev_loop *loop);
   virtual ~HttpDownstreamConnection();
   virtual int attach_downstream(Downstream *downstream);
   virtual void detach_downstream(Downstream *downstream);
@@ -58,14 +59,22 @@ public:
 
   virtual void on_upstream_change(Upstream *upstream);
   virtual int on_priority_change(int32_t pri) { return 0; }
+  virtual size_t get_addr_idx() const;
 
   int on_connect();
   void signal_write();
 
 private:
+  // Decrements the number of outstanding requests of the backend
+  // address if a request is attached.
+  void release_addr_stat();
+
   Connection conn_;
   IOControl ioctrl_;
   http_parser response_htp_;
+  // The state of the backend address this object is connected to.
+  // Not nullptr while a request is attached.
+  DownstreamAddrStat *addr_stat_;
   // index of get_config()->downstream_addrs this object is using
   size_t addr_idx_;
 };
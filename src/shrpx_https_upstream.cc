@@ -36,6 +36,7 @@
 #include "shrpx_error.h"
 #include "shrpx_log_config.h"
 #include "shrpx_worker.h"
+#include "shrpx_response_cache.h"
 #include "http2.h"
 #include "util.h"
 #include "template.h"
@@ -87,14 +88,14 @@ int htp_hdr_keycb(http_parser *htp, const char *data, size_t len) {
     if (downstream->get_request_header_key_prev()) {
       downstream->append_last_request_header_key(data, len);
     } else {
-      downstream->add_request_header(std::string(data, len), "");
+      downstream->add_request_header(StringRef{data, len}, "");
     }
   } else {
     // trailer part
     if (downstream->get_request_trailer_key_prev()) {
       downstream->append_last_request_trailer_key(data, len);
     } else {
-      downstream->add_request_trailer(std::string(data, len), "");
+      downstream->add_request_trailer(StringRef{data, len}, "");
     }
   }
   if (downstream->get_request_headers_sum() > Downstream::MAX_HEADERS_SUM) {
@@ -192,8 +193,32 @@ int htp_hdrs_completecb(http_parser *htp) {
     }
   }
 
+  auto handler = upstream->get_client_handler();
+  auto cache = handler->get_worker()->get_response_cache();
+  if (cache) {
+    auto ent = cache->lookup(downstream, ev_now(handler->get_loop()));
+    if (ent) {
+      if (LOG_ENABLED(INFO)) {
+        ULOG(INFO, upstream) << "Serving response from cache, hits="
+                             << cache->get_num_hits()
+                             << ", misses=" << cache->get_num_misses();
+      }
+
+      downstream->set_request_state(Downstream::HEADER_COMPLETE);
+
+      if (ResponseCache::serve_response(upstream, downstream, *ent,
+                                        ev_now(handler->get_loop())) != 0) {
+        return -1;
+      }
+
+      handler->signal_write();
+
+      return 0;
+    }
+  }
+
   rv = downstream->attach_downstream_connection(
-      upstream->get_client_handler()->get_downstream_connection());
+      handler->get_downstream_connection());
 
   if (rv != 0) {
     downstream->set_request_state(Downstream::CONNECT_FAIL);
@@ -237,9 +262,14 @@ int htp_msg_completecb(http_parser *htp) {
   auto handler = upstream->get_client_handler();
   auto downstream = upstream->get_downstream();
   downstream->set_request_state(Downstream::MSG_COMPLETE);
-  rv = downstream->end_upload_data();
-  if (rv != 0) {
-    return -1;
+
+  // The response has been served from cache, and there is no backend
+  // connection to finish.
+  if (!downstream->get_response_cached()) {
+    rv = downstream->end_upload_data();
+    if (rv != 0) {
+      return -1;
+    }
   }
 
   if (handler->get_http2_upgrade_allowed() &&
@@ -640,6 +670,11 @@ int HttpsUpstream::on_downstream_header_complete(Downstream *downstream) {
     }
   }
 
+  auto cache = handler_->get_worker()->get_response_cache();
+  if (cache) {
+    cache->on_response_header(downstream, ev_now(handler_->get_loop()));
+  }
+
   std::string hdrs = "HTTP/";
   hdrs += util::utos(downstream->get_request_major());
   hdrs += ".";
@@ -722,7 +757,7 @@ int HttpsUpstream::on_downstream_header_complete(Downstream *downstream) {
     auto server = downstream->get_response_header(http2::HD_SERVER);
     if (server) {
       hdrs += "Server: ";
-      hdrs += (*server).value;
+      hdrs.append(std::begin((*server).value), std::end((*server).value));
       hdrs += "\r\n";
     }
   }
@@ -731,13 +766,13 @@ int HttpsUpstream::on_downstream_header_complete(Downstream *downstream) {
   if (get_config()->no_via) {
     if (via) {
       hdrs += "Via: ";
-      hdrs += (*via).value;
+      hdrs.append(std::begin((*via).value), std::end((*via).value));
       hdrs += "\r\n";
     }
   } else {
     hdrs += "Via: ";
     if (via) {
-      hdrs += (*via).value;
+      hdrs.append(std::begin((*via).value), std::end((*via).value));
       hdrs += ", ";
     }
     hdrs += http::create_via_header_value(downstream->get_response_major(),
@@ -769,6 +804,12 @@ int HttpsUpstream::on_downstream_body(Downstream *downstream,
   if (len == 0) {
     return 0;
   }
+
+  auto cache = handler_->get_worker()->get_response_cache();
+  if (cache) {
+    cache->on_response_body(downstream, data, len);
+  }
+
   auto output = downstream->get_response_buf();
   if (downstream->get_chunked_response()) {
     auto chunk_size_hex = util::utox(len);
@@ -787,6 +828,11 @@ int HttpsUpstream::on_downstream_body(Downstream *downstream,
 }
 
 int HttpsUpstream::on_downstream_body_complete(Downstream *downstream) {
+  auto cache = handler_->get_worker()->get_response_cache();
+  if (cache) {
+    cache->on_response_complete(downstream);
+  }
+
   if (downstream->get_chunked_response()) {
     auto output = downstream->get_response_buf();
     auto &trailers = downstream->get_response_trailers();
@@ -874,6 +920,8 @@ fail:
   return 0;
 }
 
-MemchunkPool *HttpsUpstream::get_mcpool() { return &mcpool_; }
+MemchunkPool *HttpsUpstream::get_mcpool() {
+  return handler_->get_worker()->get_mcpool();
+}
 
 } // namespace shrpx
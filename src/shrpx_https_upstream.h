@@ -86,7 +86,6 @@ private:
   http_parser htp_;
   size_t current_header_length_;
   // must be put before downstream_
-  MemchunkPool mcpool_;
   std::unique_ptr<Downstream> downstream_;
   IOControl ioctrl_;
 };
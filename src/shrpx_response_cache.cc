@@ -0,0 +1,575 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2015 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "shrpx_response_cache.h"
+
+#include <algorithm>
+
+#include "shrpx_upstream.h"
+#include "shrpx_client_handler.h"
+#include "shrpx_downstream.h"
+#include "shrpx_log.h"
+#include "util.h"
+#include "template.h"
+
+
+namespace shrpx {
+
+CacheControl::CacheControl()
+    : max_age(-1), s_maxage(-1), no_store(false), no_cache(false),
+      private_(false) {}
+
+namespace {
+bool lws(char c) { return c == ' ' || c == '\t'; }
+} // namespace
+
+namespace {
+// Parses delta-seconds in |s|.  Returns 0 if |s| is not a valid
+// delta-seconds, which makes response stale immediately.
+int64_t parse_delta_seconds(const std::string &s) {
+  auto n = util::parse_uint(s);
+  if (n == -1) {
+    return 0;
+  }
+  return n;
+}
+} // namespace
+
+void parse_cache_control(CacheControl &cc, const StringRef &value) {
+  auto first = std::begin(value);
+  auto last = std::end(value);
+
+  while (first != last) {
+    for (; first != last && (lws(*first) || *first == ','); ++first)
+      ;
+    if (first == last) {
+      break;
+    }
+
+    auto name_first = first;
+    for (; first != last && !lws(*first) && *first != '=' && *first != ',';
+         ++first)
+      ;
+    auto namelen = first - name_first;
+
+    for (; first != last && lws(*first); ++first)
+      ;
+
+    std::string arg;
+    if (first != last && *first == '=') {
+      for (++first; first != last && lws(*first); ++first)
+        ;
+      if (first != last && *first == '"') {
+        auto arg_first = ++first;
+        first = std::find(first, last, '"');
+        arg.assign(arg_first, first);
+      } else {
+        auto arg_first = first;
+        for (; first != last && !lws(*first) && *first != ','; ++first)
+          ;
+        arg.assign(arg_first, first);
+      }
+    }
+
+    first = std::find(first, last, ',');
+
+    if (util::strieq_l("no-store", name_first, namelen)) {
+      cc.no_store = true;
+    } else if (util::strieq_l("no-cache", name_first, namelen)) {
+      cc.no_cache = true;
+    } else if (util::strieq_l("private", name_first, namelen)) {
+      cc.private_ = true;
+    } else if (util::strieq_l("max-age", name_first, namelen)) {
+      cc.max_age = parse_delta_seconds(arg);
+    } else if (util::strieq_l("s-maxage", name_first, namelen)) {
+      cc.s_maxage = parse_delta_seconds(arg);
+    }
+  }
+}
+
+int64_t get_freshness_lifetime(const HeaderRefs &headers, ev_tstamp now) {
+  CacheControl cc;
+  const HeaderRefs::value_type *expires = nullptr;
+  const HeaderRefs::value_type *date = nullptr;
+
+  for (auto &kv : headers) {
+    if (kv.token == http2::HD_CACHE_CONTROL) {
+      parse_cache_control(cc, kv.value);
+    } else if (kv.name == "expires") {
+      expires = &kv;
+    } else if (kv.name == "date") {
+      date = &kv;
+    }
+  }
+
+  if (cc.no_store || cc.no_cache || cc.private_) {
+    return -1;
+  }
+
+  if (cc.s_maxage != -1) {
+    return cc.s_maxage;
+  }
+
+  if (cc.max_age != -1) {
+    return cc.max_age;
+  }
+
+  if (!expires) {
+    return -1;
+  }
+
+  auto t = util::parse_http_date(expires->value.str());
+  if (t == 0) {
+    // Invalid Expires means that the response has already expired.
+    return 0;
+  }
+
+  int64_t base = now;
+  if (date) {
+    auto d = util::parse_http_date(date->value.str());
+    if (d != 0) {
+      base = d;
+    }
+  }
+
+  return std::max(static_cast<int64_t>(t) - base, static_cast<int64_t>(0));
+}
+
+namespace {
+// Returns the age of the response whose header fields are |headers|
+// received at |now|.
+int64_t get_initial_age(const HeaderRefs &headers, ev_tstamp now) {
+  int64_t age = 0;
+  for (auto &kv : headers) {
+    if (kv.name == "age") {
+      auto n = util::parse_uint(
+          reinterpret_cast<const uint8_t *>(kv.value.c_str()), kv.value.size());
+      if (n != -1) {
+        age = std::max(age, n);
+      }
+    } else if (kv.name == "date") {
+      auto d = util::parse_http_date(kv.value.str());
+      if (d != 0) {
+        age = std::max(age, static_cast<int64_t>(now) - d);
+      }
+    }
+  }
+  return age;
+}
+} // namespace
+
+namespace {
+// Returns the scheme of the request in |downstream|.  HTTP/1
+// frontend does not receive it, so it is decided by whether the
+// client connection is encrypted.
+std::string get_request_scheme(const Downstream *downstream) {
+  auto &scheme = downstream->get_request_http2_scheme();
+  if (!scheme.empty()) {
+    return scheme;
+  }
+  auto upstream = downstream->get_upstream();
+  if (upstream && upstream->get_client_handler()->get_ssl()) {
+    return "https";
+  }
+  return "http";
+}
+} // namespace
+
+namespace {
+// The same authority and path may be different resources for http
+// and https (e.g., http one redirects to https), so the key includes
+// scheme.
+std::string make_cache_key(const Downstream *downstream) {
+  auto key = get_request_scheme(downstream);
+  key += "://";
+  auto &authority = downstream->get_request_http2_authority();
+  if (!authority.empty()) {
+    key += authority;
+  } else {
+    auto host = downstream->get_request_header(http2::HD_HOST);
+    if (host) {
+      key += (*host).value.str();
+    }
+  }
+  key += downstream->get_request_path();
+  return key;
+}
+} // namespace
+
+namespace {
+// Returns true if the request in |downstream| may be served from
+// cache, or its response may be stored.  We only deal with simple GET
+// and HEAD requests.  Requests with credentials, partial or
+// conditional requests, and requests asking to bypass cache are sent
+// to backend.
+bool request_cacheable(const Downstream *downstream) {
+  auto &method = downstream->get_request_method();
+  if (method != "GET" && method != "HEAD") {
+    return false;
+  }
+
+  if (downstream->get_upgrade_request() ||
+      downstream->get_request_http2_expect_body() ||
+      downstream->get_chunked_request() ||
+      downstream->get_request_content_length() > 0) {
+    return false;
+  }
+
+  if (downstream->get_request_header(http2::HD_IF_MODIFIED_SINCE)) {
+    return false;
+  }
+
+  for (auto name : {"authorization", "range", "if-range", "if-none-match",
+                    "if-match", "if-unmodified-since"}) {
+    if (downstream->get_request_header(name)) {
+      return false;
+    }
+  }
+
+  auto pragma = downstream->get_request_header("pragma");
+  if (pragma && util::strieq_l("no-cache", (*pragma).value.c_str(),
+                                (*pragma).value.size())) {
+    return false;
+  }
+
+  CacheControl cc;
+  for (auto &kv : downstream->get_request_headers()) {
+    if (kv.token == http2::HD_CACHE_CONTROL) {
+      parse_cache_control(cc, kv.value);
+    }
+  }
+
+  return !cc.no_store && !cc.no_cache && cc.max_age != 0;
+}
+} // namespace
+
+namespace {
+// Returns true if the response with status code |status| can be
+// stored.  These are status codes defined as cacheable by default in
+// RFC 7231, section 6.1, except for 206.
+bool status_cacheable(unsigned int status) {
+  switch (status) {
+  case 200:
+  case 203:
+  case 204:
+  case 300:
+  case 301:
+  case 404:
+  case 405:
+  case 410:
+  case 414:
+  case 501:
+    return true;
+  default:
+    return false;
+  }
+}
+} // namespace
+
+namespace {
+bool vary_match(const CachedResponse &ent, const Downstream *downstream) {
+  for (auto &p : ent.vary) {
+    auto hd = downstream->get_request_header(p.first);
+    if (hd) {
+      if ((*hd).value != p.second) {
+        return false;
+      }
+    } else if (!p.second.empty()) {
+      return false;
+    }
+  }
+  return true;
+}
+} // namespace
+
+namespace {
+size_t get_entry_size(const CachedResponse &ent) {
+  auto size = ent.key.size() + ent.body.size();
+  for (auto &kv : ent.headers) {
+    size += kv.name.size() + kv.value.size();
+  }
+  for (auto &p : ent.vary) {
+    size += p.first.size() + p.second.size();
+  }
+  return size;
+}
+} // namespace
+
+ResponseCache::ResponseCache(size_t max_size, size_t max_entry_size)
+    : max_size_(max_size), max_entry_size_(max_entry_size), size_(0),
+      num_hits_(0), num_misses_(0), num_evictions_(0) {}
+
+ResponseCache::~ResponseCache() {}
+
+const CachedResponse *ResponseCache::lookup(const Downstream *downstream,
+                                            ev_tstamp now) {
+  if (!request_cacheable(downstream)) {
+    return nullptr;
+  }
+
+  auto range = index_.equal_range(make_cache_key(downstream));
+  for (auto it = range.first; it != range.second; ++it) {
+    auto lit = (*it).second;
+    auto &ent = *lit;
+
+    if (!vary_match(*ent, downstream)) {
+      continue;
+    }
+
+    if (ent->expires <= now) {
+      remove(lit);
+      break;
+    }
+
+    lru_.splice(std::begin(lru_), lru_, lit);
+
+    ++num_hits_;
+
+    return ent.get();
+  }
+
+  ++num_misses_;
+
+  return nullptr;
+}
+
+void ResponseCache::store(std::unique_ptr<CachedResponse> ent) {
+  auto size = get_entry_size(*ent);
+  if (size > max_size_) {
+    return;
+  }
+
+  auto range = index_.equal_range(ent->key);
+  for (auto it = range.first; it != range.second; ++it) {
+    auto lit = (*it).second;
+    if ((*lit)->vary == ent->vary) {
+      remove(lit);
+      break;
+    }
+  }
+
+  auto &key = ent->key;
+  lru_.push_front(std::move(ent));
+  index_.emplace(key, std::begin(lru_));
+  size_ += size;
+
+  while (size_ > max_size_) {
+    remove(std::prev(std::end(lru_)));
+    ++num_evictions_;
+  }
+}
+
+void ResponseCache::remove(EntryList::iterator it) {
+  size_ -= get_entry_size(**it);
+
+  auto range = index_.equal_range((*it)->key);
+  for (auto i = range.first; i != range.second; ++i) {
+    if ((*i).second == it) {
+      index_.erase(i);
+      break;
+    }
+  }
+
+  lru_.erase(it);
+}
+
+void ResponseCache::on_response_header(Downstream *downstream, ev_tstamp now) {
+  if (downstream->get_response_cached() ||
+      downstream->get_non_final_response() ||
+      downstream->get_request_method() != "GET" ||
+      !status_cacheable(downstream->get_response_http_status()) ||
+      !request_cacheable(downstream)) {
+    return;
+  }
+
+  if (downstream->get_response_content_length() >
+      static_cast<int64_t>(max_entry_size_)) {
+    return;
+  }
+
+  auto &headers = downstream->get_response_headers();
+
+  auto ent = make_unique<CachedResponse>();
+
+  for (auto &kv : headers) {
+    if (kv.name == "set-cookie") {
+      return;
+    }
+
+    if (kv.name != "vary") {
+      continue;
+    }
+
+    auto first = std::begin(kv.value);
+    auto last = std::end(kv.value);
+    while (first != last) {
+      auto end = std::find(first, last, ',');
+      auto name_first = first;
+      auto name_last = end;
+      for (; name_first != name_last && lws(*name_first); ++name_first)
+        ;
+      for (; name_last != name_first && lws(*(name_last - 1)); --name_last)
+        ;
+
+      if (name_first != name_last) {
+        auto name = std::string(name_first, name_last);
+        if (name == "*") {
+          return;
+        }
+        util::inp_strlower(name);
+        auto hd = downstream->get_request_header(name);
+        ent->vary.emplace_back(std::move(name), hd ? (*hd).value.str() : "");
+      }
+
+      first = end;
+      if (first != last) {
+        ++first;
+      }
+    }
+  }
+
+  auto lifetime = get_freshness_lifetime(headers, now);
+  auto age = get_initial_age(headers, now);
+  if (lifetime - age <= 0) {
+    return;
+  }
+
+  for (auto &kv : headers) {
+    if (kv.name.empty() || kv.name[0] == ':' || kv.name == "age") {
+      continue;
+    }
+    switch (kv.token) {
+    case http2::HD_CONNECTION:
+    case http2::HD_CONTENT_LENGTH:
+    case http2::HD_KEEP_ALIVE:
+    case http2::HD_PROXY_CONNECTION:
+    case http2::HD_TE:
+    case http2::HD_TRAILER:
+    case http2::HD_TRANSFER_ENCODING:
+    case http2::HD_UPGRADE:
+      continue;
+    }
+    ent->headers.emplace_back(kv.name.str(), kv.value.str(), kv.no_index,
+                              kv.token);
+  }
+
+  ent->key = make_cache_key(downstream);
+  ent->downstream_host = downstream->get_request_downstream_host();
+  ent->stored = now - age;
+  ent->expires = ent->stored + lifetime;
+  ent->status = downstream->get_response_http_status();
+  ent->major = downstream->get_response_major();
+  ent->minor = downstream->get_response_minor();
+
+  downstream->set_cache_response(std::move(ent));
+}
+
+void ResponseCache::on_response_body(Downstream *downstream,
+                                     const uint8_t *data, size_t len) {
+  auto ent = downstream->get_cache_response();
+  if (!ent) {
+    return;
+  }
+
+  if (ent->body.size() + len > max_entry_size_) {
+    downstream->pop_cache_response();
+    return;
+  }
+
+  ent->body.append(reinterpret_cast<const char *>(data), len);
+}
+
+void ResponseCache::on_response_complete(Downstream *downstream) {
+  auto ent = downstream->pop_cache_response();
+  if (!ent) {
+    return;
+  }
+
+  if (!downstream->validate_response_bodylen() ||
+      !downstream->get_response_trailers().empty()) {
+    return;
+  }
+
+  if (LOG_ENABLED(INFO)) {
+    DLOG(INFO, downstream) << "Storing response in cache, key=" << ent->key
+                           << ", bodylen=" << ent->body.size();
+  }
+
+  store(std::move(ent));
+}
+
+int ResponseCache::serve_response(Upstream *upstream, Downstream *downstream,
+                                  const CachedResponse &ent, ev_tstamp now) {
+  downstream->set_response_cached(true);
+  downstream->set_request_downstream_host(ent.downstream_host);
+  downstream->set_response_http_status(ent.status);
+  downstream->set_response_major(ent.major);
+  downstream->set_response_minor(ent.minor);
+
+  for (auto &kv : ent.headers) {
+    downstream->add_response_header(StringRef{kv.name}, StringRef{kv.value},
+                                    kv.token);
+  }
+
+  downstream->add_response_header("content-length",
+                                  StringRef{util::utos(ent.body.size())},
+                                  http2::HD_CONTENT_LENGTH);
+  downstream->set_response_content_length(ent.body.size());
+
+  auto age = std::max(static_cast<int64_t>(now - ent.stored),
+                      static_cast<int64_t>(0));
+  downstream->add_response_header("age", StringRef{util::utos(age)}, -1);
+
+  downstream->set_response_state(Downstream::HEADER_COMPLETE);
+
+  if (upstream->on_downstream_header_complete(downstream) != 0) {
+    return -1;
+  }
+
+  if (downstream->expect_response_body() && !ent.body.empty()) {
+    downstream->add_response_bodylen(ent.body.size());
+
+    if (upstream->on_downstream_body(
+            downstream, reinterpret_cast<const uint8_t *>(ent.body.c_str()),
+            ent.body.size(), false) != 0) {
+      return -1;
+    }
+  }
+
+  downstream->set_response_state(Downstream::MSG_COMPLETE);
+
+  return upstream->on_downstream_body_complete(downstream);
+}
+
+size_t ResponseCache::get_num_entries() const { return lru_.size(); }
+
+size_t ResponseCache::get_size() const { return size_; }
+
+size_t ResponseCache::get_num_hits() const { return num_hits_; }
+
+size_t ResponseCache::get_num_misses() const { return num_misses_; }
+
+size_t ResponseCache::get_num_evictions() const { return num_evictions_; }
+
+} // namespace shrpx
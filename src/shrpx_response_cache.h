@@ -0,0 +1,171 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2015 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef SHRPX_RESPONSE_CACHE_H
+#define SHRPX_RESPONSE_CACHE_H
+
+#include "shrpx.h"
+
+#include <string>
+#include <vector>
+#include <list>
+#include <memory>
+#include <unordered_map>
+
+#include <ev.h>
+
+#include "http2.h"
+
+using namespace nghttp2;
+
+namespace shrpx {
+
+class Upstream;
+class Downstream;
+
+struct CacheControl {
+  CacheControl();
+  // max-age, or -1 if it is not present
+  int64_t max_age;
+  // s-maxage, or -1 if it is not present
+  int64_t s_maxage;
+  bool no_store;
+  bool no_cache;
+  bool private_;
+};
+
+// Parses the value of Cache-Control header field |value|, and
+// updates |cc|.  Unknown directives are ignored.
+void parse_cache_control(CacheControl &cc, const StringRef &value);
+
+// Returns the freshness lifetime in seconds of the response whose
+// header fields are |headers|, taking into account the current age
+// of the response.  |now| is the time when the response was
+// received.  The response must have explicit expiration time by
+// s-maxage, max-age or Expires.  This function returns -1 if the
+// response must not be stored by a shared cache, or it has no
+// explicit expiration time.
+int64_t get_freshness_lifetime(const HeaderRefs &headers, ev_tstamp now);
+
+struct CachedResponse {
+  // Lookup key, which is the concatenation of host and request path
+  std::string key;
+  // Response header fields without hop-by-hop, Content-Length and
+  // Age header fields.
+  Headers headers;
+  std::string body;
+  // Request header fields named by Vary response header field and
+  // their values in the original request.  The value is empty if
+  // the header field was not present.
+  std::vector<std::pair<std::string, std::string>> vary;
+  // The host the original request was sent to.  This is used to
+  // rewrite Location header field.
+  std::string downstream_host;
+  // The time when the response was generated, which is the time
+  // when it was stored minus its age at that time.
+  ev_tstamp stored;
+  // The time when the response becomes stale.
+  ev_tstamp expires;
+  unsigned int status;
+  int major;
+  int minor;
+};
+
+// ResponseCache stores cacheable responses from backend in memory,
+// and serves them for the subsequent requests to the same resource
+// without contacting backend.  The cache honours Cache-Control and
+// Expires response header fields to decide whether a response is
+// stored and how long it is considered fresh, and Vary to select the
+// stored response.  The total size of stored responses is limited
+// by |max_size|, and the least recently used responses are evicted
+// to make room.  A response whose body exceeds |max_entry_size| is
+// not stored.  ResponseCache is not thread-safe; each Worker has its
+// own cache.
+class ResponseCache {
+public:
+  ResponseCache(size_t max_size, size_t max_entry_size);
+  ~ResponseCache();
+
+  // Returns fresh response stored for the request in |downstream|,
+  // or nullptr.  The returned object is valid until the next call of
+  // store().
+  const CachedResponse *lookup(const Downstream *downstream, ev_tstamp now);
+  // Stores |ent|, replacing the response stored for the same request.
+  // The least recently used responses are evicted if the total size
+  // exceeds the limit.
+  void store(std::unique_ptr<CachedResponse> ent);
+
+  // Called when response header fields are received for
+  // |downstream|.  If the response can be stored, this function
+  // starts collecting it in |downstream|.
+  void on_response_header(Downstream *downstream, ev_tstamp now);
+  // Called when response body is received for |downstream|.
+  void on_response_body(Downstream *downstream, const uint8_t *data,
+                        size_t len);
+  // Called when response is completely received for |downstream|.
+  // The response collected in |downstream| is stored if any.
+  void on_response_complete(Downstream *downstream);
+
+  // Sends stored response |ent| to the client through |upstream| as
+  // if it was received from backend for |downstream|.  Age header
+  // field is added based on |now|.  This function returns 0 if it
+  // succeeds, or -1.
+  static int serve_response(Upstream *upstream, Downstream *downstream,
+                            const CachedResponse &ent, ev_tstamp now);
+
+  // Returns the number of entries currently stored.
+  size_t get_num_entries() const;
+  // Returns the total size of entries currently stored.
+  size_t get_size() const;
+  // Returns the number of lookup() calls which returned stored
+  // response.
+  size_t get_num_hits() const;
+  // Returns the number of lookup() calls for cacheable request which
+  // returned nullptr.
+  size_t get_num_misses() const;
+  // Returns the number of entries deleted to make room for new one.
+  size_t get_num_evictions() const;
+
+private:
+  using EntryList = std::list<std::unique_ptr<CachedResponse>>;
+
+  // Removes entry pointed by |it| from lru_ and index_.
+  void remove(EntryList::iterator it);
+
+  // Stored responses.  The front is the most recently used.
+  EntryList lru_;
+  // Key to entries in lru_.  A key has multiple entries if the
+  // response has Vary header field.
+  std::unordered_multimap<std::string, EntryList::iterator> index_;
+  size_t max_size_;
+  size_t max_entry_size_;
+  size_t size_;
+  size_t num_hits_;
+  size_t num_misses_;
+  size_t num_evictions_;
+};
+
+} // namespace shrpx
+
+#endif // SHRPX_RESPONSE_CACHE_H
@@ -0,0 +1,295 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2015 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "shrpx_response_cache_test.h"
+
+#include <CUnit/CUnit.h>
+
+#include "shrpx_response_cache.h"
+#include "shrpx_downstream.h"
+
+namespace shrpx {
+
+namespace {
+void prepare_request(Downstream &d, const std::string &path) {
+  d.set_request_method("GET");
+  d.set_request_path(path);
+  d.add_request_header("host", "example.com");
+  d.index_request_headers();
+}
+} // namespace
+
+namespace {
+// Stores response with |headers| and |body| for the request in |d|
+// using |cache|.
+void store_response(ResponseCache &cache, Downstream &d,
+                    const Headers &headers, const std::string &body,
+                    ev_tstamp now) {
+  d.set_response_http_status(200);
+  for (auto &kv : headers) {
+    d.add_response_header(StringRef{kv.name}, StringRef{kv.value});
+  }
+  d.index_response_headers();
+
+  cache.on_response_header(&d, now);
+  cache.on_response_body(&d, reinterpret_cast<const uint8_t *>(body.c_str()),
+                         body.size());
+  cache.on_response_complete(&d);
+}
+} // namespace
+
+void test_shrpx_response_cache_parse_cache_control(void) {
+  {
+    CacheControl cc;
+    parse_cache_control(cc, "public, max-age=60, s-maxage=\"120\"");
+
+    CU_ASSERT(60 == cc.max_age);
+    CU_ASSERT(120 == cc.s_maxage);
+    CU_ASSERT(!cc.no_store);
+    CU_ASSERT(!cc.no_cache);
+    CU_ASSERT(!cc.private_);
+  }
+  {
+    CacheControl cc;
+    parse_cache_control(cc, "No-Store,private=\"set-cookie\"  , no-cache");
+
+    CU_ASSERT(-1 == cc.max_age);
+    CU_ASSERT(-1 == cc.s_maxage);
+    CU_ASSERT(cc.no_store);
+    CU_ASSERT(cc.no_cache);
+    CU_ASSERT(cc.private_);
+  }
+  {
+    // invalid delta-seconds makes response stale
+    CacheControl cc;
+    parse_cache_control(cc, "max-age=foo");
+
+    CU_ASSERT(0 == cc.max_age);
+  }
+}
+
+void test_shrpx_response_cache_get_freshness_lifetime(void) {
+  CU_ASSERT(60 == get_freshness_lifetime(
+                      HeaderRefs{{"cache-control", "max-age=60", false,
+                                  http2::HD_CACHE_CONTROL}},
+                      0.));
+  CU_ASSERT(120 == get_freshness_lifetime(
+                       HeaderRefs{{"cache-control", "max-age=60, s-maxage=120",
+                                   false, http2::HD_CACHE_CONTROL}},
+                       0.));
+  CU_ASSERT(-1 == get_freshness_lifetime(
+                      HeaderRefs{{"cache-control", "max-age=60, private",
+                                  false, http2::HD_CACHE_CONTROL}},
+                      0.));
+  CU_ASSERT(3600 ==
+            get_freshness_lifetime(
+                HeaderRefs{{"date", "Sun, 06 Nov 1994 08:49:37 GMT"},
+                           {"expires", "Sun, 06 Nov 1994 09:49:37 GMT"}},
+                0.));
+  // Invalid Expires
+  CU_ASSERT(0 == get_freshness_lifetime(HeaderRefs{{"expires", "0"}}, 0.));
+  // No explicit expiration time
+  CU_ASSERT(-1 ==
+            get_freshness_lifetime(HeaderRefs{{"etag", "\"foo\""}}, 0.));
+}
+
+void test_shrpx_response_cache_store_lookup(void) {
+  ResponseCache cache(4096, 1024);
+
+  {
+    Downstream d(nullptr, 0, 0);
+    prepare_request(d, "/alpha");
+    store_response(cache, d, Headers{{"cache-control", "max-age=60"},
+                                     {"content-type", "text/plain"},
+                                     {"connection", "close"}},
+                   "hello", 1000.);
+  }
+
+  CU_ASSERT(1 == cache.get_num_entries());
+
+  {
+    Downstream d(nullptr, 0, 0);
+    prepare_request(d, "/alpha");
+
+    auto ent = cache.lookup(&d, 1059.);
+
+    CU_ASSERT(nullptr != ent);
+    CU_ASSERT("hello" == ent->body);
+    CU_ASSERT(200 == ent->status);
+    CU_ASSERT((Headers{{"cache-control", "max-age=60"},
+                       {"content-type", "text/plain"}}) == ent->headers);
+    CU_ASSERT(1 == cache.get_num_hits());
+  }
+
+  {
+    // different path
+    Downstream d(nullptr, 0, 0);
+    prepare_request(d, "/bravo");
+
+    CU_ASSERT(nullptr == cache.lookup(&d, 1000.));
+    CU_ASSERT(1 == cache.get_num_misses());
+  }
+
+  {
+    // different scheme
+    Downstream d(nullptr, 0, 0);
+    d.set_request_http2_scheme("https");
+    prepare_request(d, "/alpha");
+
+    CU_ASSERT(nullptr == cache.lookup(&d, 1000.));
+    CU_ASSERT(2 == cache.get_num_misses());
+  }
+
+  {
+    // same scheme given explicitly
+    Downstream d(nullptr, 0, 0);
+    d.set_request_http2_scheme("http");
+    prepare_request(d, "/alpha");
+
+    CU_ASSERT(nullptr != cache.lookup(&d, 1000.));
+    CU_ASSERT(2 == cache.get_num_hits());
+  }
+
+  {
+    // request asks to bypass cache
+    Downstream d(nullptr, 0, 0);
+    d.add_request_header("cache-control", "no-cache");
+    prepare_request(d, "/alpha");
+
+    CU_ASSERT(nullptr == cache.lookup(&d, 1000.));
+  }
+
+  {
+    // stale response is removed
+    Downstream d(nullptr, 0, 0);
+    prepare_request(d, "/alpha");
+
+    CU_ASSERT(nullptr == cache.lookup(&d, 1060.));
+    CU_ASSERT(0 == cache.get_num_entries());
+    CU_ASSERT(0 == cache.get_size());
+  }
+
+  {
+    // response without explicit expiration time is not stored
+    Downstream d(nullptr, 0, 0);
+    prepare_request(d, "/charlie");
+    store_response(cache, d, Headers{{"content-type", "text/plain"}}, "hello",
+                   1000.);
+
+    CU_ASSERT(0 == cache.get_num_entries());
+  }
+
+  {
+    // too large response is not stored
+    Downstream d(nullptr, 0, 0);
+    prepare_request(d, "/delta");
+    store_response(cache, d, Headers{{"cache-control", "max-age=60"}},
+                   std::string(1025, 'a'), 1000.);
+
+    CU_ASSERT(0 == cache.get_num_entries());
+  }
+}
+
+void test_shrpx_response_cache_vary(void) {
+  ResponseCache cache(4096, 1024);
+
+  for (auto enc : {"gzip", "br"}) {
+    Downstream d(nullptr, 0, 0);
+    d.add_request_header("accept-encoding", enc);
+    prepare_request(d, "/alpha");
+    store_response(cache, d, Headers{{"cache-control", "max-age=60"},
+                                     {"vary", "Accept-Encoding"}},
+                   enc, 1000.);
+  }
+
+  CU_ASSERT(2 == cache.get_num_entries());
+
+  {
+    Downstream d(nullptr, 0, 0);
+    d.add_request_header("accept-encoding", "gzip");
+    prepare_request(d, "/alpha");
+
+    auto ent = cache.lookup(&d, 1000.);
+
+    CU_ASSERT(nullptr != ent);
+    CU_ASSERT("gzip" == ent->body);
+  }
+
+  {
+    Downstream d(nullptr, 0, 0);
+    prepare_request(d, "/alpha");
+
+    CU_ASSERT(nullptr == cache.lookup(&d, 1000.));
+  }
+
+  {
+    // Vary: * is never stored
+    Downstream d(nullptr, 0, 0);
+    prepare_request(d, "/bravo");
+    store_response(cache, d,
+                   Headers{{"cache-control", "max-age=60"}, {"vary", "*"}},
+                   "hello", 1000.);
+
+    CU_ASSERT(2 == cache.get_num_entries());
+  }
+}
+
+void test_shrpx_response_cache_evict(void) {
+  ResponseCache cache(2200, 1024);
+
+  for (auto path : {"/alpha", "/bravo", "/charlie"}) {
+    Downstream d(nullptr, 0, 0);
+    prepare_request(d, path);
+    store_response(cache, d, Headers{{"cache-control", "max-age=60"}},
+                   std::string(1000, 'a'), 1000.);
+
+    if (std::string("/bravo") == path) {
+      // make /alpha the most recently used
+      Downstream d2(nullptr, 0, 0);
+      prepare_request(d2, "/alpha");
+
+      CU_ASSERT(nullptr != cache.lookup(&d2, 1000.));
+    }
+  }
+
+  CU_ASSERT(2 == cache.get_num_entries());
+  CU_ASSERT(1 == cache.get_num_evictions());
+  CU_ASSERT(cache.get_size() <= 2200);
+
+  {
+    Downstream d(nullptr, 0, 0);
+    prepare_request(d, "/bravo");
+
+    CU_ASSERT(nullptr == cache.lookup(&d, 1000.));
+  }
+
+  {
+    Downstream d(nullptr, 0, 0);
+    prepare_request(d, "/alpha");
+
+    CU_ASSERT(nullptr != cache.lookup(&d, 1000.));
+  }
+}
+
+} // namespace shrpx
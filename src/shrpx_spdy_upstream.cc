@@ -36,6 +36,7 @@
 #include "shrpx_downstream_connection.h"
 #include "shrpx_config.h"
 #include "shrpx_http.h"
+#include "shrpx_worker.h"
 #include "http2.h"
 #include "util.h"
 #include "template.h"
@@ -186,13 +187,13 @@ void on_ctrl_recv_callback(spdylay_session *session, spdylay_frame_type type,
       return;
     }
 
-    downstream->set_request_method(method->value);
+    downstream->set_request_method(method->value.str());
     if (is_connect) {
-      downstream->set_request_http2_authority(path->value);
+      downstream->set_request_http2_authority(path->value.str());
     } else {
-      downstream->set_request_http2_scheme(scheme->value);
-      downstream->set_request_http2_authority(host->value);
-      downstream->set_request_path(path->value);
+      downstream->set_request_http2_scheme(scheme->value.str());
+      downstream->set_request_http2_authority(host->value.str());
+      downstream->set_request_path(path->value.str());
     }
 
     if (!(frame->syn_stream.hd.flags & SPDYLAY_CTRL_FLAG_FIN)) {
@@ -894,7 +895,7 @@ int SpdyUpstream::on_downstream_header_complete(Downstream *downstream) {
     }
   } else {
     if (via) {
-      via_value = via->value;
+      via_value = via->value.str();
       via_value += ", ";
     }
     via_value += http::create_via_header_value(
@@ -1077,6 +1078,8 @@ int SpdyUpstream::on_downstream_reset(bool no_retry) {
   return 0;
 }
 
-MemchunkPool *SpdyUpstream::get_mcpool() { return &mcpool_; }
+MemchunkPool *SpdyUpstream::get_mcpool() {
+  return handler_->get_worker()->get_mcpool();
+}
 
 } // namespace shrpx
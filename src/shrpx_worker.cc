@@ -27,6 +27,7 @@
 #include <unistd.h>
 
 #include <memory>
+#include <algorithm>
 
 #include "shrpx_ssl.h"
 #include "shrpx_log.h"
@@ -34,6 +35,9 @@
 #include "shrpx_http2_session.h"
 #include "shrpx_log_config.h"
 #include "shrpx_connect_blocker.h"
+#include "shrpx_accept_handler.h"
+#include "shrpx_health_checker.h"
+#include "shrpx_response_cache.h"
 #include "util.h"
 #include "template.h"
 
@@ -48,24 +52,111 @@ void eventcb(struct ev_loop *loop, ev_async *w, int revents) {
 }
 } // namespace
 
+namespace {
+void mcpool_clear_cb(struct ev_loop *loop, ev_timer *w, int revents) {
+  auto worker = static_cast<Worker *>(w->data);
+  worker->shrink_mcpool();
+}
+} // namespace
+
+namespace {
+void acceptor_disable_cb(struct ev_loop *loop, ev_timer *w, int revent) {
+  auto worker = static_cast<Worker *>(w->data);
+
+  // If we are in graceful shutdown period, we must not enable
+  // acceptors again.
+  if (worker->get_graceful_shutdown()) {
+    return;
+  }
+
+  worker->enable_acceptor();
+}
+} // namespace
+
+namespace {
+void http2session_timeout_cb(struct ev_loop *loop, ev_timer *w, int revents) {
+  auto worker = static_cast<Worker *>(w->data);
+  worker->remove_idle_http2_sessions();
+}
+} // namespace
+
+namespace {
+// The interval to delete idle backend HTTP/2 sessions made on
+// demand.
+constexpr ev_tstamp HTTP2SESSION_REMOVE_INTERVAL = 30.;
+} // namespace
+
+namespace {
+// The interval to release memory chunks which were not used during
+// this period.
+constexpr ev_tstamp MCPOOL_CLEAR_INTERVAL = 10.;
+} // namespace
+
 Worker::Worker(struct ev_loop *loop, SSL_CTX *sv_ssl_ctx, SSL_CTX *cl_ssl_ctx,
                ssl::CertLookupTree *cert_tree,
                const std::shared_ptr<TicketKeys> &ticket_keys)
-    : loop_(loop), sv_ssl_ctx_(sv_ssl_ctx), cl_ssl_ctx_(cl_ssl_ctx),
-      cert_tree_(cert_tree), ticket_keys_(ticket_keys),
-      graceful_shutdown_(false) {
+    : notified_(false), loop_(loop), sv_ssl_ctx_(sv_ssl_ctx),
+      cl_ssl_ctx_(cl_ssl_ctx), cert_tree_(cert_tree), ticket_keys_(ticket_keys),
+      next_http2_addr_idx_(0), graceful_shutdown_(false) {
   ev_async_init(&w_, eventcb);
   w_.data = this;
   ev_async_start(loop_, &w_);
 
+  ev_timer_init(&disable_acceptor_timer_, acceptor_disable_cb, 0., 0.);
+  disable_acceptor_timer_.data = this;
+
+  if (get_config()->worker_buffer_pool_size) {
+    mcpool_.freelistmax = get_config()->worker_buffer_pool_size;
+  }
+
+  ev_timer_init(&mcpool_clear_timer_, mcpool_clear_cb, 0.,
+                MCPOOL_CLEAR_INTERVAL);
+  mcpool_clear_timer_.data = this;
+  ev_timer_again(loop_, &mcpool_clear_timer_);
+
+  if (get_config()->response_cache_max_size > 0) {
+    response_cache_ =
+        make_unique<ResponseCache>(get_config()->response_cache_max_size,
+                                   get_config()->response_cache_max_entry_size);
+  }
+
   if (get_config()->downstream_proto == PROTO_HTTP2) {
-    http2session_ = make_unique<Http2Session>(loop_, cl_ssl_ctx_);
+    auto &addrs = get_config()->downstream_addrs;
+    auto n = get_config()->downstream_http2_connections_per_worker;
+    for (size_t i = 0; i < n; ++i) {
+      http2sessions_.push_back(
+          make_unique<Http2Session>(loop_, cl_ssl_ctx_, i % addrs.size()));
+    }
+    next_http2_addr_idx_ = n % addrs.size();
+
+    ev_timer_init(&http2session_timer_, http2session_timeout_cb, 0.,
+                  HTTP2SESSION_REMOVE_INTERVAL);
+    http2session_timer_.data = this;
+    ev_timer_again(loop_, &http2session_timer_);
   } else {
     http1_connect_blocker_ = make_unique<ConnectBlocker>(loop_);
+
+    auto &addrs = get_config()->downstream_addrs;
+
+    worker_stat_.downstream_addr_stats.resize(addrs.size());
+
+    if (get_config()->downstream_health_check_interval > 0.) {
+      for (size_t i = 0; i < addrs.size(); ++i) {
+        health_checkers_.push_back(make_unique<HealthChecker>(
+            loop_, i, &worker_stat_.downstream_addr_stats[i]));
+      }
+    }
   }
 }
 
-Worker::~Worker() { ev_async_stop(loop_, &w_); }
+Worker::~Worker() {
+  ev_async_stop(loop_, &w_);
+  ev_timer_stop(loop_, &mcpool_clear_timer_);
+  ev_timer_stop(loop_, &disable_acceptor_timer_);
+  if (get_config()->downstream_proto == PROTO_HTTP2) {
+    ev_timer_stop(loop_, &http2session_timer_);
+  }
+}
 
 void Worker::wait() {
 #ifndef NOTHREADS
@@ -83,64 +174,64 @@ void Worker::run_async() {
 }
 
 void Worker::send(const WorkerEvent &event) {
-  {
-    std::lock_guard<std::mutex> g(m_);
-
-    q_.push_back(event);
+  while (!q_.push(event)) {
+    // Queue is full.  Wake up worker, and wait for it to make room.
+    ev_async_send(loop_, &w_);
+    std::this_thread::yield();
   }
 
-  ev_async_send(loop_, &w_);
+  // Only the first event since the last process_events() call wakes
+  // up the worker.  The following events are processed in the same
+  // batch.
+  if (!notified_.exchange(true, std::memory_order_acq_rel)) {
+    ev_async_send(loop_, &w_);
+  }
 }
 
-void Worker::process_events() {
-  std::deque<WorkerEvent> q;
+void Worker::send_ticket_keys(std::shared_ptr<TicketKeys> ticket_keys) {
   {
-    std::lock_guard<std::mutex> g(m_);
-    q.swap(q_);
+    std::lock_guard<std::mutex> g(ticket_keys_m_);
+    next_ticket_keys_ = std::move(ticket_keys);
   }
-  for (auto &wev : q) {
-    switch (wev.type) {
-    case NEW_CONNECTION: {
-      if (LOG_ENABLED(INFO)) {
-        WLOG(INFO, this) << "WorkerEvent: client_fd=" << wev.client_fd
-                         << ", addrlen=" << wev.client_addrlen;
-      }
 
-      if (worker_stat_.num_connections >=
-          get_config()->worker_frontend_connections) {
+  WorkerEvent wev;
+  memset(&wev, 0, sizeof(wev));
+  wev.type = RENEW_TICKET_KEYS;
 
-        if (LOG_ENABLED(INFO)) {
-          WLOG(INFO, this) << "Too many connections >= "
-                           << get_config()->worker_frontend_connections;
-        }
-
-        close(wev.client_fd);
-
-        break;
-      }
+  send(wev);
+}
 
-      auto client_handler = ssl::accept_connection(
-          this, wev.client_fd, &wev.client_addr.sa, wev.client_addrlen);
-      if (!client_handler) {
-        if (LOG_ENABLED(INFO)) {
-          WLOG(ERROR, this) << "ClientHandler creation failed";
-        }
-        close(wev.client_fd);
-        break;
-      }
+void Worker::process_events() {
+  // Clear the flag before draining queue so that an event pushed
+  // after this point triggers another ev_async_send().
+  notified_.exchange(false, std::memory_order_acq_rel);
 
+  WorkerEvent wev;
+  while (q_.pop(wev)) {
+    switch (wev.type) {
+    case NEW_CONNECTION:
       if (LOG_ENABLED(INFO)) {
-        WLOG(INFO, this) << "CLIENT_HANDLER:" << client_handler << " created ";
+        WLOG(INFO, this) << "WorkerEvent: client_fd=" << wev.client_fd
+                         << ", addrlen=" << wev.client_addrlen;
       }
 
+      handle_connection(wev.client_fd, &wev.client_addr.sa,
+                        wev.client_addrlen);
+
       break;
-    }
     case RENEW_TICKET_KEYS:
       if (LOG_ENABLED(INFO)) {
         WLOG(INFO, this) << "Renew ticket keys: worker(" << this << ")";
       }
 
-      ticket_keys_ = wev.ticket_keys;
+      {
+        std::lock_guard<std::mutex> g(ticket_keys_m_);
+        // If more than one RENEW_TICKET_KEYS events are queued, the
+        // first one applies the latest keys.
+        if (next_ticket_keys_) {
+          ticket_keys_ = std::move(next_ticket_keys_);
+        }
+      }
 
       break;
     case REOPEN_LOG:
@@ -156,6 +247,17 @@ void Worker::process_events() {
 
       graceful_shutdown_ = true;
 
+      if (!acceptors_.empty()) {
+        disable_acceptor();
+
+        // Accept connections remaining in backlog, and then close
+        // listening sockets so that kernel stops assigning new
+        // connections to them.
+        accept_pending_connection();
+
+        acceptors_.clear();
+      }
+
       if (worker_stat_.num_connections == 0) {
         ev_break(loop_);
 
@@ -171,6 +273,70 @@ void Worker::process_events() {
   }
 }
 
+int Worker::handle_connection(int fd, sockaddr *addr, int addrlen) {
+  if (worker_stat_.num_connections >=
+      get_config()->worker_frontend_connections) {
+
+    if (LOG_ENABLED(INFO)) {
+      WLOG(INFO, this) << "Too many connections >= "
+                       << get_config()->worker_frontend_connections;
+    }
+
+    close(fd);
+
+    return -1;
+  }
+
+  auto client_handler = ssl::accept_connection(this, fd, addr, addrlen);
+  if (!client_handler) {
+    if (LOG_ENABLED(INFO)) {
+      WLOG(ERROR, this) << "ClientHandler creation failed";
+    }
+    close(fd);
+
+    return -1;
+  }
+
+  if (LOG_ENABLED(INFO)) {
+    WLOG(INFO, this) << "CLIENT_HANDLER:" << client_handler << " created ";
+  }
+
+  return 0;
+}
+
+void Worker::add_acceptor(std::unique_ptr<AcceptHandler> h) {
+  acceptors_.push_back(std::move(h));
+}
+
+void Worker::enable_acceptor() {
+  for (auto &acceptor : acceptors_) {
+    acceptor->enable();
+  }
+}
+
+void Worker::disable_acceptor() {
+  for (auto &acceptor : acceptors_) {
+    acceptor->disable();
+  }
+}
+
+void Worker::disable_acceptor_temporary(ev_tstamp t) {
+  if (t == 0. || ev_is_active(&disable_acceptor_timer_)) {
+    return;
+  }
+
+  disable_acceptor();
+
+  ev_timer_set(&disable_acceptor_timer_, t, 0.);
+  ev_timer_start(loop_, &disable_acceptor_timer_);
+}
+
+void Worker::accept_pending_connection() {
+  for (auto &acceptor : acceptors_) {
+    acceptor->accept_connection();
+  }
+}
+
 ssl::CertLookupTree *Worker::get_cert_lookup_tree() const { return cert_tree_; }
 
 const std::shared_ptr<TicketKeys> &Worker::get_ticket_keys() const {
@@ -185,7 +351,58 @@ WorkerStat *Worker::get_worker_stat() { return &worker_stat_; }
 
 DownstreamConnectionPool *Worker::get_dconn_pool() { return &dconn_pool_; }
 
-Http2Session *Worker::get_http2_session() const { return http2session_.get(); }
+Http2Session *Worker::next_http2_session() {
+  assert(!http2sessions_.empty());
+
+  auto session = std::min_element(
+      std::begin(http2sessions_), std::end(http2sessions_),
+      [](const std::unique_ptr<Http2Session> &lhs,
+         const std::unique_ptr<Http2Session> &rhs) {
+        return lhs->get_num_dconns() < rhs->get_num_dconns();
+      })->get();
+
+  if (session->get_num_dconns() < session->get_max_concurrent_streams()) {
+    return session;
+  }
+
+  // All sessions are busy.  Make a new one.
+  auto &addrs = get_config()->downstream_addrs;
+  auto addr_idx = next_http2_addr_idx_;
+  next_http2_addr_idx_ = (next_http2_addr_idx_ + 1) % addrs.size();
+
+  if (LOG_ENABLED(INFO)) {
+    WLOG(INFO, this) << "All backend HTTP/2 sessions reached stream limit; "
+                        "create new session for "
+                     << addrs[addr_idx].hostport.get()
+                     << ", num_sessions=" << http2sessions_.size() + 1;
+  }
+
+  http2sessions_.push_back(
+      make_unique<Http2Session>(loop_, cl_ssl_ctx_, addr_idx));
+
+  return http2sessions_.back().get();
+}
+
+void Worker::remove_idle_http2_sessions() {
+  auto first = std::begin(http2sessions_) +
+               get_config()->downstream_http2_connections_per_worker;
+
+  if (first >= std::end(http2sessions_)) {
+    return;
+  }
+
+  auto last = std::remove_if(first, std::end(http2sessions_),
+                             [](const std::unique_ptr<Http2Session> &session) {
+    return session->get_num_dconns() == 0;
+  });
+
+  if (LOG_ENABLED(INFO) && last != std::end(http2sessions_)) {
+    WLOG(INFO, this) << "Remove " << std::end(http2sessions_) - last
+                     << " idle backend HTTP/2 session(s)";
+  }
+
+  http2sessions_.erase(last, std::end(http2sessions_));
+}
 
 ConnectBlocker *Worker::get_http1_connect_blocker() const {
   return http1_connect_blocker_.get();
@@ -197,6 +414,65 @@ struct ev_loop *Worker::get_loop() const {
 
 SSL_CTX *Worker::get_sv_ssl_ctx() const { return sv_ssl_ctx_; }
 
+size_t Worker::select_downstream_addr() {
+  return shrpx::select_downstream_addr(&worker_stat_,
+                                       get_config()->downstream_lb_method);
+}
+
+size_t select_downstream_addr(WorkerStat *wstat, shrpx_lb_method lb_method) {
+  auto &stats = wstat->downstream_addr_stats;
+  auto n = stats.size();
+  auto start = wstat->next_downstream;
+  auto best = n;
+
+  for (size_t k = 0; k < n; ++k) {
+    auto i = (start + k) % n;
+
+    if (!stats[i].healthy) {
+      continue;
+    }
+
+    if (lb_method == LB_ROUND_ROBIN) {
+      best = i;
+      break;
+    }
+
+    // LB_LEAST_REQUESTS.  Ties are broken in round robin manner.
+    if (best == n || stats[i].num_requests < stats[best].num_requests) {
+      best = i;
+    }
+  }
+
+  if (best == n) {
+    // All addresses are unhealthy.  Health check may be wrong, so use
+    // them in round robin manner.
+    best = start;
+  }
+
+  wstat->next_downstream = (best + 1) % n;
+
+  return best;
+}
+
+MemchunkPool *Worker::get_mcpool() { return &mcpool_; }
+
+ResponseCache *Worker::get_response_cache() const {
+  return response_cache_.get();
+}
+
+void Worker::shrink_mcpool() {
+  auto poolsize = mcpool_.poolsize;
+
+  mcpool_.shrink_idle();
+
+  if (LOG_ENABLED(INFO)) {
+    WLOG(INFO, this) << "Memchunk pool: released "
+                     << poolsize - mcpool_.poolsize
+                     << " bytes, poolsize=" << mcpool_.poolsize
+                     << ", freelistsize=" << mcpool_.freelistsize;
+  }
+}
+
 void Worker::set_graceful_shutdown(bool f) { graceful_shutdown_ = f; }
 
 bool Worker::get_graceful_shutdown() const { return graceful_shutdown_; }
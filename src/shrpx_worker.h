@@ -28,7 +28,8 @@
 #include "shrpx.h"
 
 #include <mutex>
-#include <deque>
+#include <atomic>
+#include <vector>
 #include <thread>
 #ifndef NOTHREADS
 #include <future>
@@ -41,24 +42,46 @@
 
 #include "shrpx_config.h"
 #include "shrpx_downstream_connection_pool.h"
+#include "memchunk.h"
+#include "mpsc_ring.h"
+
+using namespace nghttp2;
 
 namespace shrpx {
 
 class Http2Session;
 class ConnectBlocker;
+class AcceptHandler;
+class HealthChecker;
+class ResponseCache;
 
 namespace ssl {
 class CertLookupTree;
 } // namespace ssl
 
+// Per worker state of a backend address, which is used to select
+// HTTP/1 backend address.
+struct DownstreamAddrStat {
+  DownstreamAddrStat() : num_requests(0), healthy(true) {}
+
+  // The number of requests in flight to this address from this
+  // worker.
+  size_t num_requests;
+  // false if the last health check failed.
+  bool healthy;
+};
+
 struct WorkerStat {
   WorkerStat() : num_connections(0), next_downstream(0) {}
 
   size_t num_connections;
   // Next downstream index in Config::downstream_addrs.  For HTTP/2
-  // downstream connections, this is always 0.  For HTTP/1, this is
+  // downstream connections, this is not used.  For HTTP/1, this is
   // used as load balancing.
   size_t next_downstream;
+  // The state of each backend address.  The index is the same as
+  // Config::downstream_addrs.
+  std::vector<DownstreamAddrStat> downstream_addr_stats;
 };
 
 enum WorkerEventType {
@@ -68,6 +91,9 @@ enum WorkerEventType {
   RENEW_TICKET_KEYS = 0x04,
 };
 
+// WorkerEvent must be trivially copyable since it is passed to
+// Worker through lock-free queue.  TLS ticket keys are passed by
+// Worker::send_ticket_keys() instead.
 struct WorkerEvent {
   WorkerEventType type;
   struct {
@@ -75,9 +101,11 @@ struct WorkerEvent {
     size_t client_addrlen;
     int client_fd;
   };
-  std::shared_ptr<TicketKeys> ticket_keys;
 };
 
+// The maximum number of events queued to a Worker.
+constexpr size_t WORKER_EVENT_QUEUE_SIZE = 1024;
+
 class Worker {
 public:
   Worker(struct ev_loop *loop, SSL_CTX *sv_ssl_ctx, SSL_CTX *cl_ssl_ctx,
@@ -88,16 +116,48 @@ public:
   void wait();
   void process_events();
   void send(const WorkerEvent &event);
+  // Passes new TLS ticket keys |ticket_keys| to this worker.  This
+  // function can be called from the other thread.
+  void send_ticket_keys(std::shared_ptr<TicketKeys> ticket_keys);
+  // Creates ClientHandler for accepted connection |fd|.  Returns 0
+  // if it succeeds, or -1.  In case of failure, |fd| is closed.
+  int handle_connection(int fd, sockaddr *addr, int addrlen);
+  // Adds acceptor which runs in this worker's event loop.  This is
+  // used if get_config()->listener_reuseport is true.
+  void add_acceptor(std::unique_ptr<AcceptHandler> h);
+  void enable_acceptor();
+  void disable_acceptor();
+  void disable_acceptor_temporary(ev_tstamp t);
+  void accept_pending_connection();
 
   ssl::CertLookupTree *get_cert_lookup_tree() const;
   const std::shared_ptr<TicketKeys> &get_ticket_keys() const;
   void set_ticket_keys(std::shared_ptr<TicketKeys> ticket_keys);
   WorkerStat *get_worker_stat();
   DownstreamConnectionPool *get_dconn_pool();
-  Http2Session *get_http2_session() const;
+  // Returns Http2Session which a new backend request should be sent
+  // over.  The session which has the fewest active streams is
+  // chosen.  If all sessions have reached the backend's
+  // SETTINGS_MAX_CONCURRENT_STREAMS, new session is created.  This
+  // function must be called only when HTTP/2 backend is used.
+  Http2Session *next_http2_session();
+  // Deletes idle Http2Session objects created by next_http2_session()
+  // in excess of get_config()->downstream_http2_connections_per_worker.
+  void remove_idle_http2_sessions();
   ConnectBlocker *get_http1_connect_blocker() const;
+  // Selects the index of backend address in
+  // get_config()->downstream_addrs for new HTTP/1 backend connection
+  // according to get_config()->downstream_lb_method.  Unhealthy
+  // addresses are skipped unless all of them are unhealthy.
+  size_t select_downstream_addr();
   struct ev_loop *get_loop() const;
   SSL_CTX *get_sv_ssl_ctx() const;
+  MemchunkPool *get_mcpool();
+  // Returns response cache, or nullptr if it is disabled.
+  ResponseCache *get_response_cache() const;
+  // Releases memory chunks which have not been used since the last
+  // call.
+  void shrink_mcpool();
 
   void set_graceful_shutdown(bool f);
   bool get_graceful_shutdown() const;
@@ -106,9 +166,26 @@ private:
 #ifndef NOTHREADS
   std::future<void> fut_;
 #endif // NOTHREADS
-  std::mutex m_;
-  std::deque<WorkerEvent> q_;
+  MPSCRing<WorkerEvent, WORKER_EVENT_QUEUE_SIZE> q_;
+  // true if ev_async_send() was called, and process_events() has not
+  // started to drain q_ yet.  This is used to avoid calling
+  // ev_async_send() for each event.
+  std::atomic<bool> notified_;
   ev_async w_;
+  // Protects next_ticket_keys_.
+  std::mutex ticket_keys_m_;
+  // TLS ticket keys sent by send_ticket_keys(), which are not
+  // applied yet.
+  std::shared_ptr<TicketKeys> next_ticket_keys_;
+  // Acceptors owned by this worker.  Empty unless
+  // get_config()->listener_reuseport is true.
+  std::vector<std::unique_ptr<AcceptHandler>> acceptors_;
+  ev_timer disable_acceptor_timer_;
+  // Periodically releases unused memory chunks in mcpool_.
+  ev_timer mcpool_clear_timer_;
+  // Memory chunk pool shared by all frontend connections handled by
+  // this worker.
+  MemchunkPool mcpool_;
   DownstreamConnectionPool dconn_pool_;
   WorkerStat worker_stat_;
   struct ev_loop *loop_;
@@ -120,12 +197,30 @@ private:
   ssl::CertLookupTree *cert_tree_;
 
   std::shared_ptr<TicketKeys> ticket_keys_;
-  std::unique_ptr<Http2Session> http2session_;
+  // The first get_config()->downstream_http2_connections_per_worker
+  // sessions are always kept.  The rest are created on demand, and
+  // deleted when they become idle.
+  std::vector<std::unique_ptr<Http2Session>> http2sessions_;
+  // Periodically deletes idle sessions in http2sessions_.
+  ev_timer http2session_timer_;
+  // Index in get_config()->downstream_addrs which next on-demand
+  // Http2Session connects to.
+  size_t next_http2_addr_idx_;
   std::unique_ptr<ConnectBlocker> http1_connect_blocker_;
+  // Health checkers for each backend address.  Empty if health check
+  // is disabled.
+  std::vector<std::unique_ptr<HealthChecker>> health_checkers_;
+  std::unique_ptr<ResponseCache> response_cache_;
 
   bool graceful_shutdown_;
 };
 
+// Selects the index of backend address according to |lb_method|
+// using the state of each address in |wstat|, and advances
+// |wstat|->next_downstream.  Unhealthy addresses are skipped unless
+// all of them are unhealthy.
+size_t select_downstream_addr(WorkerStat *wstat, shrpx_lb_method lb_method);
+
 } // namespace shrpx
 
 #endif // SHRPX_WORKER_H
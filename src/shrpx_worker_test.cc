@@ -0,0 +1,134 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2015 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "shrpx_worker_test.h"
+
+#include <CUnit/CUnit.h>
+
+#include "shrpx_worker.h"
+#include "shrpx_health_checker.h"
+
+namespace shrpx {
+
+namespace {
+// Sets up |n| backend addresses in the configuration and |wstat|.
+void prepare_addrs(WorkerStat &wstat, size_t n) {
+  auto &addrs = mod_config()->downstream_addrs;
+  addrs.clear();
+  for (size_t i = 0; i < n; ++i) {
+    DownstreamAddr addr;
+    addr.hostport = strcopy("127.0.0.1:" + std::to_string(3000 + i));
+    addrs.push_back(std::move(addr));
+  }
+  wstat.downstream_addr_stats.resize(n);
+}
+} // namespace
+
+void test_shrpx_worker_select_downstream_addr_health_check(void) {
+  WorkerStat wstat;
+  prepare_addrs(wstat, 3);
+  auto &stats = wstat.downstream_addr_stats;
+
+  auto loop = ev_loop_new(0);
+
+  {
+    HealthChecker hc(loop, 1, &stats[1]);
+
+    CU_ASSERT(0 == select_downstream_addr(&wstat, LB_ROUND_ROBIN));
+    CU_ASSERT(1 == select_downstream_addr(&wstat, LB_ROUND_ROBIN));
+    CU_ASSERT(2 == select_downstream_addr(&wstat, LB_ROUND_ROBIN));
+
+    // Failed probe removes the address from rotation.
+    hc.finish(false);
+
+    CU_ASSERT(!stats[1].healthy);
+    CU_ASSERT(0 == select_downstream_addr(&wstat, LB_ROUND_ROBIN));
+    CU_ASSERT(2 == select_downstream_addr(&wstat, LB_ROUND_ROBIN));
+    CU_ASSERT(0 == select_downstream_addr(&wstat, LB_ROUND_ROBIN));
+
+    // Unhealthy address is not used by least requests method even if
+    // it has the fewest requests.
+    stats[0].num_requests = 1;
+    stats[2].num_requests = 1;
+
+    CU_ASSERT(2 == select_downstream_addr(&wstat, LB_LEAST_REQUESTS));
+
+    // Successful probe puts it back.
+    hc.finish(true);
+
+    CU_ASSERT(stats[1].healthy);
+    CU_ASSERT(1 == select_downstream_addr(&wstat, LB_LEAST_REQUESTS));
+
+    stats[0].num_requests = 0;
+    stats[2].num_requests = 0;
+
+    CU_ASSERT(2 == select_downstream_addr(&wstat, LB_ROUND_ROBIN));
+    CU_ASSERT(0 == select_downstream_addr(&wstat, LB_ROUND_ROBIN));
+    CU_ASSERT(1 == select_downstream_addr(&wstat, LB_ROUND_ROBIN));
+  }
+
+  // If all addresses are unhealthy, they are still used in round
+  // robin manner.
+  for (auto &stat : stats) {
+    stat.healthy = false;
+  }
+
+  CU_ASSERT(2 == select_downstream_addr(&wstat, LB_ROUND_ROBIN));
+  CU_ASSERT(0 == select_downstream_addr(&wstat, LB_LEAST_REQUESTS));
+
+  ev_loop_destroy(loop);
+
+  mod_config()->downstream_addrs.clear();
+}
+
+void test_shrpx_worker_select_downstream_addr_least_requests(void) {
+  WorkerStat wstat;
+  prepare_addrs(wstat, 3);
+  auto &stats = wstat.downstream_addr_stats;
+
+  stats[0].num_requests = 3;
+  stats[1].num_requests = 1;
+  stats[2].num_requests = 2;
+
+  CU_ASSERT(1 == select_downstream_addr(&wstat, LB_LEAST_REQUESTS));
+  CU_ASSERT(1 == select_downstream_addr(&wstat, LB_LEAST_REQUESTS));
+
+  ++stats[1].num_requests;
+  ++stats[1].num_requests;
+
+  CU_ASSERT(2 == select_downstream_addr(&wstat, LB_LEAST_REQUESTS));
+
+  // Ties are broken in round robin manner.
+  stats[0].num_requests = 0;
+  stats[1].num_requests = 0;
+  stats[2].num_requests = 0;
+
+  CU_ASSERT(0 == select_downstream_addr(&wstat, LB_LEAST_REQUESTS));
+  CU_ASSERT(1 == select_downstream_addr(&wstat, LB_LEAST_REQUESTS));
+  CU_ASSERT(2 == select_downstream_addr(&wstat, LB_LEAST_REQUESTS));
+
+  mod_config()->downstream_addrs.clear();
+}
+
+} // namespace shrpx
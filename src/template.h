@@ -27,9 +27,13 @@
 
 #include "nghttp2_config.h"
 
+#include <cstring>
 #include <memory>
 #include <array>
 #include <functional>
+#include <string>
+#include <algorithm>
+#include <ostream>
 
 namespace nghttp2 {
 
@@ -80,6 +84,93 @@ template <typename T, typename F> bool test_flags(T t, F flags) {
   return (t & flags) == flags;
 }
 
+// StringRef is a reference to a string owned by something else.  So
+// it behaves like simple string, but it does not own pointer.  When
+// it is default constructed, it has empty string.  You can freely
+// copy or move around this struct, but never free its pointer.
+class StringRef {
+public:
+  using traits_type = std::char_traits<char>;
+  using value_type = traits_type::char_type;
+  using size_type = size_t;
+  using const_reference = const value_type &;
+  using const_pointer = const value_type *;
+  using const_iterator = const_pointer;
+
+  constexpr StringRef() : base(""), len(0) {}
+  explicit StringRef(const std::string &s) : base(s.c_str()), len(s.size()) {}
+  StringRef(const char *s) : base(s), len(strlen(s)) {}
+  constexpr StringRef(const char *s, size_t n) : base(s), len(n) {}
+
+  template <size_t N> static constexpr StringRef from_lit(const char(&s)[N]) {
+    return StringRef(s, N - 1);
+  }
+
+  const_iterator begin() const { return base; }
+  const_iterator cbegin() const { return base; }
+
+  const_iterator end() const { return base + len; }
+  const_iterator cend() const { return base + len; }
+
+  // The string is NUL-terminated only if the referenced memory is.
+  // Strings made by make_string_ref() in allocator.h always are.
+  const char *c_str() const { return base; }
+  size_type size() const { return len; }
+  bool empty() const { return len == 0; }
+  const_reference operator[](size_type pos) const { return *(base + pos); }
+
+  std::string str() const { return std::string(base, len); }
+
+private:
+  const char *base;
+  size_type len;
+};
+
+inline bool operator==(const StringRef &lhs, const StringRef &rhs) {
+  return lhs.size() == rhs.size() &&
+         std::equal(std::begin(lhs), std::end(lhs), std::begin(rhs));
+}
+
+inline bool operator==(const StringRef &lhs, const std::string &rhs) {
+  return lhs == StringRef(rhs);
+}
+
+inline bool operator==(const std::string &lhs, const StringRef &rhs) {
+  return StringRef(lhs) == rhs;
+}
+
+inline bool operator==(const StringRef &lhs, const char *rhs) {
+  return lhs == StringRef(rhs);
+}
+
+inline bool operator==(const char *lhs, const StringRef &rhs) {
+  return StringRef(lhs) == rhs;
+}
+
+inline bool operator!=(const StringRef &lhs, const StringRef &rhs) {
+  return !(lhs == rhs);
+}
+
+inline bool operator!=(const StringRef &lhs, const std::string &rhs) {
+  return !(lhs == rhs);
+}
+
+inline bool operator!=(const std::string &lhs, const StringRef &rhs) {
+  return !(lhs == rhs);
+}
+
+inline bool operator!=(const StringRef &lhs, const char *rhs) {
+  return !(lhs == rhs);
+}
+
+inline bool operator!=(const char *lhs, const StringRef &rhs) {
+  return !(lhs == rhs);
+}
+
+inline std::ostream &operator<<(std::ostream &o, const StringRef &s) {
+  return o.write(s.c_str(), s.size());
+}
+
 } // namespace nghttp2
 
 #endif // TEMPLATE_H
@@ -0,0 +1,276 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2015 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <nghttp2/nghttp2.h>
+
+/* Microbenchmark for memory allocation in nghttp2_session.  It
+   drives a client and server session pair in memory, and reports
+   the number of calls to the memory allocator per request, with and
+   without the free lists enabled by
+   nghttp2_option_set_free_list_size().
+
+   Usage: allocbench */
+
+/* The total number of requests in each run */
+#define NREQUESTS 200000
+
+/* The number of requests submitted at once */
+#define CONCURRENCY 16
+
+/* The free list size used for "freelist" run */
+#define FREE_LIST_SIZE 64
+
+typedef struct {
+  size_t nalloc;
+} alloc_counter;
+
+typedef struct {
+  nghttp2_session *client, *server;
+  size_t nclosed;
+} bench_pair;
+
+static const char body[] = "Hello World!";
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void *counting_malloc(size_t size, void *mem_user_data) {
+  ++((alloc_counter *)mem_user_data)->nalloc;
+  return malloc(size);
+}
+
+static void counting_free(void *ptr, void *mem_user_data) {
+  (void)mem_user_data;
+  free(ptr);
+}
+
+static void *counting_calloc(size_t nmemb, size_t size, void *mem_user_data) {
+  ++((alloc_counter *)mem_user_data)->nalloc;
+  return calloc(nmemb, size);
+}
+
+static void *counting_realloc(void *ptr, size_t size, void *mem_user_data) {
+  ++((alloc_counter *)mem_user_data)->nalloc;
+  return realloc(ptr, size);
+}
+
+#define MAKE_NV(NAME, VALUE)                                                   \
+  {                                                                            \
+    (uint8_t *) NAME, (uint8_t *)VALUE, sizeof(NAME) - 1, sizeof(VALUE) - 1,   \
+        NGHTTP2_NV_FLAG_NONE                                                   \
+  }
+
+static ssize_t body_read_callback(nghttp2_session *session, int32_t stream_id,
+                                  uint8_t *buf, size_t length,
+                                  uint32_t *data_flags,
+                                  nghttp2_data_source *source,
+                                  void *user_data) {
+  (void)session;
+  (void)stream_id;
+  (void)source;
+  (void)user_data;
+
+  if (length > sizeof(body) - 1) {
+    length = sizeof(body) - 1;
+  }
+
+  memcpy(buf, body, length);
+  *data_flags |= NGHTTP2_DATA_FLAG_EOF;
+
+  return (ssize_t)length;
+}
+
+static int server_on_frame_recv_callback(nghttp2_session *session,
+                                         const nghttp2_frame *frame,
+                                         void *user_data) {
+  static const nghttp2_nv nva[] = {MAKE_NV(":status", "200"),
+                                   MAKE_NV("content-type", "text/plain"),
+                                   MAKE_NV("server", "allocbench")};
+  nghttp2_data_provider data_prd;
+
+  (void)user_data;
+
+  if (frame->hd.type != NGHTTP2_HEADERS ||
+      frame->headers.cat != NGHTTP2_HCAT_REQUEST ||
+      !(frame->hd.flags & NGHTTP2_FLAG_END_STREAM)) {
+    return 0;
+  }
+
+  data_prd.source.ptr = NULL;
+  data_prd.read_callback = body_read_callback;
+
+  if (nghttp2_submit_response(session, frame->hd.stream_id, nva,
+                              sizeof(nva) / sizeof(nva[0]), &data_prd) != 0) {
+    return NGHTTP2_ERR_CALLBACK_FAILURE;
+  }
+
+  return 0;
+}
+
+static int client_on_stream_close_callback(nghttp2_session *session,
+                                           int32_t stream_id,
+                                           uint32_t error_code,
+                                           void *user_data) {
+  (void)session;
+  (void)stream_id;
+  (void)error_code;
+
+  ++((bench_pair *)user_data)->nclosed;
+
+  return 0;
+}
+
+/* Sends all pending frames from |src| to |dst|.  Returns the number
+   of bytes transferred, or -1 on error. */
+static ssize_t transfer(nghttp2_session *src, nghttp2_session *dst) {
+  const uint8_t *data;
+  ssize_t nwrite, total = 0;
+
+  for (;;) {
+    nwrite = nghttp2_session_mem_send(src, &data);
+    if (nwrite < 0) {
+      return -1;
+    }
+    if (nwrite == 0) {
+      return total;
+    }
+    if (nghttp2_session_mem_recv(dst, data, (size_t)nwrite) != nwrite) {
+      return -1;
+    }
+    total += nwrite;
+  }
+}
+
+static int run(const char *name, size_t free_list_size) {
+  static const nghttp2_nv reqnva[] = {
+      MAKE_NV(":method", "GET"), MAKE_NV(":scheme", "https"),
+      MAKE_NV(":authority", "www.example.com"), MAKE_NV(":path", "/"),
+      MAKE_NV("user-agent", "allocbench"), MAKE_NV("accept", "*/*")};
+  nghttp2_session_callbacks *callbacks;
+  nghttp2_option *option;
+  alloc_counter counter = {0};
+  nghttp2_mem mem = {&counter, counting_malloc, counting_free,
+                     counting_calloc, counting_realloc};
+  bench_pair pair;
+  size_t nsubmitted = 0, nalloc_start, i;
+  ssize_t n, m;
+  double t;
+  int rv = -1;
+
+  memset(&pair, 0, sizeof(pair));
+
+  nghttp2_session_callbacks_new(&callbacks);
+  nghttp2_session_callbacks_set_on_frame_recv_callback(
+      callbacks, server_on_frame_recv_callback);
+  nghttp2_option_new(&option);
+  nghttp2_option_set_free_list_size(option, free_list_size);
+
+  if (nghttp2_session_server_new3(&pair.server, callbacks, &pair, option,
+                                  &mem) != 0) {
+    goto fin;
+  }
+
+  nghttp2_session_callbacks_set_on_frame_recv_callback(callbacks, NULL);
+  nghttp2_session_callbacks_set_on_stream_close_callback(
+      callbacks, client_on_stream_close_callback);
+
+  if (nghttp2_session_client_new3(&pair.client, callbacks, &pair, option,
+                                  &mem) != 0) {
+    goto fin;
+  }
+
+  nghttp2_submit_settings(pair.client, NGHTTP2_FLAG_NONE, NULL, 0);
+  nghttp2_submit_settings(pair.server, NGHTTP2_FLAG_NONE, NULL, 0);
+
+  /* Exchange SETTINGS before measurement */
+  if (transfer(pair.client, pair.server) < 0 ||
+      transfer(pair.server, pair.client) < 0 ||
+      transfer(pair.client, pair.server) < 0) {
+    goto fin;
+  }
+
+  nalloc_start = counter.nalloc;
+  t = now();
+
+  while (pair.nclosed < NREQUESTS) {
+    for (i = 0; i < CONCURRENCY && nsubmitted < NREQUESTS; ++i) {
+      if (nghttp2_submit_request(pair.client, NULL, reqnva,
+                                 sizeof(reqnva) / sizeof(reqnva[0]), NULL,
+                                 NULL) < 0) {
+        goto fin;
+      }
+      ++nsubmitted;
+    }
+
+    do {
+      n = transfer(pair.client, pair.server);
+      m = transfer(pair.server, pair.client);
+      if (n < 0 || m < 0) {
+        goto fin;
+      }
+    } while (n > 0 || m > 0);
+  }
+
+  t = now() - t;
+
+  printf("%-10s %8zu %14.2f %12.0f\n", name, free_list_size,
+         (double)(counter.nalloc - nalloc_start) / NREQUESTS,
+         (double)NREQUESTS / t);
+
+  rv = 0;
+
+fin:
+  if (rv != 0) {
+    fprintf(stderr, "allocbench: session error\n");
+  }
+  nghttp2_session_del(pair.client);
+  nghttp2_session_del(pair.server);
+  nghttp2_option_del(option);
+  nghttp2_session_callbacks_del(callbacks);
+
+  return rv;
+}
+
+int main(void) {
+  printf("%-10s %8s %14s %12s\n", "allocator", "freelist", "allocs/req",
+         "req/s");
+
+  if (run("default", 0) != 0 || run("freelist", FREE_LIST_SIZE) != 0) {
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
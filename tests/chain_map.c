@@ -0,0 +1,113 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2015 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "chain_map.h"
+
+#include <stdlib.h>
+
+int chain_map_init(chain_map *map) {
+  map->tablelen = 256;
+  map->table = calloc(map->tablelen, sizeof(chain_entry *));
+  if (map->table == NULL) {
+    return -1;
+  }
+  map->size = 0;
+  return 0;
+}
+
+void chain_map_free(chain_map *map) { free(map->table); }
+
+static int32_t chain_hash(int32_t h, size_t mod) {
+  h ^= (h >> 20) ^ (h >> 12);
+  h ^= (h >> 7) ^ (h >> 4);
+  return h & (mod - 1);
+}
+
+static int chain_insert_table(chain_entry **table, size_t tablelen,
+                              chain_entry *entry) {
+  int32_t h = chain_hash(entry->key, tablelen);
+  chain_entry *p;
+  for (p = table[h]; p; p = p->next) {
+    if (p->key == entry->key) {
+      return -1;
+    }
+  }
+  entry->next = table[h];
+  table[h] = entry;
+  return 0;
+}
+
+int chain_map_insert(chain_map *map, chain_entry *entry) {
+  size_t i;
+  if ((map->size + 1) * 4 > map->tablelen * 3) {
+    size_t new_tablelen = map->tablelen * 2;
+    chain_entry **new_table = calloc(new_tablelen, sizeof(chain_entry *));
+    if (new_table == NULL) {
+      return -1;
+    }
+    for (i = 0; i < map->tablelen; ++i) {
+      chain_entry *p, *next;
+      for (p = map->table[i]; p; p = next) {
+        next = p->next;
+        p->next = NULL;
+        chain_insert_table(new_table, new_tablelen, p);
+      }
+    }
+    free(map->table);
+    map->table = new_table;
+    map->tablelen = new_tablelen;
+  }
+  if (chain_insert_table(map->table, map->tablelen, entry) != 0) {
+    return -1;
+  }
+  ++map->size;
+  return 0;
+}
+
+chain_entry *chain_map_find(chain_map *map, key_type key) {
+  chain_entry *p;
+  for (p = map->table[chain_hash(key, map->tablelen)]; p; p = p->next) {
+    if (p->key == key) {
+      return p;
+    }
+  }
+  return NULL;
+}
+
+int chain_map_remove(chain_map *map, key_type key) {
+  int32_t h = chain_hash(key, map->tablelen);
+  chain_entry *p, *prev = NULL;
+  for (p = map->table[h]; p; prev = p, p = p->next) {
+    if (p->key == key) {
+      if (prev) {
+        prev->next = p->next;
+      } else {
+        map->table[h] = p->next;
+      }
+      --map->size;
+      return 0;
+    }
+  }
+  return -1;
+}
@@ -0,0 +1,60 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2015 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef CHAIN_MAP_H
+#define CHAIN_MAP_H
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include "nghttp2_map.h"
+
+/* Chained hash table, which is what nghttp2_map was before it was
+   made open addressing.  This is kept only as a baseline for
+   mapbench, and in its own compilation unit so that it is not
+   inlined into the benchmark loop while nghttp2_map is not. */
+
+typedef struct chain_entry {
+  struct chain_entry *next;
+  key_type key;
+} chain_entry;
+
+typedef struct {
+  chain_entry **table;
+  size_t tablelen;
+  size_t size;
+} chain_map;
+
+int chain_map_init(chain_map *map);
+
+void chain_map_free(chain_map *map);
+
+int chain_map_insert(chain_map *map, chain_entry *entry);
+
+chain_entry *chain_map_find(chain_map *map, key_type key);
+
+int chain_map_remove(chain_map *map, key_type key);
+
+#endif /* CHAIN_MAP_H */
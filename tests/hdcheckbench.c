@@ -0,0 +1,229 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2015 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "nghttp2_helper.h"
+
+/* Microbenchmark for header field validation.  It runs
+   nghttp2_check_header_name(), nghttp2_check_header_value() and
+   nghttp2_downcase() over large header fields, limiting the vector
+   code path with nghttp2_simd_max_level, and reports the throughput
+   for each level.
+
+   Usage: hdcheckbench */
+
+/* The number of header fields in each corpus */
+#define NFIELDS 1024
+
+/* The minimum number of bytes processed for each function */
+#define MIN_BYTES (256 * 1024 * 1024)
+
+typedef struct {
+  const char *name;
+  /* Generates header field name, which is downcased in place */
+  void (*gen_name)(char *buf, size_t buflen, size_t i);
+  void (*gen_value)(char *buf, size_t buflen, size_t i);
+} bench_corpus;
+
+typedef struct {
+  uint8_t *name;
+  size_t namelen;
+  uint8_t *value;
+  size_t valuelen;
+} bench_field;
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void rand_token(char *buf, size_t len) {
+  static const char alnum[] =
+      "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
+  size_t i;
+
+  for (i = 0; i < len; ++i) {
+    buf[i] = alnum[rand() % (sizeof(alnum) - 1)];
+  }
+  buf[len] = '\0';
+}
+
+static void gen_cookie_name(char *buf, size_t buflen, size_t i) {
+  (void)i;
+
+  snprintf(buf, buflen, "Cookie");
+}
+
+static void gen_cookie_value(char *buf, size_t buflen, size_t i) {
+  char token[65];
+  size_t n, j;
+
+  (void)i;
+
+  n = 0;
+  for (j = 0; j < 16 && n + 80 < buflen; ++j) {
+    rand_token(token, 64);
+    n += (size_t)snprintf(buf + n, buflen - n, "%sc%zu=%s", j ? "; " : "",
+                          j, token);
+  }
+}
+
+static void gen_ua_name(char *buf, size_t buflen, size_t i) {
+  static const char *const names[] = {"User-Agent", "X-Forwarded-For",
+                                      "Accept-Language",
+                                      "X-Request-Start-Timestamp"};
+
+  snprintf(buf, buflen, "%s", names[i % (sizeof(names) / sizeof(names[0]))]);
+}
+
+static void gen_ua_value(char *buf, size_t buflen, size_t i) {
+  (void)i;
+
+  snprintf(buf, buflen,
+           "Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 "
+           "(KHTML, like Gecko) Chrome/47.0.2526.106 Safari/537.36 "
+           "Edge/13.%d",
+           rand() % 100000);
+}
+
+static int run(const bench_corpus *corpus, const bench_field *fields,
+               size_t namelen, size_t valuelen, int level) {
+  size_t i, name_rounds, value_rounds, r;
+  double t, name_time, value_time, downcase_time;
+  int rv;
+
+  nghttp2_simd_max_level = level;
+
+  rv = 1;
+  name_rounds = (MIN_BYTES + namelen - 1) / namelen;
+  value_rounds = (MIN_BYTES + valuelen - 1) / valuelen;
+
+  t = now();
+  for (r = 0; r < value_rounds; ++r) {
+    for (i = 0; i < NFIELDS; ++i) {
+      rv &= nghttp2_check_header_value(fields[i].value, fields[i].valuelen);
+    }
+  }
+  value_time = now() - t;
+
+  t = now();
+  for (r = 0; r < name_rounds; ++r) {
+    for (i = 0; i < NFIELDS; ++i) {
+      nghttp2_downcase(fields[i].name, fields[i].namelen);
+    }
+  }
+  downcase_time = now() - t;
+
+  t = now();
+  for (r = 0; r < name_rounds; ++r) {
+    for (i = 0; i < NFIELDS; ++i) {
+      rv &= nghttp2_check_header_name(fields[i].name, fields[i].namelen);
+    }
+  }
+  name_time = now() - t;
+
+  if (!rv) {
+    fprintf(stderr, "hdcheckbench: validation failed\n");
+    return -1;
+  }
+
+  printf("%-8s %-5s %9zu %9zu %12.1f %12.1f %12.1f\n", corpus->name,
+         level == NGHTTP2_SIMD_AVX2
+             ? "avx2"
+             : level == NGHTTP2_SIMD_SSE2 ? "sse2" : "none",
+         namelen / NFIELDS, valuelen / NFIELDS,
+         (double)namelen * (double)name_rounds / name_time / 1e6,
+         (double)valuelen * (double)value_rounds / value_time / 1e6,
+         (double)namelen * (double)name_rounds / downcase_time / 1e6);
+
+  return 0;
+}
+
+static int run_corpus(const bench_corpus *corpus) {
+  static const int levels[] = {NGHTTP2_SIMD_NONE, NGHTTP2_SIMD_SSE2,
+                               NGHTTP2_SIMD_AVX2};
+  bench_field fields[NFIELDS];
+  char buf[2048];
+  size_t i, namelen = 0, valuelen = 0;
+  int rv = 0;
+
+  memset(fields, 0, sizeof(fields));
+
+  for (i = 0; i < NFIELDS; ++i) {
+    corpus->gen_name(buf, sizeof(buf), i);
+    fields[i].namelen = strlen(buf);
+    fields[i].name = malloc(fields[i].namelen);
+    memcpy(fields[i].name, buf, fields[i].namelen);
+    namelen += fields[i].namelen;
+
+    corpus->gen_value(buf, sizeof(buf), i);
+    fields[i].valuelen = strlen(buf);
+    fields[i].value = malloc(fields[i].valuelen);
+    memcpy(fields[i].value, buf, fields[i].valuelen);
+    valuelen += fields[i].valuelen;
+  }
+
+  for (i = 0; i < sizeof(levels) / sizeof(levels[0]); ++i) {
+    if (run(corpus, fields, namelen, valuelen, levels[i]) != 0) {
+      rv = -1;
+      break;
+    }
+  }
+
+  for (i = 0; i < NFIELDS; ++i) {
+    free(fields[i].name);
+    free(fields[i].value);
+  }
+
+  return rv;
+}
+
+int main(void) {
+  static const bench_corpus corpora[] = {
+      {"cookie", gen_cookie_name, gen_cookie_value},
+      {"ua", gen_ua_name, gen_ua_value}};
+  size_t i;
+
+  srand(1);
+
+  printf("%-8s %-5s %9s %9s %12s %12s %12s\n", "corpus", "simd", "namelen",
+         "valuelen", "name(MB/s)", "value(MB/s)", "lower(MB/s)");
+
+  for (i = 0; i < sizeof(corpora) / sizeof(corpora[0]); ++i) {
+    if (run_corpus(&corpora[i]) != 0) {
+      return EXIT_FAILURE;
+    }
+  }
+
+  return EXIT_SUCCESS;
+}
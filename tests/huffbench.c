@@ -0,0 +1,217 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2015 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "nghttp2_hd.h"
+#include "nghttp2_hd_huffman.h"
+
+/* Microbenchmark for HPACK Huffman encoder and decoder.  It encodes
+   and decodes header field values which resemble the ones found in
+   real requests, and reports the throughput in terms of the
+   plaintext length.
+
+   Usage: huffbench */
+
+/* The number of header field values in each corpus */
+#define NVALUES 4096
+
+/* The minimum number of plaintext bytes processed for each of encode
+   and decode */
+#define MIN_BYTES (64 * 1024 * 1024)
+
+typedef struct {
+  uint8_t *data;
+  size_t len;
+} bench_str;
+
+typedef struct {
+  const char *name;
+  void (*gen)(char *buf, size_t buflen, size_t i);
+} bench_corpus;
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void rand_token(char *buf, size_t len) {
+  static const char alnum[] =
+      "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
+  size_t i;
+
+  for (i = 0; i < len; ++i) {
+    buf[i] = alnum[rand() % (sizeof(alnum) - 1)];
+  }
+  buf[len] = '\0';
+}
+
+static void gen_cookie(char *buf, size_t buflen, size_t i) {
+  char sid[33], csrf[33];
+
+  (void)i;
+
+  rand_token(sid, 32);
+  rand_token(csrf, 32);
+
+  snprintf(buf, buflen, "_ga=GA1.2.%d.%d; _gid=GA1.2.%d.%d; "
+                        "sessionid=%s; csrftoken=%s; theme=dark; "
+                        "lang=en-US",
+           rand(), 1450000000 + rand() % 1000000, rand(),
+           1450000000 + rand() % 1000000, sid, csrf);
+}
+
+static void gen_path(char *buf, size_t buflen, size_t i) {
+  char q[17];
+
+  switch (i % 3) {
+  case 0:
+    snprintf(buf, buflen,
+             "/api/v2/users/%d/repos?sort=updated&direction=desc&"
+             "per_page=%d&page=%d",
+             rand() % 1000000, 10 * (1 + rand() % 10), 1 + rand() % 50);
+    break;
+  case 1:
+    snprintf(buf, buflen, "/static/js/vendor.%08x.chunk.js",
+             (unsigned int)rand());
+    break;
+  default:
+    rand_token(q, 16);
+    snprintf(buf, buflen, "/search?q=%s&hl=en&source=hp&ei=%d", q, rand());
+    break;
+  }
+}
+
+static void gen_misc(char *buf, size_t buflen, size_t i) {
+  static const char *const values[] = {
+      "Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like "
+      "Gecko) Chrome/47.0.2526.106 Safari/537.36",
+      "text/html,application/xhtml+xml,application/xml;q=0.9,image/webp,*/"
+      "*;q=0.8",
+      "gzip, deflate, sdch", "en-US,en;q=0.8,ja;q=0.6", "max-age=0",
+      "https://www.example.com/", "www.example.com"};
+
+  snprintf(buf, buflen, "%s", values[i % (sizeof(values) / sizeof(values[0]))]);
+}
+
+static int run(const bench_corpus *corpus) {
+  bench_str plain[NVALUES], enc[NVALUES];
+  nghttp2_bufs bufs;
+  nghttp2_hd_huff_decode_context ctx;
+  char buf[1024];
+  size_t i, plainlen = 0, enclen = 0, rounds, r;
+  double t, encode_time, decode_time;
+  int rv = 0;
+
+  memset(plain, 0, sizeof(plain));
+  memset(enc, 0, sizeof(enc));
+
+  nghttp2_bufs_init(&bufs, 4096, 1, nghttp2_mem_default());
+
+  for (i = 0; i < NVALUES; ++i) {
+    corpus->gen(buf, sizeof(buf), i);
+    plain[i].len = strlen(buf);
+    plain[i].data = malloc(plain[i].len);
+    memcpy(plain[i].data, buf, plain[i].len);
+    plainlen += plain[i].len;
+
+    nghttp2_bufs_reset(&bufs);
+    if (nghttp2_hd_huff_encode(&bufs, plain[i].data, plain[i].len) != 0) {
+      fprintf(stderr, "huffbench: encode failed\n");
+      rv = -1;
+      goto fin;
+    }
+    enc[i].len = nghttp2_bufs_len(&bufs);
+    enc[i].data = malloc(enc[i].len);
+    memcpy(enc[i].data, bufs.head->buf.pos, enc[i].len);
+    enclen += enc[i].len;
+  }
+
+  rounds = (MIN_BYTES + plainlen - 1) / plainlen;
+
+  t = now();
+  for (r = 0; r < rounds; ++r) {
+    for (i = 0; i < NVALUES; ++i) {
+      nghttp2_bufs_reset(&bufs);
+      nghttp2_hd_huff_encode(&bufs, plain[i].data, plain[i].len);
+    }
+  }
+  encode_time = now() - t;
+
+  t = now();
+  for (r = 0; r < rounds; ++r) {
+    for (i = 0; i < NVALUES; ++i) {
+      nghttp2_bufs_reset(&bufs);
+      nghttp2_hd_huff_decode_context_init(&ctx);
+      if (nghttp2_hd_huff_decode(&ctx, &bufs, enc[i].data, enc[i].len, 1) <
+          0) {
+        fprintf(stderr, "huffbench: decode failed\n");
+        rv = -1;
+        goto fin;
+      }
+    }
+  }
+  decode_time = now() - t;
+
+  printf("%-8s %9zu %8.3f %12.1f %12.1f\n", corpus->name,
+         plainlen / NVALUES, (double)enclen / (double)plainlen,
+         (double)plainlen * (double)rounds / encode_time / 1e6,
+         (double)plainlen * (double)rounds / decode_time / 1e6);
+
+fin:
+  for (i = 0; i < NVALUES; ++i) {
+    free(plain[i].data);
+    free(enc[i].data);
+  }
+  nghttp2_bufs_free(&bufs);
+
+  return rv;
+}
+
+int main(void) {
+  static const bench_corpus corpora[] = {
+      {"cookie", gen_cookie}, {"path", gen_path}, {"misc", gen_misc}};
+  size_t i;
+
+  srand(1);
+
+  printf("%-8s %9s %8s %12s %12s\n", "corpus", "avglen", "ratio",
+         "enc(MB/s)", "dec(MB/s)");
+
+  for (i = 0; i < sizeof(corpora) / sizeof(corpora[0]); ++i) {
+    if (run(&corpora[i]) != 0) {
+      return EXIT_FAILURE;
+    }
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,448 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2015 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "nghttp2_hd.h"
+
+/* Microbenchmark for HPACK decoder.  It decodes the header blocks
+   in the "wire" fields of the JSON story files, which is the format
+   inflatehd reads, and reports the throughput in terms of the
+   encoded length.  If no file is given, it decodes the header
+   blocks generated from request header fields, once encoded as raw
+   literals without Huffman coding, and once encoded by the HPACK
+   encoder.
+
+   Usage: inflatebench [STORY_JSON...] */
+
+/* The number of header blocks in each generated corpus */
+#define NBLOCKS 4096
+
+/* The minimum number of encoded bytes decoded for each corpus */
+#define MIN_BYTES (64 * 1024 * 1024)
+
+/* The header table size used by the decoder.  Since entries are
+   referred to relative to the newest one, decoder can keep more
+   entries than encoder did.  This allows to decode stories which
+   change header_table_size without following it. */
+#define TABLE_SIZE 65536
+
+typedef struct {
+  uint8_t *data;
+  size_t len;
+} bench_block;
+
+typedef struct {
+  const char *name;
+  bench_block *blocks;
+  size_t nblocks;
+  size_t cap;
+} bench_corpus;
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void corpus_init(bench_corpus *corpus, const char *name) {
+  corpus->name = name;
+  corpus->blocks = NULL;
+  corpus->nblocks = 0;
+  corpus->cap = 0;
+}
+
+static void corpus_free(bench_corpus *corpus) {
+  size_t i;
+
+  for (i = 0; i < corpus->nblocks; ++i) {
+    free(corpus->blocks[i].data);
+  }
+  free(corpus->blocks);
+}
+
+static int corpus_add(bench_corpus *corpus, const uint8_t *data, size_t len) {
+  bench_block *blocks;
+
+  if (corpus->nblocks == corpus->cap) {
+    corpus->cap = corpus->cap ? corpus->cap * 2 : 64;
+    blocks = realloc(corpus->blocks, corpus->cap * sizeof(bench_block));
+    if (blocks == NULL) {
+      return -1;
+    }
+    corpus->blocks = blocks;
+  }
+
+  corpus->blocks[corpus->nblocks].data = malloc(len ? len : 1);
+  if (corpus->blocks[corpus->nblocks].data == NULL) {
+    return -1;
+  }
+  memcpy(corpus->blocks[corpus->nblocks].data, data, len);
+  corpus->blocks[corpus->nblocks].len = len;
+  ++corpus->nblocks;
+
+  return 0;
+}
+
+static int hexval(int c) {
+  if ('0' <= c && c <= '9') {
+    return c - '0';
+  }
+  if ('a' <= c && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  if ('A' <= c && c <= 'F') {
+    return c - 'A' + 10;
+  }
+  return -1;
+}
+
+/* Reads the "wire" fields of the story in |path| into |corpus|.
+   This is not a JSON parser; it only looks for the "wire" keys. */
+static int read_story(bench_corpus *corpus, const char *path) {
+  FILE *fp;
+  char *text = NULL, *p, *q;
+  uint8_t *block = NULL;
+  long size;
+  size_t len;
+  int rv = -1;
+
+  fp = fopen(path, "rb");
+  if (fp == NULL) {
+    perror(path);
+    return -1;
+  }
+
+  if (fseek(fp, 0, SEEK_END) != 0 || (size = ftell(fp)) < 0 ||
+      fseek(fp, 0, SEEK_SET) != 0) {
+    perror(path);
+    goto fin;
+  }
+
+  text = malloc((size_t)size + 1);
+  block = malloc((size_t)size / 2 + 1);
+  if (text == NULL || block == NULL ||
+      fread(text, 1, (size_t)size, fp) != (size_t)size) {
+    fprintf(stderr, "inflatebench: could not read %s\n", path);
+    goto fin;
+  }
+  text[size] = '\0';
+
+  for (p = text; (p = strstr(p, "\"wire\"")) != NULL;) {
+    p += sizeof("\"wire\"") - 1;
+    p = strchr(p, '"');
+    if (p == NULL) {
+      break;
+    }
+    ++p;
+
+    len = 0;
+    for (q = p; hexval(q[0]) != -1 && hexval(q[1]) != -1; q += 2) {
+      block[len++] = (uint8_t)(hexval(q[0]) << 4 | hexval(q[1]));
+    }
+    if (*q != '"') {
+      fprintf(stderr, "inflatebench: %s: bad wire\n", path);
+      goto fin;
+    }
+
+    if (corpus_add(corpus, block, len) != 0) {
+      goto fin;
+    }
+
+    p = q;
+  }
+
+  rv = 0;
+
+fin:
+  free(block);
+  free(text);
+  fclose(fp);
+
+  return rv;
+}
+
+static void rand_token(char *buf, size_t len) {
+  static const char alnum[] =
+      "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
+  size_t i;
+
+  for (i = 0; i < len; ++i) {
+    buf[i] = alnum[rand() % (sizeof(alnum) - 1)];
+  }
+  buf[len] = '\0';
+}
+
+/* Generates the request header fields for |i|th request.  Strings
+   are stored in |buf|. */
+static size_t gen_request(nghttp2_nv *nva, char *buf, size_t buflen,
+                          size_t i) {
+  static const char *const names[] = {
+      ":method", ":scheme", ":authority", ":path", "user-agent",
+      "accept", "accept-encoding", "accept-language", "cookie"};
+  char sid[33], path[65];
+  char *values[sizeof(names) / sizeof(names[0])];
+  size_t j, n;
+
+  rand_token(sid, 32);
+  rand_token(path, 16 + (size_t)(rand() % 48));
+
+  n = 0;
+  for (j = 0; j < sizeof(names) / sizeof(names[0]); ++j) {
+    values[j] = buf + n;
+    switch (j) {
+    case 0:
+      n += (size_t)snprintf(buf + n, buflen - n, "%s", i % 8 ? "GET" : "POST");
+      break;
+    case 1:
+      n += (size_t)snprintf(buf + n, buflen - n, "https");
+      break;
+    case 2:
+      n += (size_t)snprintf(buf + n, buflen - n, "www.example.com");
+      break;
+    case 3:
+      n += (size_t)snprintf(buf + n, buflen - n, "/%s?id=%d", path, rand());
+      break;
+    case 4:
+      n += (size_t)snprintf(buf + n, buflen - n,
+                            "Mozilla/5.0 (X11; Linux x86_64) "
+                            "AppleWebKit/537.36 (KHTML, like Gecko) "
+                            "Chrome/47.0.2526.106 Safari/537.36");
+      break;
+    case 5:
+      n += (size_t)snprintf(buf + n, buflen - n,
+                            "text/html,application/xhtml+xml,application/"
+                            "xml;q=0.9,*/*;q=0.8");
+      break;
+    case 6:
+      n += (size_t)snprintf(buf + n, buflen - n, "gzip, deflate, sdch");
+      break;
+    case 7:
+      n += (size_t)snprintf(buf + n, buflen - n, "en-US,en;q=0.8");
+      break;
+    default:
+      n += (size_t)snprintf(buf + n, buflen - n,
+                            "_ga=GA1.2.%d.%d; sessionid=%s; lang=en-US",
+                            rand(), rand(), sid);
+      break;
+    }
+    ++n;
+  }
+
+  for (j = 0; j < sizeof(names) / sizeof(names[0]); ++j) {
+    nva[j].name = (uint8_t *)names[j];
+    nva[j].namelen = strlen(names[j]);
+    nva[j].value = (uint8_t *)values[j];
+    nva[j].valuelen = strlen(values[j]);
+    nva[j].flags = NGHTTP2_NV_FLAG_NONE;
+  }
+
+  return j;
+}
+
+/* Encodes |len| as the length of raw string, and returns the number
+   of bytes written */
+static size_t put_raw_length(uint8_t *p, size_t len) {
+  uint8_t *first = p;
+
+  /* 7 bit prefix with H bit off */
+  if (len < 127) {
+    *p++ = (uint8_t)len;
+    return 1;
+  }
+
+  *p++ = 127;
+  len -= 127;
+  for (; len >= 128; len >>= 7) {
+    *p++ = (uint8_t)(0x80 | (len & 0x7f));
+  }
+  *p++ = (uint8_t)len;
+
+  return (size_t)(p - first);
+}
+
+static int gen_corpora(bench_corpus *raw, bench_corpus *deflated) {
+  nghttp2_hd_deflater *deflater;
+  nghttp2_nv nva[16];
+  char strbuf[1024];
+  uint8_t block[4096], *p;
+  size_t i, j, nvlen;
+  ssize_t n;
+
+  if (nghttp2_hd_deflate_new(&deflater, 4096) != 0) {
+    return -1;
+  }
+
+  for (i = 0; i < NBLOCKS; ++i) {
+    nvlen = gen_request(nva, strbuf, sizeof(strbuf), i);
+
+    /* Literal header field without indexing - new name */
+    p = block;
+    for (j = 0; j < nvlen; ++j) {
+      *p++ = 0;
+      p += put_raw_length(p, nva[j].namelen);
+      memcpy(p, nva[j].name, nva[j].namelen);
+      p += nva[j].namelen;
+      p += put_raw_length(p, nva[j].valuelen);
+      memcpy(p, nva[j].value, nva[j].valuelen);
+      p += nva[j].valuelen;
+    }
+
+    if (corpus_add(raw, block, (size_t)(p - block)) != 0) {
+      goto fail;
+    }
+
+    n = nghttp2_hd_deflate_hd(deflater, block, sizeof(block), nva, nvlen);
+    if (n < 0 || corpus_add(deflated, block, (size_t)n) != 0) {
+      goto fail;
+    }
+  }
+
+  nghttp2_hd_deflate_del(deflater);
+
+  return 0;
+
+fail:
+  nghttp2_hd_deflate_del(deflater);
+
+  return -1;
+}
+
+static int run(const bench_corpus *corpus) {
+  nghttp2_hd_inflater *inflater;
+  nghttp2_nv nv;
+  uint8_t *in, *last;
+  size_t i, r, rounds, enclen = 0, nhd = 0, nvlen = 0;
+  ssize_t n;
+  int inflate_flags;
+  double t, elapsed;
+
+  for (i = 0; i < corpus->nblocks; ++i) {
+    enclen += corpus->blocks[i].len;
+  }
+
+  if (enclen == 0) {
+    fprintf(stderr, "inflatebench: %s: no header block\n", corpus->name);
+    return -1;
+  }
+
+  rounds = (MIN_BYTES + enclen - 1) / enclen;
+
+  t = now();
+  for (r = 0; r < rounds; ++r) {
+    if (nghttp2_hd_inflate_new(&inflater) != 0 ||
+        nghttp2_hd_inflate_change_table_size(inflater, TABLE_SIZE) != 0) {
+      return -1;
+    }
+
+    for (i = 0; i < corpus->nblocks; ++i) {
+      in = corpus->blocks[i].data;
+      last = in + corpus->blocks[i].len;
+
+      for (;;) {
+        inflate_flags = 0;
+        n = nghttp2_hd_inflate_hd(inflater, &nv, &inflate_flags, in,
+                                  (size_t)(last - in), 1);
+        if (n < 0) {
+          fprintf(stderr, "inflatebench: %s: block %zu: %s\n", corpus->name,
+                  i, nghttp2_strerror((int)n));
+          nghttp2_hd_inflate_del(inflater);
+          return -1;
+        }
+
+        in += n;
+
+        if (inflate_flags & NGHTTP2_HD_INFLATE_EMIT) {
+          ++nhd;
+          nvlen += nv.namelen + nv.valuelen;
+        }
+
+        if (inflate_flags & NGHTTP2_HD_INFLATE_FINAL) {
+          break;
+        }
+      }
+
+      nghttp2_hd_inflate_end_headers(inflater);
+    }
+
+    nghttp2_hd_inflate_del(inflater);
+  }
+  elapsed = now() - t;
+
+  printf("%-16s %7zu %9zu %8.3f %12.1f %12.2f\n", corpus->name,
+         corpus->nblocks, enclen / corpus->nblocks,
+         (double)enclen * (double)rounds / (double)nvlen,
+         (double)enclen * (double)rounds / elapsed / 1e6,
+         (double)nhd / elapsed / 1e6);
+
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  bench_corpus raw, deflated, story;
+  int i, rv = EXIT_SUCCESS;
+
+  srand(1);
+
+  printf("%-16s %7s %9s %8s %12s %12s\n", "corpus", "blocks", "avglen",
+         "ratio", "dec(MB/s)", "dec(Mhd/s)");
+
+  if (argc < 2) {
+    corpus_init(&raw, "raw");
+    corpus_init(&deflated, "deflate");
+
+    if (gen_corpora(&raw, &deflated) != 0 || run(&raw) != 0 ||
+        run(&deflated) != 0) {
+      rv = EXIT_FAILURE;
+    }
+
+    corpus_free(&raw);
+    corpus_free(&deflated);
+
+    return rv;
+  }
+
+  for (i = 1; i < argc; ++i) {
+    corpus_init(&story, argv[i]);
+
+    if (read_story(&story, argv[i]) != 0 || run(&story) != 0) {
+      rv = EXIT_FAILURE;
+    }
+
+    corpus_free(&story);
+
+    if (rv != EXIT_SUCCESS) {
+      break;
+    }
+  }
+
+  return rv;
+}
@@ -67,8 +67,10 @@ int main(int argc _U_, char *argv[] _U_) {
   /* add the tests to the suite */
   if (!CU_add_test(pSuite, "pq", test_nghttp2_pq) ||
       !CU_add_test(pSuite, "pq_update", test_nghttp2_pq_update) ||
+      !CU_add_test(pSuite, "pq_remove", test_nghttp2_pq_remove) ||
       !CU_add_test(pSuite, "map", test_nghttp2_map) ||
       !CU_add_test(pSuite, "map_functional", test_nghttp2_map_functional) ||
+      !CU_add_test(pSuite, "map_shrink", test_nghttp2_map_shrink) ||
       !CU_add_test(pSuite, "map_each_free", test_nghttp2_map_each_free) ||
       !CU_add_test(pSuite, "queue", test_nghttp2_queue) ||
       !CU_add_test(pSuite, "npn", test_nghttp2_npn) ||
@@ -215,6 +217,11 @@ int main(int argc _U_, char *argv[] _U_) {
                    test_nghttp2_session_get_effective_local_window_size) ||
       !CU_add_test(pSuite, "session_set_option",
                    test_nghttp2_session_set_option) ||
+      !CU_add_test(pSuite, "session_free_list",
+                   test_nghttp2_session_free_list) ||
+      !CU_add_test(pSuite, "session_stats", test_nghttp2_session_stats) ||
+      !CU_add_test(pSuite, "session_window_auto_tuning",
+                   test_nghttp2_session_window_auto_tuning) ||
       !CU_add_test(pSuite, "session_data_backoff_by_high_pri_frame",
                    test_nghttp2_session_data_backoff_by_high_pri_frame) ||
       !CU_add_test(pSuite, "session_pack_data_with_padding",
@@ -238,6 +245,8 @@ int main(int argc _U_, char *argv[] _U_) {
                    test_nghttp2_session_stream_attach_item) ||
       !CU_add_test(pSuite, "session_stream_attach_item_subtree",
                    test_nghttp2_session_stream_attach_item_subtree) ||
+      !CU_add_test(pSuite, "session_stream_wfq",
+                   test_nghttp2_session_stream_wfq) ||
       !CU_add_test(pSuite, "session_stream_keep_closed_stream",
                    test_nghttp2_session_keep_closed_stream) ||
       !CU_add_test(pSuite, "session_stream_keep_idle_stream",
@@ -260,6 +269,10 @@ int main(int argc _U_, char *argv[] _U_) {
                    test_nghttp2_session_cancel_reserved_remote) ||
       !CU_add_test(pSuite, "session_reset_pending_headers",
                    test_nghttp2_session_reset_pending_headers) ||
+      !CU_add_test(pSuite, "session_send_data_callback",
+                   test_nghttp2_session_send_data_callback) ||
+      !CU_add_test(pSuite, "session_mem_send_batch",
+                   test_nghttp2_session_mem_send_batch) ||
       !CU_add_test(pSuite, "http_mandatory_headers",
                    test_nghttp2_http_mandatory_headers) ||
       !CU_add_test(pSuite, "http_content_length",
@@ -318,8 +331,12 @@ int main(int argc _U_, char *argv[] _U_) {
                    test_nghttp2_hd_inflate_clearall_inc) ||
       !CU_add_test(pSuite, "hd_inflate_zero_length_huffman",
                    test_nghttp2_hd_inflate_zero_length_huffman) ||
+      !CU_add_test(pSuite, "hd_inflate_raw_literal",
+                   test_nghttp2_hd_inflate_raw_literal) ||
       !CU_add_test(pSuite, "hd_ringbuf_reserve",
                    test_nghttp2_hd_ringbuf_reserve) ||
+      !CU_add_test(pSuite, "hd_deflate_map", test_nghttp2_hd_deflate_map) ||
+      !CU_add_test(pSuite, "hd_table_ring", test_nghttp2_hd_table_ring) ||
       !CU_add_test(pSuite, "hd_change_table_size",
                    test_nghttp2_hd_change_table_size) ||
       !CU_add_test(pSuite, "hd_deflate_inflate",
@@ -329,12 +346,15 @@ int main(int argc _U_, char *argv[] _U_) {
       !CU_add_test(pSuite, "hd_public_api", test_nghttp2_hd_public_api) ||
       !CU_add_test(pSuite, "hd_decode_length", test_nghttp2_hd_decode_length) ||
       !CU_add_test(pSuite, "hd_huff_encode", test_nghttp2_hd_huff_encode) ||
+      !CU_add_test(pSuite, "hd_huff_decode", test_nghttp2_hd_huff_decode) ||
       !CU_add_test(pSuite, "adjust_local_window_size",
                    test_nghttp2_adjust_local_window_size) ||
       !CU_add_test(pSuite, "check_header_name",
                    test_nghttp2_check_header_name) ||
       !CU_add_test(pSuite, "check_header_value",
                    test_nghttp2_check_header_value) ||
+      !CU_add_test(pSuite, "check_header_simd",
+                   test_nghttp2_check_header_simd) ||
       !CU_add_test(pSuite, "bufs_add", test_nghttp2_bufs_add) ||
       !CU_add_test(pSuite, "bufs_addb", test_nghttp2_bufs_addb) ||
       !CU_add_test(pSuite, "bufs_orb", test_nghttp2_bufs_orb) ||
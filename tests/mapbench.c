@@ -0,0 +1,259 @@
+/*
+ * nghttp2 - HTTP/2 C Library
+ *
+ * Copyright (c) 2015 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "nghttp2_map.h"
+#include "chain_map.h"
+
+/* Microbenchmark for nghttp2_map.  It measures insert, lookup and
+   remove of stream IDs, and compares them against the chained hash
+   table which nghttp2_map used to be.
+
+   Usage: mapbench [NUM_STREAMS...]
+
+   Without arguments, it runs with 100, 10000 and 1000000 streams. */
+
+/* The padding makes an entry roughly as large as the part of
+   nghttp2_stream which is touched on lookup, so that the chained
+   table pays a cache miss per hop as it does in nghttp2_session. */
+#define PAYLOADLEN 64
+
+/* The minimum number of operations measured for each of insert,
+   lookup and remove.  Small tables are filled and drained repeatedly
+   until this number is reached. */
+#define MIN_OPS 1000000
+
+typedef struct {
+  nghttp2_map_entry map_entry;
+  chain_entry chain_entry;
+  uint8_t payload[PAYLOADLEN];
+} bench_entry;
+
+typedef struct {
+  double insert, lookup, remove;
+} bench_result;
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void shuffle(key_type *a, size_t n) {
+  size_t i, j;
+  key_type t;
+  for (i = n - 1; i >= 1; --i) {
+    j = (size_t)((double)(i + 1) * rand() / (RAND_MAX + 1.0));
+    t = a[j];
+    a[j] = a[i];
+    a[i] = t;
+  }
+}
+
+/* Prevents the compiler from eliminating lookups. */
+static volatile size_t sink;
+
+static int bench_map(bench_result *res, bench_entry *ents,
+                     const key_type *order, size_t n, size_t rounds) {
+  nghttp2_map map;
+  size_t i, r, found = 0;
+  double t;
+
+  memset(res, 0, sizeof(*res));
+
+  for (r = 0; r < rounds; ++r) {
+    if (nghttp2_map_init(&map, nghttp2_mem_default()) != 0) {
+      return -1;
+    }
+
+    /* Streams are created in increasing order of stream ID */
+    t = now();
+    for (i = 0; i < n; ++i) {
+      nghttp2_map_entry_init(&ents[i].map_entry, (key_type)(i * 2 + 1));
+      if (nghttp2_map_insert(&map, &ents[i].map_entry) != 0) {
+        return -1;
+      }
+    }
+    res->insert += now() - t;
+
+    t = now();
+    for (i = 0; i < n; ++i) {
+      found += nghttp2_map_find(&map, order[i])->key;
+    }
+    res->lookup += now() - t;
+
+    t = now();
+    for (i = 0; i < n; ++i) {
+      if (nghttp2_map_remove(&map, order[i]) != 0) {
+        return -1;
+      }
+    }
+    res->remove += now() - t;
+
+    nghttp2_map_free(&map);
+  }
+
+  sink = found;
+
+  return 0;
+}
+
+static int bench_chain_map(bench_result *res, bench_entry *ents,
+                           const key_type *order, size_t n, size_t rounds) {
+  chain_map map;
+  size_t i, r, found = 0;
+  double t;
+
+  memset(res, 0, sizeof(*res));
+
+  for (r = 0; r < rounds; ++r) {
+    if (chain_map_init(&map) != 0) {
+      return -1;
+    }
+
+    t = now();
+    for (i = 0; i < n; ++i) {
+      ents[i].chain_entry.key = (key_type)(i * 2 + 1);
+      ents[i].chain_entry.next = NULL;
+      if (chain_map_insert(&map, &ents[i].chain_entry) != 0) {
+        return -1;
+      }
+    }
+    res->insert += now() - t;
+
+    t = now();
+    for (i = 0; i < n; ++i) {
+      found += chain_map_find(&map, order[i])->key;
+    }
+    res->lookup += now() - t;
+
+    t = now();
+    for (i = 0; i < n; ++i) {
+      if (chain_map_remove(&map, order[i]) != 0) {
+        return -1;
+      }
+    }
+    res->remove += now() - t;
+
+    chain_map_free(&map);
+  }
+
+  sink = found;
+
+  return 0;
+}
+
+static void print_result(const char *name, size_t n, size_t rounds,
+                         const bench_result *res) {
+  double nops = (double)n * (double)rounds;
+
+  printf("%-8s %9zu %12.1f %12.1f %12.1f\n", name, n,
+         res->insert / nops * 1e9, res->lookup / nops * 1e9,
+         res->remove / nops * 1e9);
+}
+
+static int run(size_t n) {
+  bench_entry *ents;
+  key_type *order;
+  size_t i, rounds;
+  bench_result res;
+  int rv = 0;
+
+  ents = calloc(n, sizeof(bench_entry));
+  order = malloc(n * sizeof(key_type));
+  if (ents == NULL || order == NULL) {
+    free(ents);
+    free(order);
+    fprintf(stderr, "mapbench: out of memory\n");
+    return -1;
+  }
+
+  for (i = 0; i < n; ++i) {
+    order[i] = (key_type)(i * 2 + 1);
+  }
+  shuffle(order, n);
+
+  rounds = n < MIN_OPS ? (MIN_OPS + n - 1) / n : 1;
+
+  if (bench_chain_map(&res, ents, order, n, rounds) != 0) {
+    fprintf(stderr, "mapbench: chained map failed\n");
+    rv = -1;
+    goto fin;
+  }
+  print_result("chained", n, rounds, &res);
+
+  if (bench_map(&res, ents, order, n, rounds) != 0) {
+    fprintf(stderr, "mapbench: nghttp2_map failed\n");
+    rv = -1;
+    goto fin;
+  }
+  print_result("map", n, rounds, &res);
+
+fin:
+  free(ents);
+  free(order);
+
+  return rv;
+}
+
+int main(int argc, char **argv) {
+  static const size_t defaults[] = {100, 10000, 1000000};
+  size_t i;
+
+  srand(1);
+
+  printf("%-8s %9s %12s %12s %12s\n", "impl", "streams", "insert(ns)",
+         "lookup(ns)", "remove(ns)");
+
+  if (argc > 1) {
+    for (i = 1; i < (size_t)argc; ++i) {
+      size_t n = strtoul(argv[i], NULL, 10);
+      if (n == 0) {
+        fprintf(stderr, "mapbench: invalid number of streams: %s\n",
+                argv[i]);
+        return EXIT_FAILURE;
+      }
+      if (run(n) != 0) {
+        return EXIT_FAILURE;
+      }
+    }
+    return EXIT_SUCCESS;
+  }
+
+  for (i = 0; i < sizeof(defaults) / sizeof(defaults[0]); ++i) {
+    if (run(defaults[i]) != 0) {
+      return EXIT_FAILURE;
+    }
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -274,6 +274,7 @@ void test_nghttp2_hd_inflate_indname_inc(void) {
   nghttp2_bufs bufs;
   ssize_t blocklen;
   nghttp2_nv nv = MAKE_NV("user-agent", "nghttp2");
+  nghttp2_nv ent_nv;
   nva_out out;
   nghttp2_mem *mem;
 
@@ -293,10 +294,9 @@ void test_nghttp2_hd_inflate_indname_inc(void) {
   CU_ASSERT(1 == out.nvlen);
   assert_nv_equal(&nv, out.nva, 1, mem);
   CU_ASSERT(1 == inflater.ctx.hd_table.len);
-  assert_nv_equal(
-      &nv, &GET_TABLE_ENT(&inflater.ctx, NGHTTP2_STATIC_TABLE_LENGTH +
-                                             inflater.ctx.hd_table.len - 1)->nv,
-      1, mem);
+  ent_nv = GET_TABLE_ENT(&inflater.ctx, NGHTTP2_STATIC_TABLE_LENGTH +
+                                           inflater.ctx.hd_table.len - 1);
+  assert_nv_equal(&nv, &ent_nv, 1, mem);
 
   nva_out_reset(&out, mem);
   nghttp2_bufs_free(&bufs);
@@ -395,6 +395,7 @@ void test_nghttp2_hd_inflate_newname_inc(void) {
   nghttp2_bufs bufs;
   ssize_t blocklen;
   nghttp2_nv nv = MAKE_NV("x-rel", "nghttp2");
+  nghttp2_nv ent_nv;
   nva_out out;
   nghttp2_mem *mem;
 
@@ -414,10 +415,9 @@ void test_nghttp2_hd_inflate_newname_inc(void) {
   CU_ASSERT(1 == out.nvlen);
   assert_nv_equal(&nv, out.nva, 1, mem);
   CU_ASSERT(1 == inflater.ctx.hd_table.len);
-  assert_nv_equal(
-      &nv, &GET_TABLE_ENT(&inflater.ctx, NGHTTP2_STATIC_TABLE_LENGTH +
-                                             inflater.ctx.hd_table.len - 1)->nv,
-      1, mem);
+  ent_nv = GET_TABLE_ENT(&inflater.ctx, NGHTTP2_STATIC_TABLE_LENGTH +
+                                           inflater.ctx.hd_table.len - 1);
+  assert_nv_equal(&nv, &ent_nv, 1, mem);
 
   nva_out_reset(&out, mem);
   nghttp2_bufs_free(&bufs);
@@ -528,6 +528,132 @@ void test_nghttp2_hd_inflate_zero_length_huffman(void) {
   nghttp2_hd_inflate_free(&inflater);
 }
 
+void test_nghttp2_hd_inflate_raw_literal(void) {
+  nghttp2_hd_inflater inflater;
+  /* Literal header without indexing - new name, literal header with
+     incremental indexing - new name, and literal header without
+     indexing - indexed name (:path).  All strings are raw. */
+  uint8_t data[] = {0x00, 0x03, 'f', 'o', 'o', 0x03, 'b', 'a', 'r',
+                    0x40, 0x03, 'b', 'a', 'z', 0x02, 'q', 'x',
+                    0x04, 0x04, '/', 'r', 'a', 'w'};
+  nghttp2_nv nv[] = {MAKE_NV("foo", "bar"), MAKE_NV("baz", "qx"),
+                     MAKE_NV(":path", "/raw")};
+  /* Raw name and Huffman encoded value, and vice versa */
+  nghttp2_nv mixed_nv[] = {MAKE_NV("x", "nghttp2"),
+                           MAKE_NV("my-long-content-length", "y")};
+  nghttp2_nv out_nv, ent_nv;
+  nghttp2_bufs bufs;
+  nghttp2_buf_chain *ci;
+  int inflate_flags;
+  ssize_t rv;
+  nva_out out;
+  size_t i, j;
+  size_t buflen;
+  nghttp2_mem *mem;
+
+  mem = nghttp2_mem_default();
+
+  nghttp2_hd_inflate_init(&inflater, mem);
+
+  /* If the whole string is in the input, emitted header field refers
+     to it directly. */
+  rv = nghttp2_hd_inflate_hd(&inflater, &out_nv, &inflate_flags, data,
+                             sizeof(data), 1);
+
+  CU_ASSERT(9 == rv);
+  CU_ASSERT(NGHTTP2_HD_INFLATE_EMIT == inflate_flags);
+  CU_ASSERT(data + 2 == out_nv.name);
+  CU_ASSERT(data + 6 == out_nv.value);
+  assert_nv_equal(&nv[0], &out_nv, 1, mem);
+
+  rv = nghttp2_hd_inflate_hd(&inflater, &out_nv, &inflate_flags, data + 9,
+                             sizeof(data) - 9, 1);
+
+  CU_ASSERT(8 == rv);
+  CU_ASSERT(NGHTTP2_HD_INFLATE_EMIT == inflate_flags);
+  assert_nv_equal(&nv[1], &out_nv, 1, mem);
+  CU_ASSERT(1 == inflater.ctx.hd_table.len);
+  ent_nv = GET_TABLE_ENT(&inflater.ctx, NGHTTP2_STATIC_TABLE_LENGTH);
+  assert_nv_equal(&nv[1], &ent_nv, 1, mem);
+
+  rv = nghttp2_hd_inflate_hd(&inflater, &out_nv, &inflate_flags, data + 17,
+                             sizeof(data) - 17, 1);
+
+  CU_ASSERT(6 == rv);
+  CU_ASSERT(data + 19 == out_nv.value);
+  assert_nv_equal(&nv[2], &out_nv, 1, mem);
+
+  nghttp2_hd_inflate_end_headers(&inflater);
+  nghttp2_hd_inflate_free(&inflater);
+
+  /* Feed input 1 byte at a time so that every string spans input
+     chunks. */
+  nghttp2_hd_inflate_init(&inflater, mem);
+  nva_out_init(&out);
+
+  for (i = 0; i < sizeof(data);) {
+    rv = nghttp2_hd_inflate_hd(&inflater, &out_nv, &inflate_flags, data + i,
+                               1, i + 1 == sizeof(data));
+
+    CU_ASSERT(rv >= 0);
+
+    i += (size_t)rv;
+
+    if (inflate_flags & NGHTTP2_HD_INFLATE_EMIT) {
+      add_out(&out, &out_nv, mem);
+    }
+  }
+
+  nghttp2_hd_inflate_end_headers(&inflater);
+
+  CU_ASSERT(3 == out.nvlen);
+  assert_nv_equal(nv, out.nva, 3, mem);
+
+  nva_out_reset(&out, mem);
+  nghttp2_hd_inflate_free(&inflater);
+
+  /* Split mixed_nv at every position */
+  frame_pack_bufs_init(&bufs);
+
+  for (i = 0; i < 2; ++i) {
+    CU_ASSERT(0 == nghttp2_hd_emit_newname_block(&bufs, &mixed_nv[i], 1));
+  }
+
+  ci = bufs.head;
+  buflen = (size_t)nghttp2_buf_len(&ci->buf);
+
+  for (j = 1; j < buflen; ++j) {
+    nghttp2_hd_inflate_init(&inflater, mem);
+    nva_out_init(&out);
+
+    for (i = 0; i < buflen;) {
+      size_t len = i < j ? j - i : buflen - i;
+
+      rv = nghttp2_hd_inflate_hd(&inflater, &out_nv, &inflate_flags,
+                                 ci->buf.pos + i, len, i + len == buflen);
+
+      CU_ASSERT(rv >= 0);
+
+      i += (size_t)rv;
+
+      if (inflate_flags & NGHTTP2_HD_INFLATE_EMIT) {
+        add_out(&out, &out_nv, mem);
+      }
+    }
+
+    nghttp2_hd_inflate_end_headers(&inflater);
+
+    CU_ASSERT(2 == out.nvlen);
+    assert_nv_equal(mixed_nv, out.nva, 2, mem);
+    CU_ASSERT(2 == inflater.ctx.hd_table.len);
+
+    nva_out_reset(&out, mem);
+    nghttp2_hd_inflate_free(&inflater);
+  }
+
+  nghttp2_bufs_free(&bufs);
+}
+
 void test_nghttp2_hd_ringbuf_reserve(void) {
   nghttp2_hd_deflater deflater;
   nghttp2_hd_inflater inflater;
@@ -580,6 +706,213 @@ void test_nghttp2_hd_ringbuf_reserve(void) {
   mem->free(nv.value, NULL);
 }
 
+void test_nghttp2_hd_deflate_map(void) {
+  nghttp2_hd_deflater deflater;
+  nghttp2_hd_inflater inflater;
+  nghttp2_nv nv;
+  nghttp2_bufs bufs;
+  nva_out out;
+  int i;
+  ssize_t rv;
+  ssize_t blocklen;
+  nghttp2_mem *mem;
+
+  mem = nghttp2_mem_default();
+  frame_pack_bufs_init(&bufs);
+  nva_out_init(&out);
+
+  nv.flags = NGHTTP2_NV_FLAG_NONE;
+  nv.name = (uint8_t *)"a";
+  nv.namelen = strlen((const char *)nv.name);
+  nv.valuelen = sizeof(i);
+  nv.value = mem->malloc(nv.valuelen, NULL);
+
+  nghttp2_hd_deflate_init2(&deflater, 65536, mem);
+  nghttp2_hd_inflate_init(&inflater, mem);
+
+  nghttp2_hd_inflate_change_table_size(&inflater, 65536);
+  nghttp2_hd_deflate_change_table_size(&deflater, 65536);
+
+  /* Fill more entries than the initial number of buckets */
+  for (i = 0; i < 1000; ++i) {
+    memcpy(nv.value, &i, sizeof(i));
+    rv = nghttp2_hd_deflate_hd_bufs(&deflater, &bufs, &nv, 1);
+    blocklen = nghttp2_bufs_len(&bufs);
+
+    CU_ASSERT(0 == rv);
+    CU_ASSERT(blocklen == inflate_hd(&inflater, &out, &bufs, 0, mem));
+
+    nva_out_reset(&out, mem);
+    nghttp2_bufs_reset(&bufs);
+  }
+
+  CU_ASSERT(1000 == deflater.ctx.hd_table.len);
+  CU_ASSERT(deflater.map.tablelen >= 1000);
+
+  /* All of them must be encoded as indexed representation */
+  for (i = 0; i < 1000; ++i) {
+    memcpy(nv.value, &i, sizeof(i));
+    rv = nghttp2_hd_deflate_hd_bufs(&deflater, &bufs, &nv, 1);
+    blocklen = nghttp2_bufs_len(&bufs);
+
+    CU_ASSERT(0 == rv);
+    CU_ASSERT(0x80 == (bufs.head->buf.pos[0] & 0x80));
+    CU_ASSERT(blocklen == inflate_hd(&inflater, &out, &bufs, 0, mem));
+    CU_ASSERT(1 == out.nvlen);
+    assert_nv_equal(&nv, out.nva, 1, mem);
+
+    nva_out_reset(&out, mem);
+    nghttp2_bufs_reset(&bufs);
+  }
+
+  CU_ASSERT(1000 == deflater.ctx.hd_table.len);
+
+  /* Shrink table so that only the newest entries survive */
+  nghttp2_hd_inflate_change_table_size(&inflater, 4096);
+  nghttp2_hd_deflate_change_table_size(&deflater, 4096);
+
+  CU_ASSERT(4096 / 37 == deflater.ctx.hd_table.len);
+
+  /* Flush dynamic table size update */
+  rv = nghttp2_hd_deflate_hd_bufs(&deflater, &bufs, &nv, 1);
+  blocklen = nghttp2_bufs_len(&bufs);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(blocklen == inflate_hd(&inflater, &out, &bufs, 0, mem));
+
+  nva_out_reset(&out, mem);
+  nghttp2_bufs_reset(&bufs);
+
+  for (i = 0; i < 1000; i += 999) {
+    memcpy(nv.value, &i, sizeof(i));
+    rv = nghttp2_hd_deflate_hd_bufs(&deflater, &bufs, &nv, 1);
+    blocklen = nghttp2_bufs_len(&bufs);
+
+    CU_ASSERT(0 == rv);
+    if (i == 0) {
+      /* Evicted entry is added again with indexed name */
+      CU_ASSERT(0x40 == (bufs.head->buf.pos[0] & 0xc0));
+    } else {
+      CU_ASSERT(0x80 == (bufs.head->buf.pos[0] & 0x80));
+    }
+    CU_ASSERT(blocklen == inflate_hd(&inflater, &out, &bufs, 0, mem));
+    CU_ASSERT(1 == out.nvlen);
+    assert_nv_equal(&nv, out.nva, 1, mem);
+
+    nva_out_reset(&out, mem);
+    nghttp2_bufs_reset(&bufs);
+  }
+
+  nghttp2_bufs_free(&bufs);
+  nghttp2_hd_inflate_free(&inflater);
+  nghttp2_hd_deflate_free(&deflater);
+
+  mem->free(nv.value, NULL);
+}
+
+static void check_hd_table_equal(nghttp2_hd_context *a,
+                                 nghttp2_hd_context *b) {
+  size_t i;
+  nghttp2_nv nva, nvb;
+
+  CU_ASSERT(a->hd_table.len == b->hd_table.len);
+  CU_ASSERT(a->hd_table_bufsize == b->hd_table_bufsize);
+
+  if (a->hd_table.len != b->hd_table.len) {
+    return;
+  }
+
+  for (i = 0; i < a->hd_table.len; ++i) {
+    nva = GET_TABLE_ENT(a, NGHTTP2_STATIC_TABLE_LENGTH + i);
+    nvb = GET_TABLE_ENT(b, NGHTTP2_STATIC_TABLE_LENGTH + i);
+
+    CU_ASSERT(nva.namelen == nvb.namelen);
+    CU_ASSERT(nva.valuelen == nvb.valuelen);
+    CU_ASSERT(0 == memcmp(nva.name, nvb.name, nva.namelen));
+    CU_ASSERT(0 == memcmp(nva.value, nvb.value, nva.valuelen));
+  }
+}
+
+void test_nghttp2_hd_table_ring(void) {
+  nghttp2_hd_deflater deflater;
+  nghttp2_hd_inflater inflater;
+  nghttp2_nv nv;
+  nghttp2_bufs bufs;
+  nva_out out;
+  int i;
+  ssize_t rv;
+  ssize_t blocklen;
+  uint8_t value[5000];
+  const char *names[] = {"alpha", "bravo", "charlie", "delta", "echo"};
+  const size_t table_sizes[] = {4096, 256, 8192, 0, 1024, 4096};
+  nghttp2_mem *mem;
+
+  mem = nghttp2_mem_default();
+  frame_pack_bufs_init(&bufs);
+  nva_out_init(&out);
+
+  for (i = 0; i < (int)sizeof(value); ++i) {
+    value[i] = (uint8_t)('a' + i % 26);
+  }
+
+  nghttp2_hd_deflate_init2(&deflater, 8192, mem);
+  nghttp2_hd_inflate_init(&inflater, mem);
+
+  /* Entries of various sizes wrap around the byte ring, and names of
+     the evicted entries are reused by the new entries. */
+  for (i = 0; i < 3000; ++i) {
+    if (i % 500 == 0) {
+      size_t table_size = table_sizes[i / 500];
+
+      nghttp2_hd_inflate_change_table_size(&inflater, table_size);
+      nghttp2_hd_deflate_change_table_size(&deflater, table_size);
+    }
+
+    nv.flags = NGHTTP2_NV_FLAG_NONE;
+    nv.name = (uint8_t *)names[i % 5];
+    nv.namelen = strlen(names[i % 5]);
+    nv.value = value + i % 26;
+    nv.valuelen = (size_t)(i * 37) % 300;
+
+    rv = nghttp2_hd_deflate_hd_bufs(&deflater, &bufs, &nv, 1);
+    blocklen = nghttp2_bufs_len(&bufs);
+
+    CU_ASSERT(0 == rv);
+    CU_ASSERT(blocklen == inflate_hd(&inflater, &out, &bufs, 0, mem));
+    CU_ASSERT(1 == out.nvlen);
+    assert_nv_equal(&nv, out.nva, 1, mem);
+
+    check_hd_table_equal(&deflater.ctx, &inflater.ctx);
+
+    nva_out_reset(&out, mem);
+    nghttp2_bufs_reset(&bufs);
+  }
+
+  CU_ASSERT(inflater.ctx.hd_table.len > 0);
+
+  /* Entry larger than the dynamic table clears the table, but it is
+     still emitted. */
+  nv.name = (uint8_t *)"foxtrot";
+  nv.namelen = strlen("foxtrot");
+  nv.value = value;
+  nv.valuelen = sizeof(value);
+
+  CU_ASSERT(0 == nghttp2_hd_emit_newname_block(&bufs, &nv, 1));
+
+  blocklen = nghttp2_bufs_len(&bufs);
+
+  CU_ASSERT(blocklen == inflate_hd(&inflater, &out, &bufs, 0, mem));
+  CU_ASSERT(1 == out.nvlen);
+  assert_nv_equal(&nv, out.nva, 1, mem);
+  CU_ASSERT(0 == inflater.ctx.hd_table.len);
+  CU_ASSERT(0 == inflater.ctx.hd_table_bufsize);
+
+  nva_out_reset(&out, mem);
+  nghttp2_bufs_free(&bufs);
+  nghttp2_hd_inflate_free(&inflater);
+  nghttp2_hd_deflate_free(&deflater);
+}
+
 void test_nghttp2_hd_change_table_size(void) {
   nghttp2_hd_deflater deflater;
   nghttp2_hd_inflater inflater;
@@ -1243,3 +1576,109 @@ void test_nghttp2_hd_huff_encode(void) {
   nghttp2_bufs_free(&bufs);
   nghttp2_bufs_free(&outbufs);
 }
+
+void test_nghttp2_hd_huff_decode(void) {
+  int rv;
+  ssize_t len;
+  size_t i;
+  nghttp2_bufs bufs, outbufs, smallbufs;
+  nghttp2_hd_huff_decode_context ctx;
+  uint8_t t1[256];
+  uint8_t *out;
+  uint8_t *enc;
+  size_t enclen;
+  /* "a" followed by 8 bits padding */
+  const uint8_t t2[] = {0x1f, 0xff};
+  /* "a" followed by padding containing 0 bit */
+  const uint8_t t3[] = {0x1e};
+  /* EOS */
+  const uint8_t t4[] = {0xff, 0xff, 0xff, 0xfc};
+
+  frame_pack_bufs_init(&bufs);
+  frame_pack_bufs_init(&outbufs);
+
+  for (i = 0; i < sizeof(t1); ++i) {
+    t1[i] = (uint8_t)i;
+  }
+
+  rv = nghttp2_hd_huff_encode(&bufs, t1, sizeof(t1));
+
+  CU_ASSERT(0 == rv);
+
+  enc = bufs.head->buf.pos;
+  enclen = nghttp2_buf_len(&bufs.head->buf);
+
+  CU_ASSERT(nghttp2_hd_huff_encode_count(t1, sizeof(t1)) == enclen);
+
+  nghttp2_hd_huff_decode_context_init(&ctx);
+
+  len = nghttp2_hd_huff_decode(&ctx, &outbufs, enc, enclen, 1);
+
+  CU_ASSERT((ssize_t)enclen == len);
+  CU_ASSERT(sizeof(t1) == nghttp2_bufs_len(&outbufs));
+  CU_ASSERT(0 == memcmp(t1, outbufs.head->buf.pos, sizeof(t1)));
+
+  nghttp2_bufs_reset(&outbufs);
+
+  /* Feed input 1 byte at a time */
+  nghttp2_hd_huff_decode_context_init(&ctx);
+
+  for (i = 0; i < enclen; ++i) {
+    len = nghttp2_hd_huff_decode(&ctx, &outbufs, enc + i, 1, i + 1 == enclen);
+
+    CU_ASSERT(1 == len);
+  }
+
+  CU_ASSERT(sizeof(t1) == nghttp2_bufs_len(&outbufs));
+  CU_ASSERT(0 == memcmp(t1, outbufs.head->buf.pos, sizeof(t1)));
+
+  nghttp2_bufs_reset(&outbufs);
+
+  /* Output spans multiple small chunks */
+  nghttp2_bufs_init2(&smallbufs, 7, 256, 0, nghttp2_mem_default());
+
+  rv = nghttp2_hd_huff_encode(&smallbufs, t1, sizeof(t1));
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT((ssize_t)enclen == nghttp2_bufs_remove(&smallbufs, &out));
+  CU_ASSERT(0 == memcmp(enc, out, enclen));
+
+  free(out);
+  nghttp2_bufs_reset(&smallbufs);
+
+  nghttp2_hd_huff_decode_context_init(&ctx);
+
+  len = nghttp2_hd_huff_decode(&ctx, &smallbufs, enc, enclen, 1);
+
+  CU_ASSERT((ssize_t)enclen == len);
+  CU_ASSERT((ssize_t)sizeof(t1) == nghttp2_bufs_remove(&smallbufs, &out));
+  CU_ASSERT(0 == memcmp(t1, out, sizeof(t1)));
+
+  free(out);
+  nghttp2_bufs_free(&smallbufs);
+
+  /* Padding must be strictly less than 8 bits */
+  nghttp2_hd_huff_decode_context_init(&ctx);
+
+  CU_ASSERT(NGHTTP2_ERR_HEADER_COMP ==
+            nghttp2_hd_huff_decode(&ctx, &outbufs, t2, sizeof(t2), 1));
+
+  nghttp2_bufs_reset(&outbufs);
+
+  /* Padding must be the prefix of EOS */
+  nghttp2_hd_huff_decode_context_init(&ctx);
+
+  CU_ASSERT(NGHTTP2_ERR_HEADER_COMP ==
+            nghttp2_hd_huff_decode(&ctx, &outbufs, t3, sizeof(t3), 1));
+
+  nghttp2_bufs_reset(&outbufs);
+
+  /* EOS must not appear */
+  nghttp2_hd_huff_decode_context_init(&ctx);
+
+  CU_ASSERT(NGHTTP2_ERR_HEADER_COMP ==
+            nghttp2_hd_huff_decode(&ctx, &outbufs, t4, sizeof(t4), 1));
+
+  nghttp2_bufs_free(&bufs);
+  nghttp2_bufs_free(&outbufs);
+}
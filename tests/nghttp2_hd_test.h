@@ -35,7 +35,10 @@ void test_nghttp2_hd_inflate_newname_noinc(void);
 void test_nghttp2_hd_inflate_newname_inc(void);
 void test_nghttp2_hd_inflate_clearall_inc(void);
 void test_nghttp2_hd_inflate_zero_length_huffman(void);
+void test_nghttp2_hd_inflate_raw_literal(void);
 void test_nghttp2_hd_ringbuf_reserve(void);
+void test_nghttp2_hd_deflate_map(void);
+void test_nghttp2_hd_table_ring(void);
 void test_nghttp2_hd_change_table_size(void);
 void test_nghttp2_hd_deflate_inflate(void);
 void test_nghttp2_hd_no_index(void);
@@ -43,5 +46,6 @@ void test_nghttp2_hd_deflate_bound(void);
 void test_nghttp2_hd_public_api(void);
 void test_nghttp2_hd_decode_length(void);
 void test_nghttp2_hd_huff_encode(void);
+void test_nghttp2_hd_huff_decode(void);
 
 #endif /* NGHTTP2_HD_TEST_H */
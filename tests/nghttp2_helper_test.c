@@ -24,6 +24,8 @@
  */
 #include "nghttp2_helper_test.h"
 
+#include <string.h>
+
 #include <CUnit/CUnit.h>
 
 #include "nghttp2_helper.h"
@@ -167,3 +169,62 @@ void test_nghttp2_check_header_value(void) {
   CU_ASSERT(!check_header_value(badval1));
   CU_ASSERT(!check_header_value(badval2));
 }
+
+static int ref_name_char(uint8_t c) {
+  return ('a' <= c && c <= 'z') || ('0' <= c && c <= '9') ||
+         strchr("!#$%&'*+-.^_`|~", c) != NULL;
+}
+
+static int ref_value_char(uint8_t c) {
+  return c == '\t' || (0x20 <= c && c != 0x7f);
+}
+
+void test_nghttp2_check_header_simd(void) {
+  static const int levels[] = {NGHTTP2_SIMD_NONE, NGHTTP2_SIMD_SSE2,
+                               NGHTTP2_SIMD_AVX2};
+  uint8_t buf[80], lower[80];
+  size_t i, len, pos;
+  int c, ok;
+
+  for (i = 0; i < sizeof(levels) / sizeof(levels[0]); ++i) {
+    nghttp2_simd_max_level = levels[i];
+
+    /* Put every byte value at every position of the valid field,
+       so that both vector and scalar tail code are exercised */
+    for (len = 1; len <= sizeof(buf); len += 7) {
+      for (pos = 0; pos < len; ++pos) {
+        for (c = 0; c < 256; ++c) {
+          memset(buf, 'a', len);
+          buf[pos] = (uint8_t)c;
+
+          /* strchr() finds terminating NUL; leading ':' is allowed
+             for pseudo header field */
+          ok = (c != 0 && ref_name_char((uint8_t)c)) ||
+               (c == ':' && pos == 0 && len > 1);
+          if (nghttp2_check_header_name(buf, len) != ok) {
+            CU_ASSERT(nghttp2_check_header_name(buf, len) == ok);
+            goto fin;
+          }
+
+          ok = ref_value_char((uint8_t)c);
+          if (nghttp2_check_header_value(buf, len) != ok) {
+            CU_ASSERT(nghttp2_check_header_value(buf, len) == ok);
+            goto fin;
+          }
+
+          memset(lower, 'a', len);
+          lower[pos] = ('A' <= c && c <= 'Z') ? (uint8_t)(c + 0x20)
+                                              : (uint8_t)c;
+          nghttp2_downcase(buf, len);
+          if (memcmp(lower, buf, len) != 0) {
+            CU_ASSERT(0 == memcmp(lower, buf, len));
+            goto fin;
+          }
+        }
+      }
+    }
+  }
+
+fin:
+  nghttp2_simd_max_level = NGHTTP2_SIMD_AVX2;
+}
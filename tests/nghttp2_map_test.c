@@ -125,13 +125,20 @@ void test_nghttp2_map_functional(void) {
   /* find */
   shuffle(order, NUM_ENT);
   for (i = 0; i < NUM_ENT; ++i) {
-    nghttp2_map_find(&map, order[i]);
+    CU_ASSERT(&arr[order[i] - 1].map_entry ==
+              nghttp2_map_find(&map, order[i]));
   }
   /* remove */
   shuffle(order, NUM_ENT);
   for (i = 0; i < NUM_ENT; ++i) {
     CU_ASSERT(0 == nghttp2_map_remove(&map, order[i]));
+    /* Entries shifted back by removal must be still reachable */
+    if (i + 1 < NUM_ENT) {
+      CU_ASSERT(&arr[order[i + 1] - 1].map_entry ==
+                nghttp2_map_find(&map, order[i + 1]));
+    }
   }
+  CU_ASSERT(0 == nghttp2_map_size(&map));
 
   /* each_free (but no op function for testing purpose) */
   for (i = 0; i < NUM_ENT; ++i) {
@@ -145,6 +152,33 @@ void test_nghttp2_map_functional(void) {
   nghttp2_map_free(&map);
 }
 
+void test_nghttp2_map_shrink(void) {
+  nghttp2_map map;
+  uint32_t tablelen;
+  int i;
+
+  nghttp2_map_init(&map, nghttp2_mem_default());
+  tablelen = map.tablelen;
+
+  for (i = 0; i < NUM_ENT; ++i) {
+    strentry_init(&arr[i], i * 2 + 1, "foo");
+    CU_ASSERT(0 == nghttp2_map_insert(&map, &arr[i].map_entry));
+  }
+
+  CU_ASSERT(map.tablelen > tablelen);
+
+  for (i = 0; i < NUM_ENT - 1; ++i) {
+    CU_ASSERT(0 == nghttp2_map_remove(&map, i * 2 + 1));
+  }
+
+  CU_ASSERT(1 == nghttp2_map_size(&map));
+  CU_ASSERT(tablelen == map.tablelen);
+  CU_ASSERT(&arr[NUM_ENT - 1].map_entry ==
+            nghttp2_map_find(&map, (NUM_ENT - 1) * 2 + 1));
+
+  nghttp2_map_free(&map);
+}
+
 static int entry_free(nghttp2_map_entry *entry, void *ptr) {
   nghttp2_mem *mem = ptr;
 
@@ -35,6 +35,7 @@
 #include "nghttp2_helper.h"
 #include "nghttp2_test_helper.h"
 #include "nghttp2_priority_spec.h"
+#include "nghttp2_time.h"
 
 #define OB_CTRL(ITEM) nghttp2_outbound_item_get_ctrl_frame(ITEM)
 #define OB_CTRL_TYPE(ITEM) nghttp2_outbound_item_get_ctrl_frame_type(ITEM)
@@ -270,6 +271,78 @@ static ssize_t fixed_length_data_source_read_callback(
   return wlen;
 }
 
+static ssize_t no_copy_data_source_read_callback(
+    nghttp2_session *session _U_, int32_t stream_id _U_, uint8_t *buf _U_,
+    size_t len, uint32_t *data_flags, nghttp2_data_source *source _U_,
+    void *user_data) {
+  my_user_data *ud = (my_user_data *)user_data;
+  size_t wlen;
+  if (len < ud->data_source_length) {
+    wlen = len;
+  } else {
+    wlen = ud->data_source_length;
+  }
+  ud->data_source_length -= wlen;
+  *data_flags |= NGHTTP2_DATA_FLAG_NO_COPY;
+  if (ud->data_source_length == 0) {
+    *data_flags |= NGHTTP2_DATA_FLAG_EOF;
+  }
+  return wlen;
+}
+
+static int accumulator_send_data_callback(nghttp2_session *session _U_,
+                                          nghttp2_frame *frame,
+                                          const uint8_t *framehd, size_t length,
+                                          nghttp2_data_source *source _U_,
+                                          void *user_data) {
+  accumulator *acc = ((my_user_data *)user_data)->acc;
+  size_t padlen = frame->data.padlen;
+
+  assert(acc->length + NGHTTP2_FRAME_HDLEN + length + padlen <
+         sizeof(acc->buf));
+
+  memcpy(acc->buf + acc->length, framehd, NGHTTP2_FRAME_HDLEN);
+  acc->length += NGHTTP2_FRAME_HDLEN;
+
+  if (padlen) {
+    acc->buf[acc->length++] = (uint8_t)(padlen - 1);
+  }
+
+  memset(acc->buf + acc->length, 'a', length);
+  acc->length += length;
+
+  if (padlen) {
+    memset(acc->buf + acc->length, 0, padlen - 1);
+    acc->length += padlen - 1;
+  }
+
+  return 0;
+}
+
+static int block_count_send_data_callback(nghttp2_session *session _U_,
+                                          nghttp2_frame *frame _U_,
+                                          const uint8_t *framehd _U_,
+                                          size_t length _U_,
+                                          nghttp2_data_source *source _U_,
+                                          void *user_data) {
+  my_user_data *ud = (my_user_data *)user_data;
+
+  if (ud->block_count == 0) {
+    return NGHTTP2_ERR_WOULDBLOCK;
+  }
+
+  --ud->block_count;
+
+  return 0;
+}
+
+static int temporal_failure_send_data_callback(
+    nghttp2_session *session _U_, nghttp2_frame *frame _U_,
+    const uint8_t *framehd _U_, size_t length _U_,
+    nghttp2_data_source *source _U_, void *user_data _U_) {
+  return NGHTTP2_ERR_TEMPORAL_CALLBACK_FAILURE;
+}
+
 static ssize_t temporal_failure_data_source_read_callback(
     nghttp2_session *session _U_, int32_t stream_id _U_, uint8_t *buf _U_,
     size_t len _U_, uint32_t *data_flags _U_, nghttp2_data_source *source _U_,
@@ -2527,7 +2600,7 @@ void test_nghttp2_session_on_window_update_received(void) {
 
   data_item = create_data_ob_item(mem);
 
-  CU_ASSERT(0 == nghttp2_stream_attach_item(stream, data_item, session));
+  CU_ASSERT(0 == nghttp2_stream_attach_item(stream, data_item));
 
   nghttp2_frame_window_update_init(&frame.window_update, NGHTTP2_FLAG_NONE, 1,
                                    16 * 1024);
@@ -2537,9 +2610,7 @@ void test_nghttp2_session_on_window_update_received(void) {
   CU_ASSERT(NGHTTP2_INITIAL_WINDOW_SIZE + 16 * 1024 ==
             stream->remote_window_size);
 
-  CU_ASSERT(0 ==
-            nghttp2_stream_defer_item(
-                stream, NGHTTP2_STREAM_FLAG_DEFERRED_FLOW_CONTROL, session));
+  nghttp2_stream_defer_item(stream, NGHTTP2_STREAM_FLAG_DEFERRED_FLOW_CONTROL);
 
   CU_ASSERT(0 == nghttp2_session_on_window_update_received(session, &frame));
   CU_ASSERT(2 == user_data.frame_recv_cb_called);
@@ -4447,7 +4518,7 @@ void test_nghttp2_session_pop_next_ob_item(void) {
 
   stream = nghttp2_session_get_stream(session, 1);
 
-  nghttp2_stream_detach_item(stream, session);
+  nghttp2_stream_detach_item(stream);
 
   nghttp2_outbound_item_free(item, mem);
   mem->free(item, NULL);
@@ -4655,7 +4726,7 @@ void test_nghttp2_session_defer_data(void) {
 
   /* Resume deferred DATA */
   CU_ASSERT(0 == nghttp2_session_resume_data(session, 1));
-  item = (nghttp2_outbound_item *)nghttp2_pq_top(&session->ob_da_pq);
+  item = stream->item;
   item->aux_data.data.data_prd.read_callback =
       fixed_length_data_source_read_callback;
   ud.block_count = 1;
@@ -4673,7 +4744,7 @@ void test_nghttp2_session_defer_data(void) {
 
   /* Resume deferred DATA */
   CU_ASSERT(0 == nghttp2_session_resume_data(session, 1));
-  item = (nghttp2_outbound_item *)nghttp2_pq_top(&session->ob_da_pq);
+  item = stream->item;
   item->aux_data.data.data_prd.read_callback =
       fixed_length_data_source_read_callback;
   ud.block_count = 1;
@@ -5172,6 +5243,290 @@ void test_nghttp2_session_set_option(void) {
   nghttp2_option_del(option);
 }
 
+void test_nghttp2_session_free_list(void) {
+  nghttp2_session *session;
+  nghttp2_session_callbacks callbacks;
+  nghttp2_option *option;
+  nghttp2_stream *stream;
+  nghttp2_outbound_item *item;
+
+  memset(&callbacks, 0, sizeof(nghttp2_session_callbacks));
+  callbacks.send_callback = null_send_callback;
+
+  nghttp2_option_new(&option);
+  nghttp2_option_set_free_list_size(option, 1);
+
+  nghttp2_session_client_new2(&session, &callbacks, NULL, option);
+
+  CU_ASSERT(1 == session->stream_freelist.max);
+  CU_ASSERT(1 == session->item_freelist.max);
+
+  stream = open_stream(session, 1);
+
+  CU_ASSERT(0 == session->stream_freelist.len);
+
+  CU_ASSERT(0 == nghttp2_session_close_stream(session, 1, NGHTTP2_NO_ERROR));
+  CU_ASSERT(1 == session->stream_freelist.len);
+
+  /* The released stream is reused */
+  CU_ASSERT(stream == open_stream(session, 3));
+  CU_ASSERT(0 == session->stream_freelist.len);
+
+  /* PING is released after it is sent */
+  CU_ASSERT(0 == nghttp2_submit_ping(session, NGHTTP2_FLAG_NONE, NULL));
+
+  item = nghttp2_session_get_next_ob_item(session);
+
+  CU_ASSERT(0 == nghttp2_session_send(session));
+  CU_ASSERT(1 == session->item_freelist.len);
+
+  /* The released item is reused, and the list is bounded by its
+     capacity */
+  CU_ASSERT(0 == nghttp2_submit_ping(session, NGHTTP2_FLAG_NONE, NULL));
+  CU_ASSERT(0 == session->item_freelist.len);
+  CU_ASSERT(item == nghttp2_session_get_next_ob_item(session));
+
+  CU_ASSERT(0 == nghttp2_submit_ping(session, NGHTTP2_FLAG_NONE, NULL));
+  CU_ASSERT(0 == nghttp2_session_send(session));
+  CU_ASSERT(1 == session->item_freelist.len);
+
+  nghttp2_session_del(session);
+
+  /* Free list is disabled by default */
+  nghttp2_session_client_new(&session, &callbacks, NULL);
+
+  CU_ASSERT(0 == session->item_freelist.max);
+
+  CU_ASSERT(0 == nghttp2_submit_ping(session, NGHTTP2_FLAG_NONE, NULL));
+  CU_ASSERT(0 == nghttp2_session_send(session));
+  CU_ASSERT(0 == session->item_freelist.len);
+
+  nghttp2_session_del(session);
+
+  nghttp2_option_del(option);
+}
+
+void test_nghttp2_session_stats(void) {
+  nghttp2_session *session;
+  nghttp2_session_callbacks callbacks;
+  nghttp2_option *option;
+  nghttp2_session_stats stats;
+  nghttp2_data_provider data_prd;
+  nghttp2_hd_deflater deflater;
+  nghttp2_frame frame;
+  nghttp2_bufs bufs;
+  my_user_data ud;
+  size_t i, nvlen;
+  ssize_t rv;
+  nghttp2_mem *mem;
+
+  mem = nghttp2_mem_default();
+  frame_pack_bufs_init(&bufs);
+
+  memset(&callbacks, 0, sizeof(nghttp2_session_callbacks));
+  callbacks.send_callback = null_send_callback;
+
+  /* Statistics are disabled by default */
+  nghttp2_session_client_new(&session, &callbacks, &ud);
+
+  CU_ASSERT(NGHTTP2_ERR_INVALID_STATE ==
+            nghttp2_session_get_stats(session, &stats));
+
+  nghttp2_session_del(session);
+
+  nghttp2_option_new(&option);
+  nghttp2_option_set_stats(option, 1);
+
+  nghttp2_session_client_new2(&session, &callbacks, &ud, option);
+
+  CU_ASSERT(0 == nghttp2_session_get_stats(session, &stats));
+  CU_ASSERT(0 == stats.frames_sent[NGHTTP2_HEADERS]);
+
+  /* Send more than initial window size, so that both stream and
+     connection are blocked by flow control */
+  data_prd.read_callback = fixed_length_data_source_read_callback;
+  ud.data_source_length = NGHTTP2_INITIAL_WINDOW_SIZE + 100;
+
+  CU_ASSERT(1 == nghttp2_submit_request(session, NULL, reqnv, ARRLEN(reqnv),
+                                        &data_prd, NULL));
+  CU_ASSERT(0 == nghttp2_session_send(session));
+
+  nghttp2_session_get_stats(session, &stats);
+
+  nvlen = 0;
+  for (i = 0; i < ARRLEN(reqnv); ++i) {
+    nvlen += reqnv[i].namelen + reqnv[i].valuelen;
+  }
+
+  CU_ASSERT(1 == stats.frames_sent[NGHTTP2_HEADERS]);
+  CU_ASSERT(4 == stats.frames_sent[NGHTTP2_DATA]);
+  CU_ASSERT(nvlen == stats.hd_deflate_inlen);
+  CU_ASSERT(stats.hd_deflate_outlen > 0);
+  CU_ASSERT(stats.hd_deflate_outlen < nvlen);
+  CU_ASSERT(1 == stats.stream_flow_control_stalls);
+  CU_ASSERT(1 == stats.connection_flow_control_stalls);
+
+  nghttp2_frame_window_update_init(&frame.window_update, NGHTTP2_FLAG_NONE, 1,
+                                   4096);
+
+  CU_ASSERT(0 == nghttp2_session_on_window_update_received(session, &frame));
+
+  frame.hd.stream_id = 0;
+
+  CU_ASSERT(0 == nghttp2_session_on_window_update_received(session, &frame));
+
+  nghttp2_frame_window_update_free(&frame.window_update);
+
+  CU_ASSERT(0 == nghttp2_session_send(session));
+
+  nghttp2_session_get_stats(session, &stats);
+
+  CU_ASSERT(5 == stats.frames_sent[NGHTTP2_DATA]);
+  CU_ASSERT(1 == stats.stream_flow_control_stalls);
+  CU_ASSERT(1 == stats.connection_flow_control_stalls);
+
+  /* Receive response HEADERS */
+  nghttp2_hd_deflate_init(&deflater, mem);
+
+  rv = pack_headers(&bufs, &deflater, 1, NGHTTP2_FLAG_END_HEADERS, resnv,
+                    ARRLEN(resnv), mem);
+
+  CU_ASSERT(0 == rv);
+
+  rv = nghttp2_session_mem_recv(session, bufs.head->buf.pos,
+                                nghttp2_buf_len(&bufs.head->buf));
+
+  CU_ASSERT((ssize_t)nghttp2_buf_len(&bufs.head->buf) == rv);
+
+  nghttp2_session_get_stats(session, &stats);
+
+  CU_ASSERT(1 == stats.frames_received[NGHTTP2_HEADERS]);
+  CU_ASSERT((size_t)nghttp2_buf_len(&bufs.head->buf) - NGHTTP2_FRAME_HDLEN ==
+            (size_t)stats.hd_inflate_inlen);
+  CU_ASSERT(resnv[0].namelen + resnv[0].valuelen == stats.hd_inflate_outlen);
+
+  nghttp2_hd_deflate_free(&deflater);
+  nghttp2_session_del(session);
+  nghttp2_option_del(option);
+  nghttp2_bufs_free(&bufs);
+}
+
+static void recv_data_frames(nghttp2_session *session, int32_t stream_id,
+                             size_t n) {
+  uint8_t data[NGHTTP2_FRAME_HDLEN + 4096];
+  nghttp2_frame_hd hd;
+  size_t i;
+  ssize_t rv;
+
+  memset(data, 0, sizeof(data));
+  nghttp2_frame_hd_init(&hd, 4096, NGHTTP2_DATA, NGHTTP2_FLAG_NONE,
+                        stream_id);
+  nghttp2_frame_pack_frame_hd(data, &hd);
+
+  for (i = 0; i < n; ++i) {
+    rv = nghttp2_session_mem_recv(session, data, sizeof(data));
+    CU_ASSERT((ssize_t)sizeof(data) == rv);
+  }
+}
+
+void test_nghttp2_session_window_auto_tuning(void) {
+  nghttp2_session *session;
+  nghttp2_session_callbacks callbacks;
+  nghttp2_option *option;
+  nghttp2_stream *stream;
+  nghttp2_outbound_item *item;
+  nghttp2_frame frame;
+  uint8_t opaque_data[8];
+  uint64_t now;
+
+  memset(&callbacks, 0, sizeof(nghttp2_session_callbacks));
+  callbacks.send_callback = null_send_callback;
+
+  nghttp2_option_new(&option);
+  nghttp2_option_set_window_auto_tuning(option, 1 << 20);
+
+  nghttp2_session_client_new2(&session, &callbacks, NULL, option);
+
+  stream = nghttp2_session_open_stream(session, 1, NGHTTP2_STREAM_FLAG_NONE,
+                                       &pri_spec_default,
+                                       NGHTTP2_STREAM_OPENED, NULL);
+  /* Isolate stream flow control from connection flow control */
+  stream->local_window_size = 16383;
+
+  /* Pretend that RTT was measured, and the previous WINDOW_UPDATE was
+     just sent */
+  now = nghttp2_time_now_msec();
+  session->window_tuning.rtt_msec = 1000;
+  session->window_tuning.rtt_sampled_msec = now;
+  stream->window_update_msec = now;
+
+  /* The window is consumed well within 2 RTTs, so it is doubled */
+  recv_data_frames(session, 1, 2);
+
+  item = nghttp2_session_get_next_ob_item(session);
+
+  CU_ASSERT(NGHTTP2_WINDOW_UPDATE == item->frame.hd.type);
+  CU_ASSERT(1 == item->frame.hd.stream_id);
+  CU_ASSERT(8192 + 16383 == item->frame.window_update.window_size_increment);
+  CU_ASSERT(16383 * 2 == stream->local_window_size);
+  CU_ASSERT(16383 == stream->window_growth);
+  CU_ASSERT(16383 == session->window_tuning.used);
+  CU_ASSERT(0 == stream->recv_window_size);
+
+  CU_ASSERT(0 == nghttp2_session_send(session));
+
+  /* The growth is capped by the budget */
+  session->window_tuning.budget = session->window_tuning.used + 100;
+
+  recv_data_frames(session, 1, 4);
+
+  item = nghttp2_session_get_next_ob_item(session);
+
+  CU_ASSERT(NGHTTP2_WINDOW_UPDATE == item->frame.hd.type);
+  CU_ASSERT(16384 + 100 == item->frame.window_update.window_size_increment);
+  CU_ASSERT(16383 * 2 + 100 == stream->local_window_size);
+  CU_ASSERT(16383 + 100 == stream->window_growth);
+  CU_ASSERT(session->window_tuning.budget == session->window_tuning.used);
+
+  CU_ASSERT(0 == nghttp2_session_send(session));
+
+  /* Without RTT sample, the window does not grow, and PING is sent to
+     measure RTT */
+  session->window_tuning.rtt_sampled_msec = 0;
+
+  recv_data_frames(session, 1, 4);
+
+  item = nghttp2_session_get_next_ob_item(session);
+
+  CU_ASSERT(NGHTTP2_PING == item->frame.hd.type);
+  CU_ASSERT(0 == (item->frame.hd.flags & NGHTTP2_FLAG_ACK));
+  CU_ASSERT(1 == session->window_tuning.ping_inflight);
+  CU_ASSERT(16383 * 2 + 100 == stream->local_window_size);
+
+  memcpy(opaque_data, item->frame.ping.opaque_data, sizeof(opaque_data));
+
+  CU_ASSERT(0 == nghttp2_session_send(session));
+
+  /* PING ACK gives RTT sample, and the growth of the idle stream is
+     taken back */
+  stream->window_update_msec = nghttp2_time_now_msec() - 60000;
+
+  nghttp2_frame_ping_init(&frame.ping, NGHTTP2_FLAG_ACK, opaque_data);
+
+  CU_ASSERT(0 == nghttp2_session_on_ping_received(session, &frame));
+
+  nghttp2_frame_ping_free(&frame.ping);
+
+  CU_ASSERT(0 == session->window_tuning.ping_inflight);
+  CU_ASSERT(0 != session->window_tuning.rtt_sampled_msec);
+  CU_ASSERT(16383 == stream->local_window_size);
+  CU_ASSERT(0 == stream->window_growth);
+  CU_ASSERT(0 == session->window_tuning.used);
+
+  nghttp2_session_del(session);
+  nghttp2_option_del(option);
+}
+
 void test_nghttp2_session_data_backoff_by_high_pri_frame(void) {
   nghttp2_session *session;
   nghttp2_session_callbacks callbacks;
@@ -5402,7 +5757,7 @@ void test_nghttp2_session_stream_dep_add(void) {
 
   check_stream_dep_sib(a, NULL, b, NULL, NULL);
   check_stream_dep_sib(b, a, NULL, NULL, c);
-  check_stream_dep_sib(c, NULL, d, b, NULL);
+  check_stream_dep_sib(c, a, d, b, NULL);
   check_stream_dep_sib(d, c, NULL, NULL, NULL);
 
   CU_ASSERT(4 == session->roots.num_streams);
@@ -5435,7 +5790,7 @@ void test_nghttp2_session_stream_dep_add(void) {
   check_stream_dep_sib(a, NULL, e, NULL, NULL);
   check_stream_dep_sib(e, a, b, NULL, NULL);
   check_stream_dep_sib(b, e, NULL, NULL, c);
-  check_stream_dep_sib(c, NULL, d, b, NULL);
+  check_stream_dep_sib(c, e, d, b, NULL);
   check_stream_dep_sib(d, c, NULL, NULL, NULL);
 
   CU_ASSERT(5 == session->roots.num_streams);
@@ -5577,7 +5932,7 @@ void test_nghttp2_session_stream_dep_remove(void) {
   CU_ASSERT(0 == c->sum_dep_weight);
 
   check_stream_dep_sib(a, NULL, d, NULL, NULL);
-  check_stream_dep_sib(b, NULL, NULL, d, NULL);
+  check_stream_dep_sib(b, a, NULL, d, NULL);
   check_stream_dep_sib(c, NULL, NULL, NULL, NULL);
   check_stream_dep_sib(d, a, NULL, NULL, b);
 
@@ -5639,10 +5994,10 @@ void test_nghttp2_session_stream_dep_remove(void) {
   CU_ASSERT(0 == f->sum_dep_weight);
 
   check_stream_dep_sib(a, NULL, d, NULL, NULL);
-  check_stream_dep_sib(b, NULL, NULL, e, NULL);
+  check_stream_dep_sib(b, a, NULL, e, NULL);
   check_stream_dep_sib(c, NULL, NULL, NULL, NULL);
-  check_stream_dep_sib(e, NULL, NULL, f, b);
-  check_stream_dep_sib(f, NULL, NULL, d, e);
+  check_stream_dep_sib(e, a, NULL, f, b);
+  check_stream_dep_sib(f, a, NULL, d, e);
   check_stream_dep_sib(d, a, NULL, NULL, f);
 
   nghttp2_session_del(session);
@@ -5673,7 +6028,7 @@ void test_nghttp2_session_stream_dep_add_subtree(void) {
    * d
    */
 
-  nghttp2_stream_dep_add_subtree(a, e, session);
+  nghttp2_stream_dep_add_subtree(a, e);
 
   /* becomes
    * a
@@ -5698,8 +6053,8 @@ void test_nghttp2_session_stream_dep_add_subtree(void) {
   CU_ASSERT(0 == f->sum_dep_weight);
 
   check_stream_dep_sib(a, NULL, e, NULL, NULL);
-  check_stream_dep_sib(b, NULL, NULL, c, NULL);
-  check_stream_dep_sib(c, NULL, d, e, b);
+  check_stream_dep_sib(b, a, NULL, c, NULL);
+  check_stream_dep_sib(c, a, d, e, b);
   check_stream_dep_sib(d, c, NULL, NULL, NULL);
   check_stream_dep_sib(e, a, f, NULL, c);
   check_stream_dep_sib(f, e, NULL, NULL, NULL);
@@ -5724,7 +6079,7 @@ void test_nghttp2_session_stream_dep_add_subtree(void) {
    * d
    */
 
-  nghttp2_stream_dep_insert_subtree(a, e, session);
+  nghttp2_stream_dep_insert_subtree(a, e);
 
   /* becomes
    * a
@@ -5753,8 +6108,8 @@ void test_nghttp2_session_stream_dep_add_subtree(void) {
   check_stream_dep_sib(a, NULL, e, NULL, NULL);
   check_stream_dep_sib(e, a, f, NULL, NULL);
   check_stream_dep_sib(f, e, NULL, NULL, c);
-  check_stream_dep_sib(b, NULL, NULL, c, NULL);
-  check_stream_dep_sib(c, NULL, d, f, b);
+  check_stream_dep_sib(b, e, NULL, c, NULL);
+  check_stream_dep_sib(c, e, d, f, b);
   check_stream_dep_sib(d, c, NULL, NULL, NULL);
 
   nghttp2_session_del(session);
@@ -5887,7 +6242,7 @@ void test_nghttp2_session_stream_dep_remove_subtree(void) {
 
   check_stream_dep_sib(a, NULL, b, NULL, NULL);
   check_stream_dep_sib(b, a, NULL, NULL, e);
-  check_stream_dep_sib(e, NULL, NULL, b, NULL);
+  check_stream_dep_sib(e, a, NULL, b, NULL);
   check_stream_dep_sib(c, NULL, d, NULL, NULL);
   check_stream_dep_sib(d, c, NULL, NULL, NULL);
 
@@ -5915,7 +6270,7 @@ void test_nghttp2_session_stream_dep_all_your_stream_are_belong_to_us(void) {
 
   nghttp2_stream_dep_remove_subtree(c);
   CU_ASSERT(0 ==
-            nghttp2_stream_dep_all_your_stream_are_belong_to_us(c, session));
+            nghttp2_stream_dep_all_your_stream_are_belong_to_us(c));
 
   /*
    * c
@@ -5953,7 +6308,7 @@ void test_nghttp2_session_stream_dep_all_your_stream_are_belong_to_us(void) {
 
   nghttp2_stream_dep_remove_subtree(c);
   CU_ASSERT(0 ==
-            nghttp2_stream_dep_all_your_stream_are_belong_to_us(c, session));
+            nghttp2_stream_dep_all_your_stream_are_belong_to_us(c));
 
   /*
    * c
@@ -5971,7 +6326,7 @@ void test_nghttp2_session_stream_dep_all_your_stream_are_belong_to_us(void) {
 
   check_stream_dep_sib(c, NULL, b, NULL, NULL);
   check_stream_dep_sib(b, c, NULL, NULL, a);
-  check_stream_dep_sib(a, NULL, NULL, b, NULL);
+  check_stream_dep_sib(a, c, NULL, b, NULL);
 
   nghttp2_session_del(session);
 
@@ -5990,7 +6345,7 @@ void test_nghttp2_session_stream_dep_all_your_stream_are_belong_to_us(void) {
 
   nghttp2_stream_dep_remove_subtree(c);
   CU_ASSERT(0 ==
-            nghttp2_stream_dep_all_your_stream_are_belong_to_us(c, session));
+            nghttp2_stream_dep_all_your_stream_are_belong_to_us(c));
 
   /*
    * c
@@ -6011,7 +6366,7 @@ void test_nghttp2_session_stream_dep_all_your_stream_are_belong_to_us(void) {
   CU_ASSERT(0 == b->sum_dep_weight);
 
   check_stream_dep_sib(c, NULL, a, NULL, NULL);
-  check_stream_dep_sib(d, NULL, NULL, a, NULL);
+  check_stream_dep_sib(d, c, NULL, a, NULL);
   check_stream_dep_sib(a, c, b, NULL, d);
   check_stream_dep_sib(b, a, NULL, NULL, NULL);
 
@@ -6045,93 +6400,106 @@ void test_nghttp2_session_stream_attach_item(void) {
 
   db = create_data_ob_item(mem);
 
-  nghttp2_stream_attach_item(b, db, session);
+  nghttp2_stream_attach_item(b, db);
 
-  CU_ASSERT(NGHTTP2_STREAM_DPRI_NO_ITEM == a->dpri);
-  CU_ASSERT(NGHTTP2_STREAM_DPRI_TOP == b->dpri);
-  CU_ASSERT(NGHTTP2_STREAM_DPRI_NO_ITEM == c->dpri);
-  CU_ASSERT(NGHTTP2_STREAM_DPRI_NO_ITEM == d->dpri);
+  CU_ASSERT(a->queued);
+  CU_ASSERT(b->queued);
+  CU_ASSERT(!c->queued);
+  CU_ASSERT(!d->queued);
 
-  CU_ASSERT(16 == b->effective_weight);
-
-  CU_ASSERT(16 == a->sum_norest_weight);
-
-  CU_ASSERT(1 == db->queued);
+  CU_ASSERT(1 == nghttp2_pq_size(&a->obq));
+  CU_ASSERT(1 == session->roots.num_active);
+  CU_ASSERT(db == nghttp2_stream_next_outbound_item(&session->roots.root));
 
   dc = create_data_ob_item(mem);
 
-  nghttp2_stream_attach_item(c, dc, session);
-
-  CU_ASSERT(NGHTTP2_STREAM_DPRI_NO_ITEM == a->dpri);
-  CU_ASSERT(NGHTTP2_STREAM_DPRI_TOP == b->dpri);
-  CU_ASSERT(NGHTTP2_STREAM_DPRI_TOP == c->dpri);
-  CU_ASSERT(NGHTTP2_STREAM_DPRI_NO_ITEM == d->dpri);
-
-  CU_ASSERT(16 * 16 / 32 == b->effective_weight);
-  CU_ASSERT(16 * 16 / 32 == c->effective_weight);
+  nghttp2_stream_attach_item(c, dc);
 
-  CU_ASSERT(32 == a->sum_norest_weight);
+  CU_ASSERT(a->queued);
+  CU_ASSERT(b->queued);
+  CU_ASSERT(c->queued);
+  CU_ASSERT(!d->queued);
 
-  CU_ASSERT(1 == dc->queued);
+  CU_ASSERT(2 == nghttp2_pq_size(&a->obq));
+  CU_ASSERT(2 == session->roots.num_active);
 
   da = create_data_ob_item(mem);
 
-  nghttp2_stream_attach_item(a, da, session);
+  nghttp2_stream_attach_item(a, da);
 
-  CU_ASSERT(NGHTTP2_STREAM_DPRI_TOP == a->dpri);
-  CU_ASSERT(NGHTTP2_STREAM_DPRI_REST == b->dpri);
-  CU_ASSERT(NGHTTP2_STREAM_DPRI_REST == c->dpri);
-  CU_ASSERT(NGHTTP2_STREAM_DPRI_NO_ITEM == d->dpri);
+  CU_ASSERT(a->queued);
+  CU_ASSERT(b->queued);
+  CU_ASSERT(c->queued);
+  CU_ASSERT(!d->queued);
 
-  CU_ASSERT(16 == a->effective_weight);
+  CU_ASSERT(2 == nghttp2_pq_size(&a->obq));
+  CU_ASSERT(3 == session->roots.num_active);
 
-  CU_ASSERT(1 == da->queued);
+  /* Parent stream is served first */
+  CU_ASSERT(da == nghttp2_stream_next_outbound_item(&session->roots.root));
 
-  nghttp2_stream_detach_item(a, session);
+  nghttp2_stream_detach_item(a);
 
-  CU_ASSERT(NGHTTP2_STREAM_DPRI_NO_ITEM == a->dpri);
-  CU_ASSERT(NGHTTP2_STREAM_DPRI_TOP == b->dpri);
-  CU_ASSERT(NGHTTP2_STREAM_DPRI_TOP == c->dpri);
-  CU_ASSERT(NGHTTP2_STREAM_DPRI_NO_ITEM == d->dpri);
+  CU_ASSERT(a->queued);
+  CU_ASSERT(b->queued);
+  CU_ASSERT(c->queued);
+  CU_ASSERT(!d->queued);
 
-  CU_ASSERT(16 * 16 / 32 == b->effective_weight);
-  CU_ASSERT(16 * 16 / 32 == c->effective_weight);
+  CU_ASSERT(2 == nghttp2_pq_size(&a->obq));
+  CU_ASSERT(db == nghttp2_stream_next_outbound_item(&session->roots.root));
 
   dd = create_data_ob_item(mem);
 
-  nghttp2_stream_attach_item(d, dd, session);
+  nghttp2_stream_attach_item(d, dd);
 
-  CU_ASSERT(NGHTTP2_STREAM_DPRI_NO_ITEM == a->dpri);
-  CU_ASSERT(NGHTTP2_STREAM_DPRI_TOP == b->dpri);
-  CU_ASSERT(NGHTTP2_STREAM_DPRI_TOP == c->dpri);
-  CU_ASSERT(NGHTTP2_STREAM_DPRI_REST == d->dpri);
+  CU_ASSERT(a->queued);
+  CU_ASSERT(b->queued);
+  CU_ASSERT(c->queued);
+  CU_ASSERT(d->queued);
 
-  CU_ASSERT(16 * 16 / 32 == b->effective_weight);
-  CU_ASSERT(16 * 16 / 32 == c->effective_weight);
+  CU_ASSERT(2 == nghttp2_pq_size(&a->obq));
+  CU_ASSERT(1 == nghttp2_pq_size(&c->obq));
 
-  CU_ASSERT(0 == dd->queued);
+  nghttp2_stream_detach_item(c);
 
-  nghttp2_stream_detach_item(c, session);
+  CU_ASSERT(a->queued);
+  CU_ASSERT(b->queued);
+  CU_ASSERT(c->queued);
+  CU_ASSERT(d->queued);
 
-  CU_ASSERT(NGHTTP2_STREAM_DPRI_NO_ITEM == a->dpri);
-  CU_ASSERT(NGHTTP2_STREAM_DPRI_TOP == b->dpri);
-  CU_ASSERT(NGHTTP2_STREAM_DPRI_NO_ITEM == c->dpri);
-  CU_ASSERT(NGHTTP2_STREAM_DPRI_REST == d->dpri);
+  CU_ASSERT(2 == nghttp2_pq_size(&a->obq));
+  CU_ASSERT(1 == nghttp2_pq_size(&c->obq));
 
-  CU_ASSERT(16 * 16 / 16 == b->effective_weight);
+  nghttp2_stream_detach_item(b);
 
-  CU_ASSERT(0 == dd->queued);
+  CU_ASSERT(a->queued);
+  CU_ASSERT(!b->queued);
+  CU_ASSERT(c->queued);
+  CU_ASSERT(d->queued);
 
-  nghttp2_stream_detach_item(b, session);
+  CU_ASSERT(1 == nghttp2_pq_size(&a->obq));
+  CU_ASSERT(1 == session->roots.num_active);
+  CU_ASSERT(dd == nghttp2_stream_next_outbound_item(&session->roots.root));
 
-  CU_ASSERT(NGHTTP2_STREAM_DPRI_NO_ITEM == a->dpri);
-  CU_ASSERT(NGHTTP2_STREAM_DPRI_NO_ITEM == b->dpri);
-  CU_ASSERT(NGHTTP2_STREAM_DPRI_NO_ITEM == c->dpri);
-  CU_ASSERT(NGHTTP2_STREAM_DPRI_TOP == d->dpri);
+  nghttp2_stream_detach_item(d);
 
-  CU_ASSERT(16 * 16 / 16 == d->effective_weight);
+  CU_ASSERT(!a->queued);
+  CU_ASSERT(!b->queued);
+  CU_ASSERT(!c->queued);
+  CU_ASSERT(!d->queued);
 
-  CU_ASSERT(1 == dd->queued);
+  CU_ASSERT(nghttp2_pq_empty(&session->roots.root.obq));
+  CU_ASSERT(0 == session->roots.num_active);
+  CU_ASSERT(NULL == nghttp2_stream_next_outbound_item(&session->roots.root));
+
+  nghttp2_outbound_item_free(da, mem);
+  nghttp2_mem_free(mem, da);
+  nghttp2_outbound_item_free(db, mem);
+  nghttp2_mem_free(mem, db);
+  nghttp2_outbound_item_free(dc, mem);
+  nghttp2_mem_free(mem, dc);
+  nghttp2_outbound_item_free(dd, mem);
+  nghttp2_mem_free(mem, dd);
 
   nghttp2_session_del(session);
 }
@@ -6166,26 +6534,25 @@ void test_nghttp2_session_stream_attach_item_subtree(void) {
 
   de = create_data_ob_item(mem);
 
-  nghttp2_stream_attach_item(e, de, session);
+  nghttp2_stream_attach_item(e, de);
 
   db = create_data_ob_item(mem);
 
-  nghttp2_stream_attach_item(b, db, session);
+  nghttp2_stream_attach_item(b, db);
 
-  CU_ASSERT(NGHTTP2_STREAM_DPRI_NO_ITEM == a->dpri);
-  CU_ASSERT(NGHTTP2_STREAM_DPRI_TOP == b->dpri);
-  CU_ASSERT(NGHTTP2_STREAM_DPRI_NO_ITEM == c->dpri);
-  CU_ASSERT(NGHTTP2_STREAM_DPRI_NO_ITEM == d->dpri);
-  CU_ASSERT(NGHTTP2_STREAM_DPRI_TOP == e->dpri);
-  CU_ASSERT(NGHTTP2_STREAM_DPRI_NO_ITEM == f->dpri);
+  CU_ASSERT(a->queued);
+  CU_ASSERT(b->queued);
+  CU_ASSERT(!c->queued);
+  CU_ASSERT(!d->queued);
+  CU_ASSERT(e->queued);
+  CU_ASSERT(!f->queued);
 
-  CU_ASSERT(16 == b->effective_weight);
-  CU_ASSERT(16 == e->effective_weight);
+  CU_ASSERT(2 == nghttp2_pq_size(&session->roots.root.obq));
 
   /* Insert subtree e under a */
 
   nghttp2_stream_dep_remove_subtree(e);
-  nghttp2_stream_dep_insert_subtree(a, e, session);
+  nghttp2_stream_dep_insert_subtree(a, e);
 
   /*
    * a
@@ -6197,20 +6564,22 @@ void test_nghttp2_session_stream_attach_item_subtree(void) {
    *    d
    */
 
-  CU_ASSERT(NGHTTP2_STREAM_DPRI_NO_ITEM == a->dpri);
-  CU_ASSERT(NGHTTP2_STREAM_DPRI_REST == b->dpri);
-  CU_ASSERT(NGHTTP2_STREAM_DPRI_NO_ITEM == c->dpri);
-  CU_ASSERT(NGHTTP2_STREAM_DPRI_NO_ITEM == d->dpri);
-  CU_ASSERT(NGHTTP2_STREAM_DPRI_TOP == e->dpri);
-  CU_ASSERT(NGHTTP2_STREAM_DPRI_NO_ITEM == f->dpri);
+  CU_ASSERT(a->queued);
+  CU_ASSERT(b->queued);
+  CU_ASSERT(!c->queued);
+  CU_ASSERT(!d->queued);
+  CU_ASSERT(e->queued);
+  CU_ASSERT(!f->queued);
 
-  CU_ASSERT(16 == e->effective_weight);
+  CU_ASSERT(1 == nghttp2_pq_size(&session->roots.root.obq));
+  CU_ASSERT(1 == nghttp2_pq_size(&a->obq));
+  CU_ASSERT(1 == nghttp2_pq_size(&e->obq));
 
   /* Remove subtree b */
 
   nghttp2_stream_dep_remove_subtree(b);
 
-  nghttp2_stream_dep_make_root(b, session);
+  nghttp2_stream_dep_make_root(b);
 
   /*
    * a       b
@@ -6222,34 +6591,36 @@ void test_nghttp2_session_stream_attach_item_subtree(void) {
    *    d
    */
 
-  CU_ASSERT(NGHTTP2_STREAM_DPRI_NO_ITEM == a->dpri);
-  CU_ASSERT(NGHTTP2_STREAM_DPRI_TOP == b->dpri);
-  CU_ASSERT(NGHTTP2_STREAM_DPRI_NO_ITEM == c->dpri);
-  CU_ASSERT(NGHTTP2_STREAM_DPRI_NO_ITEM == d->dpri);
-  CU_ASSERT(NGHTTP2_STREAM_DPRI_TOP == e->dpri);
-  CU_ASSERT(NGHTTP2_STREAM_DPRI_NO_ITEM == f->dpri);
+  CU_ASSERT(a->queued);
+  CU_ASSERT(b->queued);
+  CU_ASSERT(!c->queued);
+  CU_ASSERT(!d->queued);
+  CU_ASSERT(e->queued);
+  CU_ASSERT(!f->queued);
 
-  CU_ASSERT(16 == b->effective_weight);
-  CU_ASSERT(16 == e->effective_weight);
+  CU_ASSERT(2 == nghttp2_pq_size(&session->roots.root.obq));
+  CU_ASSERT(nghttp2_pq_empty(&e->obq));
 
   /* Remove subtree a */
 
   nghttp2_stream_dep_remove_subtree(a);
 
-  nghttp2_stream_dep_make_root(a, session);
+  nghttp2_stream_dep_make_root(a);
+
+  CU_ASSERT(a->queued);
+  CU_ASSERT(b->queued);
+  CU_ASSERT(!c->queued);
+  CU_ASSERT(!d->queued);
+  CU_ASSERT(e->queued);
+  CU_ASSERT(!f->queued);
 
-  CU_ASSERT(NGHTTP2_STREAM_DPRI_NO_ITEM == a->dpri);
-  CU_ASSERT(NGHTTP2_STREAM_DPRI_TOP == b->dpri);
-  CU_ASSERT(NGHTTP2_STREAM_DPRI_NO_ITEM == c->dpri);
-  CU_ASSERT(NGHTTP2_STREAM_DPRI_NO_ITEM == d->dpri);
-  CU_ASSERT(NGHTTP2_STREAM_DPRI_TOP == e->dpri);
-  CU_ASSERT(NGHTTP2_STREAM_DPRI_NO_ITEM == f->dpri);
+  CU_ASSERT(2 == nghttp2_pq_size(&session->roots.root.obq));
 
   /* Remove subtree c */
 
   nghttp2_stream_dep_remove_subtree(c);
 
-  nghttp2_stream_dep_make_root(c, session);
+  nghttp2_stream_dep_make_root(c);
 
   /*
    * a       b     c
@@ -6259,21 +6630,26 @@ void test_nghttp2_session_stream_attach_item_subtree(void) {
    * f
    */
 
-  CU_ASSERT(NGHTTP2_STREAM_DPRI_NO_ITEM == a->dpri);
-  CU_ASSERT(NGHTTP2_STREAM_DPRI_TOP == b->dpri);
-  CU_ASSERT(NGHTTP2_STREAM_DPRI_NO_ITEM == c->dpri);
-  CU_ASSERT(NGHTTP2_STREAM_DPRI_NO_ITEM == d->dpri);
-  CU_ASSERT(NGHTTP2_STREAM_DPRI_TOP == e->dpri);
-  CU_ASSERT(NGHTTP2_STREAM_DPRI_NO_ITEM == f->dpri);
+  CU_ASSERT(a->queued);
+  CU_ASSERT(b->queued);
+  CU_ASSERT(!c->queued);
+  CU_ASSERT(!d->queued);
+  CU_ASSERT(e->queued);
+  CU_ASSERT(!f->queued);
 
   dd = create_data_ob_item(mem);
 
-  nghttp2_stream_attach_item(d, dd, session);
+  nghttp2_stream_attach_item(d, dd);
+
+  CU_ASSERT(c->queued);
+  CU_ASSERT(d->queued);
+
+  CU_ASSERT(3 == nghttp2_pq_size(&session->roots.root.obq));
 
   /* Add subtree c to a */
 
   nghttp2_stream_dep_remove_subtree(c);
-  nghttp2_stream_dep_add_subtree(a, c, session);
+  nghttp2_stream_dep_add_subtree(a, c);
 
   /*
    * a       b
@@ -6283,90 +6659,186 @@ void test_nghttp2_session_stream_attach_item_subtree(void) {
    * d  f
    */
 
-  CU_ASSERT(NGHTTP2_STREAM_DPRI_NO_ITEM == a->dpri);
-  CU_ASSERT(NGHTTP2_STREAM_DPRI_TOP == b->dpri);
-  CU_ASSERT(NGHTTP2_STREAM_DPRI_NO_ITEM == c->dpri);
-  CU_ASSERT(NGHTTP2_STREAM_DPRI_REST == d->dpri);
-  CU_ASSERT(NGHTTP2_STREAM_DPRI_TOP == e->dpri);
-  CU_ASSERT(NGHTTP2_STREAM_DPRI_NO_ITEM == f->dpri);
+  CU_ASSERT(a->queued);
+  CU_ASSERT(b->queued);
+  CU_ASSERT(c->queued);
+  CU_ASSERT(d->queued);
+  CU_ASSERT(e->queued);
+  CU_ASSERT(!f->queued);
 
-  CU_ASSERT(16 == b->effective_weight);
-  CU_ASSERT(16 * 16 / 16 == e->effective_weight);
-
-  CU_ASSERT(32 == a->sum_norest_weight);
-  CU_ASSERT(16 == c->sum_norest_weight);
+  CU_ASSERT(2 == nghttp2_pq_size(&session->roots.root.obq));
+  CU_ASSERT(2 == nghttp2_pq_size(&a->obq));
+  CU_ASSERT(1 == nghttp2_pq_size(&c->obq));
 
   /* Insert b under a */
 
   nghttp2_stream_dep_remove_subtree(b);
-  nghttp2_stream_dep_insert_subtree(a, b, session);
+  nghttp2_stream_dep_insert_subtree(a, b);
 
   /*
    * a
    * |
    * b
    * |
-   * e--c
+   * c--e
    * |  |
-   * f  d
+   * d  f
    */
 
-  CU_ASSERT(NGHTTP2_STREAM_DPRI_NO_ITEM == a->dpri);
-  CU_ASSERT(NGHTTP2_STREAM_DPRI_TOP == b->dpri);
-  CU_ASSERT(NGHTTP2_STREAM_DPRI_NO_ITEM == c->dpri);
-  CU_ASSERT(NGHTTP2_STREAM_DPRI_REST == d->dpri);
-  CU_ASSERT(NGHTTP2_STREAM_DPRI_REST == e->dpri);
-  CU_ASSERT(NGHTTP2_STREAM_DPRI_NO_ITEM == f->dpri);
+  CU_ASSERT(a->queued);
+  CU_ASSERT(b->queued);
+  CU_ASSERT(c->queued);
+  CU_ASSERT(d->queued);
+  CU_ASSERT(e->queued);
+  CU_ASSERT(!f->queued);
 
-  CU_ASSERT(16 == b->effective_weight);
-
-  CU_ASSERT(16 == a->sum_norest_weight);
-  CU_ASSERT(0 == b->sum_norest_weight);
+  CU_ASSERT(1 == nghttp2_pq_size(&session->roots.root.obq));
+  CU_ASSERT(1 == nghttp2_pq_size(&a->obq));
+  CU_ASSERT(2 == nghttp2_pq_size(&b->obq));
 
   /* Remove subtree b */
 
   nghttp2_stream_dep_remove_subtree(b);
-  nghttp2_stream_dep_make_root(b, session);
+  nghttp2_stream_dep_make_root(b);
 
   /*
    * b       a
    * |
-   * e--c
+   * c--e
    * |  |
-   * f  d
+   * d  f
    */
 
-  CU_ASSERT(NGHTTP2_STREAM_DPRI_NO_ITEM == a->dpri);
-  CU_ASSERT(NGHTTP2_STREAM_DPRI_TOP == b->dpri);
-  CU_ASSERT(NGHTTP2_STREAM_DPRI_NO_ITEM == c->dpri);
-  CU_ASSERT(NGHTTP2_STREAM_DPRI_REST == d->dpri);
-  CU_ASSERT(NGHTTP2_STREAM_DPRI_REST == e->dpri);
-  CU_ASSERT(NGHTTP2_STREAM_DPRI_NO_ITEM == f->dpri);
+  CU_ASSERT(!a->queued);
+  CU_ASSERT(b->queued);
+  CU_ASSERT(c->queued);
+  CU_ASSERT(d->queued);
+  CU_ASSERT(e->queued);
+  CU_ASSERT(!f->queued);
 
-  CU_ASSERT(0 == a->sum_norest_weight);
-  CU_ASSERT(0 == b->sum_norest_weight);
+  CU_ASSERT(1 == nghttp2_pq_size(&session->roots.root.obq));
+  CU_ASSERT(nghttp2_pq_empty(&a->obq));
+  CU_ASSERT(2 == nghttp2_pq_size(&b->obq));
 
   nghttp2_session_del(session);
 }
 
-void test_nghttp2_session_keep_closed_stream(void) {
+void test_nghttp2_session_stream_wfq(void) {
   nghttp2_session *session;
   nghttp2_session_callbacks callbacks;
-  const size_t max_concurrent_streams = 5;
-  nghttp2_settings_entry iv = {NGHTTP2_SETTINGS_MAX_CONCURRENT_STREAMS,
-                               max_concurrent_streams};
-  size_t i;
+  nghttp2_stream *a, *b, *c, *d;
+  nghttp2_outbound_item *item, *db, *dc, *dd;
+  nghttp2_mem *mem;
+  size_t nb, nc, nd;
+  int i;
+
+  mem = nghttp2_mem_default();
 
   memset(&callbacks, 0, sizeof(callbacks));
-  callbacks.send_callback = null_send_callback;
 
   nghttp2_session_server_new(&session, &callbacks, NULL);
 
-  nghttp2_submit_settings(session, NGHTTP2_FLAG_NONE, &iv, 1);
+  a = open_stream(session, 1);
+  b = open_stream_with_dep_weight(session, 3, 16, a);
+  c = open_stream_with_dep_weight(session, 5, 32, a);
+  d = open_stream_with_dep_weight(session, 7, 16, NULL);
 
-  for (i = 0; i < max_concurrent_streams; ++i) {
-    open_stream(session, (int)i * 2 + 1);
-  }
+  /*
+   * a       d
+   * |
+   * c--b
+   */
+
+  db = create_data_ob_item(mem);
+  db->frame.hd.stream_id = 3;
+  dc = create_data_ob_item(mem);
+  dc->frame.hd.stream_id = 5;
+  dd = create_data_ob_item(mem);
+  dd->frame.hd.stream_id = 7;
+
+  nghttp2_stream_attach_item(b, db);
+  nghttp2_stream_attach_item(c, dc);
+  nghttp2_stream_attach_item(d, dd);
+
+  nb = nc = nd = 0;
+
+  /* Each time, the chosen stream sends 1000 bytes.  a and d share
+     the bandwidth equally, and c gets twice as much as b under a. */
+  for (i = 0; i < 1200; ++i) {
+    item = nghttp2_stream_next_outbound_item(&session->roots.root);
+
+    if (item == db) {
+      ++nb;
+      nghttp2_stream_reschedule(b, 1000);
+    } else if (item == dc) {
+      ++nc;
+      nghttp2_stream_reschedule(c, 1000);
+    } else {
+      CU_ASSERT(dd == item);
+      ++nd;
+      nghttp2_stream_reschedule(d, 1000);
+    }
+  }
+
+  CU_ASSERT(200 == nb);
+  CU_ASSERT(400 == nc);
+  CU_ASSERT(600 == nd);
+
+  /* Newly activated stream does not get the share it missed while
+     it was idle. */
+  nghttp2_stream_detach_item(b);
+
+  for (i = 0; i < 100; ++i) {
+    item = nghttp2_stream_next_outbound_item(&session->roots.root);
+    nghttp2_stream_reschedule(nghttp2_session_get_stream(
+                                  session, item->frame.hd.stream_id),
+                              1000);
+  }
+
+  nghttp2_stream_attach_item(b, db);
+
+  nb = nc = 0;
+
+  for (i = 0; i < 300; ++i) {
+    item = nghttp2_stream_next_outbound_item(&session->roots.root);
+
+    if (item == db) {
+      ++nb;
+    } else if (item == dc) {
+      ++nc;
+    }
+
+    nghttp2_stream_reschedule(nghttp2_session_get_stream(
+                                  session, item->frame.hd.stream_id),
+                              1000);
+  }
+
+  /* b starts from the current virtual time of a, so it may be ahead
+     of c by one frame. */
+  CU_ASSERT(50 <= nb && nb <= 51);
+  CU_ASSERT(nb + nc == 150);
+
+  nghttp2_session_del(session);
+}
+
+void test_nghttp2_session_keep_closed_stream(void) {
+  nghttp2_session *session;
+  nghttp2_session_callbacks callbacks;
+  const size_t max_concurrent_streams = 5;
+  nghttp2_settings_entry iv = {NGHTTP2_SETTINGS_MAX_CONCURRENT_STREAMS,
+                               max_concurrent_streams};
+  size_t i;
+
+  memset(&callbacks, 0, sizeof(callbacks));
+  callbacks.send_callback = null_send_callback;
+
+  nghttp2_session_server_new(&session, &callbacks, NULL);
+
+  nghttp2_submit_settings(session, NGHTTP2_FLAG_NONE, &iv, 1);
+
+  for (i = 0; i < max_concurrent_streams; ++i) {
+    open_stream(session, (int)i * 2 + 1);
+  }
 
   CU_ASSERT(0 == session->num_closed_streams);
 
@@ -6990,6 +7462,445 @@ static void check_nghttp2_http_recv_headers_fail(
   nghttp2_bufs_free(&bufs);
 }
 
+void test_nghttp2_session_send_data_callback(void) {
+  nghttp2_session *session;
+  nghttp2_session_callbacks callbacks;
+  my_user_data ud;
+  accumulator acc;
+  nghttp2_data_provider data_prd;
+  nghttp2_stream *stream;
+  nghttp2_frame_hd hd;
+  nghttp2_outbound_item *item;
+  uint8_t *p;
+  const uint8_t *data;
+
+  memset(&callbacks, 0, sizeof(nghttp2_session_callbacks));
+  callbacks.send_callback = null_send_callback;
+  callbacks.send_data_callback = accumulator_send_data_callback;
+  callbacks.on_frame_send_callback = on_frame_send_callback;
+
+  data_prd.read_callback = no_copy_data_source_read_callback;
+
+  acc.length = 0;
+  ud.acc = &acc;
+
+  ud.data_source_length = NGHTTP2_DATA_PAYLOADLEN * 2;
+
+  nghttp2_session_client_new(&session, &callbacks, &ud);
+
+  stream = nghttp2_session_open_stream(session, 1, NGHTTP2_STREAM_FLAG_NONE,
+                                       &pri_spec_default,
+                                       NGHTTP2_STREAM_OPENING, NULL);
+
+  nghttp2_submit_data(session, NGHTTP2_FLAG_END_STREAM, 1, &data_prd);
+
+  ud.frame_send_cb_called = 0;
+
+  CU_ASSERT(0 == nghttp2_session_send(session));
+
+  CU_ASSERT((NGHTTP2_FRAME_HDLEN + NGHTTP2_DATA_PAYLOADLEN) * 2 == acc.length);
+  CU_ASSERT(2 == ud.frame_send_cb_called);
+  CU_ASSERT(NGHTTP2_DATA == ud.sent_frame_type);
+  CU_ASSERT(NGHTTP2_INITIAL_WINDOW_SIZE - NGHTTP2_DATA_PAYLOADLEN * 2 ==
+            stream->remote_window_size);
+
+  nghttp2_frame_unpack_frame_hd(&hd, acc.buf);
+
+  CU_ASSERT(NGHTTP2_DATA_PAYLOADLEN == hd.length);
+  CU_ASSERT(NGHTTP2_DATA == hd.type);
+  CU_ASSERT(NGHTTP2_FLAG_NONE == hd.flags);
+  CU_ASSERT(1 == hd.stream_id);
+
+  p = acc.buf + NGHTTP2_FRAME_HDLEN + NGHTTP2_DATA_PAYLOADLEN;
+
+  nghttp2_frame_unpack_frame_hd(&hd, p);
+
+  CU_ASSERT(NGHTTP2_DATA_PAYLOADLEN == hd.length);
+  CU_ASSERT(NGHTTP2_FLAG_END_STREAM == hd.flags);
+  CU_ASSERT('a' == p[NGHTTP2_FRAME_HDLEN]);
+  CU_ASSERT(NULL == session->aob.item);
+
+  nghttp2_session_del(session);
+
+  /* With padding */
+  callbacks.select_padding_callback = select_padding_callback;
+
+  acc.length = 0;
+  ud.data_source_length = 100;
+  ud.padlen = 7;
+
+  nghttp2_session_client_new(&session, &callbacks, &ud);
+
+  nghttp2_session_open_stream(session, 1, NGHTTP2_STREAM_FLAG_NONE,
+                              &pri_spec_default, NGHTTP2_STREAM_OPENING, NULL);
+
+  nghttp2_submit_data(session, NGHTTP2_FLAG_END_STREAM, 1, &data_prd);
+
+  CU_ASSERT(0 == nghttp2_session_send(session));
+
+  CU_ASSERT(NGHTTP2_FRAME_HDLEN + 100 + 7 == acc.length);
+
+  nghttp2_frame_unpack_frame_hd(&hd, acc.buf);
+
+  CU_ASSERT(100 + 7 == hd.length);
+  CU_ASSERT((NGHTTP2_FLAG_END_STREAM | NGHTTP2_FLAG_PADDED) == hd.flags);
+  CU_ASSERT(6 == acc.buf[NGHTTP2_FRAME_HDLEN]);
+  CU_ASSERT(0 == acc.buf[acc.length - 1]);
+
+  nghttp2_session_del(session);
+
+  callbacks.select_padding_callback = NULL;
+
+  /* Application cannot send anything; nghttp2_session_send() returns
+     and retries the same frame later */
+  callbacks.send_data_callback = block_count_send_data_callback;
+
+  ud.data_source_length = 100;
+  ud.block_count = 0;
+
+  nghttp2_session_client_new(&session, &callbacks, &ud);
+
+  stream = nghttp2_session_open_stream(session, 1, NGHTTP2_STREAM_FLAG_NONE,
+                                       &pri_spec_default,
+                                       NGHTTP2_STREAM_OPENING, NULL);
+
+  nghttp2_submit_data(session, NGHTTP2_FLAG_END_STREAM, 1, &data_prd);
+
+  ud.frame_send_cb_called = 0;
+
+  CU_ASSERT(0 == nghttp2_session_send(session));
+  CU_ASSERT(0 == ud.frame_send_cb_called);
+  CU_ASSERT(NULL != session->aob.item);
+  CU_ASSERT(NGHTTP2_OB_SEND_NO_COPY == session->aob.state);
+  CU_ASSERT(NGHTTP2_INITIAL_WINDOW_SIZE == stream->remote_window_size);
+
+  ud.block_count = 1;
+
+  CU_ASSERT(0 == nghttp2_session_send(session));
+  CU_ASSERT(1 == ud.frame_send_cb_called);
+  CU_ASSERT(NULL == session->aob.item);
+  CU_ASSERT(NGHTTP2_INITIAL_WINDOW_SIZE - 100 == stream->remote_window_size);
+
+  nghttp2_session_del(session);
+
+  /* Application decided to reset stream */
+  callbacks.send_data_callback = temporal_failure_send_data_callback;
+  ud.data_source_length = 100;
+
+  ud.data_source_length = 100;
+
+  nghttp2_session_client_new(&session, &callbacks, &ud);
+
+  nghttp2_session_open_stream(session, 1, NGHTTP2_STREAM_FLAG_NONE,
+                              &pri_spec_default, NGHTTP2_STREAM_OPENING, NULL);
+
+  nghttp2_submit_data(session, NGHTTP2_FLAG_END_STREAM, 1, &data_prd);
+
+  ud.frame_send_cb_called = 0;
+
+  CU_ASSERT(0 == nghttp2_session_send(session));
+  CU_ASSERT(1 == ud.frame_send_cb_called);
+  CU_ASSERT(NGHTTP2_RST_STREAM == ud.sent_frame_type);
+
+  nghttp2_session_del(session);
+
+  /* NGHTTP2_DATA_FLAG_NO_COPY without send_data_callback is an
+     error */
+  callbacks.send_data_callback = NULL;
+
+  ud.data_source_length = 100;
+
+  nghttp2_session_client_new(&session, &callbacks, &ud);
+
+  nghttp2_session_open_stream(session, 1, NGHTTP2_STREAM_FLAG_NONE,
+                              &pri_spec_default, NGHTTP2_STREAM_OPENING, NULL);
+
+  nghttp2_submit_data(session, NGHTTP2_FLAG_END_STREAM, 1, &data_prd);
+
+  CU_ASSERT(NGHTTP2_ERR_CALLBACK_FAILURE == nghttp2_session_send(session));
+
+  nghttp2_session_del(session);
+
+  /* nghttp2_session_mem_send() invokes send_data_callback too */
+  callbacks.send_data_callback = accumulator_send_data_callback;
+
+  acc.length = 0;
+  ud.data_source_length = 100;
+
+  nghttp2_session_client_new(&session, &callbacks, &ud);
+
+  nghttp2_session_open_stream(session, 1, NGHTTP2_STREAM_FLAG_NONE,
+                              &pri_spec_default, NGHTTP2_STREAM_OPENING, NULL);
+
+  nghttp2_submit_data(session, NGHTTP2_FLAG_END_STREAM, 1, &data_prd);
+
+  item = nghttp2_session_get_next_ob_item(session);
+  CU_ASSERT(NGHTTP2_DATA == item->frame.hd.type);
+
+  CU_ASSERT(0 == nghttp2_session_mem_send(session, &data));
+
+  CU_ASSERT(NGHTTP2_FRAME_HDLEN + 100 == acc.length);
+  CU_ASSERT(NULL == session->aob.item);
+
+  nghttp2_session_del(session);
+}
+
+static void submit_batch_frames(nghttp2_session *session) {
+  nghttp2_submit_settings(session, NGHTTP2_FLAG_NONE, NULL, 0);
+  nghttp2_submit_ping(session, NGHTTP2_FLAG_NONE, NULL);
+  nghttp2_submit_ping(session, NGHTTP2_FLAG_NONE, NULL);
+  nghttp2_submit_request(session, NULL, reqnv, ARRLEN(reqnv), NULL, NULL);
+}
+
+void test_nghttp2_session_mem_send_batch(void) {
+  nghttp2_session *session;
+  nghttp2_session_callbacks callbacks;
+  my_user_data ud;
+  accumulator acc;
+  nghttp2_data_provider data_prd;
+  const uint8_t *data;
+  ssize_t datalen;
+  uint8_t expected[4096];
+  size_t expectedlen;
+  uint8_t buf[4096];
+  size_t buflen;
+  size_t nocopylen;
+
+  memset(&callbacks, 0, sizeof(nghttp2_session_callbacks));
+  callbacks.send_data_callback = accumulator_send_data_callback;
+  callbacks.on_frame_send_callback = on_frame_send_callback;
+
+  /* Take the output of nghttp2_session_mem_send() as reference */
+  nghttp2_session_client_new(&session, &callbacks, &ud);
+
+  submit_batch_frames(session);
+
+  expectedlen = 0;
+  while ((datalen = nghttp2_session_mem_send(session, &data)) > 0) {
+    memcpy(expected + expectedlen, data, (size_t)datalen);
+    expectedlen += (size_t)datalen;
+  }
+
+  CU_ASSERT(0 == datalen);
+
+  nghttp2_session_del(session);
+
+  /* All frames are serialized in one call */
+  nghttp2_session_client_new(&session, &callbacks, &ud);
+
+  submit_batch_frames(session);
+
+  ud.frame_send_cb_called = 0;
+
+  datalen =
+      nghttp2_session_mem_send_batch(session, buf, sizeof(buf), &nocopylen);
+
+  CU_ASSERT((ssize_t)expectedlen == datalen);
+  CU_ASSERT(0 == memcmp(expected, buf, expectedlen));
+  CU_ASSERT(4 == ud.frame_send_cb_called);
+  CU_ASSERT(0 == nghttp2_session_mem_send_batch(session, buf, sizeof(buf),
+                                                &nocopylen));
+
+  nghttp2_session_del(session);
+
+  /* Frames which do not fit in buffer are continued in the next
+     call */
+  nghttp2_session_client_new(&session, &callbacks, &ud);
+
+  submit_batch_frames(session);
+
+  buflen = 0;
+  while ((datalen = nghttp2_session_mem_send_batch(session, buf + buflen, 5,
+                                                   &nocopylen)) > 0) {
+    CU_ASSERT(5 == datalen || buflen + (size_t)datalen == expectedlen);
+    buflen += (size_t)datalen;
+  }
+
+  CU_ASSERT(0 == datalen);
+  CU_ASSERT(expectedlen == buflen);
+  CU_ASSERT(0 == memcmp(expected, buf, expectedlen));
+
+  nghttp2_session_del(session);
+
+  /* Stop before no-copy DATA, so that send_data_callback writes
+     after the data in buffer */
+  data_prd.read_callback = no_copy_data_source_read_callback;
+
+  acc.length = 0;
+  ud.acc = &acc;
+  ud.data_source_length = 100;
+
+  nghttp2_session_client_new(&session, &callbacks, &ud);
+
+  nghttp2_session_open_stream(session, 1, NGHTTP2_STREAM_FLAG_NONE,
+                              &pri_spec_default, NGHTTP2_STREAM_OPENING, NULL);
+
+  nghttp2_submit_data(session, NGHTTP2_FLAG_END_STREAM, 1, &data_prd);
+  nghttp2_submit_ping(session, NGHTTP2_FLAG_NONE, NULL);
+
+  CU_ASSERT(NGHTTP2_FRAME_HDLEN + 8 ==
+            nghttp2_session_mem_send_batch(session, buf, sizeof(buf),
+                                           &nocopylen));
+  CU_ASSERT(0 == nocopylen);
+  CU_ASSERT(0 == acc.length);
+  CU_ASSERT(NGHTTP2_OB_SEND_NO_COPY == session->aob.state);
+
+  CU_ASSERT(0 == nghttp2_session_mem_send_batch(session, buf, sizeof(buf),
+                                                &nocopylen));
+  CU_ASSERT(NGHTTP2_FRAME_HDLEN + 100 == nocopylen);
+  CU_ASSERT(NGHTTP2_FRAME_HDLEN + 100 == acc.length);
+  CU_ASSERT(NULL == session->aob.item);
+
+  CU_ASSERT(0 == nghttp2_session_mem_send_batch(session, buf, sizeof(buf),
+                                                &nocopylen));
+
+  nghttp2_session_del(session);
+
+  /* If send_data_callback appends to the same buffer, application
+     keeps calling the function while the callback advances the end
+     of buffer, so that several no-copy DATA frames are written at
+     once. */
+  acc.length = 0;
+  ud.data_source_length = NGHTTP2_DATA_PAYLOADLEN * 2 + 100;
+
+  nghttp2_session_client_new(&session, &callbacks, &ud);
+
+  nghttp2_session_open_stream(session, 1, NGHTTP2_STREAM_FLAG_NONE,
+                              &pri_spec_default, NGHTTP2_STREAM_OPENING, NULL);
+
+  nghttp2_submit_ping(session, NGHTTP2_FLAG_NONE, NULL);
+  nghttp2_submit_data(session, NGHTTP2_FLAG_END_STREAM, 1, &data_prd);
+
+  for (;;) {
+    buflen = acc.length;
+
+    datalen = nghttp2_session_mem_send_batch(session, acc.buf + acc.length,
+                                             sizeof(acc.buf) - acc.length,
+                                             &nocopylen);
+
+    CU_ASSERT(datalen >= 0);
+
+    if (datalen <= 0) {
+      if (nocopylen > 0) {
+        CU_ASSERT(acc.length == buflen + nocopylen);
+        continue;
+      }
+      CU_ASSERT(acc.length == buflen);
+      break;
+    }
+
+    acc.length += (size_t)datalen;
+  }
+
+  CU_ASSERT(0 == nghttp2_session_want_write(session));
+  CU_ASSERT(NGHTTP2_FRAME_HDLEN + 8 + NGHTTP2_FRAME_HDLEN * 3 +
+                NGHTTP2_DATA_PAYLOADLEN * 2 + 100 ==
+            acc.length);
+
+  /* PING, followed by 3 DATA frames */
+  CU_ASSERT(NGHTTP2_PING == acc.buf[3]);
+
+  buflen = NGHTTP2_FRAME_HDLEN + 8;
+
+  CU_ASSERT(NGHTTP2_DATA == acc.buf[buflen + 3]);
+
+  buflen += NGHTTP2_FRAME_HDLEN + NGHTTP2_DATA_PAYLOADLEN;
+
+  CU_ASSERT(NGHTTP2_DATA == acc.buf[buflen + 3]);
+
+  buflen += NGHTTP2_FRAME_HDLEN + NGHTTP2_DATA_PAYLOADLEN;
+
+  CU_ASSERT(NGHTTP2_DATA == acc.buf[buflen + 3]);
+  CU_ASSERT(NGHTTP2_FLAG_END_STREAM == acc.buf[buflen + 4]);
+
+  nghttp2_session_del(session);
+
+  /* If no-copy DATA is cancelled because stream was closed, the
+     frames following it are written to buffer */
+  acc.length = 0;
+  ud.data_source_length = 100;
+
+  nghttp2_session_client_new(&session, &callbacks, &ud);
+
+  nghttp2_session_open_stream(session, 1, NGHTTP2_STREAM_FLAG_NONE,
+                              &pri_spec_default, NGHTTP2_STREAM_OPENING, NULL);
+
+  nghttp2_submit_data(session, NGHTTP2_FLAG_END_STREAM, 1, &data_prd);
+  nghttp2_submit_ping(session, NGHTTP2_FLAG_NONE, NULL);
+
+  CU_ASSERT(NGHTTP2_FRAME_HDLEN + 8 ==
+            nghttp2_session_mem_send_batch(session, buf, sizeof(buf),
+                                           &nocopylen));
+  CU_ASSERT(NGHTTP2_OB_SEND_NO_COPY == session->aob.state);
+
+  nghttp2_session_close_stream(session, 1, NGHTTP2_NO_ERROR);
+  nghttp2_submit_ping(session, NGHTTP2_FLAG_NONE, NULL);
+
+  memset(buf, 0, sizeof(buf));
+
+  CU_ASSERT(NGHTTP2_FRAME_HDLEN + 8 ==
+            nghttp2_session_mem_send_batch(session, buf, sizeof(buf),
+                                           &nocopylen));
+  CU_ASSERT(0 == nocopylen);
+  CU_ASSERT(NGHTTP2_PING == buf[3]);
+  CU_ASSERT(0 == acc.length);
+  CU_ASSERT(0 == nghttp2_session_mem_send_batch(session, buf, sizeof(buf),
+                                                &nocopylen));
+  CU_ASSERT(0 == nocopylen);
+
+  nghttp2_session_del(session);
+
+  /* If send_data_callback fails temporarily, RST_STREAM is written
+     to buffer */
+  callbacks.send_data_callback = temporal_failure_send_data_callback;
+  ud.data_source_length = 100;
+
+  nghttp2_session_client_new(&session, &callbacks, &ud);
+
+  nghttp2_session_open_stream(session, 1, NGHTTP2_STREAM_FLAG_NONE,
+                              &pri_spec_default, NGHTTP2_STREAM_OPENING, NULL);
+
+  nghttp2_submit_data(session, NGHTTP2_FLAG_END_STREAM, 1, &data_prd);
+
+  memset(buf, 0, sizeof(buf));
+
+  CU_ASSERT(NGHTTP2_FRAME_HDLEN + 4 ==
+            nghttp2_session_mem_send_batch(session, buf, sizeof(buf),
+                                           &nocopylen));
+  CU_ASSERT(0 == nocopylen);
+  CU_ASSERT(NGHTTP2_RST_STREAM == buf[3]);
+  CU_ASSERT(0 == nghttp2_session_mem_send_batch(session, buf, sizeof(buf),
+                                                &nocopylen));
+
+  nghttp2_session_del(session);
+
+  /* If send_data_callback would block, 0 is returned, and the DATA is
+     sent in the next call */
+  callbacks.send_data_callback = block_count_send_data_callback;
+  ud.block_count = 0;
+  ud.data_source_length = 100;
+
+  nghttp2_session_client_new(&session, &callbacks, &ud);
+
+  nghttp2_session_open_stream(session, 1, NGHTTP2_STREAM_FLAG_NONE,
+                              &pri_spec_default, NGHTTP2_STREAM_OPENING, NULL);
+
+  nghttp2_submit_data(session, NGHTTP2_FLAG_END_STREAM, 1, &data_prd);
+
+  CU_ASSERT(0 == nghttp2_session_mem_send_batch(session, buf, sizeof(buf),
+                                                &nocopylen));
+  CU_ASSERT(0 == nocopylen);
+  CU_ASSERT(NGHTTP2_OB_SEND_NO_COPY == session->aob.state);
+
+  ud.block_count = 1;
+
+  CU_ASSERT(0 == nghttp2_session_mem_send_batch(session, buf, sizeof(buf),
+                                                &nocopylen));
+  CU_ASSERT(NGHTTP2_FRAME_HDLEN + 100 == nocopylen);
+
+  nghttp2_session_del(session);
+}
+
 void test_nghttp2_http_mandatory_headers(void) {
   nghttp2_session *session;
   nghttp2_session_callbacks callbacks;
@@ -101,6 +101,9 @@ void test_nghttp2_session_on_ctrl_not_send(void);
 void test_nghttp2_session_get_outbound_queue_size(void);
 void test_nghttp2_session_get_effective_local_window_size(void);
 void test_nghttp2_session_set_option(void);
+void test_nghttp2_session_free_list(void);
+void test_nghttp2_session_stats(void);
+void test_nghttp2_session_window_auto_tuning(void);
 void test_nghttp2_session_data_backoff_by_high_pri_frame(void);
 void test_nghttp2_session_pack_data_with_padding(void);
 void test_nghttp2_session_pack_headers_with_padding(void);
@@ -112,6 +115,7 @@ void test_nghttp2_session_stream_dep_remove_subtree(void);
 void test_nghttp2_session_stream_dep_all_your_stream_are_belong_to_us(void);
 void test_nghttp2_session_stream_attach_item(void);
 void test_nghttp2_session_stream_attach_item_subtree(void);
+void test_nghttp2_session_stream_wfq(void);
 void test_nghttp2_session_keep_closed_stream(void);
 void test_nghttp2_session_keep_idle_stream(void);
 void test_nghttp2_session_detach_idle_stream(void);
@@ -123,6 +127,8 @@ void test_nghttp2_session_delete_data_item(void);
 void test_nghttp2_session_open_idle_stream(void);
 void test_nghttp2_session_cancel_reserved_remote(void);
 void test_nghttp2_session_reset_pending_headers(void);
+void test_nghttp2_session_send_data_callback(void);
+void test_nghttp2_session_mem_send_batch(void);
 void test_nghttp2_http_mandatory_headers(void);
 void test_nghttp2_http_content_length(void);
 void test_nghttp2_http_content_length_mismatch(void);